@@ -2,10 +2,13 @@
 // (i.e. byte 3 = 3 blinks, byte 105 = 105 blinks; better be patient)
 
 #include "ArCOM.h" // Import serial communication wrapper
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 
 // Module setup
 unsigned long FirmwareVersion = 1;
 char moduleName[] = "BlinkModule"; // Name of module for manual override UI and state machine assembler
+byte moduleInfo[sizeof(moduleName)+6] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 ArCOM Serial1COM(Serial1); // Wrap Serial5 (equivalent to Serial on Arduino Leonardo and Serial1 on Arduino Due)
 
 // Variables
@@ -16,6 +19,7 @@ void setup()
   Serial1.begin(1312500);
   pinMode(13, OUTPUT); 
   digitalWrite(13, LOW);
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName);
 }
 
 void loop()
@@ -37,10 +41,6 @@ void loop()
 }
 
 void returnModuleInfo() {
-  Serial1COM.writeByte(65); // Acknowledge
-  Serial1COM.writeUint32(FirmwareVersion); // 4-byte firmware version
-  Serial1COM.writeByte(sizeof(moduleName)-1); // Length of module name
-  Serial1COM.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  Serial1COM.writeByte(0); // 1 if more info follows, 0 if not
+  Serial1COM.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
 
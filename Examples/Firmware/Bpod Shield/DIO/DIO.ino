@@ -24,6 +24,7 @@
 // A 3-byte serial message from the state machine enables or disables input lines: ['E' Channel (2-7), State (0 = disabled, 1 = enabled)]
 
 #include "ArCOM.h" // Import serial communication wrapper
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 
 // Module setup
 ArCOM Serial1COM(Serial1); // Wrap Serial1 (UART on Arduino M0, Due + Teensy 3.X)
@@ -42,6 +43,7 @@ uint32_t refractoryPeriod = 300; // Minimum amount of time (in microseconds) aft
 #define OutputChRangeHigh OutputOffset+nOutputChannels
 
 byte nEventNames = (sizeof(eventNames)/sizeof(char *));
+#define ModuleInfoBufferSize 128 // Must hold the serialized reply to op code 255 (see ModuleInfo.h)
 
 
 // Variables
@@ -57,6 +59,8 @@ uint32_t inputChSwitchTime[nInputChannels] = {0}; // Time of last detected logic
 byte events[nInputChannels*2] = {0}; // List of high or low events captured this cycle
 byte nEvents = 0; // Number of events captured in the current cycle
 uint32_t currentTime = 0; // Current time in microseconds
+byte moduleInfo[ModuleInfoBufferSize] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 
 void setup()
 {
@@ -71,6 +75,7 @@ void setup()
   for (int i = OutputOffset; i < OutputChRangeHigh; i++) {
     pinMode(i, OUTPUT);
   }
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName, nInputChannels*2, eventNames, nEventNames);
 }
 
 void loop()
@@ -125,21 +130,5 @@ void loop()
 }
 
 void returnModuleInfo() {
-  Serial1COM.writeByte(65); // Acknowledge
-  Serial1COM.writeUint32(FirmwareVersion); // 4-byte firmware version
-  Serial1COM.writeByte(sizeof(moduleName)-1);
-  Serial1COM.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  Serial1COM.writeByte(1); // 1 if more info follows, 0 if not
-  Serial1COM.writeByte('#'); // Op code for: Number of behavior events this module can generate
-  Serial1COM.writeByte(nInputChannels*2); // 2 states for each input channel
-  Serial1COM.writeByte(1); // 1 if more info follows, 0 if not
-  Serial1COM.writeByte('E'); // Op code for: Behavior event names
-  Serial1COM.writeByte(nEventNames);
-  for (int i = 0; i < nEventNames; i++) { // Once for each event name
-    Serial1COM.writeByte(strlen(eventNames[i])); // Send event name length
-    for (int j = 0; j < strlen(eventNames[i]); j++) { // Once for each character in this event name
-      Serial1COM.writeByte(*(eventNames[i]+j)); // Send the character
-    }
-  }
-  Serial1COM.writeByte(0); // 1 if more info follows, 0 if not
+  Serial1COM.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
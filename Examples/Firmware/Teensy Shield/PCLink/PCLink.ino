@@ -5,10 +5,13 @@
 
 
 #include "ArCOM.h"
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 
 // Module setup
 unsigned long FirmwareVersion = 1;
 char moduleName[] = "PCLink"; // Name of module for manual override UI and state machine assembler
+byte moduleInfo[sizeof(moduleName)+6] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 ArCOM Serial1COM(Serial1); // UART serial port
 
 byte inByte = 0;
@@ -21,6 +24,7 @@ void setup() {
   Serial1.begin(1312500);
   pinMode(13, OUTPUT); // Set board LED to illuminate
   digitalWrite(13, HIGH);
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName);
 }
 
 void loop() {
@@ -48,9 +52,5 @@ void loop() {
 }
 
 void returnModuleInfo() {
-  Serial1COM.writeByte(65); // Acknowledge
-  Serial1COM.writeUint32(FirmwareVersion); // 4-byte firmware version
-  Serial1COM.writeByte(sizeof(moduleName)-1); // Length of module name
-  Serial1COM.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  Serial1COM.writeByte(0); // 1 if more info follows, 0 if not
+  Serial1COM.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
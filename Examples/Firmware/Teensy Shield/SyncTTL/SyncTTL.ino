@@ -25,11 +25,14 @@
 // Data is sent to the PC via USB and can be retrieved with the SyncTTL class in /Bpod_Gen2/Functions/Modules/Teensy Shield/
 
 #include "ArCOM.h" // ArCOM is a serial interface wrapper developed by Sanworks, to streamline transmission of datatypes and arrays over serial
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 ArCOM myUSB(SerialUSB); // Creates an ArCOM object called myUSB, wrapping SerialUSB
 ArCOM myUART(Serial1); // Creates an ArCOM object called myUART, wrapping Serial1
 
 uint32_t FirmwareVersion = 1;
 char moduleName[] = "SyncTTL"; 
+byte moduleInfo[sizeof(moduleName)+6] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 const byte InputChannels[3] = {4,5,6};
 byte opCode = 0; 
 byte opSource = 0;
@@ -52,6 +55,7 @@ void setup() {
     pinMode(InputChannels[i], INPUT_PULLUP);
   }
   Serial1.begin(1312500);
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName);
 }
 
 void loop() {
@@ -97,9 +101,5 @@ uint64_t getTheTime() {
 }
 
 void returnModuleInfo() { // Return module name and firmware version
-  myUART.writeByte(65); // Acknowledge
-  myUART.writeUint32(FirmwareVersion); // 4-byte firmware version
-  myUART.writeByte(sizeof(moduleName)-1); // Length of module name
-  myUART.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  myUART.writeByte(0); // 1 if more info follows, 0 if not
+  myUART.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
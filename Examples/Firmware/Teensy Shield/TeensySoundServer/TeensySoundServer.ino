@@ -19,6 +19,7 @@
 
 */
 #include "ArCOM.h"
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 #include <Audio.h>
 #include <Wire.h>
 #include <SPI.h>
@@ -34,6 +35,8 @@ ArCOM StateMachineCOM(Serial1);
 // Module setup
 uint32_t FirmwareVersion = 1;
 char moduleName[] = "TeensyAudio"; // Name of module for manual override UI and state machine assembler
+byte moduleInfo[sizeof(moduleName)+6] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 
 byte commandByte = 0; byte dataByte = 0;
 byte soundIndex = 0;
@@ -58,6 +61,7 @@ void setup() {
     myFile = SD.open("000.WAV", FILE_WRITE);
     myFile.close();
   }
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName);
 }
 
 void loop() {
@@ -115,9 +119,5 @@ void loop() {
 }
 
 void returnModuleInfo() { // Return module name and firmware version
-  StateMachineCOM.writeByte(65); // Acknowledge
-  StateMachineCOM.writeUint32(FirmwareVersion); // 4-byte firmware version
-  StateMachineCOM.writeByte(sizeof(moduleName)-1); // Length of module name
-  StateMachineCOM.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  StateMachineCOM.writeByte(0); // 1 if more info follows, 0 if not
+  StateMachineCOM.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
@@ -0,0 +1,77 @@
+/*
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod_Gen2 repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Serializes a module's reply to op code 255 (module name and info), so it can be sent with a single write.
+// Like ArCOM.h, each example sketch folder carries an identical copy of this file; keep them in sync.
+
+#ifndef ModuleInfo_h
+#define ModuleInfo_h
+
+#include "Arduino.h"
+
+// Appends nBytes from data at buffer[length] if they fit in bufferSize; returns false (and writes nothing) if not.
+static boolean appendModuleInfo(byte* buffer, unsigned int bufferSize, unsigned int &length, const void* data, unsigned int nBytes) {
+  if (length > bufferSize || nBytes > bufferSize - length) {
+    return false;
+  }
+  memcpy(&buffer[length], data, nBytes);
+  length += nBytes;
+  return true;
+}
+
+static boolean appendModuleInfoByte(byte* buffer, unsigned int bufferSize, unsigned int &length, byte value) {
+  return appendModuleInfo(buffer, bufferSize, length, &value, 1);
+}
+
+// Writes the reply into buffer and returns its length, or 0 if it does not fit in bufferSize.
+// Layout: 65 (acknowledge), firmware version (4 bytes, little-endian, as ArCOM::writeUint32), name length, name,
+// then optionally 1 '#' nEvents (number of behavior events) and 1 'E' nEventNames [length, name]...,
+// and a final 0 (no more info follows).
+static unsigned int buildModuleInfo(byte* buffer, unsigned int bufferSize, uint32_t firmwareVersion, const char* moduleName,
+                                    byte nEvents = 0, char* const eventNames[] = NULL, byte nEventNames = 0) {
+  unsigned int length = 0;
+  byte nameLength = strlen(moduleName);
+  boolean fits = appendModuleInfoByte(buffer, bufferSize, length, 65); // Acknowledge
+  for (int i = 0; (i < 4) && fits; i++) {
+    fits = appendModuleInfoByte(buffer, bufferSize, length, (byte)(firmwareVersion >> (8*i)));
+  }
+  fits = fits && appendModuleInfoByte(buffer, bufferSize, length, nameLength); // Length of module name
+  fits = fits && appendModuleInfo(buffer, bufferSize, length, moduleName, nameLength); // Module name
+  if (nEvents > 0) {
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, 1); // 1 if more info follows, 0 if not
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, '#'); // Op code for: Number of behavior events this module can generate
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, nEvents);
+  }
+  if (nEventNames > 0) {
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, 1); // 1 if more info follows, 0 if not
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, 'E'); // Op code for: Behavior event names
+    fits = fits && appendModuleInfoByte(buffer, bufferSize, length, nEventNames);
+    for (int i = 0; (i < nEventNames) && fits; i++) { // Once for each event name
+      nameLength = strlen(eventNames[i]);
+      fits = appendModuleInfoByte(buffer, bufferSize, length, nameLength); // Event name length
+      fits = fits && appendModuleInfo(buffer, bufferSize, length, eventNames[i], nameLength); // Event name characters
+    }
+  }
+  fits = fits && appendModuleInfoByte(buffer, bufferSize, length, 0); // 1 if more info follows, 0 if not
+  return fits ? length : 0;
+}
+
+#endif
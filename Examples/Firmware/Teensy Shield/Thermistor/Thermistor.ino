@@ -20,10 +20,13 @@
 */
 
 #include "ArCOM.h" // Import serial communication wrapper
+#include "ModuleInfo.h" // Serializes the reply to op code 255
 
 // Module setup
 ArCOM Serial1COM(Serial1); // Wrap Serial1 (UART on Arduino M0, Due + Teensy 3.X)
 char moduleName[] = "Thermo"; // Name of module for manual override UI and state machine assembler
+byte moduleInfo[sizeof(moduleName)+6] = {0}; // Reply to op code 255, serialized once in setup() and sent with a single write
+unsigned int moduleInfoLength = 0; // Number of valid bytes in moduleInfo
 #define FirmwareVersion 1
 
 // Variables
@@ -37,6 +40,7 @@ void setup()
 {
   Serial1.begin(1312500);
   
+  moduleInfoLength = buildModuleInfo(moduleInfo, sizeof(moduleInfo), FirmwareVersion, moduleName);
 }
 
 void loop()
@@ -59,9 +63,5 @@ void loop()
 }
 
 void returnModuleInfo() {
-  Serial1COM.writeByte(65); // Acknowledge
-  Serial1COM.writeUint32(FirmwareVersion); // 4-byte firmware version
-  Serial1COM.writeByte(sizeof(moduleName)-1);
-  Serial1COM.writeCharArray(moduleName, sizeof(moduleName)-1); // Module name
-  Serial1COM.writeByte(0); // 1 if more info follows, 0 if not
+  Serial1COM.writeByteArray(moduleInfo, moduleInfoLength); // Precomputed in setup()
 }
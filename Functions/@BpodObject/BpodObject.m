@@ -134,10 +134,15 @@ classdef BpodObject < handle
             obj.Status.CurrentSubjectName = '';
             obj.Status.SerialPortName = '';
             obj.Status.NewStateMachineSent = 0;
+            if exist('BpodStateMachineBytes', 'file') == 3
+                BpodStateMachineBytes('reset'); % The state machine holds no description yet
+            end
             obj.Status.SessionStartFlag = 0;
             obj.Status.AnalogViewer = 0;
             obj.Status.nAnalogSamples = 0;
             obj.Status.RecordAnalog = 1;
+            obj.Status.NativeAnalog = 0; % 1 while BpodFlexIOAcquisition owns the analog port (see analogAcquisition())
+            obj.Status.AnalogPortName = '';
 
             % Initialize paths
             obj.Path = struct;
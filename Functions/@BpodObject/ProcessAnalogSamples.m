@@ -20,9 +20,23 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 % BpodObject.ProcessAnalogSamples() is called by the analog timer during
 % FlexIO analog data acquisition. It reads and processes any new samples
-% that have arrived in the buffer.
+% that have arrived in the buffer. When the native acquisition thread owns
+% the analog port (see analogAcquisition()), samples are logged to the file
+% there, and this only polls its status and the viewer's samples.
 
 function ProcessAnalogSamples(obj, e)
+    if obj.Status.NativeAnalog
+        status = BpodFlexIOAcquisition('status');
+        obj.Status.nAnalogSamples = status.nSamples;
+        obj.Data.Analog.nSamples = obj.Status.nAnalogSamples;
+        if obj.Status.AnalogViewer == 1
+            newData = BpodFlexIOAcquisition('view', obj.GUIHandles.OSC.Decimation);
+            if ~isempty(newData)
+                obj.analogViewer('update', newData);
+            end
+        end
+        return
+    end
     if obj.AnalogSerialPort.bytesAvailable() > 0
         nChannels = sum(obj.HW.FlexIO_ChannelTypes == 2); % Number of FlexIO configured as analog input
         nBytesAvailable = obj.AnalogSerialPort.bytesAvailable;
@@ -37,8 +51,12 @@ function ProcessAnalogSamples(obj, e)
             obj.Status.nAnalogSamples = obj.Status.nAnalogSamples + nSamplesToRead;
             obj.Data.Analog.nSamples = obj.Status.nAnalogSamples;
             if obj.Status.AnalogViewer == 1
-                obj.analogViewer('update', newData);
+                % Every Decimation-th sample, continuing from the last batch
+                decimation = obj.GUIHandles.OSC.Decimation;
+                phase = mod(obj.GUIHandles.OSC.ViewPhase, decimation);
+                obj.GUIHandles.OSC.ViewPhase = mod(phase - nSamplesToRead, decimation);
+                obj.analogViewer('update', newData(:,phase+1:decimation:end));
             end
         end
     end
-end
\ No newline at end of file
+end
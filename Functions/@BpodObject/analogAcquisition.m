@@ -0,0 +1,69 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the 
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% BpodObject.analogAcquisition() starts and stops Flex I/O analog acquisition
+% for a session. If BpodFlexIOAcquisition is built ("make mex" in
+% /Functions/Internal Functions/Native), a native thread takes over the analog
+% port: it drains the port continuously and logs samples to the analog data file,
+% so MATLAB timer delays cannot overflow the port's buffer. The analog timer then
+% only polls it (see ProcessAnalogSamples()). Otherwise, the timer reads the port.
+%
+% Arguments:
+% op (char array) must be one of:
+%                                'start' to start acquiring, at the start of a session
+%                                'stop' to stop acquiring and close the native thread's data file
+
+function analogAcquisition(obj, op)
+
+switch op
+    case 'start'
+        nChannels = sum(obj.HW.FlexIO_ChannelTypes == 2);
+        if obj.EmulatorMode == 0 && nChannels > 0 && exist('BpodFlexIOAcquisition', 'file') == 3
+            fileName = '';
+            if isfield(obj.Data, 'Analog')
+                fileName = obj.Data.Analog.FileName;
+            end
+            obj.Status.AnalogPortName = obj.AnalogSerialPort.PortName;
+            obj.AnalogSerialPort = []; % Release the port (triggers the ArCOM object's destructor); code that needs its name reads Status.AnalogPortName while Status.NativeAnalog is set
+            BpodFlexIOAcquisition('open', obj.Status.AnalogPortName, nChannels);
+            BpodFlexIOAcquisition('start', fileName); % Discards stale input, as flush does
+            BpodFlexIOAcquisition('record', obj.Status.RecordAnalog);
+            obj.Status.NativeAnalog = 1;
+        else
+            obj.AnalogSerialPort.flush;
+        end
+        start(obj.Timers.AnalogTimer);
+    case 'stop'
+        stop(obj.Timers.AnalogTimer);
+        if obj.Status.NativeAnalog
+            BpodFlexIOAcquisition('stop'); % Writes the buffered samples to the data file
+            obj.ProcessAnalogSamples(); % Final sample count
+            status = BpodFlexIOAcquisition('status');
+            BpodFlexIOAcquisition('close');
+            obj.Status.NativeAnalog = 0;
+            obj.AnalogSerialPort = ArCOMObject_Bpod(obj.Status.AnalogPortName, 115200);
+            if status.SamplesDropped > 0
+                warning(['Flex I/O analog acquisition dropped ' num2str(status.SamplesDropped) ' samples.'])
+            end
+            if ~isempty(status.WriteError)
+                warning(['Flex I/O analog data could not be written to the data file: ' status.WriteError])
+            end
+        end
+end
@@ -30,7 +30,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 %                                'logStartStop to start or stop logging the analog data
 %                                'setDC' to toggle DC offset subtraction
 %                                'end' to close the GUI
-% newData (uint16), new analog data processed by the 'update' op
+% newData (uint16), new analog data processed by the 'update' op: every
+%          obj.GUIHandles.OSC.Decimation-th sample (1 unless a sweep has more than
+%          obj.GUIHandles.OSC.MaxDisplaySamples samples)
 
 function obj = analogViewer(obj, op, newData)
 
@@ -82,8 +84,12 @@ switch op
         obj.GUIHandles.OSC.TimeDivPos = 3;
         obj.GUIHandles.OSC.VoltDivValues = [0.02 0.05 0.1 0.2 0.5 1 2 5];
         obj.GUIHandles.OSC.TimeDivValues = [0.05 0.1 0.2 0.5 1];
-        obj.GUIHandles.OSC.nDisplaySamples = obj.FlexIOConfig.analogSamplingRate *...
+        obj.GUIHandles.OSC.MaxDisplaySamples = 3000; % Longer sweeps show every Decimation-th sample
+        nSamplesPerSweep = obj.FlexIOConfig.analogSamplingRate *...
             obj.GUIHandles.OSC.TimeDivValues(obj.GUIHandles.OSC.TimeDivPos) * obj.GUIHandles.OSC.nXDivisions;
+        obj.GUIHandles.OSC.Decimation = max(1, ceil(nSamplesPerSweep/obj.GUIHandles.OSC.MaxDisplaySamples));
+        obj.GUIHandles.OSC.ViewPhase = 0;
+        obj.GUIHandles.OSC.nDisplaySamples = floor(nSamplesPerSweep/obj.GUIHandles.OSC.Decimation);
         obj.GUIHandles.OSC.SweepPos = 1;
         obj.GUIHandles.OSC.DCmode = 0;
         obj.GUIHandles.OSC.DCOffset = zeros(1,obj.HW.n.FlexIO);
@@ -256,6 +262,8 @@ switch op
             obj.GUIHandles.OSC.TimeDivPos = obj.GUIHandles.OSC.TimeDivPos + newData;
             newTimeDivValue = obj.GUIHandles.OSC.TimeDivValues(obj.GUIHandles.OSC.TimeDivPos);
             nSamplesPerSweep = obj.FlexIOConfig.analogSamplingRate*newTimeDivValue*obj.GUIHandles.OSC.nXDivisions;
+            obj.GUIHandles.OSC.Decimation = max(1, ceil(nSamplesPerSweep/obj.GUIHandles.OSC.MaxDisplaySamples));
+            nSamplesPerSweep = floor(nSamplesPerSweep/obj.GUIHandles.OSC.Decimation);
             interval = obj.GUIHandles.OSC.nXDivisions/(nSamplesPerSweep-1);
             obj.GUIHandles.OSCData.Xdata = 0:interval:obj.GUIHandles.OSC.nXDivisions;
             obj.GUIHandles.OSC.SweepPos = 1;
@@ -279,10 +287,16 @@ switch op
         switch obj.Status.RecordAnalog
             case 0
                 obj.Status.RecordAnalog = 1;
+                if obj.Status.NativeAnalog
+                    BpodFlexIOAcquisition('record', 1);
+                end
                 set(obj.GUIHandles.OSC.RecStatText, 'String', 'Recording');
                 set(obj.GUIHandles.RecordButton, 'String', stopButtonChar, 'ForegroundColor', [0 0 0]);
             case 1
                 obj.Status.RecordAnalog = 0;
+                if obj.Status.NativeAnalog
+                    BpodFlexIOAcquisition('record', 0);
+                end
                 set(obj.GUIHandles.OSC.RecStatText, 'String', '');
                 set(obj.GUIHandles.RecordButton, 'String', recButtonChar, 'ForegroundColor', [.7 0 0]);
         end
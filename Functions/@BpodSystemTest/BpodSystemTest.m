@@ -132,6 +132,7 @@ classdef BpodSystemTest < handle
             obj.fsm_extension_test;
             obj.rapid_event_test;
             obj.psram_test;
+            obj.state_machine_encoder_test;
             obj.behaviorport_test;
         end
 
@@ -141,6 +142,7 @@ classdef BpodSystemTest < handle
             disp('fsm_extension_test: Verifies global timer, global counter and condition functionality.')
             disp('rapid_event_test: Ensures data integrity during rapid events (10kHz) with rapid state transitions (5kHz).')
             disp('psram_test: Tests the external PSRAM IC on Bpod State Machine r2+. Test skipped on other models.')
+            disp('state_machine_encoder_test: Verifies the native state machine encoder against the MATLAB encoder.')
             disp('behaviorport_test: Verifies functionality of all behavior port channels. Test requires manual operation.')
         end
 
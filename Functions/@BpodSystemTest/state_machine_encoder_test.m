@@ -0,0 +1,113 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+function state_machine_encoder_test(obj)
+% STATE MACHINE ENCODER TEST
+%
+% This test verifies that the native state machine encoder (BpodStateMachineBytes)
+% returns the same bytes as the MATLAB reference encoder (EncodeStateMachine)
+% for state machines using long state chains, global timers, counters,
+% conditions and implicit serial messages. It also verifies that an unchanged
+% description is reported as such, is not sent again, and still runs.
+
+global BpodSystem % Import the global BpodSystem object
+
+testPass = 1;  % Initialize testPass flag as 1 (true)
+
+% Display test information
+obj.dispAndLog(' ');
+obj.dispAndLog('Starting: State Machine Encoder Test.');
+if exist('BpodStateMachineBytes', 'file') ~= 3
+    obj.dispAndLog('BpodStateMachineBytes is not built (run make mex in /Functions/Internal Functions/Native). Test skipped.');
+    return
+end
+
+% Setup the state machine descriptions for the test
+smas = cell(1,3);
+sma = NewStateMachine;
+for x = 1:254
+    sma = AddState(sma, 'Name', ['State ' num2str(x)], 'Timer', .001*mod(x,3), 'StateChangeConditions',...
+        {'Tup', ['State ' num2str(x+1)], 'BNC2High', '>exit'}, 'OutputActions', {'BNC1', mod(x,2)});
+end
+sma = AddState(sma, 'Name', 'State 255', 'Timer', .001, 'StateChangeConditions', {'Tup', '>exit'}, 'OutputActions', {});
+smas{1} = sma;
+sma = NewStateMachine;
+sma = SetGlobalTimer(sma, 'TimerID', 1, 'Duration', 0.1, 'OnsetDelay', 0.05,...
+    'Channel', 'BNC1', 'OnEvent', 1, 'OffEvent', 0, 'Loop', 1, 'SendGlobalTimerEvents', 0, 'LoopInterval', 0.1);
+sma = SetGlobalTimer(sma, 'TimerID', BpodSystem.HW.n.GlobalTimers, 'Duration', 3, 'OnsetDelay', 0);
+sma = SetGlobalCounter(sma, 1, 'BNC1High', 3);
+sma = SetCondition(sma, 2, 'BNC2', 1);
+sma = AddState(sma, 'Name', 'TimerTrig', 'Timer', 0, 'StateChangeConditions', {'Tup', 'WaitForCounter'},...
+    'OutputActions', {'GlobalTimerTrig', 1, 'GlobalCounterReset', 1});
+sma = AddState(sma, 'Name', 'WaitForCounter', 'Timer', 1, 'StateChangeConditions',...
+    {'GlobalCounter1_End', 'WaitForCondition', 'Tup', '>back'}, 'OutputActions', {'GlobalTimerCancel', 1});
+sma = AddState(sma, 'Name', 'WaitForCondition', 'Timer', 0.5, 'StateChangeConditions', {'Condition2', '>exit', 'Tup', '>exit'},...
+    'OutputActions', {});
+smas{2} = sma;
+sma = NewStateMachine;
+if BpodSystem.HW.n.UartSerialChannels > 0
+    sma = AddState(sma, 'Name', 'Message1', 'Timer', 0, 'StateChangeConditions', {'Tup', 'Message2'},...
+        'OutputActions', {BpodSystem.Modules.Name{1}, ['A' 1 2]});
+    sma = AddState(sma, 'Name', 'Message2', 'Timer', 0, 'StateChangeConditions', {'Tup', '>exit'},...
+        'OutputActions', {BpodSystem.Modules.Name{1}, ['B' 3]});
+else
+    sma = AddState(sma, 'Name', 'Message1', 'Timer', 0, 'StateChangeConditions', {'Tup', '>exit'}, 'OutputActions', {});
+end
+smas{3} = sma;
+
+% Compare the encoders on each description, as prepared by SendStateMachine
+for i = 1:length(smas)
+    SendStateMachine(smas{i});
+    prepared = BpodSystem.StateMatrixSent;
+    [refBytes, refSerial, refModules] = EncodeStateMachine(prepared);
+    [bytes, serial, nModules, unchanged] = BpodStateMachineBytes(prepared, BpodSystem.HW,...
+        BpodSystem.MachineType, BpodSystem.FirmwareVersion);
+    if ~isequal(bytes, refBytes) || ~isequal(serial, refSerial) || nModules ~= refModules
+        testPass = 0;
+        firstDifference = find(bytes(1:min(end,length(refBytes))) ~= refBytes(1:min(end,length(bytes))), 1);
+        obj.dispAndLog(['Error: Test FAILED. Encoded state machine ' num2str(i) ' differs from the reference (' ...
+            num2str(length(bytes)) ' vs ' num2str(length(refBytes)) ' bytes, first difference at byte '...
+            num2str(firstDifference) ').'])
+    end
+    if ~unchanged
+        testPass = 0;
+        obj.dispAndLog(['Error: Test FAILED. State machine ' num2str(i) ' was not reported as unchanged.'])
+    end
+    RunStateMachine;
+end
+
+% Resend the first description after running it: it is not sent again, and runs from the copy held by the state machine
+SendStateMachine(smas{1});
+RunStateMachine;
+SendStateMachine(smas{1});
+if BpodSystem.Status.NewStateMachineSent
+    testPass = 0;
+    obj.dispAndLog('Error: Test FAILED. An unchanged state machine was sent again.')
+end
+RawEvents = RunStateMachine;
+if length(RawEvents.States) ~= 255 || sum(RawEvents.States ~= 1:255) > 0
+    testPass = 0;
+    obj.dispAndLog('Error: Test FAILED. The reused state machine did not run through all states.')
+end
+if testPass
+    obj.dispAndLog('State Machine Encoder Test Passed.');
+else
+    obj.dispAndLog('State Machine Encoder Test Failed.');
+end
+end
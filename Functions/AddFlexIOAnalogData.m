@@ -20,6 +20,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 % AddFlexIOAnalogData() is intended to be run on the Bpod computer after a session is complete.
 % It reads the current Flex I/O analog data file and combines it into BpodSystem.Data
+% If BpodFlexIOAnalog is built ("make mex" in /Functions/Internal Functions/Native), the file is
+% memory-mapped and only the samples are converted, without loading it whole; BpodFlexIOAnalog
+% can also read part of a file (e.g. one trial) on its own.
 %
 % Arguments:
 % -sessionData: A Bpod session data structure
@@ -68,13 +71,13 @@ if BpodSystem.MachineType > 3
         end
     end
     if nargin > 2
-        includeTrialAlignedData = varargin{1};
+        includeTrialAlignedData = varargin{2};
     end
     
     % Ensure that analog acquisition is stopped
     if ~isempty(BpodSystem)
         if BpodSystem.MachineType > 3
-            stop(BpodSystem.Timers.AnalogTimer); % Stop acquisition + data logging
+            BpodSystem.analogAcquisition('stop'); % Stop acquisition + data logging
             pause(.5);
         end
     else
@@ -90,31 +93,58 @@ if BpodSystem.MachineType > 3
             warning(['AddFlexIOAnalogData was called but could not open the analog data file: ' ... 
                 analogMeta.FileName ' No data was added to the primary data file.'])
         else
-            Data = fread(myFile, (analogMeta.nSamples*analogMeta.nChannels)+analogMeta.nSamples, 'uint16');
             if targetDataFormat == 0
-                formattedData = (double(Data)/BIT_MAX)*VOLTAGE_RANGE_MAX; % Convert to volts
                 sessionData.Analog.info.Samples = 'Analog measurements. Rows are separate analog input channels. Units = Volts';
             else
-                formattedData = Data;
                 sessionData.Analog.info.Samples = ['Analog measurements. Rows are separate analog input channels. ' ...
                                                    'Units = Bits (0-4095) encoding volts (0-5V)'];
             end
-            fclose(myFile);
-            clear myFile;
-            sessionData.Analog.Samples = [];
-            for i = 1:sessionData.Analog.nChannels
-                sessionData.Analog.Samples(i,:) = formattedData(i+1:analogMeta.nChannels+1:end)';
+            useNativeReader = exist('BpodFlexIOAnalog', 'file') == 3;
+            if useNativeReader
+                % The native reader maps the file and converts the samples straight into Samples,
+                % without reading the whole file into memory first
+                fclose(myFile);
+                clear myFile;
+                formatNames = {'Volts', 'Bits'};
+                nSamples = min(analogMeta.nSamples, BpodFlexIOAnalog('nSamples', analogMeta.FileName, analogMeta.nChannels));
+                [sessionData.Analog.Samples, trialNumber] = BpodFlexIOAnalog('read', analogMeta.FileName, analogMeta.nChannels,...
+                    formatNames{targetDataFormat+1}, [1 nSamples]);
+            else
+                Data = fread(myFile, (analogMeta.nSamples*analogMeta.nChannels)+analogMeta.nSamples, 'uint16');
+                if targetDataFormat == 0
+                    formattedData = (double(Data)/BIT_MAX)*VOLTAGE_RANGE_MAX; % Convert to volts
+                else
+                    formattedData = Data;
+                end
+                fclose(myFile);
+                clear myFile;
+                sessionData.Analog.Samples = [];
+                for i = 1:sessionData.Analog.nChannels
+                    sessionData.Analog.Samples(i,:) = formattedData(i+1:analogMeta.nChannels+1:end)';
+                end
+                trialNumber = Data(1:analogMeta.nChannels+1:end)';
             end
             oneTrialCompleted = isfield(sessionData, 'TrialStartTimestamp');
             if oneTrialCompleted
                 sessionData.Analog.Timestamps =... 
                                   sessionData.TrialStartTimestamp:(1/analogMeta.SamplingRate):sessionData.TrialStartTimestamp + ... 
                                   ((1/analogMeta.SamplingRate)*(analogMeta.nSamples-1));
-                sessionData.Analog.TrialNumber = Data(1:analogMeta.nChannels+1:end)';
+                sessionData.Analog.TrialNumber = trialNumber;
                 if includeTrialAlignedData
                     sessionData.Analog.TrialData = cell(1,sessionData.nTrials);
-                    for i = 1:sessionData.nTrials
-                        sessionData.Analog.TrialData{i} = sessionData.Analog.Samples(:,sessionData.Analog.TrialNumber == i);
+                    if useNativeReader
+                        % Runs of consecutive samples from the same trial: [Trial FirstSample nSamples]
+                        runs = BpodFlexIOAnalog('index', analogMeta.FileName, analogMeta.nChannels);
+                        runs = runs(runs(:,1) >= 1 & runs(:,1) <= sessionData.nTrials & runs(:,2) <= nSamples, :);
+                        for i = 1:size(runs,1)
+                            lastSample = min(runs(i,2)+runs(i,3)-1, nSamples);
+                            sessionData.Analog.TrialData{runs(i,1)} = [sessionData.Analog.TrialData{runs(i,1)}...
+                                                                      sessionData.Analog.Samples(:,runs(i,2):lastSample)];
+                        end
+                    else
+                        for i = 1:sessionData.nTrials
+                            sessionData.Analog.TrialData{i} = sessionData.Analog.Samples(:,sessionData.Analog.TrialNumber == i);
+                        end
                     end
                 end
             else
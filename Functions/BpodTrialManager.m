@@ -157,8 +157,7 @@ classdef BpodTrialManager < handle
             if BpodSystem.Status.SessionStartFlag == 1
                 BpodSystem.Status.SessionStartFlag = 0;
                 if BpodSystem.MachineType == 4
-                    BpodSystem.AnalogSerialPort.flush;
-                    start(BpodSystem.Timers.AnalogTimer);
+                    BpodSystem.analogAcquisition('start');
                 end
             end
 
@@ -177,12 +176,15 @@ classdef BpodTrialManager < handle
             BpodSystem.Status.SM2runASAP = 0; % Reset runASAP flag, previously set by SendStateMachine()
 
             % Confirm that if a state machine description was sent, it was received by
-            % the Bpod State Machine device prior to trial start
-            smaConfirmed = BpodSystem.SerialPort.read(1, 'uint8');
-            if isempty(smaConfirmed) || smaConfirmed ~= 1
-                BpodSystem.Status.BeingUsed = 0;
-                BpodSystem.Status.InStateMatrix = 0;
-                error('Error: The last state machine sent was not acknowledged by the Bpod device.');
+            % the Bpod State Machine device prior to trial start. SendStateMachine() sends
+            % nothing (and so no confirmation byte follows) if the device already holds it.
+            if BpodSystem.Status.NewStateMachineSent
+                smaConfirmed = BpodSystem.SerialPort.read(1, 'uint8');
+                if isempty(smaConfirmed) || smaConfirmed ~= 1
+                    BpodSystem.Status.BeingUsed = 0;
+                    BpodSystem.Status.InStateMatrix = 0;
+                    error('Error: The last state machine sent was not acknowledged by the Bpod device.');
+                end
             end
 
             % Read and format trial start timestamp
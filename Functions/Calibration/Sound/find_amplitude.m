@@ -13,6 +13,7 @@ function [Amplitude] = find_amplitude(SoundParam,TargetSPL,BandLimits, handles)
     SPLref = 20e-6;                         % Pa
 
     SoundParam.Amplitude = InitialAmplitude;
+    Slope = 1; % dB of level per dB of amplitude
     
     axes(handles.signalFig);
 
@@ -51,7 +52,15 @@ function [Amplitude] = find_amplitude(SoundParam,TargetSPL,BandLimits, handles)
         if(abs(PowerDifference_dBSPL)<AcceptableDifference_dBSPL)
             break;
         elseif(inditer<MaxIterations)
-            AmpFactor = sqrt(10^(PowerDifference_dBSPL/10));
+            % Secant on level vs. 20*log10(amplitude), as in mcc/soundcal.c: slope 1 on the
+            % first step (plain rescaling), measured slope after that, limited to [0.25 2]
+            if inditer > 1 && SoundParam.Amplitude ~= LastAmplitude
+                Slope = (PowerAtThisFrequency_dBSPL - LastPower_dBSPL)/(20*log10(SoundParam.Amplitude/LastAmplitude));
+                Slope = min(max(Slope, 0.25), 2);
+            end
+            LastAmplitude = SoundParam.Amplitude;
+            LastPower_dBSPL = PowerAtThisFrequency_dBSPL;
+            AmpFactor = 10^(PowerDifference_dBSPL/(20*Slope));
             SoundParam.Amplitude = SoundParam.Amplitude/AmpFactor;
             % If it cannot find the right level, set to 0.1
             if(SoundParam.Amplitude>1)
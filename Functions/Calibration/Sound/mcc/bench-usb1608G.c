@@ -0,0 +1,185 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Compares the per-sample conversion used by read-usb1608G
+  (rint + volts_USB1608G for every sample) with the batch kernel
+  usbAInScanVolts_USB1608G on a synthetic scan buffer, then times the
+  whole driver path (open, configure, scan, read, convert) against the
+  emulated device in usb-1608G-emu.c.  No device needed.
+
+  Usage: bench-usb1608G [n_chan] [n_scan] [repeats]
+  n_chan is 1-15 (the scan list length); more than 8 are read single ended.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "pmd.h"
+#include "usb-1608G.h"
+#include "usb-1608G-emu.h"
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int benchEmulated(int nchan, int nScans, ScanList list[NCHAN_1608G])
+{
+  /* Full driver path against the emulator; checks the recovered signal amplitude on every channel. */
+  const double fullScale[NGAINS_1608G] = {10., 5., 2., 1.};
+  Emulator1608G *emu = emu1608GCreate("EMU00001");
+  usbDevice1608G usbdev;
+  AInStream inStream;
+  AOutStream outStream;
+  float slope[NCHAN_1608G], offset[NCHAN_1608G];
+  uint16_t *raw = malloc((size_t) nScans*nchan*sizeof(uint16_t));
+  float *volts = malloc((size_t) nScans*nchan*sizeof(float));
+  double amplitude[NCHAN_1608G], rms, t0, tOpen, tScan, worst = 0;
+  int i, j, ret, refused;
+
+  setenv("MCC_CAL_CACHE", "", 1);  // always read the emulated EEPROM
+  for (j = 0; j < nchan; j++) {
+    amplitude[j] = 0.8*fullScale[list[j].range];
+    emu1608GSetSignal(emu, list[j].channel, amplitude[j], 1000.*(j + 1), 0.0);
+  }
+  mccSetTransport(&emu1608GTransport);
+  emu->status = 0;  // just powered up: the FPGA needs its bitstream
+
+  t0 = now();
+  if (usbOpenHandle_USB1608G_r(&usbdev, emu1608GHandle(emu), USB1608G_PID) < 0) {
+    fprintf(stderr, "emulated 1608G: could not read the calibration tables\n");
+    return 1;
+  }
+  tOpen = now() - t0;
+  printf("emulated 1608G: FPGA loaded in %.3f ms with %llu control transfers\n",
+	 usbdev.fpgaLoadTime*1e3, (unsigned long long) emu->nControl);
+  list[nchan-1].mode |= LAST_CHANNEL;
+  t0 = now();
+  usbAInConfig_USB1608G_r(&usbdev, list);
+  usbAInScanStart_USB1608G_r(&usbdev, nScans, 0, 200000., 0x0);
+  ret = usbAInScanRead_USB1608G_r(&usbdev, nScans, nchan, raw);
+  usbAInScanCoefficients_USB1608G(usbdev.table_AIn, list, nchan, slope, offset);
+  usbAInScanVolts_USB1608G(raw, nScans, nchan, slope, offset, volts);
+  tScan = now() - t0;
+  list[nchan-1].mode &= ~LAST_CHANNEL;
+
+  printf("emulated 1608G: open %.3f ms, scan+read+convert %.3f ms (%.1f Msamples/s), %llu control / %llu bulk transfers\n",
+	 tOpen*1e3, tScan*1e3, (double) nScans*nchan/tScan*1e-6,
+	 (unsigned long long) emu->nControl, (unsigned long long) emu->nBulk);
+  for (j = 0; j < nchan; j++) {
+    rms = 0;
+    for (i = 0; i < nScans; i++) rms += volts[i*nchan + j]*volts[i*nchan + j];
+    rms = sqrt(rms/nScans);
+    if (fabs(rms*sqrt(2) - amplitude[j]) > worst) worst = fabs(rms*sqrt(2) - amplitude[j]);
+  }
+  printf("emulated 1608G: %d bytes read, worst amplitude error %.5f V\n", ret, worst);
+
+  // The stream API queues libusb transfers on udev, which is not a libusb handle here
+  refused = usbAInStreamStart_USB1608G_r(&usbdev, &inStream, nScans, nchan, 200000., 0x0, 0, NULL, NULL) == -1 &&
+            usbAInStreamPoll_USB1608G(&inStream, 0) == 0 &&
+            usbAOutStreamStart_USB1608GX_2AO_r(&usbdev, &outStream, 1000, 1000., AO_CHAN0, 0, NULL, NULL) == -1;
+  printf("emulated 1608G: stream API %s\n", refused ? "refused without libusb" : "FAILED to refuse");
+
+  usbClose_USB1608G_r(&usbdev);
+  mccSetTransport(NULL);
+  emu1608GDestroy(emu);
+  free(raw);
+  free(volts);
+  return (ret == nScans*nchan*2 && worst < 0.01 && refused) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  int nchan = (argc > 1) ? atoi(argv[1]) : 1;
+  int nScans = (argc > 2) ? atoi(argv[2]) : 80000;
+  int repeats = (argc > 3) ? atoi(argv[3]) : 100;
+  float table_AIN[NGAINS_1608G][2] = {{1.0012, -3.1}, {0.9987, 2.4}, {1.0005, -0.8}, {0.9993, 1.7}};
+  ScanList list[NCHAN_1608G];
+  float slope[NCHAN_1608G], offset[NCHAN_1608G];
+  uint16_t *raw, data;
+  double *reference, t0, tScalar, tBatchF, tBatchD, maxError = 0;
+  float *volts;
+  double *voltsD;
+  long nSamples, k;
+  int i, j, r;
+  uint8_t gain;
+
+  if (nchan < 1 || nchan > MAX_SCAN_LIST_1608G || nScans < 1) {
+    fprintf(stderr, "usage: bench-usb1608G [n_chan (1-%d)] [n_scan] [repeats]\n", MAX_SCAN_LIST_1608G);
+    return 1;
+  }
+  nSamples = (long) nScans*nchan;
+  raw = malloc(nSamples*sizeof(uint16_t));
+  reference = malloc(nSamples*sizeof(double));
+  volts = malloc(nSamples*sizeof(float));
+  voltsD = malloc(nSamples*sizeof(double));
+  for (j = 0; j < nchan; j++) {
+    list[j].range = j % NGAINS_1608G;
+    list[j].mode = (nchan > NCHAN_1608G/2) ? SINGLE_ENDED : DIFFERENTIAL;  // 8 differential inputs, 16 single ended
+    list[j].channel = j;
+  }
+  for (k = 0; k < nSamples; k++) {
+    raw[k] = 32768 + 30000*sin(2*M_PI*1000.*(k/nchan)/200000.) + (k % 7);
+  }
+
+  // Per-sample path, as in read-usb1608G
+  t0 = now();
+  for (r = 0; r < repeats; r++) {
+    for (i = 0; i < nScans; i++) {
+      for (j = 0; j < nchan; j++) {
+	gain = list[j].range;
+	k = (long) i*nchan + j;
+	data = rint(raw[k]*table_AIN[gain][0] + table_AIN[gain][1]);
+	reference[k] = volts_USB1608G(NULL, gain, data);
+      }
+    }
+  }
+  tScalar = (now() - t0)/repeats;
+
+  usbAInScanCoefficients_USB1608G(table_AIN, list, nchan, slope, offset);
+  t0 = now();
+  for (r = 0; r < repeats; r++) {
+    usbAInScanVolts_USB1608G(raw, nScans, nchan, slope, offset, volts);
+  }
+  tBatchF = (now() - t0)/repeats;
+  t0 = now();
+  for (r = 0; r < repeats; r++) {
+    usbAInScanVoltsD_USB1608G(raw, nScans, nchan, slope, offset, voltsD);
+  }
+  tBatchD = (now() - t0)/repeats;
+
+  for (k = 0; k < nSamples; k++) {
+    if (fabs(volts[k] - reference[k]) > maxError) maxError = fabs(volts[k] - reference[k]);
+  }
+  printf("%d channels x %d scans, %d repeats\n", nchan, nScans, repeats);
+  printf("per-sample (rint + volts_USB1608G): %8.3f ms  %7.1f Msamples/s\n", tScalar*1e3, nSamples/tScalar*1e-6);
+  printf("usbAInScanVolts_USB1608G (float):   %8.3f ms  %7.1f Msamples/s\n", tBatchF*1e3, nSamples/tBatchF*1e-6);
+  printf("usbAInScanVoltsD_USB1608G (double): %8.3f ms  %7.1f Msamples/s\n", tBatchD*1e3, nSamples/tBatchD*1e-6);
+  printf("max |batch - per-sample| = %.6f V (per-sample path rounds to an integer code)\n", maxError);
+
+  free(raw); free(reference); free(volts); free(voltsD);
+  return benchEmulated(nchan, nScans, list) ? 1 : 0;
+}
@@ -0,0 +1,367 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Persistent acquisition server for the USB-1608G.
+
+  read-usb1608G opens the device, configures the FPGA and reads the
+  calibration EEPROM on every run.  daq-usb1608G does that once and then
+  serves scan requests over a Unix domain socket and a localhost TCP
+  port, so each measurement only costs the acquisition itself.  MATLAB
+  (mcc_daq.m) sends its requests to the TCP port directly.
+
+  Server:  daq-usb1608G -d [-s socket] [-p port]
+  Client:  daq-usb1608G [-s socket] n_chan n_scan range freq [outfile]
+  Stop:    daq-usb1608G [-s socket] -q
+
+  The client takes the same arguments as read-usb1608G and writes the
+  same binary output (ScanHeader + uint16 samples) to outfile, or to
+  stdout if outfile is "-" or omitted.  The server holds the device, so
+  stop it before running read-usb1608G: it releases the device, then
+  answers the stop request and exits.  -p 0 turns the TCP port off.
+
+  A request is a ScanRequest; the reply is a ScanHeader (nScan = 0 if
+  the request was rejected, or for a stop request) and the samples.
+  Clients are served one at a time; one that stalls for CLIENT_TIMEOUT
+  seconds is dropped.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pmd.h"
+#include "usb-1608G.h"
+
+#define DEFAULT_SOCKET "/tmp/daq-usb1608G.sock"
+#define DEFAULT_PORT   51608     // TCP, 127.0.0.1 only
+#define REQUEST_MAGIC  "MCCR"
+#define STOP_MAGIC     "MCCQ"    // release the device and exit
+#define MAX_RESTARTS   8         // overrun recoveries per request
+#define CLIENT_TIMEOUT 2         // seconds a client may stall a read or write before it is dropped
+
+typedef struct ScanRequest_t {
+  char magic[4];       // "MCCR", or "MCCQ" to stop the server
+  uint32_t nChan;      // differential channels 0 .. nChan-1
+  uint32_t nScan;      // number of scans
+  uint32_t range;      // full scale range in volts (10, 5, 2 or 1)
+  double frequency;    // sample rate per channel (Hz)
+} ScanRequest;
+
+static int writeAll(int fd, const void *buf, size_t length)
+{
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (length > 0) {
+    n = write(fd, p, length);
+    if (n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int readAll(int fd, void *buf, size_t length)
+{
+  uint8_t *p = buf;
+  ssize_t n;
+
+  while (length > 0) {
+    n = read(fd, p, length);
+    if (n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int rangeToGain(uint32_t range)
+{
+  /* -1 for a range the 1608G does not have */
+  switch (range) {
+    case 10: return BP_10V;
+    case 5: return BP_5V;
+    case 2: return BP_2V;
+    case 1: return BP_1V;
+    default: return -1;
+  }
+}
+
+static int serveRequest(usbDevice1608G *usbdev, int fd, uint16_t **buffer, size_t *bufferSize)
+{
+  /* Returns 1 for a stop request, with the device closed, 0 otherwise. */
+  const uint8_t rangeVolts[NGAINS_1608G] = {10, 5, 2, 1};
+  ScanList list[NCHAN_1608G];
+  ScanRequest request;
+  ScanHeader header;
+  AInScanResult result;
+  size_t nSamples;
+  size_t i;
+  double code;
+  uint8_t gain;
+  uint32_t j;
+  int k;
+
+  if (readAll(fd, &request, sizeof(request)) < 0) return 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SCAN_HEADER_MAGIC, 4);
+  header.headerSize = sizeof(ScanHeader);
+  if (memcmp(request.magic, STOP_MAGIC, 4) == 0) {
+    usbClose_USB1608G_r(usbdev);
+    writeAll(fd, &header, sizeof(header));
+    return 1;
+  }
+  if (memcmp(request.magic, REQUEST_MAGIC, 4) != 0 || request.nChan < 1 || request.nChan > 8 ||
+      request.nScan == 0 || request.frequency <= 0 || rangeToGain(request.range) < 0) {
+    writeAll(fd, &header, sizeof(header));  // nScan = 0 signals a rejected request
+    return 0;
+  }
+
+  nSamples = (size_t) request.nScan*request.nChan;
+  if (nSamples > *bufferSize) {
+    free(*buffer);
+    *buffer = malloc(nSamples*sizeof(uint16_t));
+    *bufferSize = (*buffer) ? nSamples : 0;
+    if (*buffer == NULL) {
+      writeAll(fd, &header, sizeof(header));
+      return 0;
+    }
+  }
+
+  gain = rangeToGain(request.range);
+  memset(list, 0, sizeof(list));
+  for (j = 0; j < request.nChan; j++) {
+    list[j].range = gain;
+    list[j].mode = DIFFERENTIAL;
+    list[j].channel = j;
+    header.range[j] = rangeVolts[gain];
+  }
+  usbAInScanList_USB1608G(list, request.nChan);
+
+  usbAInScanStop_USB1608G(usbdev->udev);
+  usbAInScanClearFIFO_USB1608G(usbdev->udev);
+  usbAInConfig_USB1608G_r(usbdev, list);
+  usbAInScanReadResult_USB1608G_r(usbdev, request.nScan, request.nChan, request.frequency, 0x0, MAX_RESTARTS, *buffer, &result);
+  if (result.nOverruns > 0) {
+    printf("daq-usb1608G: %d overrun(s), %u scans lost.\n", result.nOverruns, result.scansDropped);
+    fflush(stdout);
+  }
+
+  header.nChan = request.nChan;
+  header.nScan = result.scansDelivered;
+  header.frequency = request.frequency;
+  header.nGaps = result.nGaps;
+  for (k = 0; k < result.nGaps; k++) {
+    header.gap[k] = result.gap[k].scan;
+  }
+  for (i = 0; i < (size_t) header.nScan*header.nChan; i++) {
+    code = rint((*buffer)[i]*usbdev->table_AIn[gain][0] + usbdev->table_AIn[gain][1]);
+    (*buffer)[i] = (code > 0xffff) ? 0xffff : ((code < 0.0) ? 0x0 : code);  // a clipped input stays at its rail
+  }
+  if (writeAll(fd, &header, sizeof(header)) == 0) {
+    writeAll(fd, *buffer, (size_t) header.nScan*header.nChan*sizeof(uint16_t));
+  }
+  return 0;
+}
+
+static int runServer(const char *socketPath, int port)
+{
+  usbDevice1608G usbdev;
+  struct sockaddr_un addr;
+  struct sockaddr_in inet;
+  struct pollfd listenFd[2];
+  uint16_t *buffer = NULL;
+  size_t bufferSize = 0;
+  int nListen = 1;
+  int one = 1;
+  struct timeval timeout = {CLIENT_TIMEOUT, 0};
+  int fd, i;
+
+  if (usbOpen_USB1608G_r(&usbdev, USB1608G_PID, NULL) < 0) {
+    printf("Failure, did not find a USB 1608G series device!\n");
+    return 1;
+  }
+
+  listenFd[0].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+  unlink(socketPath);
+  if (listenFd[0].fd < 0 || bind(listenFd[0].fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listenFd[0].fd, 4) < 0) {
+    perror("daq-usb1608G: cannot listen on socket");
+    usbClose_USB1608G_r(&usbdev);
+    return 1;
+  }
+  if (port > 0) {
+    listenFd[1].fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&inet, 0, sizeof(inet));
+    inet.sin_family = AF_INET;
+    inet.sin_port = htons(port);
+    inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listenFd[1].fd >= 0) setsockopt(listenFd[1].fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listenFd[1].fd < 0 || bind(listenFd[1].fd, (struct sockaddr *) &inet, sizeof(inet)) < 0 || listen(listenFd[1].fd, 4) < 0) {
+      perror("daq-usb1608G: cannot listen on TCP port");
+      usbClose_USB1608G_r(&usbdev);
+      unlink(socketPath);
+      return 1;
+    }
+    nListen = 2;
+  }
+  if (usbdev.fpgaLoadTime > 0) {
+    printf("daq-usb1608G: FPGA loaded in %.2f s\n", usbdev.fpgaLoadTime);
+  }
+  printf("daq-usb1608G: serial %s ready on %s", usbdev.serial, socketPath);
+  if (port > 0) printf(" and 127.0.0.1:%d", port);
+  printf("\n");
+  fflush(stdout);
+
+  for (;;) {
+    for (i = 0; i < nListen; i++) listenFd[i].events = POLLIN;
+    if (poll(listenFd, nListen, -1) < 0) continue;
+    for (i = 0; i < nListen; i++) {
+      if (!(listenFd[i].revents & POLLIN)) continue;
+      fd = accept(listenFd[i].fd, NULL, NULL);
+      if (fd < 0) continue;
+      // One client at a time: one that stalls must not hold up the server (and mcc_daq) for good
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      if (serveRequest(&usbdev, fd, &buffer, &bufferSize)) {
+	close(fd);
+	unlink(socketPath);
+	free(buffer);
+	printf("daq-usb1608G: stopped\n");
+	return 0;
+      }
+      close(fd);
+    }
+  }
+  return 0;
+}
+
+static int runClient(const char *socketPath, int argc, char **argv)
+{
+  /* A scan request, or a stop request when argc is 0. */
+  struct sockaddr_un addr;
+  ScanRequest request;
+  ScanHeader header;
+  uint16_t *data;
+  size_t nSamples;
+  FILE *out = stdout;
+  int fd;
+
+  memset(&request, 0, sizeof(request));
+  if (argc == 0) {
+    memcpy(request.magic, STOP_MAGIC, 4);
+  } else {
+    memcpy(request.magic, REQUEST_MAGIC, 4);
+    request.nChan = atoi(argv[0]);
+    request.nScan = atoi(argv[1]);
+    request.range = atoi(argv[2]);
+    request.frequency = atof(argv[3]);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    perror("daq-usb1608G: cannot connect to server");
+    return 1;
+  }
+  if (writeAll(fd, &request, sizeof(request)) < 0 || readAll(fd, &header, sizeof(header)) < 0) {
+    fprintf(stderr, "daq-usb1608G: server closed the connection.\n");
+    close(fd);
+    return 1;
+  }
+  if (argc == 0) {
+    close(fd);
+    return 0;
+  }
+  nSamples = (size_t) header.nScan*header.nChan;
+  data = malloc(nSamples*sizeof(uint16_t) + 1);
+  if (data == NULL || readAll(fd, data, nSamples*sizeof(uint16_t)) < 0) {
+    fprintf(stderr, "daq-usb1608G: short read from server.\n");
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  if (argc > 4 && strcmp(argv[4], "-") != 0) {
+    out = fopen(argv[4], "wb");
+    if (out == NULL) {
+      perror("daq-usb1608G: cannot create output file");
+      return 1;
+    }
+  }
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(data, sizeof(uint16_t), nSamples, out);
+  if (out != stdout) fclose(out);
+  free(data);
+  return (header.nScan == request.nScan) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *socketPath = DEFAULT_SOCKET;
+  int port = DEFAULT_PORT;
+  int daemonMode = 0;
+  int stop = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "dqs:p:")) != -1) {
+    switch (ch) {
+      case 'd': daemonMode = 1; break;
+      case 'q': stop = 1; break;
+      case 's': socketPath = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      default:
+	fprintf(stderr, "usage: daq-usb1608G -d [-s socket] [-p port]\n"
+		"       daq-usb1608G [-s socket] n_chan n_scan range freq [outfile]\n"
+		"       daq-usb1608G [-s socket] -q\n");
+	return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);  // a client that goes away must not kill the server
+
+  if (daemonMode) {
+    return runServer(socketPath, port);
+  }
+  if (stop) {
+    return runClient(socketPath, 0, NULL);
+  }
+  if (argc - optind < 4) {
+    fprintf(stderr, "usage: daq-usb1608G [-s socket] n_chan n_scan range freq [outfile]\n");
+    return 1;
+  }
+  return runClient(socketPath, argc - optind, &argv[optind]);
+}
@@ -0,0 +1,159 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Checks the thermocouple conversions in nist.c against the NIST ITS-90
+  reference tables (NIST Monograph 175), with no hardware attached:
+
+    NISTCalcTemp at tabulated voltages, within NIST_TEMP_TOL of the table
+    (the inverse polynomials are within 0.06 C of the tables, and the
+    tables round to 1 uV)
+    NISTCalcVoltage at tabulated temperatures inside the range of the
+    single polynomial nist.c uses per type, within NIST_VOLT_TOL
+    NISTCalcTemps/NISTCalcVoltages against the scalar functions over
+    each type's NIST range, within NIST_BATCH_TOL
+    NISTLookupTemps against NISTCalcTemp, within the table's maxError
+
+  nist-check   prints the worst error of each check; exits 1 on a failure
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "pmd.h"
+
+#define NIST_TEMP_TOL   0.1      // C
+#define NIST_VOLT_TOL   0.0006   // mV
+#define NIST_BATCH_TOL  1e-6     // C or mV
+#define NGRID           100001
+
+typedef struct NISTPoint_t {
+  unsigned char type;
+  double temp;       // C
+  double voltage;    // mV, NIST table value
+  int forward;       // temp is inside the range of the NISTCalcVoltage polynomial
+} NISTPoint;
+
+static const NISTPoint reference[] = {
+  {TYPE_J, -200, -7.890, 1}, {TYPE_J, -100, -4.633, 1}, {TYPE_J, 100, 5.269, 1}, {TYPE_J, 500, 27.393, 1},
+  {TYPE_J, 760, 42.919, 1}, {TYPE_J, 1000, 57.953, 0}, {TYPE_J, 1200, 69.553, 0},
+  {TYPE_K, -200, -5.891, 0}, {TYPE_K, -100, -3.554, 0}, {TYPE_K, 100, 4.096, 1}, {TYPE_K, 500, 20.644, 1},
+  {TYPE_K, 1000, 41.276, 1}, {TYPE_K, 1300, 52.410, 1},
+  {TYPE_T, -200, -5.603, 0}, {TYPE_T, -100, -3.379, 0}, {TYPE_T, 100, 4.279, 1}, {TYPE_T, 400, 20.872, 1},
+  {TYPE_E, -200, -8.825, 0}, {TYPE_E, -100, -5.237, 0}, {TYPE_E, 100, 6.319, 1}, {TYPE_E, 500, 37.005, 1},
+  {TYPE_E, 1000, 76.373, 1},
+  {TYPE_R, 100, 0.647, 1}, {TYPE_R, 500, 4.471, 1}, {TYPE_R, 1000, 10.506, 1}, {TYPE_R, 1500, 17.451, 0},
+  {TYPE_S, 100, 0.646, 1}, {TYPE_S, 500, 4.233, 1}, {TYPE_S, 1000, 9.587, 1}, {TYPE_S, 1500, 15.582, 0},
+  {TYPE_B, 500, 1.242, 1}, {TYPE_B, 1000, 4.834, 0}, {TYPE_B, 1500, 10.099, 0}, {TYPE_B, 1800, 13.591, 0},
+  {TYPE_N, -100, -2.407, 0}, {TYPE_N, 100, 2.774, 1}, {TYPE_N, 500, 16.748, 1}, {TYPE_N, 1000, 36.256, 1},
+  {TYPE_N, 1300, 47.513, 1}
+};
+
+/* NIST voltage range of each type (mV), indexed by TYPE_J .. TYPE_N */
+static const double voltageRange[8][2] = {
+  {-8.095, 69.553}, {-5.891, 54.886}, {-5.603, 20.872}, {-8.825, 76.373},
+  {-0.226, 21.103}, {-0.235, 18.693}, {0.291, 13.820}, {-3.990, 47.513}
+};
+/* temperature range of the NISTCalcVoltage polynomial (C) */
+static const double tempRange[8][2] = {
+  {-200, 760}, {0, 1372}, {0, 400}, {0, 1000}, {-50, 1064}, {-50, 1064}, {0, 630}, {0, 1300}
+};
+static const char typeName[] = "JKTERSBN";
+
+static int check(const char *name, double error, double tolerance)
+{
+  printf("  %-44s %10.3g (tolerance %g)%s\n", name, error, tolerance, (error <= tolerance) ? "" : "  FAILED");
+  return error <= tolerance;
+}
+
+int main(void)
+{
+  double *x = malloc(NGRID*sizeof(double)), *y = malloc(NGRID*sizeof(double));
+  double tempError = 0, voltError = 0, batchTemp, batchVolt, error;
+  NIST_Lookup lut;
+  char name[64];
+  int ok = 1;
+  int i, type;
+  size_t k;
+
+  if (x == NULL || y == NULL) {
+    fprintf(stderr, "nist-check: out of memory\n");
+    return 1;
+  }
+  for (k = 0; k < sizeof(reference)/sizeof(reference[0]); k++) {
+    error = fabs(NISTCalcTemp(reference[k].type, reference[k].voltage) - reference[k].temp);
+    if (error > tempError) tempError = error;
+    if (reference[k].forward) {
+      error = fabs(NISTCalcVoltage(reference[k].type, reference[k].temp) - reference[k].voltage);
+      if (error > voltError) voltError = error;
+    }
+  }
+  printf("nist-check: %d NIST reference points\n", (int) (sizeof(reference)/sizeof(reference[0])));
+  ok &= check("NISTCalcTemp vs NIST table (C)", tempError, NIST_TEMP_TOL);
+  ok &= check("NISTCalcVoltage vs NIST table (mV)", voltError, NIST_VOLT_TOL);
+
+  for (type = TYPE_J; type <= TYPE_N; type++) {
+    batchTemp = batchVolt = 0;
+    for (i = 0; i < NGRID; i++) {
+      x[i] = voltageRange[type][0] + (voltageRange[type][1] - voltageRange[type][0])*i/(NGRID - 1);
+    }
+    NISTCalcTemps(type, x, y, NGRID);
+    for (i = 0; i < NGRID; i++) {
+      error = fabs(y[i] - NISTCalcTemp(type, x[i]));
+      if (error > batchTemp) batchTemp = error;
+    }
+    for (i = 0; i < NGRID; i++) {
+      x[i] = tempRange[type][0] + (tempRange[type][1] - tempRange[type][0])*i/(NGRID - 1);
+    }
+    NISTCalcVoltages(type, x, y, NGRID);
+    for (i = 0; i < NGRID; i++) {
+      error = fabs(y[i] - NISTCalcVoltage(type, x[i]));
+      if (error > batchVolt) batchVolt = error;
+    }
+    snprintf(name, sizeof(name), "type %c NISTCalcTemps vs NISTCalcTemp (C)", typeName[type]);
+    ok &= check(name, batchTemp, NIST_BATCH_TOL);
+    snprintf(name, sizeof(name), "type %c NISTCalcVoltages vs NISTCalcVoltage (mV)", typeName[type]);
+    ok &= check(name, batchVolt, NIST_BATCH_TOL);
+  }
+
+  // 4096 points over 0-54.886 mV (type K, 0-1372 C), as in the nist.c comment; compared off the grid points
+  if (NISTLookupInit(&lut, TYPE_K, 0.0, voltageRange[TYPE_K][1], 4096) < 0) {
+    fprintf(stderr, "nist-check: NISTLookupInit failed\n");
+    return 1;
+  }
+  for (i = 0; i < NGRID; i++) {
+    x[i] = voltageRange[TYPE_K][1]*(i + 0.37)/NGRID;
+  }
+  NISTLookupTemps(&lut, x, y, NGRID);
+  error = 0;
+  for (i = 0; i < NGRID; i++) {
+    if (fabs(y[i] - NISTCalcTemp(TYPE_K, x[i])) > error) error = fabs(y[i] - NISTCalcTemp(TYPE_K, x[i]));
+  }
+  ok &= check("type K lookup vs NISTCalcTemp (C)", error, lut.maxError);
+  ok &= check("type K lookup maxError, 4096 points (C)", lut.maxError, 0.03);
+  NISTLookupFree(&lut);
+
+  free(x);
+  free(y);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
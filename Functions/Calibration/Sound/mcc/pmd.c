@@ -57,16 +57,40 @@ int usb_get_max_packet_size(libusb_device_handle* udev, int endpointNum)
   return packet_size;
 }
 
+static const MCCTransport libusbTransport = {
+  libusb_control_transfer,
+  libusb_bulk_transfer,
+  usb_get_max_packet_size,
+  NULL,
+  1
+};
+
+const MCCTransport *mccTransport = &libusbTransport;
+
+void mccSetTransport(const MCCTransport *transport)
+{
+  mccTransport = transport ? transport : &libusbTransport;
+}
+
 libusb_device_handle* usb_device_find_USB_MCC( int productId, char *serialID )
 {
+  return usb_device_find_USB_MCC_ctx(NULL, productId, serialID);
+}
+
+libusb_device_handle* usb_device_find_USB_MCC_ctx( libusb_context *ctx, int productId, char *serialID )
+{
+  /*
+    Same as usb_device_find_USB_MCC, on the devices of libusb context ctx
+    (NULL for the default).  Returns the first board with productId (and
+    serialID, unless it is NULL) with interface 0 claimed, or NULL.
+  */
   int vendorId = MCC_VID;
 
   struct libusb_device_handle *udev = NULL;
   struct libusb_device_descriptor desc;
   struct libusb_device **list;
-  struct libusb_device *found = NULL;
   struct libusb_device *device;
-  char serial[9];
+  char serial[10];  // 8 characters; libusb_get_string_descriptor_ascii keeps one byte for the terminator
 
   ssize_t cnt = 0;
   ssize_t i = 0;
@@ -75,7 +99,7 @@ libusb_device_handle* usb_device_find_USB_MCC( int productId, char *serialID )
   int config;
 
   // discover devices
-  cnt = libusb_get_device_list(NULL, &list);
+  cnt = libusb_get_device_list(ctx, &list);
 
   if (cnt < 0) {
     perror("No USB devices found on bus.");
@@ -87,8 +111,7 @@ libusb_device_handle* usb_device_find_USB_MCC( int productId, char *serialID )
     err = libusb_get_device_descriptor(device, &desc);
     if (err < 0) goto out;
     if (desc.idVendor == vendorId && desc.idProduct == productId) {
-      found = device;
-      err = libusb_open(found, &udev);
+      err = libusb_open(device, &udev);
       if (err < 0) {
 	udev = NULL;
 	continue;
@@ -112,11 +135,14 @@ libusb_device_handle* usb_device_find_USB_MCC( int productId, char *serialID )
       }
       /* Check to see if serial ID match */
       if (serialID != NULL) {
-	libusb_get_string_descriptor_ascii(udev, desc.iSerialNumber, (unsigned char *) serial, 8);
-	serial[9] = '\0';
-        if (strcmp(serialID, serial) == 0) {
+	if (libusb_get_string_descriptor_ascii(udev, desc.iSerialNumber, (unsigned char *) serial, sizeof(serial)) > 0 &&
+	    strcmp(serialID, serial) == 0) {
 	  break;
 	}
+	/* Another board: let it go, so it can be opened by its own serial number */
+	libusb_release_interface(udev, 0);
+	libusb_close(udev);
+	udev = NULL;
       } else {
         
         /* If we got to here, we found a match and were able to claim the interface.  At
@@ -141,10 +167,8 @@ libusb_device_handle* usb_device_find_USB_MCC( int productId, char *serialID )
   return udev;
 
 out:
-  libusb_free_device_list(list,1);
-  libusb_close(udev);
-  libusb_exit(NULL);
-  exit(0);
+  libusb_free_device_list(list,1);  // udev is NULL here: a handle is only kept on a match
+  return NULL;
 }
 
 void getUsbSerialNumber(libusb_device_handle *udev, unsigned char serial[])
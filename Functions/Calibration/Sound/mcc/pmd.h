@@ -53,8 +53,27 @@ extern "C" {
 
 /* For USB devices */
 libusb_device_handle* usb_device_find_USB_MCC(int productId, char *serialID);
+libusb_device_handle* usb_device_find_USB_MCC_ctx(libusb_context *ctx, int productId, char *serialID);
 int usb_get_max_packet_size(libusb_device_handle* udev, int endpointNum);
 
+/* Transport used by the device drivers for synchronous transfers.  It is
+   libusb by default; mccSetTransport installs another one, e.g. the
+   USB-1608G emulator in usb-1608G-emu.c, so the drivers can run with
+   no hardware attached.  close is NULL for libusb (the cleanup functions
+   release the device themselves). */
+typedef struct MCCTransport_t {
+  int (*control_transfer)(libusb_device_handle *udev, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+			  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout);
+  int (*bulk_transfer)(libusb_device_handle *udev, unsigned char endpoint, unsigned char *data, int length,
+		       int *transferred, unsigned int timeout);
+  int (*get_max_packet_size)(libusb_device_handle *udev, int endpointNum);
+  void (*close)(libusb_device_handle *udev);
+  int async;  // nonzero if udev is a real libusb handle that accepts libusb_submit_transfer
+} MCCTransport;
+
+extern const MCCTransport *mccTransport;
+void mccSetTransport(const MCCTransport *transport);  // NULL restores libusb
+
 /* MDB Control Transfers */
 #define MAX_MESSAGE_LENGTH 64      // max length of MBD Packet in bytes
 #define STRING_MESSAGE     (0x80)  // Send string messages to the device
@@ -106,8 +125,24 @@ typedef struct Thermocouple_Data_t {
   const NIST_Table* Tables;
 } Thermocouple_Data;
 
+/* Piecewise linear voltage to temperature table, see NISTLookupInit */
+typedef struct NIST_Lookup_t {
+  unsigned char tc_type;
+  int nPoints;
+  double vMin;         // mV, first grid point
+  double vMax;         // mV, last grid point
+  double scale;        // grid points per mV
+  double maxError;     // worst |table - NISTCalcTemp| inside [vMin, vMax], Celsius
+  double *temp;        // NISTCalcTemp at each grid point
+} NIST_Lookup;
+
 double NISTCalcVoltage(unsigned char tc_type, double temp);
 double NISTCalcTemp(unsigned char tc_type, double voltage);
+void NISTCalcVoltages(unsigned char tc_type, const double *temp, double *voltage, int n);
+void NISTCalcTemps(unsigned char tc_type, const double *voltage, double *temp, int n);
+int NISTLookupInit(NIST_Lookup *lut, unsigned char tc_type, double vMin, double vMax, int nPoints);
+void NISTLookupFree(NIST_Lookup *lut);
+void NISTLookupTemps(const NIST_Lookup *lut, const double *voltage, double *temp, int n);
 
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
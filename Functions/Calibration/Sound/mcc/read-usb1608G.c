@@ -24,11 +24,14 @@
 #include <ctype.h>
 #include <math.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "pmd.h"
 #include "usb-1608G.h"
 
 #define MAX_COUNT     (0xffff)
+#define TRIGGER_TIMEOUT 10000   // ms allowed for all trigger waits by default
+#define MAX_RESTARTS  8         // overrun recoveries before a free-running scan gives up
 #define FALSE 0
 #define TRUE 1
 
@@ -45,8 +48,74 @@ struct parsed_options
 	int n_chan;
 	int n_scan;
 	double freq;
+	int channels[MAX_SCAN_LIST_1608G];  // input per scan list entry, channels[0] = -1: 0 .. n_chan-1
+	int modes[MAX_SCAN_LIST_1608G];     // DIFFERENTIAL or SINGLE_ENDED per entry
+	int ranges[MAX_SCAN_LIST_1608G];    // full scale volts per entry
+	int trigger;         // usbTriggerConfig options, -1 = free running
+	int retrig_count;    // scans per trigger in retrigger mode, 0 = single trigger
+	unsigned int timeout;
 };
 
+static int parseTrigger(const char *mode)
+{
+  if (strcmp(mode, "rising") == 0) return TRIG_EDGE | TRIG_RISING;
+  if (strcmp(mode, "falling") == 0) return TRIG_EDGE;
+  if (strcmp(mode, "high") == 0) return TRIG_RISING;
+  if (strcmp(mode, "low") == 0) return 0;
+  return -1;
+}
+
+
+static int parseMode(const char *mode)
+{
+  if (strcmp(mode, "diff") == 0) return DIFFERENTIAL;
+  if (strcmp(mode, "se") == 0) return SINGLE_ENDED;
+  return -1;
+}
+
+static uint8_t rangeToGain(int range)
+{
+  switch (range) {
+    case 5: return BP_5V;
+    case 2: return BP_2V;
+    case 1: return BP_1V;
+    default: return BP_10V;
+  }
+}
+
+static int parseList(char *arg, char *item[MAX_SCAN_LIST_1608G])
+{
+  /* Splits a comma separated list in place; returns the number of items, -1 if there are too many. */
+  int n = 0;
+  char *p;
+
+  for (p = strtok(arg, ","); p; p = strtok(NULL, ",")) {
+    if (n == MAX_SCAN_LIST_1608G) return -1;
+    item[n++] = p;
+  }
+  return n;
+}
+
+static int expandList(char *arg, int nchan, int value[MAX_SCAN_LIST_1608G], int (*parse)(const char *))
+{
+  /* Fills value[0 .. nchan-1] from a list of one or nchan items; returns -1 on a bad list. */
+  char *item[MAX_SCAN_LIST_1608G];
+  int n = parseList(arg, item);
+  int j;
+
+  if (n != 1 && n != nchan) return -1;
+  for (j = 0; j < nchan; j++) {
+    value[j] = parse(item[(n == 1) ? 0 : j]);
+    if (value[j] < 0) return -1;
+  }
+  return 0;
+}
+
+static int parseInt(const char *arg)
+{
+  return isdigit((unsigned char) arg[0]) ? atoi(arg) : -1;
+}
+
 
 /* Test Program */
 int toContinue()
@@ -59,45 +128,113 @@ int toContinue()
   return ( answer == 'y' || answer == 'Y');
 }
 
+static void fillHeader(ScanHeader *header, int nchan, int nScans, double frequency, ScanList *list)
+{
+  const uint8_t rangeVolts[NGAINS_1608G] = {10, 5, 2, 1};  // indexed by BP_10V .. BP_1V
+  int j;
+
+  memset(header, 0, sizeof(ScanHeader));
+  memcpy(header->magic, SCAN_HEADER_MAGIC, 4);
+  header->headerSize = sizeof(ScanHeader);
+  header->nChan = nchan;
+  header->nScan = nScans;
+  header->frequency = frequency;
+  for (j = 0; j < nchan; j++) {
+    header->range[j] = rangeVolts[list[j].range & 0x3];
+  }
+}
+
 int main (int argc, char **argv)
 {
   libusb_device_handle *udev = NULL;
+  usbDevice1608G usbdev;
 
   double frequency;
-  float table_AIN[NGAINS_1608G][2];
+  double code;
   ScanList list[NCHAN_1608G];  // scan list used to configure the A/D channels.
 
   int i, j, k, nchan;
   int nScans = 0;
   int ret;
 
-  uint16_t data;
-  uint16_t sdataIn[100000]; //holds 16 bit unsigned analog input data
+  uint16_t *sdataIn = NULL; //holds 16 bit unsigned analog input data
+  float *voltsIn = NULL;     //sdataIn converted to volts
+  float *voltsChannel[NCHAN_1608G];  // voltsIn split by channel
+  float slope[NCHAN_1608G], offset[NCHAN_1608G];  // per-channel calibration + range
+  uint8_t *map = NULL;
+  size_t mapSize = 0;
+  int fd = -1;
+  ScanHeader header;
+  AInScanResult result;
 
-  uint8_t gain, channel;
+  uint8_t gain;
+  uint8_t scanOptions = 0x0;
+  int ch;
 
   struct parsed_options options;
-  options.n_chan = atoi(argv[1]);
-  options.n_scan = atoi(argv[2]);
-  options.range = atoi(argv[3]);
-  options.freq = atof(argv[4]);
+  char *channelArg = NULL, *modeArg = NULL;
+  char defaultMode[] = "diff";
+  options.trigger = -1;
+  options.retrig_count = 0;
+  options.timeout = TRIGGER_TIMEOUT;
+  while ((ch = getopt(argc, argv, "c:m:t:r:w:")) != -1) {
+    switch (ch) {
+      case 'c': channelArg = optarg; break;
+      case 'm': modeArg = optarg; break;
+      case 't':
+	options.trigger = parseTrigger(optarg);
+	if (options.trigger < 0) {
+	  fprintf(stderr, "read-usb1608G: trigger must be rising, falling, high or low.\n");
+	  return 1;
+	}
+	break;
+      case 'r': options.retrig_count = atoi(optarg); break;
+      case 'w': options.timeout = atoi(optarg); break;
+      default: argc = 0; break;  // print usage
+    }
+  }
+  if (argc - optind < 4) {
+    fprintf(stderr, "usage: read-usb1608G [-c channels] [-m modes] [-t trigger [-r retrig_count] [-w timeout]]\n"
+	    "                     n_chan n_scan range freq [outfile]\n"
+	    "  -c: input channel of each scan list entry, e.g. 0,3 (default 0 .. n_chan-1)\n"
+	    "  -m: diff or se per entry, e.g. se,diff (default diff)\n"
+	    "  range: 10, 5, 2 or 1 V, one value or one per entry, e.g. 10,1\n"
+	    "  -t: wait for the external trigger: rising, falling (edge) or high, low (level)\n"
+	    "  -r: rearm the trigger every retrig_count scans; n_scan must be a multiple of it\n"
+	    "  -w: ms allowed for waiting on triggers, in total over all of them,\n"
+	    "      on top of the acquisition time (default %d)\n"
+	    "  outfile: write a binary header and uint16 samples instead of text;\n"
+	    "           \"-\" writes them to stdout, a path writes a memory-mapped file.\n", TRIGGER_TIMEOUT);
+    return 1;
+  }
+  options.n_chan = atoi(argv[optind]);
+  options.n_scan = atoi(argv[optind+1]);
+  options.freq = atof(argv[optind+3]);
+  options.filename = (argc - optind > 4) ? argv[optind+4] : NULL;
+  options.channels[0] = -1;
+  if (options.n_chan < 1 || options.n_chan > MAX_SCAN_LIST_1608G ||
+      expandList(argv[optind+2], options.n_chan, options.ranges, parseInt) < 0 ||
+      (channelArg && expandList(channelArg, options.n_chan, options.channels, parseInt) < 0) ||
+      (modeArg ? expandList(modeArg, options.n_chan, options.modes, parseMode) :
+       expandList(defaultMode, options.n_chan, options.modes, parseMode)) < 0) {
+    fprintf(stderr, "read-usb1608G: n_chan must be 1 to %d, with one or n_chan entries in -c, -m and range.\n",
+	    MAX_SCAN_LIST_1608G);
+    return 1;
+  }
+  if (options.retrig_count > 0 && (options.trigger < 0 || options.n_scan % options.retrig_count != 0)) {
+    fprintf(stderr, "read-usb1608G: -r needs -t and n_scan a multiple of retrig_count.\n");
+    return 1;
+  }
 
   udev = NULL;
 
-  ret = libusb_init(NULL);
-  if (ret < 0) {
-    perror("libusb_init: Failed to initialize libusb");
-    exit(1);
-  }
-  if ((udev = usb_device_find_USB_MCC(USB1608G_PID, NULL))) {} else {
+  // find the device, configure the FPGA and get the calibration tables (cached per serial number);
+  // usbOpen_USB1608G_r makes the libusb context and usbClose_USB1608G_r exits it
+  if (usbOpen_USB1608G_r(&usbdev, USB1608G_PID, NULL) < 0) {
     printf("Failure, did not find a USB 1608G series device!\n");
     return 0;
   }
-
-  // some initialization
-  usbInit_1608G(udev);
- 
-  usbBuildGainTable_USB1608G(udev, table_AIN);
+  udev = usbdev.udev;
 
   usbAInScanStop_USB1608G(udev);
   usbAInScanClearFIFO_USB1608G(udev);
@@ -106,40 +243,128 @@ int main (int argc, char **argv)
   nScans = options.n_scan;
   frequency = options.freq;
 
-  for (channel = 0; channel < nchan; channel++) {
-
-	switch(options.range) {
-	    case '10': gain = BP_10V; break;
-	    case '5': gain = BP_5V; break;
-	    case '2': gain = BP_2V; break;
-	    case '1': gain = BP_1V; break;
-	    default:  gain = BP_10V; break;
-	}
+  // one scan list entry per channel; single values in -c/-m/range apply to every channel
+  memset(list, 0, sizeof(list));
+  for (j = 0; j < nchan; j++) {
+    list[j].channel = (options.channels[0] >= 0) ? options.channels[j] : j;
+    list[j].mode = options.modes[j];
+    list[j].range = rangeToGain(options.ranges[j]);
+    if (options.ranges[j] != 10 && options.ranges[j] != 5 && options.ranges[j] != 2 && options.ranges[j] != 1) {
+      fprintf(stderr, "read-usb1608G: range must be 10, 5, 2 or 1 V.\n");
+      usbClose_USB1608G_r(&usbdev);
+      return 1;
+    }
   }
- 
-  list[channel].range = gain;  
-  list[channel].mode = DIFFERENTIAL;
-  list[channel].channel = channel;
-
-  list[nchan-1].mode |= LAST_CHANNEL;
-  usbAInConfig_USB1608G(udev, list);
+  if (usbAInScanList_USB1608G(list, nchan) < 0) {
+    usbClose_USB1608G_r(&usbdev);
+    return 1;
+  }
+  usbAInConfig_USB1608G_r(&usbdev, list);
 
-  usbAInScanStart_USB1608G(udev, nScans, 0, frequency, 0x0);
+  fillHeader(&header, nchan, nScans, frequency, list);
+  if (options.filename && strcmp(options.filename, "-") != 0) {
+    // Scan straight into a memory-mapped output file (header, then samples)
+    mapSize = sizeof(ScanHeader) + (size_t) nScans*nchan*sizeof(uint16_t);
+    fd = open(options.filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, mapSize) < 0) {
+      perror("read-usb1608G: cannot create output file");
+      usbClose_USB1608G_r(&usbdev);
+      return 1;
+    }
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      perror("read-usb1608G: mmap");
+      close(fd);
+      usbClose_USB1608G_r(&usbdev);
+      return 1;
+    }
+    memcpy(map, &header, sizeof(ScanHeader));
+    sdataIn = (uint16_t *) (map + sizeof(ScanHeader));
+  } else {
+    sdataIn = malloc((size_t) nScans*nchan*sizeof(uint16_t));
+    if (sdataIn == NULL) {
+      fprintf(stderr, "read-usb1608G: out of memory.\n");
+      usbClose_USB1608G_r(&usbdev);
+      return 1;
+    }
+  }
 
- // printf("hello \n");
+  if (options.trigger >= 0) {
+    // One scan of n_scan/retrig_count windows, each aligned to a trigger
+    usbTriggerConfig_USB1608G_r(&usbdev, options.trigger);
+    scanOptions |= AIN_TRIG;
+    if (options.retrig_count > 0) scanOptions |= AIN_RETRIG_MODE;
+  }
+  if (options.trigger >= 0) {
+    usbAInScanStart_USB1608G_r(&usbdev, nScans, options.retrig_count, frequency, scanOptions);
+    ret = usbAInScanReadTimeout_USB1608G_r(&usbdev, nScans, nchan, sdataIn, options.timeout + (unsigned int) (1000.0*nScans/frequency));
+    if (ret != nScans*nchan*2) {
+      // timed out waiting for a trigger: the output holds only the whole scans received
+      fprintf(stderr, "read-usb1608G: trigger timeout, %d of %d scans received.\n", ret/(nchan*2), nScans);
+      nScans = ret/(nchan*2);
+      header.nScan = nScans;
+      if (map) memcpy(map, &header, sizeof(ScanHeader));
+      ret = -1;
+    }
+  } else {
+    // restarts after an overrun are recorded in the header; the output holds only the scans delivered
+    ret = usbAInScanReadResult_USB1608G_r(&usbdev, nScans, nchan, frequency, scanOptions, MAX_RESTARTS, sdataIn, &result);
+    if (result.nOverruns > 0) {
+      fprintf(stderr, "read-usb1608G: %d overrun(s), %u scans lost, %u of %d scans delivered.\n",
+	      result.nOverruns, result.scansDropped, result.scansDelivered, nScans);
+    }
+    header.nScan = result.scansDelivered;
+    header.nGaps = result.nGaps;
+    for (k = 0; k < result.nGaps; k++) {
+      header.gap[k] = result.gap[k].scan;
+    }
+    if (map) memcpy(map, &header, sizeof(ScanHeader));
+    nScans = result.scansDelivered;
+    ret = nScans*nchan*2;
+    if (result.scansDelivered != result.scansRequested || result.error) ret = -1;
+  }
 
-  ret = usbAInScanRead_USB1608G(udev, nScans, nchan, sdataIn);
+  if (options.filename) {
+    // Binary output: calibrate in place and leave the conversion to volts to the reader
+    for (i = 0; i < nScans; i++) {
+      for (j = 0; j < nchan; j++) {
+	gain = list[j].range;
+	k = i*nchan + j;
+	code = rint(sdataIn[k]*usbdev.table_AIn[gain][0] + usbdev.table_AIn[gain][1]);
+	sdataIn[k] = (code > 0xffff) ? 0xffff : ((code < 0.0) ? 0x0 : code);  // a clipped input stays at its rail
+      }
+    }
+    if (map) {
+      munmap(map, mapSize);
+      if (ftruncate(fd, sizeof(ScanHeader) + (size_t) nScans*nchan*sizeof(uint16_t)) < 0) {
+	perror("read-usb1608G: cannot trim output file");
+      }
+      close(fd);
+    } else {
+      fwrite(&header, sizeof(ScanHeader), 1, stdout);
+      fwrite(sdataIn, sizeof(uint16_t), (size_t) nScans*nchan, stdout);
+      free(sdataIn);
+    }
+    usbClose_USB1608G_r(&usbdev);
+    return (ret == nScans*nchan*2) ? 0 : 1;
+  }
 
+  // text output: one buffer per channel, printed as one column per channel
+  voltsIn = malloc((size_t) nScans*nchan*sizeof(float));
+  for (j = 0; j < nchan; j++) {
+    voltsChannel[j] = voltsIn + (size_t) j*nScans;
+  }
+  usbAInScanCoefficients_USB1608G(usbdev.table_AIn, list, nchan, slope, offset);
+  usbAInScanVoltsChannels_USB1608G(sdataIn, nScans, nchan, slope, offset, voltsChannel);
   for (i = 0; i < nScans; i++) {
     for (j = 0; j < nchan; j++) {
-      gain = list[j].range;
-      k = i*nchan + j;
-      data = rint(sdataIn[k]*table_AIN[gain][0] + table_AIN[gain][1]);
-      printf("%8.4lf", volts_USB1608G(udev, gain, data));
+      printf("%8.4lf", voltsChannel[j][i]);
     }
     printf("\n");
   }
+  free(voltsIn);
+  free(sdataIn);
   
-  cleanup_USB1608G(udev);
-  return 0;
+  usbClose_USB1608G_r(&usbdev);
+  return (ret == nScans*nchan*2) ? 0 : 1;
 }
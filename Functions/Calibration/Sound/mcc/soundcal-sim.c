@@ -0,0 +1,75 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Runs the closed-loop amplitude search (soundcal.c) against the simulated
+  speaker and microphone, so the search can be tuned without hardware.
+
+  soundcal-sim [-t targetSPL] [-g gain] [-n noise] [-S saturation] [freq ...]
+
+  With no frequencies, sweeps the default calibration frequencies.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "soundcal.h"
+
+int main(int argc, char **argv)
+{
+  const double defaultFrequencies[] = {1000, 2000, 4000, 8000, 16000, 32000, 50000};
+  SoundCalConfig config;
+  SoundCalResult result;
+  SoundCalSim sim;
+  double targetSPL = 60;
+  double frequency;
+  int nFrequencies, nPlays = 0, nFailed = 0;
+  int ch, i;
+
+  soundCalSimInit(&sim);
+  while ((ch = getopt(argc, argv, "t:g:n:S:")) != -1) {
+    switch (ch) {
+      case 't': targetSPL = atof(optarg); break;
+      case 'g': sim.gain = atof(optarg); break;
+      case 'n': sim.noise = atof(optarg); break;
+      case 'S': sim.saturation = atof(optarg); break;
+      default:
+	fprintf(stderr, "usage: soundcal-sim [-t targetSPL] [-g gain] [-n noise] [-S saturation] [freq ...]\n");
+	return 1;
+    }
+  }
+  nFrequencies = (optind < argc) ? argc - optind : sizeof(defaultFrequencies)/sizeof(double);
+
+  for (i = 0; i < nFrequencies; i++) {
+    frequency = (optind < argc) ? atof(argv[optind + i]) : defaultFrequencies[i];
+    soundCalDefaults(&config, frequency, targetSPL);
+    config.telemetry = stdout;
+    if (soundCalFindAmplitude(&config, frequency, soundCalSimPlay, soundCalSimCapture, &sim, &result) != 0) {
+      nFailed++;
+    }
+    printf("%.1f Hz: amplitude %.6f after %d plays%s\n", frequency, result.amplitude,
+	   result.nIterations, result.converged ? "" : " (not converged)");
+    nPlays += result.nIterations;
+  }
+  printf("%d frequencies, %d plays, %d not converged\n", nFrequencies, nPlays, nFailed);
+  return nFailed ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "soundcal.h"
+#include "welch.h"
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void soundCalDefaults(SoundCalConfig *config, double frequency, double targetSPL)
+{
+  config->targetSPL = targetSPL;
+  config->tolerance = 0.5;
+  config->initialAmplitude = 0.2;
+  config->maxAmplitude = 1.0;
+  config->maxIterations = 8;
+  config->fs = 200000;
+  config->nSamples = 80000;    // 0.4 s
+  config->segmentLength = WELCH_SEGMENT_LENGTH;
+  config->bandLow = frequency*0.9;
+  config->bandHigh = frequency*1.1;
+  config->telemetry = NULL;
+}
+
+int soundCalFindAmplitude(const SoundCalConfig *config, double frequency, SoundCalPlayFn play,
+			  SoundCalCaptureFn capture, void *userData, SoundCalResult *result)
+{
+  /*
+    The level in dB SPL is modeled as locally linear in 20*log10(amplitude).
+    The first update assumes slope 1 (an ideal linear speaker, exactly the
+    rescaling find_amplitude.m does); from then on the slope is the secant
+    through the last two measurements, limited to [0.25, 2] so noise or a
+    saturating speaker cannot throw the prediction far off.
+  */
+  SoundCalIteration *it;
+  float *volts;
+  double *psd;
+  double t0, logA, slope = 1.0;
+  int maxIterations = config->maxIterations;
+  int i;
+
+  memset(result, 0, sizeof(*result));
+  if (maxIterations > SOUNDCAL_MAX_ITERATIONS) maxIterations = SOUNDCAL_MAX_ITERATIONS;
+  volts = malloc(config->nSamples*sizeof(float));
+  psd = malloc(welchNumBins(config->segmentLength)*sizeof(double));
+  if (volts == NULL || psd == NULL) {
+    free(volts); free(psd);
+    return -1;
+  }
+
+  result->amplitude = config->initialAmplitude;
+  for (i = 0; i < maxIterations; i++) {
+    it = &result->iteration[i];
+    it->amplitude = result->amplitude;
+
+    t0 = now();
+    if (play(frequency, it->amplitude, userData) < 0 ||
+	capture(volts, config->nSamples, config->fs, userData) < 0) {
+      free(volts); free(psd);
+      return -1;
+    }
+    it->captureTime = now() - t0;
+
+    t0 = now();
+    if (welchPSD(volts, config->nSamples, 1, config->fs, config->segmentLength, 0, psd) < 0) {
+      free(volts); free(psd);
+      return -1;
+    }
+    it->bandPower = welchBandPower(psd, config->segmentLength, config->fs, config->bandLow, config->bandHigh);
+    it->analysisTime = now() - t0;
+    it->SPL = 10*log10(it->bandPower/(SOUNDCAL_SPL_REF*SOUNDCAL_SPL_REF));
+    it->error = it->SPL - config->targetSPL;
+    result->nIterations = i + 1;
+
+    if (i > 0 && fabs(it->amplitude - it[-1].amplitude) > 1e-12) {
+      slope = (it->SPL - it[-1].SPL)/(20*log10(it->amplitude/it[-1].amplitude));
+      if (!(slope >= 0.25)) slope = 0.25;  // also catches NaN
+      if (slope > 2.0) slope = 2.0;
+    }
+    it->slope = slope;
+
+    if (config->telemetry) {
+      fprintf(config->telemetry, "%.1f Hz iter %d: amplitude %.6f  SPL %.2f dB  error %+.2f dB  slope %.3f  capture %.1f ms  psd %.1f ms\n",
+	      frequency, i + 1, it->amplitude, it->SPL, it->error, it->slope,
+	      it->captureTime*1e3, it->analysisTime*1e3);
+      fflush(config->telemetry);
+    }
+
+    if (fabs(it->error) < config->tolerance) {
+      result->converged = 1;
+      break;
+    }
+    if (it->error < 0 && it->amplitude >= config->maxAmplitude) {
+      break;  // target is out of reach; replaying at full scale will not help
+    }
+    if (i < maxIterations - 1) {
+      logA = log10(it->amplitude) - it->error/(20*slope);
+      result->amplitude = pow(10, logA);
+      if (result->amplitude > config->maxAmplitude) result->amplitude = config->maxAmplitude;
+    }
+  }
+
+  free(volts);
+  free(psd);
+  return result->converged ? 0 : 1;
+}
+
+int soundCalCapture_USB1608G(float *volts, int nSamples, double fs, void *userData)
+{
+  usbDevice1608G *usbdev = (usbDevice1608G *) userData;
+  ScanList list[NCHAN_1608G];
+  uint16_t *data;
+  float slope[NCHAN_1608G], offset[NCHAN_1608G];
+  int ret;
+
+  data = malloc(nSamples*sizeof(uint16_t));
+  if (data == NULL) return -1;
+  memset(list, 0, sizeof(list));
+  list[0].range = BP_10V;
+  list[0].mode = DIFFERENTIAL | LAST_CHANNEL;
+  list[0].channel = 0;
+
+  usbAInScanStop_USB1608G(usbdev->udev);
+  usbAInScanClearFIFO_USB1608G(usbdev->udev);
+  usbAInConfig_USB1608G_r(usbdev, list);
+  usbAInScanStart_USB1608G_r(usbdev, nSamples, 0, fs, 0x0);
+  ret = usbAInScanRead_USB1608G_r(usbdev, nSamples, 1, data);
+  if (ret != nSamples*2) {
+    free(data);
+    return -1;
+  }
+  usbAInScanCoefficients_USB1608G(usbdev->table_AIn, list, 1, slope, offset);
+  usbAInScanVolts_USB1608G(data, nSamples, 1, slope, offset, volts);
+  free(data);
+  return 0;
+}
+
+void soundCalSimInit(SoundCalSim *sim)
+{
+  memset(sim, 0, sizeof(*sim));
+  sim->gain = 0.5;          // ~1 Pa (94 dB SPL) at full scale with a 1 V/Pa microphone path
+  sim->lowCorner = 300;
+  sim->highCorner = 30000;
+  sim->saturation = 1.0;
+  sim->noise = 1e-3;
+  sim->seed = 1;
+}
+
+int soundCalSimPlay(double frequency, double amplitude, void *userData)
+{
+  SoundCalSim *sim = (SoundCalSim *) userData;
+
+  sim->frequency = frequency;
+  sim->amplitude = amplitude;
+  sim->nPlays++;
+  return 0;
+}
+
+int soundCalSimCapture(float *volts, int nSamples, double fs, void *userData)
+{
+  SoundCalSim *sim = (SoundCalSim *) userData;
+  double f = sim->frequency;
+  double hp, lp, peak, phase, u1, u2;
+  int i;
+
+  // second order high-pass and low-pass magnitudes
+  hp = (f/sim->lowCorner)*(f/sim->lowCorner);
+  hp = hp/sqrt(1 + hp*hp);
+  lp = 1/sqrt(1 + pow(f/sim->highCorner, 4));
+  peak = sim->gain*sim->amplitude*hp*lp;
+  phase = 2*M_PI*(rand_r(&sim->seed)/(RAND_MAX + 1.0));
+
+  for (i = 0; i < nSamples; i++) {
+    u1 = (rand_r(&sim->seed) + 1.0)/(RAND_MAX + 2.0);
+    u2 = rand_r(&sim->seed)/(RAND_MAX + 1.0);
+    volts[i] = sim->saturation*tanh(peak*sin(2*M_PI*f*i/fs + phase)/sim->saturation) +
+      sim->noise*sqrt(-2*log(u1))*cos(2*M_PI*u2);
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Closed-loop amplitude search for speaker calibration, the native
+  counterpart of find_amplitude.m: play a tone, capture it, measure the
+  band power (welch.c) and update the amplitude until the level is within
+  tolerance of the target.
+
+  Playback and capture are callbacks so the same loop runs against the
+  USB-1608G (soundCalCapture_USB1608G) or against the simulated speaker
+  and microphone below (soundCalSimPlay / soundCalSimCapture).
+*/
+
+#ifndef SOUNDCAL_H
+#define SOUNDCAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "pmd.h"
+#include "usb-1608G.h"
+
+#define SOUNDCAL_SPL_REF        20e-6   // Pa
+#define SOUNDCAL_MAX_ITERATIONS 16
+
+/* Start (or restart) a tone of the given frequency (Hz) and amplitude (0..1). Returns < 0 on error. */
+typedef int (*SoundCalPlayFn)(double frequency, double amplitude, void *userData);
+/* Record nSamples of the microphone signal (volts) at fs Hz. Returns < 0 on error. */
+typedef int (*SoundCalCaptureFn)(float *volts, int nSamples, double fs, void *userData);
+
+typedef struct SoundCalConfig_t {
+  double targetSPL;          // dB SPL
+  double tolerance;          // acceptable difference (dB)
+  double initialAmplitude;
+  double maxAmplitude;
+  int maxIterations;
+  double fs;                 // capture rate (Hz)
+  int nSamples;              // samples per capture
+  int segmentLength;         // Welch segment length (power of 2)
+  double bandLow;            // band power limits (Hz)
+  double bandHigh;
+  FILE *telemetry;           // if not NULL, one line per iteration is written here
+} SoundCalConfig;
+
+typedef struct SoundCalIteration_t {
+  double amplitude;          // amplitude played
+  double bandPower;          // measured band power (V^2)
+  double SPL;                // measured level (dB SPL)
+  double error;              // SPL - target (dB)
+  double slope;              // dB of level per dB of amplitude used for the next prediction
+  double captureTime;        // play + capture (s)
+  double analysisTime;       // PSD + band power (s)
+} SoundCalIteration;
+
+typedef struct SoundCalResult_t {
+  double amplitude;          // final amplitude
+  int converged;
+  int nIterations;
+  SoundCalIteration iteration[SOUNDCAL_MAX_ITERATIONS];
+} SoundCalResult;
+
+/* Defaults matching find_amplitude.m / response_one_sound.m. */
+void soundCalDefaults(SoundCalConfig *config, double frequency, double targetSPL);
+/* Run the search for one frequency. Returns 0 when converged, 1 if not converged, -1 on error. */
+int soundCalFindAmplitude(const SoundCalConfig *config, double frequency, SoundCalPlayFn play,
+			  SoundCalCaptureFn capture, void *userData, SoundCalResult *result);
+
+/* Capture from differential channel 0 of an open 1608G; userData is the usbDevice1608G. */
+int soundCalCapture_USB1608G(float *volts, int nSamples, double fs, void *userData);
+
+/* Simulated speaker + microphone: a band-pass speaker with soft clipping, and a noisy microphone. */
+typedef struct SoundCalSim_t {
+  double gain;               // mic volts per unit amplitude at the speaker's peak response
+  double lowCorner;          // speaker high-pass corner (Hz)
+  double highCorner;         // speaker low-pass corner (Hz)
+  double saturation;         // speaker output limit (mic volts)
+  double noise;              // rms microphone noise (V)
+  double frequency;          // current tone (set by soundCalSimPlay)
+  double amplitude;
+  unsigned int seed;
+  int nPlays;
+} SoundCalSim;
+
+void soundCalSimInit(SoundCalSim *sim);
+int soundCalSimPlay(double frequency, double amplitude, void *userData);
+int soundCalSimCapture(float *volts, int nSamples, double fs, void *userData);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif //SOUNDCAL_H
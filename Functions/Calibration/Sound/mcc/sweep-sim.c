@@ -0,0 +1,187 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Checks sweep.c against a known response with no hardware attached: the
+  sweep and multitone stimuli are passed through a synthetic speaker
+  (2nd order high-pass + peaking resonance + 2nd order low-pass biquads,
+  plus latency and microphone noise) and the recovered gains are
+  compared with the filter's exact magnitude response.
+
+  sweep-sim [-d duration] [-n nFreq] [-N noise]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+
+#include "sweep.h"
+
+#define FS        200000.0
+#define F1        1000.0
+#define F2        80000.0
+#define LATENCY   0.010     // s
+
+typedef struct Biquad_t {
+  double b[3], a[3];
+  double z1, z2;
+} Biquad;
+
+/* RBJ audio EQ cookbook filters */
+static void biquadLowHigh(Biquad *q, double f0, double Q, int highPass)
+{
+  double w = 2*M_PI*f0/FS, alpha = sin(w)/(2*Q), c = cos(w);
+
+  q->b[0] = highPass ? (1 + c)/2 : (1 - c)/2;
+  q->b[1] = highPass ? -(1 + c) : 1 - c;
+  q->b[2] = q->b[0];
+  q->a[0] = 1 + alpha; q->a[1] = -2*c; q->a[2] = 1 - alpha;
+  q->z1 = q->z2 = 0;
+}
+
+static void biquadPeak(Biquad *q, double f0, double Q, double dB)
+{
+  double A = pow(10, dB/40), w = 2*M_PI*f0/FS, alpha = sin(w)/(2*Q), c = cos(w);
+
+  q->b[0] = 1 + alpha*A; q->b[1] = -2*c; q->b[2] = 1 - alpha*A;
+  q->a[0] = 1 + alpha/A; q->a[1] = -2*c; q->a[2] = 1 - alpha/A;
+  q->z1 = q->z2 = 0;
+}
+
+static double biquadRun(Biquad *q, double x)
+{
+  // transposed direct form II
+  double y = (q->b[0]*x)/q->a[0] + q->z1;
+
+  q->z1 = (q->b[1]*x - q->a[1]*y)/q->a[0] + q->z2;
+  q->z2 = (q->b[2]*x - q->a[2]*y)/q->a[0];
+  return y;
+}
+
+static double biquadMagnitude(const Biquad *q, double f)
+{
+  double complex z = cexp(-I*2*M_PI*f/FS);
+
+  return cabs((q->b[0] + q->b[1]*z + q->b[2]*z*z)/(q->a[0] + q->a[1]*z + q->a[2]*z*z));
+}
+
+static void speaker(Biquad *q, int nq, const float *x, long nx, float *y, long ny, double gain, double noise, unsigned int *seed)
+{
+  long delay = (long) (LATENCY*FS);
+  long i;
+  double v, u1, u2;
+  int k;
+
+  for (i = 0; i < ny; i++) {
+    v = (i >= delay && i - delay < nx) ? x[i - delay] : 0.0;
+    for (k = 0; k < nq; k++) v = biquadRun(&q[k], v);
+    u1 = (rand_r(seed) + 1.0)/(RAND_MAX + 2.0);
+    u2 = rand_r(seed)/(RAND_MAX + 1.0);
+    y[i] = gain*v + noise*sqrt(-2*log(u1))*cos(2*M_PI*u2);
+  }
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double report(const char *name, const Biquad *q, int nq, double speakerGain, const double *freq,
+		     const double *gain, int nFreq, double seconds)
+{
+  double expected, errorDB, maxError = 0;
+  int i, k;
+
+  printf("%s (analysis %.1f ms)\n", name, seconds*1e3);
+  for (i = 0; i < nFreq; i++) {
+    expected = speakerGain;
+    for (k = 0; k < nq; k++) expected *= biquadMagnitude(&q[k], freq[i]);
+    errorDB = 20*log10(gain[i]/expected);
+    if (fabs(errorDB) > maxError) maxError = fabs(errorDB);
+    printf("  %8.1f Hz  expected %7.2f dB  measured %7.2f dB  error %+.2f dB  amplitude for 60 dB SPL %.5f\n",
+	   freq[i], 20*log10(expected), 20*log10(gain[i]), errorDB, sweepAmplitudeForSPL(gain[i], 60));
+  }
+  printf("  max error %.2f dB\n", maxError);
+  return maxError;
+}
+
+int main(int argc, char **argv)
+{
+  Biquad q[3];
+  double duration = 1.0, noise = 1e-3, speakerGain = 0.5, a = 0.5;
+  double *freq, *gain, t0, sweepError, toneError;
+  float *x, *y;
+  long nx, ny;
+  int nFreq = 20;
+  unsigned int seed = 1;
+  int ch, i;
+
+  while ((ch = getopt(argc, argv, "d:n:N:")) != -1) {
+    switch (ch) {
+      case 'd': duration = atof(optarg); break;
+      case 'n': nFreq = atoi(optarg); break;
+      case 'N': noise = atof(optarg); break;
+      default:
+	fprintf(stderr, "usage: sweep-sim [-d duration] [-n nFreq] [-N noise]\n");
+	return 1;
+    }
+  }
+  if (nFreq < 2) nFreq = 2;
+
+  // calibration frequencies, log spaced inside the sweep with a margin for the analysis band
+  freq = malloc(nFreq*sizeof(double));
+  gain = malloc(nFreq*sizeof(double));
+  for (i = 0; i < nFreq; i++) freq[i] = 2000*pow(60000/2000.0, i/(nFreq - 1.0));
+
+  nx = (long) (duration*FS);
+  ny = nx + (long) (2*LATENCY*FS);
+  x = malloc(nx*sizeof(float));
+  y = malloc(ny*sizeof(float));
+
+  biquadLowHigh(&q[0], 1500, M_SQRT1_2, 1);
+  biquadPeak(&q[1], 8000, 2.0, 6.0);
+  biquadLowHigh(&q[2], 40000, M_SQRT1_2, 0);
+
+  sweepGenerate(x, nx, FS, F1, F2, a);
+  speaker(q, 3, x, nx, y, ny, speakerGain, noise, &seed);
+  t0 = now();
+  sweepGain(y, ny, FS, F1, F2, duration, a, freq, nFreq, gain);
+  sweepError = report("exponential sweep", q, 3, speakerGain, freq, gain, nFreq, now() - t0);
+
+  biquadLowHigh(&q[0], 1500, M_SQRT1_2, 1);
+  biquadPeak(&q[1], 8000, 2.0, 6.0);
+  biquadLowHigh(&q[2], 40000, M_SQRT1_2, 0);
+  multitoneGenerate(x, nx, FS, freq, nFreq, a/sqrt(nFreq));
+  speaker(q, 3, x, nx, y, ny, speakerGain, noise, &seed);
+  t0 = now();
+  multitoneGain(y, ny, FS, freq, nFreq, a/sqrt(nFreq), gain);
+  toneError = report("multitone", q, 3, speakerGain, freq, gain, nFreq, now() - t0);
+
+  free(freq); free(gain); free(x); free(y);
+  return (sweepError < 0.5 && toneError < 0.5) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "sweep.h"
+#include "welch.h"
+
+#define SPL_REF 20e-6   // Pa
+
+static double fade(long i, long n, double fs)
+{
+  long nFade = (long) (SWEEP_FADE_TIME*fs);
+
+  if (nFade < 1) return 1.0;
+  if (i < nFade) return 0.5 - 0.5*cos(M_PI*i/nFade);
+  if (i >= n - nFade) return 0.5 - 0.5*cos(M_PI*(n - 1 - i)/nFade);
+  return 1.0;
+}
+
+void sweepGenerate(float *out, long n, double fs, double f1, double f2, double a)
+{
+  double T = n/fs;
+  double k = log(f2/f1);
+  double t;
+  long i;
+
+  for (i = 0; i < n; i++) {  // phase = 2*pi*f1*T/k*(exp(t*k/T) - 1)
+    t = i/fs;
+    out[i] = a*fade(i, n, fs)*sin(2*M_PI*f1*T/k*(exp(t*k/T) - 1));
+  }
+}
+
+int sweepGain(const float *y, long n, double fs, double f1, double f2, double duration, double a,
+	      const double *freq, int nFreq, double *gain)
+{
+  /*
+    An exponential sweep spends duration*ln(fb/fa)/ln(f2/f1) seconds in
+    the band [fa fb], so it puts a^2/2 times that much energy there.  The
+    recorded energy in the same band comes from the FFT (Parseval); the
+    gain is the square root of the ratio.
+  */
+  double *re, *im;
+  double halfBand = pow(2.0, SWEEP_BAND_OCTAVES/2);
+  double df, fa, fb, energy, stimulus;
+  long N, i, k, kLow, kHigh;
+
+  for (N = 2; N < n; N <<= 1);
+  re = calloc(N, sizeof(double));
+  im = calloc(N, sizeof(double));
+  if (re == NULL || im == NULL || f2 <= f1 || duration <= 0 || a <= 0) {
+    free(re); free(im);
+    return -1;
+  }
+  for (i = 0; i < n; i++) re[i] = y[i];
+  welchFFT(re, im, N);
+  df = fs/N;
+
+  for (i = 0; i < nFreq; i++) {
+    fa = freq[i]/halfBand;
+    fb = freq[i]*halfBand;
+    kLow = (long) ceil(fa/df);
+    kHigh = (long) floor(fb/df);
+    if (kHigh > N/2 - 1) kHigh = N/2 - 1;
+    energy = 0.0;
+    for (k = kLow; k <= kHigh; k++) energy += re[k]*re[k] + im[k]*im[k];
+    energy *= 2.0/((double) N*fs);   // one-sided, in V^2*s
+    stimulus = a*a/2*duration*log(fb/fa)/log(f2/f1);
+    gain[i] = sqrt(energy/stimulus);
+  }
+  free(re);
+  free(im);
+  return 0;
+}
+
+void multitoneGenerate(float *out, long n, double fs, const double *freq, int nFreq, double a)
+{
+  double *phase = malloc(nFreq*sizeof(double));
+  double sum;
+  long i;
+  int k;
+
+  if (phase == NULL) return;
+  for (k = 0; k < nFreq; k++) phase[k] = -M_PI*k*(k + 1)/nFreq;  // Schroeder phases
+  for (i = 0; i < n; i++) {
+    sum = 0.0;
+    for (k = 0; k < nFreq; k++) sum += sin(2*M_PI*freq[k]*i/fs + phase[k]);
+    out[i] = a*fade(i, n, fs)*sum;
+  }
+  free(phase);
+}
+
+int multitoneGain(const float *y, long n, double fs, const double *freq, int nFreq, double a, double *gain)
+{
+  /* Each tone's power comes from the Welch PSD, in a band reaching at most halfway to its neighbours. */
+  int segmentLength = WELCH_SEGMENT_LENGTH;
+  double *psd;
+  double lo, hi, power;
+  int k;
+
+  while (segmentLength > n && segmentLength > 256) segmentLength >>= 1;
+  psd = malloc(welchNumBins(segmentLength)*sizeof(double));
+  if (psd == NULL || a <= 0) {
+    free(psd);
+    return -1;
+  }
+  if (welchPSD(y, n, 1, fs, segmentLength, 0, psd) < 0) {
+    free(psd);
+    return -1;
+  }
+  for (k = 0; k < nFreq; k++) {
+    lo = freq[k]*0.95;
+    hi = freq[k]*1.05;
+    if (k > 0 && lo < (freq[k-1] + freq[k])/2) lo = (freq[k-1] + freq[k])/2;
+    if (k < nFreq - 1 && hi > (freq[k] + freq[k+1])/2) hi = (freq[k] + freq[k+1])/2;
+    power = welchBandPower(psd, segmentLength, fs, lo, hi);
+    gain[k] = sqrt(2*power)/a;
+  }
+  free(psd);
+  return 0;
+}
+
+double sweepAmplitudeForSPL(double gain, double targetSPL)
+{
+  // a tone of amplitude a*gain has band power (a*gain)^2/2
+  return sqrt(2*SPL_REF*SPL_REF*pow(10, targetSPL/10))/gain;
+}
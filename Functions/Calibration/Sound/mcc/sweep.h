@@ -0,0 +1,65 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Single-shot speaker characterization: play one exponential sine sweep
+  or Schroeder-phase multitone, record it in one continuous 1608G scan,
+  and recover the gain (mic volts per unit playback amplitude) at every
+  calibration frequency from one FFT of the recording.
+
+  Sweep gains come from band energies, so the playback and capture rates
+  and the playback latency do not need to match; the whole sweep must be
+  inside the recording.  With a linear speaker, the amplitude for a
+  target level at frequency f is sweepAmplitudeForSPL(gain[f], targetSPL).
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWEEP_FADE_TIME     0.005   // raised cosine fade in/out (s)
+#define SWEEP_BAND_OCTAVES  (1.0/6) // analysis band width around each frequency
+
+/* Exponential sweep from f1 to f2 Hz, n samples at fs, peak amplitude a. */
+void sweepGenerate(float *out, long n, double fs, double f1, double f2, double a);
+/*
+  Gain at each of freq[0..nFreq-1] from a recording y of n samples at fs of
+  the sweep (f1, f2, duration, amplitude a).  Frequencies within a half band
+  of f1/f2 or the fades read low.  Returns 0, or -1 on error.
+*/
+int sweepGain(const float *y, long n, double fs, double f1, double f2, double duration, double a,
+	      const double *freq, int nFreq, double *gain);
+
+/* Sum of nFreq tones (ascending frequencies) of amplitude a each with Schroeder phases (low crest factor). */
+void multitoneGenerate(float *out, long n, double fs, const double *freq, int nFreq, double a);
+/* Gain at each tone from a recording y (n samples at fs) of multitoneGenerate(..., a). */
+int multitoneGain(const float *y, long n, double fs, const double *freq, int nFreq, double a, double *gain);
+
+/* Playback amplitude that gives targetSPL (dB SPL, band_power.m convention) for a given gain. */
+double sweepAmplitudeForSPL(double gain, double targetSPL);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif //SWEEP_H
@@ -0,0 +1,68 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX wrapper for sweep.c:
+
+    Gain = sweep_gain(Recorded, FsIn, [F1 F2], Duration, Amplitude, Frequencies)
+
+  Recorded is one continuous scan containing the whole exponential sweep
+  (F1 to F2 Hz, Duration s, peak Amplitude) as generated by
+
+    t = (0:round(Duration*FsOut)-1)/FsOut;
+    Sweep = Amplitude*sin(2*pi*F1*Duration/log(F2/F1)*(exp(t*log(F2/F1)/Duration)-1));
+
+  with 5 ms raised cosine fades.  Gain is in mic volts per unit
+  amplitude at each of Frequencies.  Build with "make mex".
+*/
+
+#include <stdlib.h>
+#include "mex.h"
+#include "sweep.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  const double *signal, *limits;
+  double fs, duration, amplitude;
+  float *x;
+  mwSize n, nFreq;
+  mwIndex i;
+
+  if (nrhs < 6 || !mxIsDouble(prhs[0]) || !mxIsDouble(prhs[5]) || mxGetNumberOfElements(prhs[2]) != 2) {
+    mexErrMsgIdAndTxt("Bpod:sweep_gain", "Usage: sweep_gain(Recorded, FsIn, [F1 F2], Duration, Amplitude, Frequencies)");
+  }
+  signal = mxGetPr(prhs[0]);
+  n = mxGetNumberOfElements(prhs[0]);
+  fs = mxGetScalar(prhs[1]);
+  limits = mxGetPr(prhs[2]);
+  duration = mxGetScalar(prhs[3]);
+  amplitude = mxGetScalar(prhs[4]);
+  nFreq = mxGetNumberOfElements(prhs[5]);
+
+  x = mxMalloc(n*sizeof(float));
+  for (i = 0; i < n; i++) x[i] = (float) signal[i];
+  plhs[0] = mxCreateDoubleMatrix(1, nFreq, mxREAL);
+  if (sweepGain(x, n, fs, limits[0], limits[1], duration, amplitude, mxGetPr(prhs[5]), nFreq, mxGetPr(plhs[0])) < 0) {
+    mxFree(x);
+    mexErrMsgIdAndTxt("Bpod:sweep_gain", "Invalid sweep parameters.");
+  }
+  mxFree(x);
+}
@@ -0,0 +1,278 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "usb-1608G-emu.h"
+
+#define EMU_PACKET_SIZE 512
+#define FALSE 0
+#define TRUE 1
+
+/* Calibration table written to the emulated EEPROM at 0x7000 (slope, offset per gain) */
+static const float emuTableAIn[NGAINS_1608G][2] = {{1.0012, -3.1}, {0.9987, 2.4}, {1.0005, -0.8}, {0.9993, 1.7}};
+static const double emuRange[NGAINS_1608G] = {10., 5., 2., 1.};
+
+static double emuNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+Emulator1608G *emu1608GCreate(const char *serial)
+{
+  Emulator1608G *emu = calloc(1, sizeof(Emulator1608G));
+
+  if (emu == NULL) return NULL;
+  snprintf(emu->serial, sizeof(emu->serial), "%.8s", serial ? serial : "EMU00001");
+  memset(emu->eeprom, 0xff, sizeof(emu->eeprom));
+  memcpy(&emu->eeprom[CAL_AIN_ADDRESS - EMU1608G_EEPROM_BASE], emuTableAIn, sizeof(emuTableAIn));
+  emu->status = FPGA_CONFIGURED;
+  emu->seed = 1;
+  return emu;
+}
+
+void emu1608GDestroy(Emulator1608G *emu)
+{
+  free(emu);
+}
+
+void emu1608GSetSignal(Emulator1608G *emu, int channel, double amplitude, double frequency, double noise)
+{
+  if (channel < 0 || channel >= NCHAN_1608G) return;
+  emu->signal[channel].amplitude = amplitude;
+  emu->signal[channel].frequency = frequency;
+  emu->signal[channel].noise = noise;
+}
+
+libusb_device_handle *emu1608GHandle(Emulator1608G *emu)
+{
+  // The driver never looks inside the handle; the emulator transport casts it back.
+  return (libusb_device_handle *) emu;
+}
+
+static uint16_t emuSample(Emulator1608G *emu, uint8_t entry, uint64_t scan)
+{
+  /* Raw A/D code for one scan list entry, such that slope*raw + offset is the calibrated code of the signal. */
+  int mode = (entry >> 5) & 0x3;
+  int gain = (entry >> 3) & 0x3;
+  int channel = (entry & 0x7) + ((mode == 0x2) ? 8 : 0);
+  Emu1608GSignal *s = &emu->signal[channel];
+  double t = emu->frequency > 0 ? scan/emu->frequency : 0;
+  double v, code, u1, u2;
+
+  v = s->dc + s->amplitude*sin(2*M_PI*s->frequency*t);
+  if (s->noise > 0) {
+    u1 = (rand_r(&emu->seed) + 1.0)/(RAND_MAX + 2.0);
+    u2 = rand_r(&emu->seed)/(RAND_MAX + 1.0);
+    v += s->noise*sqrt(-2*log(u1))*cos(2*M_PI*u2);
+  }
+  if (mode == CALIBRATION) v = 0;
+  code = (v/emuRange[gain]*32768. + 32768. - emuTableAIn[gain][1])/emuTableAIn[gain][0];
+  if (code < 0) return 0;
+  if (code > 65535) return 65535;
+  return (uint16_t) rint(code);
+}
+
+static void emuScanStart(Emulator1608G *emu, const uint8_t *data)
+{
+  uint32_t count, pacerPeriod;
+  int i;
+
+  memcpy(&count, &data[0], 4);
+  memcpy(&pacerPeriod, &data[8], 4);
+  for (i = 0; i < 15; i++) {
+    if (emu->scanList[i] & LAST_CHANNEL) break;
+  }
+  emu->nChan = (i < 15) ? i + 1 : 1;
+  emu->frequency = 64.E6/((double) pacerPeriod + 1);
+  emu->samplesTotal = (uint64_t) count*emu->nChan;
+  emu->samplesSent = 0;
+  emu->zeroLengthPending = FALSE;
+  emu->startTime = emuNow();
+  emu->status = FPGA_CONFIGURED | AIN_SCAN_RUNNING;  // a trigger, if requested, is taken as already there
+}
+
+static int emuControlTransfer(libusb_device_handle *udev, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+			      uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout)
+{
+  Emulator1608G *emu = (Emulator1608G *) udev;
+  int in = (request_type & 0x80) != 0;
+  int offset, n;
+  uint16_t value;
+
+  emu->nControl++;
+  switch (bRequest) {
+    case STATUS:
+      if (!in || wLength < 2) return LIBUSB_ERROR_PIPE;
+      if ((emu->status & FPGA_CONFIG_MODE) && emu->fpgaSize == 0 && emu->fpgaReceived > 0) {
+	emu->status = FPGA_CONFIGURED;  // any length bitstream: done once the host asks
+      }
+      memcpy(data, &emu->status, 2);
+      return 2;
+    case SERIAL:
+      if (!in) return LIBUSB_ERROR_PIPE;
+      n = wLength < 8 ? wLength : 8;
+      memcpy(data, emu->serial, n);
+      return n;
+    case MEM_ADDRESS:
+      if (wLength < 2) return LIBUSB_ERROR_PIPE;
+      if (in) memcpy(data, &emu->memAddress, 2);
+      else memcpy(&emu->memAddress, data, 2);
+      return 2;
+    case MEMORY:
+      for (n = 0; n < wLength; n++, emu->memAddress++) {
+	offset = emu->memAddress - EMU1608G_EEPROM_BASE;
+	if (offset < 0 || offset >= EMU1608G_EEPROM_SIZE) {
+	  if (in) data[n] = 0xff;
+	} else if (in) {
+	  data[n] = emu->eeprom[offset];
+	} else {
+	  emu->eeprom[offset] = data[n];
+	}
+      }
+      return wLength;
+    case AIN:
+      if (!in || wLength < 2 || wValue >= NCHAN_1608G || (emu->status & AIN_SCAN_RUNNING)) return LIBUSB_ERROR_PIPE;
+      value = emuSample(emu, (wValue < 8) ? (0x1 << 5) | wValue : (0x2 << 5) | (wValue & 0x7), 0);
+      memcpy(data, &value, 2);
+      return 2;
+    case AIN_CONFIG:
+      if (wLength < 15) return LIBUSB_ERROR_PIPE;
+      if (in) {
+	memcpy(data, emu->scanList, 15);
+      } else {
+	if (emu->status & AIN_SCAN_RUNNING) return LIBUSB_ERROR_PIPE;
+	memcpy(emu->scanList, data, 15);
+      }
+      return 15;
+    case AIN_SCAN_START:
+      if (in || wLength < 14 || (emu->status & AIN_SCAN_RUNNING)) return LIBUSB_ERROR_PIPE;
+      emuScanStart(emu, data);
+      return wLength;
+    case AIN_SCAN_STOP:
+      emu->status &= ~AIN_SCAN_RUNNING;
+      return 0;
+    case AIN_CLR_FIFO:
+      emu->status &= ~(AIN_SCAN_OVERRUN | AIN_SCAN_DONE);
+      emu->zeroLengthPending = FALSE;
+      return 0;
+    case TRIGGER_CONFIG:
+      if (wLength < 1) return LIBUSB_ERROR_PIPE;
+      if (in) data[0] = emu->triggerConfig;
+      else emu->triggerConfig = data[0];
+      return 1;
+    case FPGA_CONFIG:
+      if (in || wLength < 1 || data[0] != 0xad) return LIBUSB_ERROR_PIPE;
+      emu->status = FPGA_CONFIG_MODE;
+      emu->fpgaReceived = 0;
+      return 1;
+    case FPGA_DATA:
+      if (in || wLength > FPGA_DATA_SIZE || !(emu->status & FPGA_CONFIG_MODE)) return LIBUSB_ERROR_PIPE;
+      emu->fpgaReceived += wLength;
+      if (emu->fpgaSize && emu->fpgaReceived >= emu->fpgaSize) emu->status = FPGA_CONFIGURED;
+      return wLength;
+    case BLINK_LED:
+    case RESET:
+      return wLength;
+    default:
+      return LIBUSB_ERROR_PIPE;  // not emulated: the device would stall too
+  }
+}
+
+static int emuBulkTransfer(libusb_device_handle *udev, unsigned char endpoint, unsigned char *data, int length,
+			   int *transferred, unsigned int timeout)
+{
+  Emulator1608G *emu = (Emulator1608G *) udev;
+  uint16_t *samples = (uint16_t *) data;
+  uint64_t n, available, k;
+  double deadline;
+
+  emu->nBulk++;
+  *transferred = 0;
+  if (endpoint != (LIBUSB_ENDPOINT_IN|6)) return LIBUSB_ERROR_PIPE;
+  if (!(emu->status & AIN_SCAN_RUNNING)) {
+    if (emu->zeroLengthPending) {
+      emu->zeroLengthPending = FALSE;
+      return 0;
+    }
+    if (timeout) usleep(1000);
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+
+  n = length/2;
+  if (emu->samplesTotal && emu->samplesTotal - emu->samplesSent < n) n = emu->samplesTotal - emu->samplesSent;
+  if (emu->realTime) {
+    // overrun if more than a FIFO's worth piled up since the last read, then wait for the pacer
+    available = (uint64_t) ((emuNow() - emu->startTime)*emu->frequency)*emu->nChan - emu->samplesSent;
+    if (available > EMU1608G_FIFO_SAMPLES) {
+      emu->status = (emu->status & ~AIN_SCAN_RUNNING) | AIN_SCAN_OVERRUN;
+      return LIBUSB_ERROR_PIPE;
+    }
+    deadline = emuNow() + (timeout ? timeout*1e-3 : 1e9);
+    for (;;) {
+      available = (uint64_t) ((emuNow() - emu->startTime)*emu->frequency)*emu->nChan - emu->samplesSent;
+      if (available >= n) break;
+      if (emuNow() > deadline) {
+	n = available;
+	break;
+      }
+      usleep(500);
+    }
+  }
+
+  for (k = 0; k < n; k++) {
+    samples[k] = emuSample(emu, emu->scanList[(emu->samplesSent + k) % emu->nChan], (emu->samplesSent + k)/emu->nChan);
+  }
+  emu->samplesSent += n;
+  *transferred = n*2;
+  if (emu->samplesTotal && emu->samplesSent >= emu->samplesTotal) {
+    emu->status = (emu->status & ~AIN_SCAN_RUNNING) | AIN_SCAN_DONE;
+    // a read longer than the data takes the zero length packet as its terminating short packet
+    emu->zeroLengthPending = ((emu->samplesTotal*2) % EMU_PACKET_SIZE) == 0 && n*2 == length;
+  }
+  return (n*2 < length && emu->realTime && (emu->status & AIN_SCAN_RUNNING)) ? LIBUSB_ERROR_TIMEOUT : 0;
+}
+
+static int emuGetMaxPacketSize(libusb_device_handle *udev, int endpointNum)
+{
+  return EMU_PACKET_SIZE;
+}
+
+static void emuClose(libusb_device_handle *udev)
+{
+  /* The emulator outlives its handle; free it with emu1608GDestroy. */
+}
+
+const MCCTransport emu1608GTransport = {
+  emuControlTransfer,
+  emuBulkTransfer,
+  emuGetMaxPacketSize,
+  emuClose,
+  0
+};
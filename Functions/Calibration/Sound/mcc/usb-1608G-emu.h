@@ -0,0 +1,99 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Software USB-1608G for running the driver with no hardware attached.
+
+  Installed with mccSetTransport(&emu1608GTransport), it answers the
+  control requests the driver uses (STATUS, MEMORY/MEM_ADDRESS, SERIAL,
+  AIN, AIN_CONFIG, AIN_SCAN_START/STOP, AIN_CLR_FIFO, TRIGGER_CONFIG,
+  FPGA_CONFIG/FPGA_DATA)
+  and feeds bulk endpoint 6 from a per-channel signal generator.  The
+  EEPROM holds a non-trivial calibration table, and the samples are
+  generated so that the calibrated result is the requested signal.
+
+    Emulator1608G *emu = emu1608GCreate("EMU00001");
+    emu1608GSetSignal(emu, 0, 1.0, 1000., 0.001);
+    mccSetTransport(&emu1608GTransport);
+    usbOpenHandle_USB1608G_r(&usbdev, emu1608GHandle(emu), USB1608G_PID);
+
+  By default data is produced as fast as it is read (for throughput
+  benchmarks); with realTime set, scans become available at the pacer
+  rate and a reader that falls more than the FIFO behind gets an overrun.
+  The asynchronous stream API needs libusb: with the emulator installed,
+  usbAInStreamStart_USB1608G_r and usbAOutStreamStart_USB1608GX_2AO_r return -1.
+*/
+
+#ifndef USB_1608G_EMU_H
+#define USB_1608G_EMU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "pmd.h"
+#include "usb-1608G.h"
+
+#define EMU1608G_FIFO_SAMPLES  4096    // samples buffered before an overrun in real time mode
+#define EMU1608G_EEPROM_BASE   0x7000  // emulated EEPROM window (calibration area)
+#define EMU1608G_EEPROM_SIZE   0x1000
+
+typedef struct Emu1608GSignal_t {
+  double amplitude;          // V
+  double frequency;          // Hz
+  double dc;                 // V
+  double noise;              // rms V
+} Emu1608GSignal;
+
+typedef struct Emulator1608G_t {
+  char serial[9];
+  uint8_t eeprom[EMU1608G_EEPROM_SIZE];
+  uint16_t memAddress;
+  uint16_t status;
+  uint8_t scanList[15];
+  uint8_t triggerConfig;
+  int nChan;                 // channels in the running scan
+  double frequency;          // pacer rate of the running scan
+  uint64_t samplesTotal;     // 0 = continuous
+  uint64_t samplesSent;
+  int zeroLengthPending;     // send a zero length packet after a scan of whole packets
+  int realTime;
+  double startTime;
+  unsigned int seed;
+  Emu1608GSignal signal[NCHAN_1608G];
+  uint32_t fpgaSize;         // bitstream length, 0 = any; clear status to emulate a power cycle
+  uint32_t fpgaReceived;
+  uint64_t nControl;         // transfer counters, for benchmarks
+  uint64_t nBulk;
+} Emulator1608G;
+
+extern const MCCTransport emu1608GTransport;
+
+Emulator1608G *emu1608GCreate(const char *serial);
+void emu1608GDestroy(Emulator1608G *emu);
+void emu1608GSetSignal(Emulator1608G *emu, int channel, double amplitude, double frequency, double noise);
+libusb_device_handle *emu1608GHandle(Emulator1608G *emu);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif //USB_1608G_EMU_H
@@ -25,33 +25,37 @@
 #include <math.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "pmd.h"
 #include "usb-1608G.h"
 #include "usb-1608G.rbf"
 
 #define HS_DELAY 2000
+#define FALSE 0
+#define TRUE 1
 
-static int wMaxPacketSize = 0;  // will be the same for all devices of this type so
-                                // no need to be reentrant. 
-static uint8_t scan_list[15];   // scan list
+static usbDevice1608G legacyDevice;  // state shared by the non-reentrant (udev) interface
+
+static int usbOpenContext_USB1608G_r(usbDevice1608G *usbdev, libusb_context *ctx, libusb_device_handle *udev, int productId);
+static int usbFPGALoadContext_USB1608G(libusb_context *ctx, libusb_device_handle *udev, const uint8_t *data, int length);
 
 
 void usbBuildGainTable_USB1608G(libusb_device_handle *udev, float table[NGAINS_1608G][2])
 {
   /* Builds a lookup table of calibration coefficents to translate values into voltages:
        voltage = value*table[gain#][0] + table[gain#][1]
-     only needed for fast lookup.
+     only needed for fast lookup.  The table is read in one transfer; the
+     EEPROM address increments during the read.
   */
-  int i, j;
-  uint16_t address = 0x7000;
+  uint16_t address = CAL_AIN_ADDRESS;
 
   usbMemAddressW_USB1608G(udev, address);  // Beginning of Calibration Table
-  for (i = 0; i < NGAINS_1608G; i++) {
-    for (j = 0; j < 2; j++) {
-      usbMemoryR_USB1608G(udev, (uint8_t *) &table[i][j], sizeof(float));
-    }
-  }
+  usbMemoryR_USB1608G(udev, (uint8_t *) table, NGAINS_1608G*2*sizeof(float));
   return;
 }
 
@@ -61,54 +65,195 @@ void usbBuildGainTable_USB1608GX_2AO(libusb_device_handle *udev, float table_AO[
     Builds a lookup table of calibration coefficents to translate values into voltages:
     corrected value = value*table[VDAC#][0] + table[VDAC][1]
   */
-
-  int j, k;
-  uint16_t address = 0x07080;
+  uint16_t address = CAL_AOUT_ADDRESS;
 
   usbMemAddressW_USB1608G(udev, address);
-  
-  for (j = 0; j < NCHAN_AO_1608GX; j++) {
-    for (k = 0; k < 2; k++) {
-      usbMemoryR_USB1608G(udev, (uint8_t *) &table_AO[j][k], sizeof(float));
+  usbMemoryR_USB1608G(udev, (uint8_t *) table_AO, NCHAN_AO_1608GX*2*sizeof(float));
+  return;
+}
+
+void usbBuildGainTable_USB1608G_r(usbDevice1608G *usbdev)
+{
+  usbBuildGainTable_USB1608G(usbdev->udev, usbdev->table_AIn);
+}
+
+void usbBuildGainTable_USB1608GX_2AO_r(usbDevice1608G *usbdev)
+{
+  usbBuildGainTable_USB1608GX_2AO(usbdev->udev, usbdev->table_AOut);
+}
+
+int usbReadCalTables_USB1608G_r(usbDevice1608G *usbdev, int aOut)
+{
+  /*
+    Reads the AIn table (0x7000) and, if aOut is set, the AOut table
+    (0x7080) in a single EEPROM read spanning both, and parses them in
+    memory.  The tables are little-endian floats, as is the host.
+    Returns 0, or -1 if the read failed; the tables are then unchanged.
+  */
+  uint8_t block[CAL_AOUT_ADDRESS - CAL_AIN_ADDRESS + sizeof(usbdev->table_AOut)];
+  uint16_t length = aOut ? sizeof(block) : sizeof(usbdev->table_AIn);
+
+  usbMemAddressW_USB1608G(usbdev->udev, CAL_AIN_ADDRESS);
+  if (usbMemoryR_USB1608G(usbdev->udev, block, length) < 0) return -1;
+  memcpy(usbdev->table_AIn, block, sizeof(usbdev->table_AIn));
+  if (aOut) {
+    memcpy(usbdev->table_AOut, &block[CAL_AOUT_ADDRESS - CAL_AIN_ADDRESS], sizeof(usbdev->table_AOut));
+  }
+  return 0;
+}
+
+static int calCachePath_USB1608G(const char *serial, char *path, size_t size, int create)
+{
+  /* $MCC_CAL_CACHE (empty disables the cache), else $HOME/.cache/mcc, made if create is set */
+  const char *dir = getenv("MCC_CAL_CACHE");
+  const char *home = getenv("HOME");
+  char defaultDir[256];
+
+  if (serial[0] == '\0') return -1;
+  if (dir == NULL) {
+    if (home == NULL) return -1;
+    if (create) {
+      snprintf(defaultDir, sizeof(defaultDir), "%s/.cache", home);
+      mkdir(defaultDir, 0755);
     }
+    snprintf(defaultDir, sizeof(defaultDir), "%s/.cache/mcc", home);
+    if (create) mkdir(defaultDir, 0755);
+    dir = defaultDir;
+  } else if (dir[0] == '\0') {
+    return -1;
   }
-  return;
+  snprintf(path, size, "%s/usb1608G-%s.cal", dir, serial);
+  return 0;
+}
+
+int usbLoadCalCache_USB1608G_r(usbDevice1608G *usbdev, int productId)
+{
+  /* Fills the calibration tables from the cache file for usbdev->serial. Returns 0 on a hit. */
+  CalCache cache;
+  char path[512];
+  FILE *fp;
+  int n;
+
+  if (calCachePath_USB1608G(usbdev->serial, path, sizeof(path), 0) < 0) return -1;
+  if ((fp = fopen(path, "rb")) == NULL) return -1;
+  n = fread(&cache, sizeof(cache), 1, fp);
+  fclose(fp);
+  if (n != 1 || memcmp(cache.magic, CAL_CACHE_MAGIC, 4) != 0 || cache.productId != productId ||
+      strncmp(cache.serial, usbdev->serial, sizeof(cache.serial)) != 0) {
+    return -1;
+  }
+  memcpy(usbdev->table_AIn, cache.table_AIn, sizeof(usbdev->table_AIn));
+  memcpy(usbdev->table_AOut, cache.table_AOut, sizeof(usbdev->table_AOut));
+  return 0;
+}
+
+int usbSaveCalCache_USB1608G_r(usbDevice1608G *usbdev, int productId)
+{
+  /* Writes the tables to a temporary file and renames it, so readers never see a partial file. */
+  CalCache cache;
+  char path[512], tmpPath[520];
+  FILE *fp;
+  int n;
+
+  if (calCachePath_USB1608G(usbdev->serial, path, sizeof(path), 1) < 0) return -1;
+  memset(&cache, 0, sizeof(cache));
+  memcpy(cache.magic, CAL_CACHE_MAGIC, 4);
+  cache.productId = productId;
+  strncpy(cache.serial, usbdev->serial, sizeof(cache.serial));
+  memcpy(cache.table_AIn, usbdev->table_AIn, sizeof(cache.table_AIn));
+  memcpy(cache.table_AOut, usbdev->table_AOut, sizeof(cache.table_AOut));
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int) getpid());
+  if ((fp = fopen(tmpPath, "wb")) == NULL) return -1;
+  n = fwrite(&cache, sizeof(cache), 1, fp);
+  if (fclose(fp) != 0 || n != 1 || rename(tmpPath, path) != 0) {
+    unlink(tmpPath);
+    return -1;
+  }
+  return 0;
+}
+
+int usbOpen_USB1608G_r(usbDevice1608G *usbdev, int productId, char *serialID)
+{
+  /*
+    Finds and claims a USB-1608G series device (any board if serialID
+    is NULL), configures its FPGA and reads its calibration tables into
+    usbdev, from the on-disk cache for its serial number when there is
+    one (see CalCache in usb-1608G.h).  The device is opened in a
+    libusb context of its own, released by usbClose_USB1608G_r.
+    Returns 0 on success, -1 if no matching device was found or its
+    calibration tables could not be read.
+  */
+  libusb_context *ctx = NULL;
+  libusb_device_handle *udev;
+
+  memset(usbdev, 0, sizeof(usbDevice1608G));
+  if (libusb_init(&ctx) < 0) return -1;
+  udev = usb_device_find_USB_MCC_ctx(ctx, productId, serialID);
+  if (udev == NULL) {
+    libusb_exit(ctx);
+    return -1;
+  }
+  if (usbOpenContext_USB1608G_r(usbdev, ctx, udev, productId) < 0) {
+    usbClose_USB1608G_r(usbdev);
+    return -1;
+  }
+  return 0;
+}
+
+int usbOpenHandle_USB1608G_r(usbDevice1608G *usbdev, libusb_device_handle *udev, int productId)
+{
+  /*
+    Same as usbOpen_USB1608G_r for a handle that is already open in the
+    default libusb context (or emulated, see usb-1608G-emu.h).  Returns
+    -1 if the calibration tables could not be read: they are left zero,
+    and nothing is cached.
+  */
+  return usbOpenContext_USB1608G_r(usbdev, NULL, udev, productId);
+}
+
+static int usbOpenContext_USB1608G_r(usbDevice1608G *usbdev, libusb_context *ctx, libusb_device_handle *udev, int productId)
+{
+  memset(usbdev, 0, sizeof(usbDevice1608G));
+  usbdev->udev = udev;
+  usbdev->ctx = ctx;
+  usbInit_1608G_r(usbdev);
+  usbGetSerialNumber_USB1608G(usbdev->udev, usbdev->serial);
+  if (usbLoadCalCache_USB1608G_r(usbdev, productId) < 0) {
+    if (usbReadCalTables_USB1608G_r(usbdev, productId == USB1608GX_2AO_PID) < 0) return -1;
+    usbSaveCalCache_USB1608G_r(usbdev, productId);
+  }
+  return 0;
+}
+
+void usbClose_USB1608G_r(usbDevice1608G *usbdev)
+{
+  cleanup_USB1608G(usbdev->udev);
+  usbdev->udev = NULL;
+  if (usbdev->ctx) libusb_exit(usbdev->ctx);
+  usbdev->ctx = NULL;
 }
 
 void usbInit_1608G(libusb_device_handle *udev)
 {
-  int i;
+  legacyDevice.udev = udev;
+  usbInit_1608G_r(&legacyDevice);
+}
+
+void usbInit_1608G_r(usbDevice1608G *usbdev)
+{
+  libusb_device_handle *udev = usbdev->udev;
 
   /* This function does the following:
      1. Configure the FPGA
      2. Finds the maxPacketSize for bulk transfers
   */
-  wMaxPacketSize = usb_get_max_packet_size(udev, 0);
-  if (wMaxPacketSize < 0) {
+  usbdev->wMaxPacketSize = mccTransport->get_max_packet_size(udev, 0);
+  if (usbdev->wMaxPacketSize < 0) {
     perror("usbInit_1608G: error in getting wMaxPacketSize");
   }
 
-  if (!(usbStatus_USB1608G(udev) & FPGA_CONFIGURED)) {
-    usbFPGAConfig_USB1608G(udev);
-    if (usbStatus_USB1608G(udev) & FPGA_CONFIG_MODE) {
-      for (i = 0; i <= (sizeof(FPGA_data) - 64); i += 64) {
-	usbFPGAData_USB1608G(udev, &FPGA_data[i], 64);
-      }
-      if (sizeof(FPGA_data) % 64) {
-	usbFPGAData_USB1608G(udev, &FPGA_data[i], sizeof(FPGA_data)%64);
-      }
-      if (!(usbStatus_USB1608G(udev) & FPGA_CONFIGURED)) {
-	printf("Error: FPGA for the USB-1608G is not configured.  status = %#x\n", usbStatus_USB1608G(udev));
-	return;
-      }
-    } else {
-      printf("Error: could not put USB-1608G into FPGA Config Mode.  status = %#x\n", usbStatus_USB1608G(udev));
-      return;
-    }
-  } else {
-    //printf("USB-1608G FPGA configured.\n");
-    return;
-  }
+  usbFPGAEnsureConfigured_USB1608G_r(usbdev, &usbdev->fpgaLoadTime);
 }
 
 /***********************************************
@@ -128,7 +273,7 @@ uint16_t usbDTristateR_USB1608G(libusb_device_handle *udev)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t data = 0x0;
 
-  if (libusb_control_transfer(udev, requesttype, DTRISTATE, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, DTRISTATE, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
     perror("usbDTristateR_USB1608G: error in libusb_control_transfer().");
   }
   return data;
@@ -145,7 +290,7 @@ void usbDTristateW_USB1608G(libusb_device_handle *udev, uint16_t value)
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  if (libusb_control_transfer(udev, requesttype, DTRISTATE, value, 0x0, NULL, 0x0, HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, DTRISTATE, value, 0x0, NULL, 0x0, HS_DELAY) < 0) {
     perror("usbDTristateW_USB1608G: error in libusb_control_transfer()");
   }
   return;
@@ -161,7 +306,7 @@ uint16_t usbDPort_USB1608G(libusb_device_handle *udev)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t data;
 
-  if (libusb_control_transfer(udev, requesttype, DPORT, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, DPORT, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
     perror("usbDPort_USB1608G: error in libusb_control_transfer().");
   }
   return data;
@@ -176,7 +321,7 @@ uint16_t usbDLatchR_USB1608G(libusb_device_handle *udev)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t data = 0x0;
 
-  if (libusb_control_transfer(udev, requesttype, DLATCH, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, DLATCH, 0x0, 0x0, (unsigned char *) &data, sizeof(data), HS_DELAY) < 0) {
     perror("usbDLatchR_USB1608G: error in libusb_control_transfer().");
   }
   return data;
@@ -189,7 +334,7 @@ void usbDLatchW_USB1608G(libusb_device_handle *udev, uint16_t value)
   */
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  if (libusb_control_transfer(udev, requesttype, DLATCH, value, 0x0, NULL, 0x0, HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, DLATCH, value, 0x0, NULL, 0x0, HS_DELAY) < 0) {
     perror("usbDLatchW_USB1608G: error in libusb_control_transfer().");
   }
   return;
@@ -208,13 +353,19 @@ uint16_t usbAIn_USB1608G(libusb_device_handle *udev, uint16_t channel)
   uint16_t value;
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  if (libusb_control_transfer(udev, requesttype, AIN, channel, 0x0, (unsigned char *) &value, sizeof(value), HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, AIN, channel, 0x0, (unsigned char *) &value, sizeof(value), HS_DELAY) < 0) {
     perror("usbAIn_USB1608G: error in libusb_control_transfer.");
   }
   return value;
 }
 
-void usbAInScanStart_USB1608G(libusb_device_handle *udev, uint32_t count, uint32_t retrig_count, double frequency,uint8_t options)
+void usbAInScanStart_USB1608G(libusb_device_handle *udev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options)
+{
+  legacyDevice.udev = udev;
+  usbAInScanStart_USB1608G_r(&legacyDevice, count, retrig_count, frequency, options);
+}
+
+void usbAInScanStart_USB1608G_r(usbDevice1608G *usbdev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options)
 {
   /* This command starts the analog input channel scan.  The gain
      ranges that are currently set on the desired channels will be
@@ -286,6 +437,8 @@ void usbAInScanStart_USB1608G(libusb_device_handle *udev, uint32_t count, uint32
 		        */
     uint8_t pad[2];
   } AInScan;
+  libusb_device_handle *udev = usbdev->udev;
+  int wMaxPacketSize = usbdev->wMaxPacketSize;
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   int i;
 
@@ -296,25 +449,51 @@ void usbAInScanStart_USB1608G(libusb_device_handle *udev, uint32_t count, uint32
   AInScan.options = options;
 
   for (i = 0; i < 15; i++) {
-    if (scan_list[i] & LAST_CHANNEL) break;
+    if (usbdev->scan_list[i] & LAST_CHANNEL) break;
   }
-  if (((i+1)*count) < wMaxPacketSize/2) AInScan.packet_size = (i+1)*count - 1;
+  if (count > 0 && ((i+1)*count) < wMaxPacketSize/2) AInScan.packet_size = (i+1)*count - 1;
 
   /* Pack the data into 14 bytes */
-  if (libusb_control_transfer(udev, requesttype, AIN_SCAN_START, 0x0, 0x0, (unsigned char *) &AInScan, 14, HS_DELAY) < 0) {
+  if (mccTransport->control_transfer(udev, requesttype, AIN_SCAN_START, 0x0, 0x0, (unsigned char *) &AInScan, 14, HS_DELAY) < 0) {
     perror("usbAinScanStart_USB1608G: Error");
   }
 }
 
 int usbAInScanRead_USB1608G(libusb_device_handle *udev, int nScan, int nChan, uint16_t *data)
 {
+  legacyDevice.udev = udev;
+  return usbAInScanRead_USB1608G_r(&legacyDevice, nScan, nChan, data);
+}
+
+int usbAInScanReadTimeout_USB1608G(libusb_device_handle *udev, int nScan, int nChan, uint16_t *data, unsigned int timeout)
+{
+  legacyDevice.udev = udev;
+  return usbAInScanReadTimeout_USB1608G_r(&legacyDevice, nScan, nChan, data, timeout);
+}
+
+int usbAInScanRead_USB1608G_r(usbDevice1608G *usbdev, int nScan, int nChan, uint16_t *data)
+{
+  return usbAInScanReadTimeout_USB1608G_r(usbdev, nScan, nChan, data, HS_DELAY);
+}
+
+int usbAInScanReadTimeout_USB1608G_r(usbDevice1608G *usbdev, int nScan, int nChan, uint16_t *data, unsigned int timeout)
+{
+  /*
+    Same as usbAInScanRead_USB1608G_r with the bulk transfer timeout in ms.
+    The scan is read in one transfer, so timeout is a deadline for the
+    whole read.  A triggered scan sends nothing until the trigger
+    arrives, so timeout must cover the acquisition time plus the waits
+    for every trigger (all of them in retrigger mode).
+  */
+  libusb_device_handle *udev = usbdev->udev;
+  int wMaxPacketSize = usbdev->wMaxPacketSize;
   char value[PACKET_SIZE];
   int ret = -1;
   int nbytes = nChan*nScan*2;    // nuber of bytes to read;
   int transferred;
   uint8_t status;
 
-  ret = libusb_bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, (unsigned char *) data, nbytes, &transferred, HS_DELAY);
+  ret = mccTransport->bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, (unsigned char *) data, nbytes, &transferred, timeout);
 
   if (ret < 0) {
     perror("usbAInScanRead_USB1608G: error in libusb_bulk_transfer.");
@@ -326,7 +505,7 @@ int usbAInScanRead_USB1608G(libusb_device_handle *udev, int nScan, int nChan, ui
   status = usbStatus_USB1608G(udev);
   // if nbytes is a multiple of wMaxPacketSize the device will send a zero byte packet.
   if ((nbytes%wMaxPacketSize) == 0 && !(status & AIN_SCAN_RUNNING)) {
-    libusb_bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, (unsigned char *) value, 2, &ret, 100);
+    mccTransport->bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, (unsigned char *) value, 2, &ret, 100);
   }
 
   if ((status & AIN_SCAN_OVERRUN)) {
@@ -338,7 +517,310 @@ int usbAInScanRead_USB1608G(libusb_device_handle *udev, int nScan, int nChan, ui
   return transferred;
 }
 
+static double usbMonotonicTime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void usbAInScanRestart_USB1608G(usbDevice1608G *usbdev, uint32_t count, double frequency, uint8_t options)
+{
+  usbAInScanStop_USB1608G(usbdev->udev);
+  usbAInScanClearFIFO_USB1608G(usbdev->udev);
+  usbAInScanStart_USB1608G_r(usbdev, count, 0, frequency, options);
+}
+
+int usbAInScanReadResult_USB1608G_r(usbDevice1608G *usbdev, uint32_t nScan, int nChan, double frequency, uint8_t options,
+				    int maxRestarts, uint16_t *data, AInScanResult *result)
+{
+  /*
+    Starts a scan of nScan scans and reads it into data, restarting the
+    scan (up to maxRestarts times) for the remaining scans whenever the
+    device reports an overrun.  The scan list must already be set with
+    usbAInConfig_USB1608G_r.
+
+    The data is read in AIN_SCAN_CHUNK pieces, so an overrun only loses
+    what was still in the device: everything up to the last whole scan
+    is kept, and result->gap[] records where the record restarts and
+    how many pacer periods were missed.  The last read asks for one
+    packet more than the remaining data, so a trailing zero length
+    packet ends it instead of needing a read of its own.
+
+    Returns the number of scans delivered (result->scansDelivered).
+  */
+  libusb_device_handle *udev = usbdev->udev;
+  int wMaxPacketSize = (usbdev->wMaxPacketSize > 0) ? usbdev->wMaxPacketSize : 512;
+  int scanBytes = 2*nChan;
+  uint8_t *bytes = (uint8_t *) data;
+  uint8_t *tail = malloc(AIN_SCAN_CHUNK + wMaxPacketSize);
+  uint64_t total = (uint64_t) nScan*scanBytes;
+  uint64_t received = 0;        // bytes written to data
+  uint64_t segmentStart = 0;    // received when the current scan was started
+  double start, segmentTime, now;
+  int length, transferred, ret;
+  unsigned int timeout;
+  uint16_t status;
+  AInScanGap *gap;
+  uint32_t lost;
+
+  memset(result, 0, sizeof(AInScanResult));
+  result->scansRequested = nScan;
+  if (tail == NULL) {
+    result->error = LIBUSB_ERROR_NO_MEM;
+    return 0;
+  }
+
+  usbAInScanRestart_USB1608G(usbdev, nScan, frequency, options);
+  start = segmentTime = usbMonotonicTime();
+  while (received < total) {
+    length = (total - received > AIN_SCAN_CHUNK) ? AIN_SCAN_CHUNK : total - received;
+    timeout = HS_DELAY + (unsigned int) (1000.*length/(scanBytes*frequency));
+    if (received + length < total) {   // AIN_SCAN_CHUNK is a multiple of wMaxPacketSize
+      ret = mccTransport->bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, bytes + received, length, &transferred, timeout);
+    } else {
+      ret = mccTransport->bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, tail, (length/wMaxPacketSize + 1)*wMaxPacketSize,
+					&transferred, timeout);
+      if (transferred > length) transferred = length;
+      memcpy(bytes + received, tail, transferred);
+    }
+    received += transferred;
+    if (ret == 0 && transferred == length) continue;
+
+    status = usbStatus_USB1608G(udev);
+    if (!(status & AIN_SCAN_OVERRUN)) {
+      if (ret < 0) {
+	result->error = ret;
+	break;
+      }
+      if (!(status & AIN_SCAN_RUNNING)) {
+	result->error = LIBUSB_ERROR_IO;  // the scan ended early: nothing more is coming
+	break;
+      }
+      continue;  // short packet on a live scan
+    }
+
+    /* Overrun: keep whole scans only and restart for the rest. */
+    now = usbMonotonicTime();
+    received -= received % scanBytes;
+    result->nOverruns++;
+    if (result->nOverruns > maxRestarts) {
+      usbAInScanStop_USB1608G(udev);
+      usbAInScanClearFIFO_USB1608G(udev);
+      break;
+    }
+    usbAInScanRestart_USB1608G(usbdev, (total - received)/scanBytes, frequency, options);
+    segmentTime = usbMonotonicTime() - segmentTime;   // time covered by the previous scan
+    lost = (segmentTime*frequency > (received - segmentStart)/scanBytes) ?
+      (uint32_t) (segmentTime*frequency - (received - segmentStart)/scanBytes + 0.5) : 0;
+    result->scansDropped += lost;
+    if (result->nGaps < AIN_SCAN_MAX_GAPS) {
+      gap = &result->gap[result->nGaps++];
+      gap->scan = received/scanBytes;
+      gap->scansLost = lost;
+      gap->time = now - start;
+    }
+    segmentStart = received;
+    segmentTime = usbMonotonicTime();
+  }
+
+  result->scansDelivered = received/scanBytes;
+  result->elapsed = usbMonotonicTime() - start;
+  free(tail);
+  return result->scansDelivered;
+}
+
+static void usbAInStreamSubmit_USB1608G(AInStream *stream, struct libusb_transfer *transfer)
+{
+  /* Queue one more bulk IN transfer unless the whole scan has already been requested. */
+  uint64_t remaining;
+  int length = stream->transferSize;
+
+  if (!stream->running) return;
+  if (stream->bytesTotal) {
+    remaining = stream->bytesTotal - stream->bytesSubmitted;
+    if (remaining == 0) return;
+    if (remaining < length) length = remaining;
+  }
+  transfer->length = length;
+  if (libusb_submit_transfer(transfer) < 0) {
+    stream->failed = 1;
+    stream->running = FALSE;
+    return;
+  }
+  stream->bytesSubmitted += length;
+  stream->nPending++;
+}
+
+static void usbAInStreamCallback_USB1608G(struct libusb_transfer *transfer)
+{
+  AInStream *stream = (AInStream *) transfer->user_data;
+
+  stream->nPending--;
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    if (transfer->actual_length > 0) {
+      stream->bytesReceived += transfer->actual_length;
+      stream->callback(AIN_STREAM_DATA, (uint16_t *) transfer->buffer, transfer->actual_length/2, stream->userData);
+    }
+    if (stream->bytesTotal && stream->bytesReceived >= stream->bytesTotal) {
+      stream->running = FALSE;
+      return;
+    }
+    usbAInStreamSubmit_USB1608G(stream, transfer);
+  } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    /* A stall or timeout usually means the FIFO overran.  The status
+       request is a synchronous control transfer, so it is left to
+       usbAInStreamPoll_USB1608G rather than issued from the event handler. */
+    stream->failed = transfer->status;
+    stream->running = FALSE;
+  }
+}
+
+int usbAInStreamStart_USB1608G(libusb_device_handle *udev, AInStream *stream, uint32_t count, int nChan, double frequency,
+			       uint8_t options, int transferSize, AInStreamCallback callback, void *userData)
+{
+  legacyDevice.udev = udev;
+  return usbAInStreamStart_USB1608G_r(&legacyDevice, stream, count, nChan, frequency, options, transferSize, callback, userData);
+}
+
+int usbAInStreamStart_USB1608G_r(usbDevice1608G *usbdev, AInStream *stream, uint32_t count, int nChan, double frequency,
+				 uint8_t options, int transferSize, AInStreamCallback callback, void *userData)
+{
+  /*
+    Starts an analog input scan and keeps AIN_STREAM_NTRANSFERS bulk
+    transfers queued on endpoint 6, so the device FIFO is drained while
+    earlier packets are being processed.  Each completed transfer is
+    handed to callback with AIN_STREAM_DATA.  count = 0 selects
+    continuous mode; the scan then runs until usbAInStreamStop_USB1608G.
+    The scan list must already be set with usbAInConfig_USB1608G.
+
+    The caller drives the stream with usbAInStreamPoll_USB1608G, which
+    returns 1 while the scan is running and 0 once it has finished,
+    overrun or failed.  Returns -1 if it could not start, also when the
+    transport cannot queue asynchronous transfers (the emulator).
+  */
+  int wMaxPacketSize = usbdev->wMaxPacketSize;
+  int i;
+
+  memset(stream, 0, sizeof(AInStream));
+  if (!mccTransport->async) {
+    fprintf(stderr, "usbAInStreamStart_USB1608G: the transport does not support asynchronous transfers.\n");
+    return -1;
+  }
+  if (transferSize <= 0) transferSize = AIN_STREAM_XFER_SIZE;
+  if (wMaxPacketSize > 0) {
+    // transfers must be a multiple of the packet size or the last packet overflows
+    transferSize = ((transferSize + wMaxPacketSize - 1)/wMaxPacketSize)*wMaxPacketSize;
+  }
+  stream->usbdev = usbdev;
+  stream->transferSize = transferSize;
+  stream->nChan = nChan;
+  stream->bytesTotal = (uint64_t) count*nChan*2;
+  stream->callback = callback;
+  stream->userData = userData;
+
+  for (i = 0; i < AIN_STREAM_NTRANSFERS; i++) {
+    stream->transfer[i] = libusb_alloc_transfer(0);
+    stream->buffer[i] = malloc(transferSize);
+    if (stream->transfer[i] == NULL || stream->buffer[i] == NULL) {
+      fprintf(stderr, "usbAInStreamStart_USB1608G: out of memory.\n");
+      usbAInStreamStop_USB1608G(stream);
+      return -1;
+    }
+    libusb_fill_bulk_transfer(stream->transfer[i], usbdev->udev, LIBUSB_ENDPOINT_IN|6, stream->buffer[i], transferSize,
+			      usbAInStreamCallback_USB1608G, stream, 0);
+  }
+
+  usbAInScanStart_USB1608G_r(usbdev, count, 0, frequency, options);
+  stream->running = TRUE;
+  for (i = 0; i < AIN_STREAM_NTRANSFERS; i++) {
+    usbAInStreamSubmit_USB1608G(stream, stream->transfer[i]);
+  }
+  if (stream->nPending == 0) {
+    perror("usbAInStreamStart_USB1608G: error in libusb_submit_transfer.");
+    usbAInStreamStop_USB1608G(stream);
+    return -1;
+  }
+  return 0;
+}
+
+int usbAInStreamPoll_USB1608G(AInStream *stream, int timeout)
+{
+  /*
+    Services completed transfers for up to timeout milliseconds.
+    Returns 1 while the scan is running, 0 when it is over.
+  */
+  struct timeval tv;
+  uint64_t bytesReceived = stream->bytesReceived;
+  uint16_t status;
+
+  if (stream->usbdev == NULL) return 0;  // already reported
+  if (stream->running) {
+    tv.tv_sec = timeout/1000;
+    tv.tv_usec = (timeout%1000)*1000;
+    libusb_handle_events_timeout_completed(stream->usbdev->ctx, &tv, NULL);
+    if (stream->running && stream->bytesReceived != bytesReceived) return 1;
+  }
+
+  /* Nothing arrived during this interval (or the scan is over): an
+     overrun stops the device without completing the pending transfers. */
+  status = usbStatus_USB1608G(stream->usbdev->udev);
+  if (stream->running && !(status & AIN_SCAN_OVERRUN)) return 1;
+  if (status & AIN_SCAN_OVERRUN) {
+    stream->callback(AIN_STREAM_OVERRUN, NULL, stream->bytesReceived/2, stream->userData);
+  } else if (stream->failed) {
+    stream->callback(AIN_STREAM_ERROR, NULL, stream->failed, stream->userData);
+  } else {
+    stream->callback(AIN_STREAM_DONE, NULL, stream->bytesReceived/2, stream->userData);
+  }
+  usbAInStreamStop_USB1608G(stream);
+  return 0;
+}
+
+void usbAInStreamStop_USB1608G(AInStream *stream)
+{
+  /* Stops the scan, cancels outstanding transfers and frees the stream buffers. */
+  struct timeval tv = {0, 100000};
+  libusb_context *ctx = stream->usbdev ? stream->usbdev->ctx : NULL;
+  libusb_device_handle *udev;
+  uint8_t value[PACKET_SIZE];
+  int wMaxPacketSize;
+  int i, transferred;
+
+  stream->running = FALSE;
+  for (i = 0; i < AIN_STREAM_NTRANSFERS; i++) {
+    if (stream->transfer[i]) libusb_cancel_transfer(stream->transfer[i]);
+  }
+  while (stream->nPending > 0) {
+    if (libusb_handle_events_timeout_completed(ctx, &tv, NULL) < 0) break;
+  }
+  if (stream->usbdev) {
+    udev = stream->usbdev->udev;
+    wMaxPacketSize = stream->usbdev->wMaxPacketSize;
+    usbAInScanStop_USB1608G(udev);
+    // if the scan length was a multiple of wMaxPacketSize the device sends a zero byte packet.
+    if (stream->bytesTotal && wMaxPacketSize > 0 && (stream->bytesTotal%wMaxPacketSize) == 0 && !stream->failed) {
+      mccTransport->bulk_transfer(udev, LIBUSB_ENDPOINT_IN|6, value, 2, &transferred, 100);
+    }
+    usbAInScanClearFIFO_USB1608G(udev);
+  }
+  for (i = 0; i < AIN_STREAM_NTRANSFERS; i++) {
+    if (stream->transfer[i]) libusb_free_transfer(stream->transfer[i]);
+    free(stream->buffer[i]);
+    stream->transfer[i] = NULL;
+    stream->buffer[i] = NULL;
+  }
+  stream->usbdev = NULL;
+}
+
 void usbAInConfig_USB1608G(libusb_device_handle *udev, ScanList scanList[NCHAN_1608G])
+{
+  legacyDevice.udev = udev;
+  usbAInConfig_USB1608G_r(&legacyDevice, scanList);
+}
+
+void usbAInConfig_USB1608G_r(usbDevice1608G *usbdev, ScanList scanList[NCHAN_1608G])
 {
   /*
     This command reads or writes the analog input channel
@@ -357,15 +839,17 @@ void usbAInConfig_USB1608G(libusb_device_handle *udev, ScanList scanList[NCHAN_1
 
   */
 
+  libusb_device_handle *udev = usbdev->udev;
+  uint8_t *scan_list = usbdev->scan_list;
   int i;
   int ret;
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  for (i = 0; i < NCHAN_1608G; i++) {
+  for (i = 0; i < MAX_SCAN_LIST_1608G; i++) {
     if ((scanList[i].mode & 0x3) == SINGLE_ENDED && scanList[i].channel >= 0 && scanList[i].channel < 8) {
       scan_list[i] = ((0x1 << 5) | (scanList[i].channel & 0x7));
     } else if ((scanList[i].mode & 0x3) == SINGLE_ENDED && scanList[i].channel >= 8 && scanList[i].channel < 16) {
-      scan_list[i] = ((0x10 << 5) | (scanList[i].channel & 0x7));
+      scan_list[i] = ((0x2 << 5) | (scanList[i].channel & 0x7));
     } else if ((scanList[i].mode & 0x3) == DIFFERENTIAL && scanList[i].channel >= 0 && scanList[i].channel < 8) {
       scan_list[i] = ((0x00 << 5) | (scanList[i].channel & 0x7));
     } else if ((scanList[i].mode & 0x3) == CALIBRATION) {
@@ -384,11 +868,11 @@ void usbAInConfig_USB1608G(libusb_device_handle *udev, ScanList scanList[NCHAN_1
     }
   }
 
-  if (usbStatus_USB1608G(udev) | AIN_SCAN_RUNNING) {
+  if (usbStatus_USB1608G(udev) & AIN_SCAN_RUNNING) {
     usbAInScanStop_USB1608G(udev);
   }
 
-  ret = libusb_control_transfer(udev, requesttype, AIN_CONFIG, 0x0, 0x0, (unsigned char*) &scan_list[0], 15, HS_DELAY);
+  ret = mccTransport->control_transfer(udev, requesttype, AIN_CONFIG, 0x0, 0x0, (unsigned char*) &scan_list[0], 15, HS_DELAY);
   if (ret < 0) {
     perror("usbAinConfig_USB1608G Error.");
   }
@@ -396,6 +880,13 @@ void usbAInConfig_USB1608G(libusb_device_handle *udev, ScanList scanList[NCHAN_1
 
 int usbAInConfigR_USB1608G(libusb_device_handle *udev, uint8_t *scanList)
 {
+  legacyDevice.udev = udev;
+  return usbAInConfigR_USB1608G_r(&legacyDevice, scanList);
+}
+
+int usbAInConfigR_USB1608G_r(usbDevice1608G *usbdev, uint8_t *scanList)
+{
+  uint8_t *scan_list = usbdev->scan_list;
   int i;
 /*
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
@@ -405,7 +896,7 @@ int usbAInConfigR_USB1608G(libusb_device_handle *udev, uint8_t *scanList)
     usbAInScanStop_USB1608G(udev);
   }
   
-  ret = libusb_control_transfer(udev, requesttype, AIN_CONFIG, 0x0, 0x0, (unsigned char *) scanList, 15, HS_DELAY);
+  ret = mccTransport->control_transfer(udev, requesttype, AIN_CONFIG, 0x0, 0x0, (unsigned char *) scanList, 15, HS_DELAY);
   if (ret < 0) {
     perror("usbAinConfigR_USB1608G Error.");
   }
@@ -424,13 +915,13 @@ void usbAInScanStop_USB1608G(libusb_device_handle *udev)
     This command stops the analog input scan (if running).
   */
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, AIN_SCAN_STOP, 0x0, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AIN_SCAN_STOP, 0x0, 0x0, NULL, 0x0, HS_DELAY);
 }
 
 void usbAInScanClearFIFO_USB1608G(libusb_device_handle *udev)
 {
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, AIN_CLR_FIFO, 0x0, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AIN_CLR_FIFO, 0x0, 0x0, NULL, 0x0, HS_DELAY);
 }
 
 
@@ -473,7 +964,7 @@ void usbAOut_USB1608GX_2AO(libusb_device_handle *udev, uint8_t channel, double v
   } else {
     value = rint(dvalue);
   }
-  libusb_control_transfer(udev, requesttype, AOUT, value, channel, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AOUT, value, channel, NULL, 0x0, HS_DELAY);
 }
 
 void usbAOutR_USB1608GX_2AO(libusb_device_handle *udev, uint8_t channel, double *voltage, float table_AO[NCHAN_AO_1608GX][2])
@@ -481,7 +972,7 @@ void usbAOutR_USB1608GX_2AO(libusb_device_handle *udev, uint8_t channel, double
   uint16_t value[4];
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   
-  libusb_control_transfer(udev, requesttype, AOUT, 0x0, 0x0, (unsigned char *) value, sizeof(value), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AOUT, 0x0, 0x0, (unsigned char *) value, sizeof(value), HS_DELAY);
   *voltage = ((double)(value[channel] - table_AO[channel][1])) / (double) table_AO[channel][0];
   *voltage = (*voltage - 32768.)*10./32768.;
 }
@@ -491,14 +982,14 @@ void usbAOutScanStop_USB1608GX_2AO(libusb_device_handle *udev)
   /* This command stops the analog output scan (if running). */
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, AOUT_SCAN_STOP, 0x0, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AOUT_SCAN_STOP, 0x0, 0x0, NULL, 0x0, HS_DELAY);
 }
 
 void usbAOutScanClearFIFO_USB1608GX_2AO(libusb_device_handle *udev)
 {
   /* This command clears any remaining output FIFO data after a scan */
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, AOUT_CLEAR_FIFO, 0x0, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AOUT_CLEAR_FIFO, 0x0, 0x0, NULL, 0x0, HS_DELAY);
 }
 
 void usbAOutScanStart_USB1608GX_2AO(libusb_device_handle *udev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options)
@@ -545,9 +1036,190 @@ void usbAOutScanStart_USB1608GX_2AO(libusb_device_handle *udev, uint32_t count,
   AOutScan.retrig_count = retrig_count;
   AOutScan.options = options;
   
-  libusb_control_transfer(udev, requesttype, AOUT_SCAN_START, 0x0, 0x0, (unsigned char *) &AOutScan, sizeof(AOutScan), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, AOUT_SCAN_START, 0x0, 0x0, (unsigned char *) &AOutScan, sizeof(AOutScan), HS_DELAY);
 }
 
+static int usbAOutStreamSubmit_USB1608GX_2AO(AOutStream *stream, struct libusb_transfer *transfer)
+{
+  /* Refills one buffer from the user's fill function and queues it. Returns 0 if nothing was left to send. */
+  int nScans = stream->transferScans;
+  int n;
+
+  if (!stream->running || stream->exhausted) return 0;
+  if (stream->scansTotal && stream->scansTotal - stream->scansQueued < nScans) {
+    nScans = stream->scansTotal - stream->scansQueued;
+  }
+  if (nScans == 0) return 0;
+  n = stream->fill(stream->volts, nScans, stream->userData);
+  // A short block ends a finite scan; a continuous one ends when fill has nothing at all
+  if (n <= 0 || (n < nScans && stream->scansTotal)) stream->exhausted = TRUE;
+  if (n <= 0) return 0;
+  usbAOutScanCodes_USB1608GX_2AO(stream->volts, n, stream->nChan, stream->slope, stream->offset, (uint16_t *) transfer->buffer);
+  transfer->length = n*stream->nChan*2;
+  if (libusb_submit_transfer(transfer) < 0) {
+    stream->failed = LIBUSB_TRANSFER_ERROR;
+    stream->running = FALSE;
+    return 0;
+  }
+  stream->scansQueued += n;
+  stream->nPending++;
+  return 1;
+}
+
+static void usbAOutStreamCallback_USB1608GX_2AO(struct libusb_transfer *transfer)
+{
+  AOutStream *stream = (AOutStream *) transfer->user_data;
+
+  stream->nPending--;
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    usbAOutStreamSubmit_USB1608GX_2AO(stream, transfer);
+    if (stream->nPending == 0) stream->running = FALSE;  // everything has been sent
+  } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    stream->failed = transfer->status;
+    stream->running = FALSE;
+  }
+}
+
+int usbAOutStreamStart_USB1608GX_2AO_r(usbDevice1608G *usbdev, AOutStream *stream, uint32_t count, double frequency,
+				       uint8_t options, int transferSize, AOutStreamFill fill, void *userData)
+{
+  /*
+    Starts an analog output scan on the channels selected by options
+    (AO_CHAN0, AO_CHAN1) and streams to bulk OUT endpoint 2 with two
+    transfers: while one is on the bus, the other is refilled by fill
+    and converted to calibrated codes.  A finite scan (count > 0) ends
+    after count scans or when fill returns a short block; count = 0
+    runs until fill returns 0.  Drive it with usbAOutStreamPoll_USB1608GX_2AO.
+    Like the input stream, it needs asynchronous transfers (not the emulator).
+
+    For sample-locked play and record on one board, start the output
+    with frequency = 0 (paced by AO_CLK_IN) and wire AI_CLK_OUT to
+    AO_CLK_IN, or start both scans from the same trigger.
+  */
+  int nChan = ((options & AO_CHAN0) ? 1 : 0) + ((options & AO_CHAN1) ? 1 : 0);
+  int i;
+
+  memset(stream, 0, sizeof(AOutStream));
+  if (!mccTransport->async) {
+    fprintf(stderr, "usbAOutStreamStart_USB1608GX_2AO: the transport does not support asynchronous transfers.\n");
+    return -1;
+  }
+  if (nChan == 0) {
+    fprintf(stderr, "usbAOutStreamStart_USB1608GX_2AO: no channel selected in options.\n");
+    return -1;
+  }
+  if (transferSize <= 0) transferSize = AOUT_STREAM_XFER_SIZE;
+  stream->usbdev = usbdev;
+  stream->nChan = nChan;
+  stream->transferScans = transferSize/(2*nChan);
+  stream->scansTotal = count;
+  stream->frequency = frequency;
+  stream->fill = fill;
+  stream->userData = userData;
+  usbAOutScanCoefficients_USB1608GX_2AO(usbdev->table_AOut, options, stream->slope, stream->offset);
+
+  stream->volts = malloc(stream->transferScans*nChan*sizeof(float));
+  for (i = 0; i < AOUT_STREAM_NBUFFERS; i++) {
+    stream->transfer[i] = libusb_alloc_transfer(0);
+    stream->buffer[i] = malloc(stream->transferScans*nChan*2);
+    if (stream->volts == NULL || stream->transfer[i] == NULL || stream->buffer[i] == NULL) {
+      fprintf(stderr, "usbAOutStreamStart_USB1608GX_2AO: out of memory.\n");
+      usbAOutStreamStop_USB1608GX_2AO(stream);
+      return -1;
+    }
+    libusb_fill_bulk_transfer(stream->transfer[i], usbdev->udev, LIBUSB_ENDPOINT_OUT|2, stream->buffer[i], 0,
+			      usbAOutStreamCallback_USB1608GX_2AO, stream, HS_DELAY);
+  }
+
+  usbAOutScanStop_USB1608GX_2AO(usbdev->udev);
+  usbAOutScanClearFIFO_USB1608GX_2AO(usbdev->udev);
+  usbAOutScanStart_USB1608GX_2AO(usbdev->udev, count, 0, frequency, options);
+  stream->running = TRUE;
+  for (i = 0; i < AOUT_STREAM_NBUFFERS; i++) {
+    usbAOutStreamSubmit_USB1608GX_2AO(stream, stream->transfer[i]);
+  }
+  if (stream->nPending == 0) {
+    fprintf(stderr, "usbAOutStreamStart_USB1608GX_2AO: no data to send.\n");
+    usbAOutStreamStop_USB1608GX_2AO(stream);
+    return -1;
+  }
+  return 0;
+}
+
+int usbAOutStreamPoll_USB1608GX_2AO(AOutStream *stream, int timeout)
+{
+  /*
+    Services completed transfers for up to timeout milliseconds.
+    Returns 1 while data is still being sent.  Once it has all been
+    sent, waits for the device FIFO to play out and returns 0; returns
+    -1 on an underrun, a transfer error, or a FIFO that is not empty
+    AOUT_STREAM_DRAIN_TIMEOUT ms (plus the time to play the buffers at
+    the scan rate) after the last transfer.  The stream is stopped then.
+  */
+  struct timeval tv;
+  uint16_t status;
+  double deadline;
+
+  if (stream->usbdev == NULL) return 0;
+  if (stream->running) {
+    tv.tv_sec = timeout/1000;
+    tv.tv_usec = (timeout%1000)*1000;
+    libusb_handle_events_timeout_completed(stream->usbdev->ctx, &tv, NULL);
+    if (stream->running) {
+      status = usbStatus_USB1608G(stream->usbdev->udev);
+      if (!(status & AOUT_SCAN_UNDERRUN)) return 1;
+      fprintf(stderr, "usbAOutStreamPoll_USB1608GX_2AO: analog output scan underrun.\n");
+      stream->failed = LIBUSB_TRANSFER_ERROR;
+    }
+  }
+  if (stream->failed == 0) {
+    /* All data is in the device FIFO; let it play out before stopping.  A finite scan stops
+       by itself; a continuous one (or one fill ended early) underruns once the FIFO is empty. */
+    deadline = usbMonotonicTime() + AOUT_STREAM_DRAIN_TIMEOUT/1000.;
+    if (stream->frequency > 0) deadline += AOUT_STREAM_NBUFFERS*stream->transferScans/stream->frequency;
+    for (;;) {
+      status = usbStatus_USB1608G(stream->usbdev->udev);
+      if (!(status & AOUT_SCAN_RUNNING) || (status & AOUT_SCAN_UNDERRUN)) break;
+      if (usbMonotonicTime() > deadline) {
+	fprintf(stderr, "usbAOutStreamPoll_USB1608GX_2AO: analog output scan did not finish.\n");
+	stream->failed = LIBUSB_TRANSFER_TIMED_OUT;
+	break;
+      }
+      usleep(1000);
+    }
+  }
+  usbAOutStreamStop_USB1608GX_2AO(stream);
+  return stream->failed ? -1 : 0;
+}
+
+void usbAOutStreamStop_USB1608GX_2AO(AOutStream *stream)
+{
+  /* Stops the scan, cancels outstanding transfers and frees the stream buffers. */
+  struct timeval tv = {0, 100000};
+  libusb_context *ctx = stream->usbdev ? stream->usbdev->ctx : NULL;
+  int i;
+
+  stream->running = FALSE;
+  for (i = 0; i < AOUT_STREAM_NBUFFERS; i++) {
+    if (stream->transfer[i]) libusb_cancel_transfer(stream->transfer[i]);
+  }
+  while (stream->nPending > 0) {
+    if (libusb_handle_events_timeout_completed(ctx, &tv, NULL) < 0) break;
+  }
+  if (stream->usbdev) {
+    usbAOutScanStop_USB1608GX_2AO(stream->usbdev->udev);
+    usbAOutScanClearFIFO_USB1608GX_2AO(stream->usbdev->udev);
+  }
+  for (i = 0; i < AOUT_STREAM_NBUFFERS; i++) {
+    if (stream->transfer[i]) libusb_free_transfer(stream->transfer[i]);
+    free(stream->buffer[i]);
+    stream->transfer[i] = NULL;
+    stream->buffer[i] = NULL;
+  }
+  free(stream->volts);
+  stream->volts = NULL;
+  stream->usbdev = NULL;
+}
 
 /***********************************************
  *            Counter/Timer                    *
@@ -561,7 +1233,7 @@ void usbCounterInit_USB1608G(libusb_device_handle *udev, uint8_t counter)
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  libusb_control_transfer(udev, requesttype, COUNTER, counter, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, COUNTER, counter, 0x0, NULL, 0x0, HS_DELAY);
   return;
 }
 
@@ -574,7 +1246,7 @@ uint32_t usbCounter_USB1608G(libusb_device_handle *udev, uint8_t counter)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint32_t counts[2] = {0x0, 0x0};
 
-  libusb_control_transfer(udev, requesttype, COUNTER, 0x0, 0x0, (unsigned char *) &counts, sizeof(counts), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, COUNTER, 0x0, 0x0, (unsigned char *) &counts, sizeof(counts), HS_DELAY);
   if (counter == COUNTER0) {
     return counts[0];
   } else {
@@ -595,7 +1267,7 @@ void usbTimerControlR_USB1608G(libusb_device_handle *udev, uint8_t *control)
   */
 
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_CONTROL, 0x0, 0x0, (unsigned char *) control, sizeof(control), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_CONTROL, 0x0, 0x0, (unsigned char *) control, sizeof(control), HS_DELAY);
 }
 
 void usbTimerControlW_USB1608G(libusb_device_handle *udev, uint8_t control)
@@ -603,7 +1275,7 @@ void usbTimerControlW_USB1608G(libusb_device_handle *udev, uint8_t control)
   /* This command reads/writes the timer control register */
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_CONTROL, control, 0x0, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_CONTROL, control, 0x0, NULL, 0x0, HS_DELAY);
 }
 
 void usbTimerPeriodR_USB1608G(libusb_device_handle *udev, uint32_t *period)
@@ -620,7 +1292,7 @@ void usbTimerPeriodR_USB1608G(libusb_device_handle *udev, uint32_t *period)
   */
 
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_PERIOD, 0x0, 0x0, (unsigned char *) period, sizeof(period), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PERIOD, 0x0, 0x0, (unsigned char *) period, sizeof(period), HS_DELAY);
 }    
 
 void usbTimerPeriodW_USB1608G(libusb_device_handle *udev, uint32_t period)
@@ -628,7 +1300,7 @@ void usbTimerPeriodW_USB1608G(libusb_device_handle *udev, uint32_t period)
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t wValue = period & 0xffff;
   uint16_t wIndex = (period >> 16) & 0xffff;
-  libusb_control_transfer(udev, requesttype, TIMER_PERIOD, wValue, wIndex, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PERIOD, wValue, wIndex, NULL, 0x0, HS_DELAY);
 }
 
 void usbTimerPulseWidthR_USB1608G(libusb_device_handle *udev, uint32_t *pulseWidth)
@@ -644,7 +1316,7 @@ void usbTimerPulseWidthR_USB1608G(libusb_device_handle *udev, uint32_t *pulseWid
     the period register or you may get unexpected results.
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_PULSE_WIDTH, 0x0, 0x0, (unsigned char *) pulseWidth, sizeof(pulseWidth), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PULSE_WIDTH, 0x0, 0x0, (unsigned char *) pulseWidth, sizeof(pulseWidth), HS_DELAY);
 }
 
 void usbTimerPulseWidthW_USB1608G(libusb_device_handle *udev, uint32_t pulseWidth)
@@ -652,7 +1324,7 @@ void usbTimerPulseWidthW_USB1608G(libusb_device_handle *udev, uint32_t pulseWidt
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t wValue = pulseWidth & 0xffff;
   uint16_t wIndex = (pulseWidth >> 16) & 0xffff;
-  libusb_control_transfer(udev, requesttype, TIMER_PULSE_WIDTH, wValue, wIndex, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PULSE_WIDTH, wValue, wIndex, NULL, 0x0, HS_DELAY);
 }
 
 void usbTimerCountR_USB1608G(libusb_device_handle *udev, uint32_t *count)
@@ -666,7 +1338,7 @@ void usbTimerCountR_USB1608G(libusb_device_handle *udev, uint32_t *count)
   */
 
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_COUNT, 0x0, 0x0, (unsigned char *) count, sizeof(count), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_COUNT, 0x0, 0x0, (unsigned char *) count, sizeof(count), HS_DELAY);
 }
 
 void usbTimerCountW_USB1608G(libusb_device_handle *udev, uint32_t count)
@@ -674,7 +1346,7 @@ void usbTimerCountW_USB1608G(libusb_device_handle *udev, uint32_t count)
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t wValue = count & 0xffff;
   uint16_t wIndex = (count >> 16) & 0xffff;
-  libusb_control_transfer(udev, requesttype, TIMER_COUNT, wValue, wIndex, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_COUNT, wValue, wIndex, NULL, 0x0, HS_DELAY);
 }
 
 void usbTimerDelayR_USB1608G(libusb_device_handle *udev, uint32_t *delay)
@@ -687,7 +1359,7 @@ void usbTimerDelayR_USB1608G(libusb_device_handle *udev, uint32_t *delay)
      while the timer output is enabled.
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_START_DELAY, 0x0, 0x0, (unsigned char *) delay, sizeof(delay), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_START_DELAY, 0x0, 0x0, (unsigned char *) delay, sizeof(delay), HS_DELAY);
 }
 
 void usbTimerDelayW_USB1608G(libusb_device_handle *udev, uint32_t delay)
@@ -695,7 +1367,7 @@ void usbTimerDelayW_USB1608G(libusb_device_handle *udev, uint32_t delay)
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t wValue = delay & 0xffff;
   uint16_t wIndex = (delay >> 16) & 0xffff;
-  libusb_control_transfer(udev, requesttype, TIMER_START_DELAY, wValue, wIndex, NULL, 0x0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_START_DELAY, wValue, wIndex, NULL, 0x0, HS_DELAY);
 }
 
 void usbTimerParamsR_USB1608G(libusb_device_handle *udev, timerParams *params)
@@ -704,19 +1376,19 @@ void usbTimerParamsR_USB1608G(libusb_device_handle *udev, timerParams *params)
     This command reads/writes all timer parameters in one call.
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_PARAMETERS, 0x0, 0x0, (unsigned char *) params, sizeof(timerParams), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PARAMETERS, 0x0, 0x0, (unsigned char *) params, sizeof(timerParams), HS_DELAY);
 }
 
 void usbTimerParamsW_USB1608G(libusb_device_handle *udev, timerParams *params)
 {
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TIMER_PARAMETERS, 0x0, 0x0, (unsigned char *) params, sizeof(timerParams), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TIMER_PARAMETERS, 0x0, 0x0, (unsigned char *) params, sizeof(timerParams), HS_DELAY);
 }
 
 /***********************************************
  *            Memory Commands                  *
  ***********************************************/
-void usbMemoryR_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length)
+int usbMemoryR_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length)
 {
   /*
     This command reads or writes data from the EEPROM memory.  The
@@ -731,16 +1403,18 @@ void usbMemoryR_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t len
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   int ret;
-  ret = libusb_control_transfer(udev, requesttype, MEMORY, 0x0, 0x0, (unsigned char *) data, length, HS_DELAY);
+  ret = mccTransport->control_transfer(udev, requesttype, MEMORY, 0x0, 0x0, (unsigned char *) data, length, HS_DELAY);
   if (ret != length) {
     perror("usbMemoryR_USB1608G: error in reading memory.");
+    return -1;
   }
+  return 0;
 }
 
 void usbMemoryW_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length)
 {
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, MEMORY, 0x0, 0x0, (unsigned char *) data, length, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, MEMORY, 0x0, 0x0, (unsigned char *) data, length, HS_DELAY);
 }
 
 void usbMemAddressR_USB1608G(libusb_device_handle *udev, uint16_t address)
@@ -762,13 +1436,13 @@ void usbMemAddressR_USB1608G(libusb_device_handle *udev, uint16_t address)
     or a value other than 0xAA55 is written to address 0x8000.
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &address, sizeof(address), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &address, sizeof(address), HS_DELAY);
 }
 
 void usbMemAddressW_USB1608G(libusb_device_handle *udev, uint16_t address)
 {
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &address, sizeof(address), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &address, sizeof(address), HS_DELAY);
 }
 
 void usbMemWriteEnable_USB1608G(libusb_device_handle *udev)
@@ -781,7 +1455,7 @@ void usbMemWriteEnable_USB1608G(libusb_device_handle *udev)
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint8_t unlock_code = 0xad;
-  libusb_control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &unlock_code, sizeof(unlock_code), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, MEM_ADDRESS, 0x0, 0x0, (unsigned char *) &unlock_code, sizeof(unlock_code), HS_DELAY);
 }
 
 /***********************************************
@@ -796,7 +1470,7 @@ void usbBlink_USB1608G(libusb_device_handle *udev, uint8_t count)
   */
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  libusb_control_transfer(udev, requesttype, BLINK_LED, 0x0, 0x0, (unsigned char *) &count, sizeof(count), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, BLINK_LED, 0x0, 0x0, (unsigned char *) &count, sizeof(count), HS_DELAY);
   return;
 }
 
@@ -809,7 +1483,7 @@ uint16_t usbStatus_USB1608G(libusb_device_handle *udev)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint16_t status = 0x0;
 
-  libusb_control_transfer(udev, requesttype, STATUS, 0x0, 0x0, (unsigned char *) &status, sizeof(status), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, STATUS, 0x0, 0x0, (unsigned char *) &status, sizeof(status), HS_DELAY);
   return status;
 }
 
@@ -822,11 +1496,17 @@ void usbReset_USB1608G(libusb_device_handle *udev)
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  libusb_control_transfer(udev, requesttype, RESET, 0x0, 0x0, NULL, 0, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, RESET, 0x0, 0x0, NULL, 0, HS_DELAY);
   return;
 }
 
 void usbTriggerConfig_USB1608G(libusb_device_handle *udev, uint8_t options)
+{
+  legacyDevice.udev = udev;
+  usbTriggerConfig_USB1608G_r(&legacyDevice, options);
+}
+
+void usbTriggerConfig_USB1608G_r(usbDevice1608G *usbdev, uint8_t options)
 {
   /*
     This function configures the AInScan trigger.  Once the trigger is
@@ -840,13 +1520,13 @@ void usbTriggerConfig_USB1608G(libusb_device_handle *udev, uint8_t options)
   */
 
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TRIGGER_CONFIG, 0x0, 0x0, (unsigned char*) &options, sizeof(options), HS_DELAY);
+  mccTransport->control_transfer(usbdev->udev, requesttype, TRIGGER_CONFIG, 0x0, 0x0, (unsigned char*) &options, sizeof(options), HS_DELAY);
 }
 
 void usbTriggerConfigR_USB1608G(libusb_device_handle *udev, uint8_t *options)
 {
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
-  libusb_control_transfer(udev, requesttype, TRIGGER_CONFIG, 0x0, 0x0, (unsigned char*) options, sizeof(options), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, TRIGGER_CONFIG, 0x0, 0x0, (unsigned char*) options, sizeof(*options), HS_DELAY);
 }
 
 void usbTemperature_USB1608G(libusb_device_handle *udev, float *temperature)
@@ -862,7 +1542,7 @@ void usbTemperature_USB1608G(libusb_device_handle *udev, float *temperature)
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
   int ret;
 
-  ret =  libusb_control_transfer(udev, requesttype, TEMPERATURE, 0x0, 0x0, (unsigned char*) &temp, sizeof(temp), HS_DELAY);
+  ret =  mccTransport->control_transfer(udev, requesttype, TEMPERATURE, 0x0, 0x0, (unsigned char*) &temp, sizeof(temp), HS_DELAY);
   if (ret < 0) {
     perror("usbTemperature_USB1608G: error in reading temperature.");
   }
@@ -878,7 +1558,7 @@ void usbGetSerialNumber_USB1608G(libusb_device_handle *udev, char serial[9])
   */
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  libusb_control_transfer(udev, requesttype, SERIAL, 0x0, 0x0, (unsigned char *) serial, 8, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, SERIAL, 0x0, 0x0, (unsigned char *) serial, 8, HS_DELAY);
   serial[8] = '\0';
   return;
 }
@@ -904,7 +1584,7 @@ void usbFPGAConfig_USB1608G(libusb_device_handle *udev)
   */
   uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
   uint8_t unlock_code = 0xad;
-  libusb_control_transfer(udev, requesttype, FPGA_CONFIG, 0x0, 0x0, (unsigned char*) &unlock_code, sizeof(unlock_code), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, FPGA_CONFIG, 0x0, 0x0, (unsigned char*) &unlock_code, sizeof(unlock_code), HS_DELAY);
 }
 
 void usbFPGAData_USB1608G(libusb_device_handle *udev, uint8_t *data, uint8_t length)
@@ -922,7 +1602,142 @@ void usbFPGAData_USB1608G(libusb_device_handle *udev, uint8_t *data, uint8_t len
     printf("usbFPGAData_USB1608G: max length = 64 bytes\n");
     return;
   }
-  libusb_control_transfer(udev, requesttype, FPGA_DATA, 0x0, 0x0, (unsigned char*) data, length, HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, FPGA_DATA, 0x0, 0x0, (unsigned char*) data, length, HS_DELAY);
+}
+
+typedef struct FPGALoadSlot_t {
+  struct libusb_transfer *transfer;
+  int pending;
+  int *failed;
+  uint8_t buffer[LIBUSB_CONTROL_SETUP_SIZE + FPGA_DATA_SIZE];
+} FPGALoadSlot;
+
+static void usbFPGALoadCallback_USB1608G(struct libusb_transfer *transfer)
+{
+  FPGALoadSlot *slot = (FPGALoadSlot *) transfer->user_data;
+
+  slot->pending = 0;
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED) *slot->failed = transfer->status;
+}
+
+static int usbFPGALoadAsync_USB1608G(libusb_context *ctx, libusb_device_handle *udev, const uint8_t *data, int length)
+{
+  /*
+    Keeps FPGA_LOAD_INFLIGHT FPGA_DATA requests queued on endpoint 0.
+    Control transfers to one device complete in submission order, so
+    the bitstream still arrives in sequence, but the host no longer
+    waits a full round trip between 64 byte chunks.
+  */
+  uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
+  FPGALoadSlot slot[FPGA_LOAD_INFLIGHT];
+  struct timeval tv;
+  int failed = 0;
+  int offset = 0;
+  int nPending, chunk, i;
+
+  memset(slot, 0, sizeof(slot));
+  for (i = 0; i < FPGA_LOAD_INFLIGHT; i++) {
+    if ((slot[i].transfer = libusb_alloc_transfer(0)) == NULL) {
+      failed = LIBUSB_ERROR_NO_MEM;
+      break;
+    }
+    slot[i].failed = &failed;
+  }
+
+  do {
+    nPending = 0;
+    for (i = 0; i < FPGA_LOAD_INFLIGHT && slot[i].transfer; i++) {
+      if (!slot[i].pending && offset < length && !failed) {
+	chunk = (length - offset < FPGA_DATA_SIZE) ? length - offset : FPGA_DATA_SIZE;
+	libusb_fill_control_setup(slot[i].buffer, requesttype, FPGA_DATA, 0x0, 0x0, chunk);
+	memcpy(slot[i].buffer + LIBUSB_CONTROL_SETUP_SIZE, data + offset, chunk);
+	libusb_fill_control_transfer(slot[i].transfer, udev, slot[i].buffer, usbFPGALoadCallback_USB1608G, &slot[i], HS_DELAY);
+	if (libusb_submit_transfer(slot[i].transfer) < 0) {
+	  failed = LIBUSB_ERROR_IO;
+	} else {
+	  slot[i].pending = 1;
+	  offset += chunk;
+	}
+      }
+      nPending += slot[i].pending;
+    }
+    if (nPending) {
+      tv.tv_sec = 0;
+      tv.tv_usec = 100000;
+      libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+    }
+  } while (nPending);
+
+  for (i = 0; i < FPGA_LOAD_INFLIGHT; i++) {
+    if (slot[i].transfer) libusb_free_transfer(slot[i].transfer);
+  }
+  return failed ? -1 : 0;
+}
+
+int usbFPGALoad_USB1608G(libusb_device_handle *udev, const uint8_t *data, int length)
+{
+  /*
+    Streams a complete bitstream with FPGA_DATA.  The device must
+    already be in FPGA config mode (usbFPGAConfig_USB1608G).  Chunks
+    are FPGA_DATA_SIZE bytes, the firmware limit; on libusb handles
+    they are pipelined, other transports (the emulator) send them one
+    at a time.  Returns 0 on success, -1 if a transfer failed.
+  */
+  return usbFPGALoadContext_USB1608G(NULL, udev, data, length);
+}
+
+static int usbFPGALoadContext_USB1608G(libusb_context *ctx, libusb_device_handle *udev, const uint8_t *data, int length)
+{
+  uint8_t requesttype = (HOST_TO_DEVICE | VENDOR_TYPE | DEVICE_RECIPIENT);
+  int offset, chunk;
+
+  if (mccTransport->async) {
+    return usbFPGALoadAsync_USB1608G(ctx, udev, data, length);
+  }
+  for (offset = 0; offset < length; offset += chunk) {
+    chunk = (length - offset < FPGA_DATA_SIZE) ? length - offset : FPGA_DATA_SIZE;
+    if (mccTransport->control_transfer(udev, requesttype, FPGA_DATA, 0x0, 0x0, (unsigned char *) data + offset, chunk, HS_DELAY) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int usbFPGAEnsureConfigured_USB1608G_r(usbDevice1608G *usbdev, double *loadTime)
+{
+  /*
+    Loads the compiled-in FPGA bitstream unless the status register
+    shows FPGA_CONFIGURED.  The FPGA keeps its configuration until the
+    board loses power, so only the first open after a power cycle pays
+    for the load.  Returns 0 if the FPGA was already configured, 1 if
+    it was loaded now and -1 on failure.  If loadTime is not NULL it
+    receives the seconds spent loading (0 when nothing was loaded).
+  */
+  libusb_device_handle *udev = usbdev->udev;
+  struct timespec start, stop;
+
+  if (loadTime) *loadTime = 0.0;
+  if (usbStatus_USB1608G(udev) & FPGA_CONFIGURED) {
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  usbFPGAConfig_USB1608G(udev);
+  if (!(usbStatus_USB1608G(udev) & FPGA_CONFIG_MODE)) {
+    printf("Error: could not put USB-1608G into FPGA Config Mode.  status = %#x\n", usbStatus_USB1608G(udev));
+    return -1;
+  }
+  if (usbFPGALoadContext_USB1608G(usbdev->ctx, udev, FPGA_data, sizeof(FPGA_data)) < 0) {
+    perror("usbFPGAEnsureConfigured_USB1608G: error in libusb_control_transfer()");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if (loadTime) *loadTime = (stop.tv_sec - start.tv_sec) + 1e-9*(stop.tv_nsec - start.tv_nsec);
+
+  if (!(usbStatus_USB1608G(udev) & FPGA_CONFIGURED)) {
+    printf("Error: FPGA for the USB-1608G is not configured.  status = %#x\n", usbStatus_USB1608G(udev));
+    return -1;
+  }
+  return 1;
 }
 
 void usbFPGAVersion_USB1608G(libusb_device_handle *udev, uint16_t *version)
@@ -933,12 +1748,14 @@ void usbFPGAVersion_USB1608G(libusb_device_handle *udev, uint16_t *version)
 
   uint8_t requesttype = (DEVICE_TO_HOST | VENDOR_TYPE | DEVICE_RECIPIENT);
 
-  libusb_control_transfer(udev, requesttype, FPGA_VERSION, 0x0, 0x0, (unsigned char *) version, sizeof(uint16_t), HS_DELAY);
+  mccTransport->control_transfer(udev, requesttype, FPGA_VERSION, 0x0, 0x0, (unsigned char *) version, sizeof(uint16_t), HS_DELAY);
 }
 
 void cleanup_USB1608G( libusb_device_handle *udev )
 {
-  if (udev) {
+  if (udev && mccTransport->close) {
+    mccTransport->close(udev);
+  } else if (udev) {
     libusb_clear_halt(udev, LIBUSB_ENDPOINT_IN|6);
     libusb_clear_halt(udev, LIBUSB_ENDPOINT_OUT|2);
     libusb_release_interface(udev, 0);
@@ -957,7 +1774,7 @@ uint16_t voltsTou16_USB1608GX_AO(double volts, int channel, float table_AO[NCHAN
   }
 
   /* correct voltage */
-  dvalue = (volts/10.*32768. + 32678);
+  dvalue = (volts/10.*32768. + 32768.);
   dvalue = dvalue*table_AO[channel][0] + table_AO[channel][1];
 
   if (dvalue > 0xffff) {
@@ -992,3 +1809,209 @@ double volts_USB1608G(libusb_device_handle *udev, const uint8_t gain, uint16_t v
   }
   return volt;
 }
+
+/***********************************************
+ *      Batch conversion of scan buffers       *
+ ***********************************************/
+
+#define SCAN_BLOCK 8   // scans per block; keeps every block a multiple of 8 samples
+
+int usbAInScanList_USB1608G(ScanList list[], int nChan)
+{
+  /*
+    Checks the first nChan entries of a scan list before it is sent with
+    usbAInConfig_USB1608G and marks the last one with LAST_CHANNEL (and
+    only that one).  Single-ended inputs are channels 0-15, differential
+    inputs 0-7.  Returns 0 if the list is usable, -1 otherwise.
+  */
+  int i, mode;
+
+  if (nChan < 1 || nChan > MAX_SCAN_LIST_1608G) {
+    fprintf(stderr, "usbAInScanList_USB1608G: %d channels, the scan list holds 1 to %d.\n", nChan, MAX_SCAN_LIST_1608G);
+    return -1;
+  }
+  for (i = 0; i < nChan; i++) {
+    list[i].mode &= ~LAST_CHANNEL;
+    mode = list[i].mode & 0x3;
+    if ((mode == SINGLE_ENDED && list[i].channel >= NCHAN_1608G) ||
+	(mode == DIFFERENTIAL && list[i].channel >= NCHAN_1608G/2) ||
+	(mode != SINGLE_ENDED && mode != DIFFERENTIAL && mode != CALIBRATION) || list[i].range > BP_1V) {
+      fprintf(stderr, "usbAInScanList_USB1608G: bad entry %d: mode = %#x  channel = %d  range = %#x\n",
+	      i, list[i].mode, list[i].channel, list[i].range);
+      return -1;
+    }
+  }
+  list[nChan-1].mode |= LAST_CHANNEL;
+  return 0;
+}
+
+void usbAInScanCoefficients_USB1608G(float table_AIN[NGAINS_1608G][2], ScanList list[NCHAN_1608G], int nChan, float slope[], float offset[])
+{
+  /*
+    Folds the calibration table and the range of each channel in the
+    scan list into one slope and offset per channel, so that
+
+       volts = raw*slope[channel] + offset[channel]
+
+    is the same as volts_USB1608G applied to the calibrated value, minus
+    the intermediate rounding to an integer code.
+  */
+  const double fullScale[NGAINS_1608G] = {10., 5., 2., 1.};  // indexed by BP_10V .. BP_1V
+  double scale;
+  int j, gain;
+
+  for (j = 0; j < nChan; j++) {
+    gain = list[j].range & 0x3;
+    scale = fullScale[gain]/32768.;
+    slope[j] = table_AIN[gain][0]*scale;
+    offset[j] = (table_AIN[gain][1] - 32768.)*scale;
+  }
+}
+
+void usbAInScanVolts_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[], float *volts)
+{
+  /*
+    Converts an interleaved scan buffer (nScan*nChan raw samples) to
+    volts using per-channel coefficients from usbAInScanCoefficients_USB1608G.
+    The coefficients are repeated over a block of SCAN_BLOCK scans so the
+    inner loop runs over contiguous samples with no per-sample channel
+    lookup; on x86 it uses SSE2, elsewhere it is left to the compiler.
+  */
+  float a[NCHAN_1608G*SCAN_BLOCK], b[NCHAN_1608G*SCAN_BLOCK];
+  int blockSize = nChan*SCAN_BLOCK;
+  long nSamples = (long) nScan*nChan;
+  long k;
+  int i;
+
+  for (i = 0; i < blockSize; i++) {
+    a[i] = slope[i%nChan];
+    b[i] = offset[i%nChan];
+  }
+  for (k = 0; k + blockSize <= nSamples; k += blockSize) {
+#ifdef __SSE2__
+    for (i = 0; i < blockSize; i += 8) {
+      __m128i raw = _mm_loadu_si128((const __m128i *) &data[k+i]);
+      __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, _mm_setzero_si128()));
+      __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, _mm_setzero_si128()));
+      _mm_storeu_ps(&volts[k+i], _mm_add_ps(_mm_mul_ps(lo, _mm_loadu_ps(&a[i])), _mm_loadu_ps(&b[i])));
+      _mm_storeu_ps(&volts[k+i+4], _mm_add_ps(_mm_mul_ps(hi, _mm_loadu_ps(&a[i+4])), _mm_loadu_ps(&b[i+4])));
+    }
+#else
+    for (i = 0; i < blockSize; i++) {
+      volts[k+i] = data[k+i]*a[i] + b[i];
+    }
+#endif
+  }
+  for (i = 0; k < nSamples; k++, i++) {  // remaining partial block
+    volts[k] = data[k]*a[i] + b[i];
+  }
+}
+
+void usbAInScanVoltsChannels_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[],
+				      float *volts[])
+{
+  /*
+    Same as usbAInScanVolts_USB1608G, but de-interleaves the scan:
+    volts[j][i] is scan i of channel j, so each channel ends up in its
+    own buffer of nScan values.  The scans are taken in blocks that stay
+    in cache while every channel's part is written out.
+  */
+  const int blockScans = 1024;
+  const uint16_t *src;
+  float *dst;
+  int i, i0, i1, j;
+
+  for (i0 = 0; i0 < nScan; i0 = i1) {
+    i1 = (nScan - i0 < blockScans) ? nScan : i0 + blockScans;
+    for (j = 0; j < nChan; j++) {
+      src = &data[(long) i0*nChan + j];
+      dst = volts[j];
+      for (i = i0; i < i1; i++, src += nChan) {
+	dst[i] = *src*slope[j] + offset[j];
+      }
+    }
+  }
+}
+
+void usbAInScanVoltsD_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[], double *volts)
+{
+  /* Same as usbAInScanVolts_USB1608G with double precision output. */
+  double a[NCHAN_1608G*SCAN_BLOCK], b[NCHAN_1608G*SCAN_BLOCK];
+  int blockSize = nChan*SCAN_BLOCK;
+  long nSamples = (long) nScan*nChan;
+  long k;
+  int i;
+
+  for (i = 0; i < blockSize; i++) {
+    a[i] = slope[i%nChan];
+    b[i] = offset[i%nChan];
+  }
+  for (k = 0; k + blockSize <= nSamples; k += blockSize) {
+    for (i = 0; i < blockSize; i++) {
+      volts[k+i] = data[k+i]*a[i] + b[i];
+    }
+  }
+  for (i = 0; k < nSamples; k++, i++) {
+    volts[k] = data[k]*a[i] + b[i];
+  }
+}
+
+void usbAOutScanCoefficients_USB1608GX_2AO(float table_AO[NCHAN_AO_1608GX][2], uint8_t channels, float slope[], float offset[])
+{
+  /*
+    Folds the +/-10 V output scaling and the calibration of each channel
+    selected in channels (AO_CHAN0, AO_CHAN1), in scan order, into
+
+       code = volts*slope[j] + offset[j]
+
+    the same correction usbAOut_USB1608GX_2AO applies per sample.
+  */
+  int channel, j = 0;
+
+  for (channel = 0; channel < NCHAN_AO_1608GX; channel++) {
+    if (!(channels & (AO_CHAN0 << channel))) continue;
+    slope[j] = 32768./10.*table_AO[channel][0];
+    offset[j] = 32768.*table_AO[channel][0] + table_AO[channel][1];
+    j++;
+  }
+}
+
+void usbAOutScanCodes_USB1608GX_2AO(const float *volts, int nScan, int nChan, const float slope[], const float offset[], uint16_t *codes)
+{
+  /*
+    Converts an interleaved block of output volts to rounded, clamped
+    16-bit codes, the inverse of usbAInScanVolts_USB1608G.  SSE2 has no
+    unsigned 32->16 bit pack, so codes are offset by 32768, packed with
+    signed saturation and the sign bit flipped back.
+  */
+  float a[NCHAN_AO_1608GX*SCAN_BLOCK], b[NCHAN_AO_1608GX*SCAN_BLOCK];
+  int blockSize = nChan*SCAN_BLOCK;
+  long nSamples = (long) nScan*nChan;
+  long k;
+  double value;
+  int i;
+
+  for (i = 0; i < blockSize; i++) {
+    a[i] = slope[i%nChan];
+    b[i] = offset[i%nChan] - 32768.;
+  }
+  for (k = 0; k + blockSize <= nSamples; k += blockSize) {
+#ifdef __SSE2__
+    for (i = 0; i < blockSize; i += 8) {
+      __m128 lo = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&volts[k+i]), _mm_loadu_ps(&a[i])), _mm_loadu_ps(&b[i]));
+      __m128 hi = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&volts[k+i+4]), _mm_loadu_ps(&a[i+4])), _mm_loadu_ps(&b[i+4]));
+      __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+      _mm_storeu_si128((__m128i *) &codes[k+i], _mm_xor_si128(packed, _mm_set1_epi16((short) 0x8000)));
+    }
+#else
+    for (i = 0; i < blockSize; i++) {
+      value = rint(volts[k+i]*a[i] + b[i]);
+      codes[k+i] = (value > 32767. ? 32767. : (value < -32768. ? -32768. : value)) + 32768.;
+    }
+#endif
+  }
+  for (i = 0; k < nSamples; k++, i++) {  // remaining partial block
+    value = rint(volts[k]*a[i] + b[i]);
+    codes[k] = (value > 32767. ? 32767. : (value < -32768. ? -32768. : value)) + 32768.;
+  }
+}
@@ -88,6 +88,15 @@ extern "C" {
 #define LAST_CHANNEL   (0x80)
 #define PACKET_SIZE    512       // max bulk transfer size in bytes
 
+/* Analog Input Scan Options */
+#define AIN_BURST_MODE  0x1   // Burst mode
+#define AIN_TRIG        0x8   // Use Trigger
+#define AIN_RETRIG_MODE 0x40  // Retrigger Mode (rearm after retrig_count scans)
+
+/* Trigger Configuration Options */
+#define TRIG_EDGE       0x1   // 1 = edge, 0 = level
+#define TRIG_RISING     0x2   // 1 = high / rising, 0 = low / falling
+
 /* Ananlog Output Scan Options */
 #define AO_CHAN0       0x1   // Include Channel 0 in output scan
 #define AO_CHAN1       0x2   // Include Channel 1 in output scan
@@ -100,6 +109,11 @@ extern "C" {
 #define BP_2V  0x2      // +/- 2V
 #define BP_1V  0x3      // +/- 1V
   
+/* Calibration tables in EEPROM */
+#define CAL_AIN_ADDRESS   0x7000
+#define CAL_AOUT_ADDRESS  0x7080
+#define CAL_CACHE_MAGIC   "MCCC"
+
 /* Status bit values */
 #define AIN_SCAN_RUNNING   (0x1 << 1)
 #define AIN_SCAN_OVERRUN   (0x1 << 2)
@@ -111,6 +125,7 @@ extern "C" {
 #define FPGA_CONFIG_MODE   (0x1 << 9)
 
 #define NCHAN_1608G          16  // max number of A/D channels in the device
+#define MAX_SCAN_LIST_1608G  15  // entries in the AIN_CONFIG scan list
 #define NGAINS_1608G          4  // max number of gain levels
 #define NCHAN_AO_1608GX       2  // number of analog output channels
 #define MAX_PACKET_SIZE_HS  512  // max packet size for HS device
@@ -129,6 +144,142 @@ typedef struct ScanList_t {
   uint8_t channel;
 } ScanList;
 
+/* Binary scan output (read-usb1608G, daq-usb1608G), little-endian.  The
+   header is followed by nScan*nChan uint16_t calibrated A/D codes
+   interleaved by channel.  Volts for channel j are
+   (code - 32768)*range[j]/32768.  When the scan had to be restarted
+   after an overrun, gap[] lists the first scan of each restart: the
+   data before and after it are not contiguous in time. */
+#define SCAN_HEADER_MAGIC "MCCB"
+#define AIN_SCAN_MAX_GAPS 16           // restarts recorded per scan
+typedef struct ScanHeader_t {
+  char magic[4];               // "MCCB"
+  uint32_t headerSize;         // offset of the sample data in bytes
+  uint32_t nChan;              // channels per scan
+  uint32_t nScan;              // number of scans
+  double frequency;            // sample rate per channel (Hz)
+  uint8_t range[NCHAN_1608G];  // full scale range per channel in volts (10, 5, 2 or 1)
+  uint32_t nGaps;              // restarts after an overrun
+  uint32_t gap[AIN_SCAN_MAX_GAPS];  // scan index at which each restart begins
+} ScanHeader;
+
+/* Blocking scan read with overrun recovery (usbAInScanReadResult_USB1608G_r) */
+#define AIN_SCAN_CHUNK          65536   // bytes per bulk read
+
+typedef struct AInScanGap_t {
+  uint32_t scan;             // first scan after the restart (index into data)
+  uint32_t scansLost;        // pacer periods not covered while the scan was down
+  double time;               // seconds from the start of the read to the overrun
+} AInScanGap;
+
+typedef struct AInScanResult_t {
+  uint32_t scansRequested;
+  uint32_t scansDelivered;   // scans written to data, contiguous except at gap[]
+  uint32_t scansDropped;     // sum of gap[].scansLost
+  int nOverruns;             // overruns seen (restarts beyond AIN_SCAN_MAX_GAPS are counted but not listed)
+  int nGaps;
+  AInScanGap gap[AIN_SCAN_MAX_GAPS];
+  double elapsed;            // seconds spent in the read
+  int error;                 // libusb error that ended the read early, 0 if none
+} AInScanResult;
+
+/* FPGA bitstream load */
+#define FPGA_DATA_SIZE          64      // largest FPGA_DATA payload the firmware accepts
+#define FPGA_LOAD_INFLIGHT      32      // FPGA_DATA control transfers kept queued while loading
+
+/* Asynchronous (streaming) analog input scan */
+#define AIN_STREAM_NTRANSFERS   8       // bulk IN transfers kept queued on endpoint 6
+#define AIN_STREAM_XFER_SIZE    16384   // default bytes per transfer (rounded to wMaxPacketSize)
+
+/* Stream events passed to the user callback */
+#define AIN_STREAM_DATA     0   // data points to nSamples new samples (interleaved by channel)
+#define AIN_STREAM_OVERRUN  1   // device reported AIN_SCAN_OVERRUN; the scan has been stopped
+#define AIN_STREAM_DONE     2   // all requested scans have been delivered
+#define AIN_STREAM_ERROR    3   // a transfer failed; nSamples holds the libusb_transfer_status
+
+typedef void (*AInStreamCallback)(int event, uint16_t *data, int nSamples, void *userData);
+
+/* Asynchronous (streaming) analog output scan, USB-1608GX-2AO only */
+#define AOUT_STREAM_NBUFFERS    2       // double buffered: one transfer on the bus while the other is refilled
+#define AOUT_STREAM_XFER_SIZE   16384   // default bytes per transfer (rounded to whole scans)
+#define AOUT_STREAM_DRAIN_TIMEOUT 1000  // ms allowed for the FIFO to play out, on top of the buffered scans
+
+/* Fills volts with up to nScans scans (interleaved by channel) and returns
+   the number written.  Returning fewer than nScans ends a finite scan;
+   a continuous scan (count = 0) sends the short block and ends when fill
+   returns 0. */
+typedef int (*AOutStreamFill)(float *volts, int nScans, void *userData);
+
+/* Per-device state.  Every function with an _r suffix works on one of
+   these.  A board opened with usbOpen_USB1608G_r gets its own libusb
+   context, so its stream and FPGA load callbacks only run in the thread
+   that polls that board, and several boards can be driven from separate
+   threads (one thread per board).  Handles passed to
+   usbOpenHandle_USB1608G_r use the default libusb context, whose events
+   any thread may handle: poll all such boards from a single thread.  The
+   older functions that take a bare libusb_device_handle share a single
+   internal instance and are kept for existing programs. */
+typedef struct usbDevice1608G_t {
+  libusb_device_handle *udev;
+  libusb_context *ctx;                         // context udev was opened in, NULL for the default one
+  int wMaxPacketSize;                          // bulk packet size, set by usbInit_1608G_r
+  uint8_t scan_list[MAX_SCAN_LIST_1608G];      // scan list as sent to the device by usbAInConfig_USB1608G_r
+  float table_AIn[NGAINS_1608G][2];            // A/D calibration (slope, offset) per gain
+  float table_AOut[NCHAN_AO_1608GX][2];        // D/A calibration (slope, offset) per channel, 1608GX-2AO only
+  char serial[9];                              // USB serial number
+  double fpgaLoadTime;                         // seconds spent loading the FPGA at open, 0 if it was already configured
+} usbDevice1608G;
+
+/* On-disk copy of the calibration tables, one file per serial number,
+   so usbOpen_USB1608G_r can skip the EEPROM on later runs.  The files go
+   in $MCC_CAL_CACHE, or by default in ~/.cache/mcc, which the first save
+   creates.  Set MCC_CAL_CACHE to "" to turn the cache off, and delete
+   the file after recalibrating a board.  Only tables read successfully
+   from the EEPROM are saved. */
+typedef struct CalCache_t {
+  char magic[4];                               // "MCCC"
+  uint32_t productId;
+  char serial[12];
+  float table_AIn[NGAINS_1608G][2];
+  float table_AOut[NCHAN_AO_1608GX][2];
+} CalCache;
+
+typedef struct AInStream_t {
+  usbDevice1608G *usbdev;
+  struct libusb_transfer *transfer[AIN_STREAM_NTRANSFERS];
+  uint8_t *buffer[AIN_STREAM_NTRANSFERS];
+  int transferSize;          // bytes per bulk transfer
+  int nPending;              // transfers currently submitted
+  int nChan;                 // channels in the scan list
+  uint64_t bytesTotal;       // bytes in the whole scan (0 = continuous)
+  uint64_t bytesSubmitted;   // bytes requested from the device so far
+  uint64_t bytesReceived;    // bytes delivered to the callback so far
+  volatile int running;      // cleared on stop, overrun, error or completion
+  int failed;                // set by the transfer callback on a stall or error
+  AInStreamCallback callback;
+  void *userData;
+} AInStream;
+
+typedef struct AOutStream_t {
+  usbDevice1608G *usbdev;
+  struct libusb_transfer *transfer[AOUT_STREAM_NBUFFERS];
+  uint8_t *buffer[AOUT_STREAM_NBUFFERS];
+  float *volts;              // scratch buffer handed to fill
+  int transferScans;         // scans per bulk transfer
+  int nPending;              // transfers currently submitted
+  int nChan;                 // 1 or 2 channels in the scan
+  float slope[NCHAN_AO_1608GX];
+  float offset[NCHAN_AO_1608GX];
+  uint64_t scansTotal;       // scans in the whole output scan (0 = until fill runs out)
+  uint64_t scansQueued;      // scans handed to the device so far
+  double frequency;          // scan rate, 0 if paced by AO_CLK_IN
+  volatile int running;      // cleared on stop, underrun, error or completion
+  int exhausted;             // fill returned a short block
+  int failed;                // set by the transfer callback on a stall or error
+  AOutStreamFill fill;
+  void *userData;
+} AOutStream;
+
 /* function prototypes for the USB-1608G */
 void usbDTristateW_USB1608G(libusb_device_handle *udev, uint16_t value);
 uint16_t usbDTristateR_USB1608G(libusb_device_handle *udev);
@@ -143,6 +294,7 @@ void usbReset_USB1608G(libusb_device_handle *udev);
 void usbFPGAConfig_USB1608G(libusb_device_handle *udev);
 void usbFPGAData_USB1608G(libusb_device_handle *udev, uint8_t *data, uint8_t length);
 void usbFPGAVersion_USB1608G(libusb_device_handle *udev, uint16_t *version);
+int usbFPGALoad_USB1608G(libusb_device_handle *udev, const uint8_t *data, int length);
 uint16_t usbStatus_USB1608G(libusb_device_handle *udev);
 void usbInit_1608G(libusb_device_handle *udev);
 void usbCounterInit_USB1608G(libusb_device_handle *udev, uint8_t counter);
@@ -159,7 +311,7 @@ void usbTimerDelayR_USB1608G(libusb_device_handle *udev, uint32_t *delay);
 void usbTimerDelayW_USB1608G(libusb_device_handle *udev, uint32_t delay);
 void usbTimerParamsR_USB1608G(libusb_device_handle *udev, timerParams *params);
 void usbTimerParamsW_USB1608G(libusb_device_handle *udev, timerParams *params);
-void usbMemoryR_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length);
+int usbMemoryR_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length);
 void usbMemoryW_USB1608G(libusb_device_handle *udev, uint8_t *data, uint16_t length);
 void usbMemAddressR_USB1608G(libusb_device_handle *udev, uint16_t address);
 void usbMemAddressW_USB1608G(libusb_device_handle *udev, uint16_t address);
@@ -173,11 +325,22 @@ uint16_t usbAIn_USB1608G(libusb_device_handle *udev, uint16_t channel);
 void usbAInScanStart_USB1608G(libusb_device_handle *udev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options);
 void usbAInScanStop_USB1608G(libusb_device_handle *udev);
 int usbAInScanRead_USB1608G(libusb_device_handle *udev, int nScan, int nChan, uint16_t *data);
+int usbAInScanReadTimeout_USB1608G(libusb_device_handle *udev, int nScan, int nChan, uint16_t *data, unsigned int timeout);
+int usbAInStreamStart_USB1608G(libusb_device_handle *udev, AInStream *stream, uint32_t count, int nChan, double frequency,
+			       uint8_t options, int transferSize, AInStreamCallback callback, void *userData);
+int usbAInStreamPoll_USB1608G(AInStream *stream, int timeout);
+void usbAInStreamStop_USB1608G(AInStream *stream);
 void usbAInConfig_USB1608G(libusb_device_handle *udev, ScanList scanList[NCHAN_1608G]);
 int usbAInConfigR_USB1608G(libusb_device_handle *udev, uint8_t *scanList);
 void usbAInScanClearFIFO_USB1608G(libusb_device_handle *udev);
 void usbBuildGainTable_USB1608G(libusb_device_handle *udev, float table[NGAINS_1608G][2]);
 double volts_USB1608G(libusb_device_handle *udev, const uint8_t gain, uint16_t value);
+void usbAInScanCoefficients_USB1608G(float table_AIN[NGAINS_1608G][2], ScanList list[NCHAN_1608G], int nChan, float slope[], float offset[]);
+int usbAInScanList_USB1608G(ScanList list[], int nChan);
+void usbAInScanVolts_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[], float *volts);
+void usbAInScanVoltsChannels_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[],
+				      float *volts[]);
+void usbAInScanVoltsD_USB1608G(const uint16_t *data, int nScan, int nChan, const float slope[], const float offset[], double *volts);
 void usbBuildGainTable_USB1608GX_2AO(libusb_device_handle *udev, float table_AO[NCHAN_AO_1608GX][2]);
 uint16_t voltsTou16_USB1608GX_AO(double volts, int channel, float table_AO[NCHAN_AO_1608GX][2]);
 void usbAOut_USB1608GX_2AO(libusb_device_handle *udev, uint8_t channel, double voltage, float table_AO[NCHAN_AO_1608GX][2]);
@@ -185,6 +348,34 @@ void usbAOutR_USB1608GX_2AO(libusb_device_handle *udev, uint8_t channel, double
 void usbAOutScanStop_USB1608GX_2AO(libusb_device_handle *udev);
 void usbAOutScanClearFIFO_USB1608GX_2AO(libusb_device_handle *udev);
 void usbAOutScanStart_USB1608GX_2AO(libusb_device_handle *udev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options);
+void usbAOutScanCoefficients_USB1608GX_2AO(float table_AO[NCHAN_AO_1608GX][2], uint8_t channels, float slope[], float offset[]);
+void usbAOutScanCodes_USB1608GX_2AO(const float *volts, int nScan, int nChan, const float slope[], const float offset[], uint16_t *codes);
+int usbAOutStreamStart_USB1608GX_2AO_r(usbDevice1608G *usbdev, AOutStream *stream, uint32_t count, double frequency,
+				       uint8_t options, int transferSize, AOutStreamFill fill, void *userData);
+int usbAOutStreamPoll_USB1608GX_2AO(AOutStream *stream, int timeout);
+void usbAOutStreamStop_USB1608GX_2AO(AOutStream *stream);
+
+/* reentrant, per-device versions */
+int usbReadCalTables_USB1608G_r(usbDevice1608G *usbdev, int aOut);
+int usbLoadCalCache_USB1608G_r(usbDevice1608G *usbdev, int productId);
+int usbSaveCalCache_USB1608G_r(usbDevice1608G *usbdev, int productId);
+int usbOpen_USB1608G_r(usbDevice1608G *usbdev, int productId, char *serialID);
+int usbOpenHandle_USB1608G_r(usbDevice1608G *usbdev, libusb_device_handle *udev, int productId);
+void usbClose_USB1608G_r(usbDevice1608G *usbdev);
+void usbInit_1608G_r(usbDevice1608G *usbdev);
+int usbFPGAEnsureConfigured_USB1608G_r(usbDevice1608G *usbdev, double *loadTime);
+void usbBuildGainTable_USB1608G_r(usbDevice1608G *usbdev);
+void usbBuildGainTable_USB1608GX_2AO_r(usbDevice1608G *usbdev);
+void usbAInScanStart_USB1608G_r(usbDevice1608G *usbdev, uint32_t count, uint32_t retrig_count, double frequency, uint8_t options);
+int usbAInScanRead_USB1608G_r(usbDevice1608G *usbdev, int nScan, int nChan, uint16_t *data);
+int usbAInScanReadTimeout_USB1608G_r(usbDevice1608G *usbdev, int nScan, int nChan, uint16_t *data, unsigned int timeout);
+int usbAInScanReadResult_USB1608G_r(usbDevice1608G *usbdev, uint32_t nScan, int nChan, double frequency, uint8_t options,
+				    int maxRestarts, uint16_t *data, AInScanResult *result);
+void usbTriggerConfig_USB1608G_r(usbDevice1608G *usbdev, uint8_t options);
+void usbAInConfig_USB1608G_r(usbDevice1608G *usbdev, ScanList scanList[NCHAN_1608G]);
+int usbAInConfigR_USB1608G_r(usbDevice1608G *usbdev, uint8_t *scanList);
+int usbAInStreamStart_USB1608G_r(usbDevice1608G *usbdev, AInStream *stream, uint32_t count, int nChan, double frequency,
+				 uint8_t options, int transferSize, AInStreamCallback callback, void *userData);
 
 
 #ifdef __cplusplus
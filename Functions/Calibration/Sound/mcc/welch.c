@@ -0,0 +1,219 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "welch.h"
+
+typedef struct WelchJob_t {
+  const float *x;
+  int stride;
+  int segmentLength;
+  int firstSegment;
+  int nSegments;
+  const double *window;
+  const double *cosTable;   // cos(2*pi*k/N), k < N/2
+  const double *sinTable;
+  double *sum;              // this job's sum of |X|^2 over its segments
+} WelchJob;
+
+int welchNumBins(int segmentLength)
+{
+  return segmentLength/2 + 1;
+}
+
+static void fft(double *re, double *im, int n, const double *cosTable, const double *sinTable)
+{
+  /* In-place iterative radix-2 FFT; n is a power of 2. */
+  int i, j, k, len, half, step;
+  double tr, ti, ur, ui;
+
+  for (i = 1, j = 0; i < n; i++) {  // bit reversal permutation
+    for (k = n >> 1; j & k; k >>= 1) j ^= k;
+    j |= k;
+    if (i < j) {
+      tr = re[i]; re[i] = re[j]; re[j] = tr;
+      ti = im[i]; im[i] = im[j]; im[j] = ti;
+    }
+  }
+  for (len = 2; len <= n; len <<= 1) {
+    half = len >> 1;
+    step = n/len;
+    for (i = 0; i < n; i += len) {
+      for (k = 0; k < half; k++) {
+	ur = cosTable[k*step];
+	ui = -sinTable[k*step];
+	tr = re[i+k+half]*ur - im[i+k+half]*ui;
+	ti = re[i+k+half]*ui + im[i+k+half]*ur;
+	re[i+k+half] = re[i+k] - tr;
+	im[i+k+half] = im[i+k] - ti;
+	re[i+k] += tr;
+	im[i+k] += ti;
+      }
+    }
+  }
+}
+
+int welchFFT(double *re, double *im, int n)
+{
+  double *cosTable, *sinTable;
+  int i;
+
+  if (n < 2 || (n & (n-1))) return -1;
+  cosTable = malloc((n/2)*sizeof(double));
+  sinTable = malloc((n/2)*sizeof(double));
+  if (cosTable == NULL || sinTable == NULL) {
+    free(cosTable); free(sinTable);
+    return -1;
+  }
+  for (i = 0; i < n/2; i++) {
+    cosTable[i] = cos(2*M_PI*i/n);
+    sinTable[i] = sin(2*M_PI*i/n);
+  }
+  fft(re, im, n, cosTable, sinTable);
+  free(cosTable);
+  free(sinTable);
+  return 0;
+}
+
+static void *welchWorker(void *arg)
+{
+  WelchJob *job = (WelchJob *) arg;
+  int L = job->segmentLength;
+  int nBins = welchNumBins(L);
+  double *re = malloc(L*sizeof(double));
+  double *im = malloc(L*sizeof(double));
+  const float *segment;
+  int s, i;
+
+  if (re == NULL || im == NULL) {
+    free(re); free(im);
+    return (void *) -1;
+  }
+  for (s = job->firstSegment; s < job->firstSegment + job->nSegments; s++) {
+    segment = job->x + (long) s*(L/2)*job->stride;
+    for (i = 0; i < L; i++) {
+      re[i] = segment[(long) i*job->stride]*job->window[i];
+      im[i] = 0.0;
+    }
+    fft(re, im, L, job->cosTable, job->sinTable);
+    for (i = 0; i < nBins; i++) {
+      job->sum[i] += re[i]*re[i] + im[i]*im[i];
+    }
+  }
+  free(re);
+  free(im);
+  return NULL;
+}
+
+int welchPSD(const float *x, long n, int stride, double fs, int segmentLength, int nThreads, double *psd)
+{
+  int L = segmentLength;
+  int nBins = welchNumBins(L);
+  int nSegments, perThread, extra, first, t, i;
+  double *window, *cosTable, *sinTable, *sums;
+  double U = 0.0, scale;
+  WelchJob job[WELCH_MAX_THREADS];
+  pthread_t thread[WELCH_MAX_THREADS];
+  int failed = 0;
+  void *ret;
+
+  if (L < 2 || (L & (L-1)) || n < L || stride < 1 || fs <= 0) return -1;
+  nSegments = (n - L/2)/(L/2);   // MATLAB: fix((n - noverlap)/(L - noverlap))
+  if (nThreads <= 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads > WELCH_MAX_THREADS) nThreads = WELCH_MAX_THREADS;
+  if (nThreads > nSegments) nThreads = nSegments;
+  if (nThreads < 1) nThreads = 1;
+
+  window = malloc(L*sizeof(double));
+  cosTable = malloc((L/2)*sizeof(double));
+  sinTable = malloc((L/2)*sizeof(double));
+  sums = calloc((size_t) nThreads*nBins, sizeof(double));
+  if (window == NULL || cosTable == NULL || sinTable == NULL || sums == NULL) {
+    free(window); free(cosTable); free(sinTable); free(sums);
+    return -1;
+  }
+  for (i = 0; i < L; i++) {  // symmetric Hamming window, as MATLAB hamming(L)
+    window[i] = 0.54 - 0.46*cos(2*M_PI*i/(L-1));
+    U += window[i]*window[i];
+  }
+  for (i = 0; i < L/2; i++) {
+    cosTable[i] = cos(2*M_PI*i/L);
+    sinTable[i] = sin(2*M_PI*i/L);
+  }
+
+  // Split the segments into contiguous runs, one per thread
+  perThread = nSegments/nThreads;
+  extra = nSegments%nThreads;
+  for (t = 0, first = 0; t < nThreads; t++) {
+    job[t].x = x;
+    job[t].stride = stride;
+    job[t].segmentLength = L;
+    job[t].firstSegment = first;
+    job[t].nSegments = perThread + (t < extra);
+    job[t].window = window;
+    job[t].cosTable = cosTable;
+    job[t].sinTable = sinTable;
+    job[t].sum = &sums[(size_t) t*nBins];
+    first += job[t].nSegments;
+  }
+  for (t = 1; t < nThreads; t++) {
+    if (pthread_create(&thread[t], NULL, welchWorker, &job[t]) != 0) {
+      if (welchWorker(&job[t]) != NULL) failed = 1;  // run it here if no thread is available
+      thread[t] = 0;
+    }
+  }
+  if (welchWorker(&job[0]) != NULL) failed = 1;
+  for (t = 1; t < nThreads; t++) {
+    if (thread[t] && (pthread_join(thread[t], &ret) != 0 || ret != NULL)) failed = 1;
+  }
+
+  // Average over segments; one-sided PSD doubles every bin except DC and Nyquist
+  scale = 1.0/(fs*U*nSegments);
+  for (i = 0; i < nBins; i++) {
+    psd[i] = 0.0;
+    for (t = 0; t < nThreads; t++) psd[i] += sums[(size_t) t*nBins + i];
+    psd[i] *= (i == 0 || i == nBins-1) ? scale : 2.0*scale;
+  }
+
+  free(window); free(cosTable); free(sinTable); free(sums);
+  return failed ? -1 : nSegments;
+}
+
+double welchBandPower(const double *psd, int segmentLength, double fs, double fLow, double fHigh)
+{
+  int nBins = welchNumBins(segmentLength);
+  double df = fs/segmentLength;
+  double sum = 0.0;
+  int iLow, iHigh, i;
+
+  iLow = (int) floor(fLow/df + 0.5);   // nearest bin, as min(abs(PSDfreq - f)) in band_power.m
+  iHigh = (int) floor(fHigh/df + 0.5);
+  if (iLow < 0) iLow = 0;
+  if (iHigh > nBins-1) iHigh = nBins-1;
+  if (iHigh < iLow) return 0.0;
+  for (i = iLow; i <= iHigh; i++) sum += psd[i];
+  return sum/(iHigh - iLow + 1)*((iHigh - iLow)*df);
+}
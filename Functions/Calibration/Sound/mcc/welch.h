@@ -0,0 +1,62 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Welch power spectral density and band power estimates for sound
+  calibration.  Equivalent to MATLAB's psd(spectrum.welch, x, 'Fs', fs)
+  (Hamming window, 50% overlap, one-sided PSD) followed by band_power.m,
+  so results can be compared directly with the MATLAB path.
+*/
+
+#ifndef WELCH_H
+#define WELCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WELCH_SEGMENT_LENGTH 16384   // default segment length (response_one_sound.m)
+#define WELCH_MAX_THREADS    16
+
+/* In-place complex FFT of n (a power of 2) points. Returns -1 on error. */
+int welchFFT(double *re, double *im, int n);
+
+/* Number of one-sided PSD bins for a segment length (nfft/2 + 1). */
+int welchNumBins(int segmentLength);
+
+/*
+  Welch PSD of n samples of x taken every stride elements (stride =
+  nChan reads one channel straight out of an interleaved scan buffer,
+  e.g. the output of usbAInScanVolts_USB1608G).  segmentLength must be a
+  power of 2; segments overlap by 50% and are processed by up to
+  nThreads threads (0 = one per available CPU).  psd must hold
+  welchNumBins(segmentLength) values, in units^2/Hz.  Returns the number
+  of segments averaged, or -1 on error.
+*/
+int welchPSD(const float *x, long n, int stride, double fs, int segmentLength, int nThreads, double *psd);
+
+/* Same as band_power.m: mean PSD between the bins nearest fLow and fHigh times the band width. */
+double welchBandPower(const double *psd, int segmentLength, double fs, double fLow, double fHigh);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif //WELCH_H
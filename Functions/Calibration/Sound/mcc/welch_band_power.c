@@ -0,0 +1,77 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX wrapper for welch.c, a drop-in for the psd(spectrum.welch)/band_power
+  pair in response_one_sound.m:
+
+    [BandPower, PSD, Frequencies] = welch_band_power(Signal, Fs, BandLimits, SegmentLength)
+
+  BandLimits is an N x 2 matrix of [low high] frequencies (Hz); BandPower
+  is N x 1.  SegmentLength is optional (default 16384) and must be a
+  power of 2.  Build with "make mex" in this folder.
+*/
+
+#include <stdlib.h>
+#include "mex.h"
+#include "welch.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  const double *signal, *bands;
+  double fs, *psd, *out;
+  float *x;
+  mwSize n, nBands;
+  int segmentLength = WELCH_SEGMENT_LENGTH;
+  int nBins, i;
+
+  if (nrhs < 3 || !mxIsDouble(prhs[0]) || !mxIsDouble(prhs[2]) || mxGetN(prhs[2]) != 2) {
+    mexErrMsgIdAndTxt("Bpod:welch_band_power", "Usage: welch_band_power(Signal, Fs, BandLimits [Nx2], SegmentLength)");
+  }
+  signal = mxGetPr(prhs[0]);
+  n = mxGetNumberOfElements(prhs[0]);
+  fs = mxGetScalar(prhs[1]);
+  bands = mxGetPr(prhs[2]);
+  nBands = mxGetM(prhs[2]);
+  if (nrhs > 3) segmentLength = (int) mxGetScalar(prhs[3]);
+  nBins = welchNumBins(segmentLength);
+
+  x = mxMalloc(n*sizeof(float));
+  for (i = 0; i < n; i++) x[i] = (float) signal[i];
+  plhs[1] = mxCreateDoubleMatrix(nBins, 1, mxREAL);
+  psd = mxGetPr(plhs[1]);
+  if (welchPSD(x, n, 1, fs, segmentLength, 0, psd) < 0) {
+    mxFree(x);
+    mexErrMsgIdAndTxt("Bpod:welch_band_power", "Signal must be at least SegmentLength samples and SegmentLength a power of 2.");
+  }
+  mxFree(x);
+
+  plhs[0] = mxCreateDoubleMatrix(nBands, 1, mxREAL);
+  out = mxGetPr(plhs[0]);
+  for (i = 0; i < nBands; i++) {
+    out[i] = welchBandPower(psd, segmentLength, fs, bands[i], bands[i + nBands]);
+  }
+  if (nlhs > 2) {
+    plhs[2] = mxCreateDoubleMatrix(nBins, 1, mxREAL);
+    out = mxGetPr(plhs[2]);
+    for (i = 0; i < nBins; i++) out[i] = i*fs/segmentLength;
+  }
+}
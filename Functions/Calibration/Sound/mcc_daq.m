@@ -1,6 +1,8 @@
 function [data] = mcc_daq(varargin)
 
-options = struct('n_scan',1,'freq',1000,'n_chan',16,'range', 10);
+options = struct('n_scan',1,'freq',1000,'n_chan',8,'range', 10, 'binary', true,...
+                 'port', 51608, 'trigger', '', 'retrig_count', 0,...
+                 'channels', [], 'mode', '');
 
 optionNames = fieldnames(options);
 
@@ -20,15 +22,136 @@ for pair = reshape(varargin,2,[])
     end
 end
 
-%./read-usb1608G n_chan n_scan range freq
-[status,cmdout] = system(['./read-usb1608G ' num2str(options.n_chan) ' ' num2str(options.n_scan) ' ' num2str(options.range) ' ' num2str(options.freq)]);
-d = sscanf(cmdout,'%f');
+% The 1608G scan list holds 15 entries (MAX_SCAN_LIST_1608G); the default of 8
+% is every differential input.
+if options.n_chan < 1 || options.n_chan > 15 || options.n_chan ~= round(options.n_chan)
+    error('mcc_daq: n_chan must be 1 to 15, the length of the 1608G scan list')
+end
 
-try
-    data = reshape(d,options.n_chan,options.n_scan);
-catch ME
-    disp('ERROR')
-    disp(cmdout)
+% Hardware trigger ('rising', 'falling', 'high' or 'low' on the 1608G TRIG input).
+% With retrig_count > 0, one scan returns n_scan/retrig_count windows, one per trigger.
+triggerArgs = '';
+if ~isempty(options.trigger)
+    triggerArgs = ['-t ' options.trigger ' '];
+    if options.retrig_count > 0
+        triggerArgs = [triggerArgs '-r ' num2str(options.retrig_count) ' '];
+    end
+end
+
+% Scan list: 'channels' (e.g. [0 9]), 'mode' ('diff', 'se' or a cell array with
+% one per channel) and 'range' (one value or one per channel) select the inputs;
+% by default channels 0..n_chan-1 are read differentially.
+listArgs = '';
+if ~isempty(options.channels)
+    listArgs = [listArgs '-c ' strjoin(arrayfun(@num2str, options.channels, 'UniformOutput', false), ',') ' '];
+end
+if ~isempty(options.mode)
+    listArgs = [listArgs '-m ' strjoin(cellstr(options.mode), ',') ' '];
+end
+rangeArg = strjoin(arrayfun(@num2str, options.range, 'UniformOutput', false), ',');
+
+% If a daq-usb1608G server is running (./daq-usb1608G -d), ask it for the scan
+% over its TCP port instead of opening and initializing the device again.  It
+% only does free-running differential scans of channels 0..n_chan-1; for
+% anything else it is stopped, since it holds the device read-usb1608G needs.
+if options.binary && isempty(triggerArgs) && isempty(listArgs) && isscalar(options.range)
+    data = serverScan(options);
+    if ~isempty(data)
+        return
+    end
+end
+stopServer(options.port);
+
+if options.binary
+    % Binary mode: read-usb1608G writes a header + uint16 samples to a file
+    % (memory-mapped on the C side), read back here with two freads.
+    dataFile = [tempname '.bin'];
+    scanArgs = [num2str(options.n_chan) ' ' num2str(options.n_scan) ' ' rangeArg ' ' num2str(options.freq) ' ' dataFile];
+    %./read-usb1608G n_chan n_scan range freq outfile
+    [status,cmdout] = system(['./read-usb1608G ' listArgs triggerArgs scanArgs]);
+    fid = fopen(dataFile, 'r', 'l');
+    if fid < 0 % read-usb1608G built without binary output support printed text instead
+        data = reshape(sscanf(cmdout,'%f'),options.n_chan,options.n_scan);
+        return
+    end
+    magic = fread(fid, 4, '*char')';
+    headerSize = fread(fid, 1, 'uint32');
+    nChan = fread(fid, 1, 'uint32');
+    nScan = fread(fid, 1, 'uint32');
+    fread(fid, 1, 'double'); % Sampling rate
+    range = fread(fid, 16, 'uint8');
+    if headerSize > 40 % the scan was restarted after an overrun at each of gaps (1-based scan index)
+        nGaps = fread(fid, 1, 'uint32');
+        gaps = fread(fid, nGaps, 'uint32') + 1;
+        if nGaps > 0
+            warning('mcc_daq: DAQ overrun, data are not contiguous before scans %s', mat2str(gaps'));
+        end
+    end
+    fseek(fid, headerSize, 'bof');
+    codes = fread(fid, [nChan nScan], 'uint16=>double');
+    fclose(fid);
+    delete(dataFile);
+    if ~strcmp(magic, 'MCCB') || size(codes,2) ~= options.n_scan
+        disp('ERROR')
+        disp(cmdout)
+    end
+    data = (codes - 32768).*(range(1:nChan)/32768);
+else
+    %./read-usb1608G n_chan n_scan range freq
+    [status,cmdout] = system(['./read-usb1608G ' listArgs triggerArgs num2str(options.n_chan) ' ' num2str(options.n_scan) ' ' rangeArg ' ' num2str(options.freq)]);
+    d = sscanf(cmdout,'%f');
+
+    try
+        data = reshape(d,options.n_chan,options.n_scan);
+    catch ME
+        disp('ERROR')
+        disp(cmdout)
+    end
 end
 
+function data = serverScan(options)
+% Scan from a daq-usb1608G server on 127.0.0.1:port.  The request is a
+% ScanRequest ("MCCR", uint32 n_chan, n_scan, range, double freq); the reply
+% a ScanHeader and the calibrated uint16 samples (see daq-usb1608G.c).
+% Returns [] if no server is running or it rejected the request.
+data = [];
+try
+    t = tcpclient('127.0.0.1', options.port, 'Timeout', 5 + options.n_scan/options.freq);
+catch
+    return
+end
+write(t, [uint8('MCCR') typecast(uint32([options.n_chan options.n_scan options.range]), 'uint8')...
+          typecast(double(options.freq), 'uint8')]);
+header = read(t, 8, 'uint8');
+if numel(header) < 8
+    return
+end
+header = [header read(t, double(typecast(header(5:8), 'uint32')) - 8, 'uint8')];
+nChan = double(typecast(header(9:12), 'uint32'));
+nScan = double(typecast(header(13:16), 'uint32'));
+if nScan == 0
+    return
+end
+range = double(header(25:40))';
+nGaps = typecast(header(41:44), 'uint32');
+if nGaps > 0 % the scan was restarted after an overrun at each of gaps (1-based scan index)
+    gaps = typecast(header(45:44+4*nGaps), 'uint32') + 1;
+    warning('mcc_daq: DAQ overrun, data are not contiguous before scans %s', mat2str(gaps));
+end
+codes = double(read(t, nChan*nScan, 'uint16'));
+if numel(codes) ~= nChan*nScan || nScan ~= options.n_scan
+    disp('ERROR: short scan from daq-usb1608G')
+    return
+end
+data = (reshape(codes, nChan, nScan) - 32768).*(range(1:nChan)/32768);
 
+function stopServer(port)
+% Asks a daq-usb1608G server to release the device and exit (./daq-usb1608G -q).
+% It answers once the device is closed.
+try
+    t = tcpclient('127.0.0.1', port, 'Timeout', 5);
+catch
+    return
+end
+write(t, [uint8('MCCQ') zeros(1, 20, 'uint8')]);
+read(t, 8, 'uint8');
@@ -83,8 +83,13 @@ else
 end
 
 % --- Calculate power ---
-ThisPSD = psd(hPSD,RawSignal,'Fs',Parameters.FsIn);
-BandPower = band_power(ThisPSD.Data,ThisPSD.Frequencies,BandLimits);
+if exist('welch_band_power','file') == 3 % native Welch estimate (mcc/welch_band_power.c), same result
+    [BandPower, PSDData, PSDFreq] = welch_band_power(RawSignal, Parameters.FsIn, BandLimits([1 end]), hPSD.SegmentLength);
+    ThisPSD = struct('Data', PSDData, 'Frequencies', PSDFreq);
+else
+    ThisPSD = psd(hPSD,RawSignal,'Fs',Parameters.FsIn);
+    BandPower = band_power(ThisPSD.Data,ThisPSD.Frequencies,BandLimits);
+end
 
 
 function StimuliVec=SqCosBeeper(RR,SR,Freq,BeepDuration,CosRamp,MaxToneDuration)
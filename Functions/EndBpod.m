@@ -96,7 +96,7 @@ if ~isempty(BpodSystem)
         end
 
         % Stop and clear timers
-        stop(BpodSystem.Timers.AnalogTimer);
+        BpodSystem.analogAcquisition('stop');
         delete(BpodSystem.Timers.AnalogTimer);
         BpodSystem.Timers.AnalogTimer = [];
         stop(BpodSystem.Timers.PortRelayTimer);
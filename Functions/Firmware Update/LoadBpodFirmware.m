@@ -183,6 +183,8 @@ classdef LoadBpodFirmware < handle
                 fsmPort = [];
                 if ~isempty(BpodSystem.AnalogSerialPort)
                     analogPort = BpodSystem.AnalogSerialPort.PortName;
+                elseif BpodSystem.Status.NativeAnalog % BpodFlexIOAcquisition holds the analog port during the session
+                    analogPort = BpodSystem.Status.AnalogPortName;
                 end
                 if excludeFSM
                     fsmPort = BpodSystem.SerialPort.PortName;
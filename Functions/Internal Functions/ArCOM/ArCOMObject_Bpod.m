@@ -144,7 +144,11 @@ classdef ArCOMObject_Bpod < handle
             end
 
             obj.Port = [];
-            obj.InBuffer = BpodDoubleSidedBuffer(obj.InputBufferSize);
+            if exist('BpodRingBuffer', 'file') == 3
+                obj.InBuffer = BpodMirroredBuffer(obj.InputBufferSize);
+            else
+                obj.InBuffer = BpodDoubleSidedBuffer(obj.InputBufferSize);
+            end
             if (exist('OCTAVE_VERSION'))
                 try
                     pkg load instrument-control
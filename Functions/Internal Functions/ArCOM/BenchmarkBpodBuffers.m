@@ -0,0 +1,90 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the 
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% BenchmarkBpodBuffers() times ArCOM's input buffer pattern (write the bytes that
+% arrived from the port, then read the messages in them) through BpodDoubleSidedBuffer
+% and through BpodMirroredBuffer, and checks that both return the same bytes.
+% BpodMirroredBuffer requires the BpodRingBuffer MEX ("make mex" in
+% /Functions/Internal Functions/Native).
+%
+% Arguments (optional):
+% nMessages, the number of messages to read (default 100000)
+% bufferSizeInBytes, the size of each buffer (default 1000000, as ArCOM's)
+%
+% Returns:
+% Results, a struct with the time in seconds and the MB/s through each buffer
+%
+% Example usage: Results = BenchmarkBpodBuffers(100000);
+
+function Results = BenchmarkBpodBuffers(varargin)
+
+nMessages = 100000;
+bufferSizeInBytes = 1000000;
+if nargin > 0
+    nMessages = varargin{1};
+end
+if nargin > 1
+    bufferSizeInBytes = varargin{2};
+end
+if exist('BpodRingBuffer', 'file') ~= 3
+    error('Error: the BpodRingBuffer MEX was not found. Build it with "make mex" in /Functions/Internal Functions/Native.');
+end
+
+% The same arrivals (1-256 bytes) and messages (1-16 bytes) for both buffers
+rng(2468);
+arrivalSizes = randi(256, 1, nMessages);
+messageSizes = randi(16, 1, nMessages);
+streamLength = sum(messageSizes);
+stream = uint8(mod(0:streamLength-1, 251));
+
+buffers = {BpodDoubleSidedBuffer(bufferSizeInBytes), BpodMirroredBuffer(bufferSizeInBytes)};
+bufferNames = {'DoubleSided', 'Mirrored'};
+checksums = zeros(1,2);
+for b = 1:2
+    B = buffers{b};
+    streamPos = 1;
+    arrival = 1;
+    checksum = 0;
+    nBytesRead = 0;
+    tic;
+    for m = 1:nMessages
+        nBytes = messageSizes(m);
+        while B.bytesAvailable < nBytes % As ArCOM's read() waits for the port
+            nArrived = min(arrivalSizes(arrival), streamLength-streamPos+1);
+            B.write(stream(streamPos:streamPos+nArrived-1));
+            streamPos = streamPos + nArrived;
+            arrival = mod(arrival, nMessages) + 1;
+        end
+        message = B.read(nBytes);
+        checksum = checksum + double(message(1))*m + double(message(end));
+        nBytesRead = nBytesRead + nBytes;
+    end
+    elapsed = toc;
+    checksums(b) = checksum;
+    Results.(bufferNames{b}).Seconds = elapsed;
+    Results.(bufferNames{b}).MBps = nBytesRead/elapsed/1e6;
+    disp([bufferNames{b} ': ' num2str(nMessages) ' messages in ' num2str(elapsed, 3) ' s ('...
+        num2str(Results.(bufferNames{b}).MBps, 3) ' MB/s)']);
+end
+if checksums(1) ~= checksums(2)
+    error('Error: BpodDoubleSidedBuffer and BpodMirroredBuffer returned different bytes');
+end
+disp(['BpodMirroredBuffer is ' num2str(Results.DoubleSided.Seconds/Results.Mirrored.Seconds, 3)...
+    'x as fast as BpodDoubleSidedBuffer']);
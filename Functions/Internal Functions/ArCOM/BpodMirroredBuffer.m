@@ -0,0 +1,65 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the 
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% The BpodMirroredBuffer class is a drop-in replacement for BpodDoubleSidedBuffer,
+% backed by a native ring buffer (BpodRingBuffer MEX) whose memory is mapped twice,
+% so that every write and read is a single copy. Requires the MEX; build it with
+% "make mex" in /Functions/Internal Functions/Native.
+%
+% Usage:
+% B = BpodMirroredBuffer(bufferSizeInBytes);
+% B.write([1 2 3 4 5]); % Add bytes [1 2 3 4 5] to the buffer
+% message = B.read(5); % Read 5 bytes from the buffer
+
+classdef BpodMirroredBuffer < handle
+    properties (Dependent)
+        bytesAvailable
+    end
+    properties (Access = private)
+        Handle = 0;
+    end
+
+    methods
+        function obj = BpodMirroredBuffer(bufferSizeInBytes)
+            obj.Handle = BpodRingBuffer('create', bufferSizeInBytes);
+        end
+
+        function obj = write(obj,dataIn)
+            BpodRingBuffer('write', obj.Handle, dataIn);
+        end
+
+        function dataOut = read(obj,nBytes)
+            dataOut = BpodRingBuffer('read', obj.Handle, nBytes);
+        end
+
+        function nBytes = get.bytesAvailable(obj)
+            nBytes = BpodRingBuffer('bytesAvailable', obj.Handle);
+        end
+
+        function delete(obj)
+            if obj.Handle > 0
+                try
+                    BpodRingBuffer('delete', obj.Handle);
+                catch % The MEX was cleared, and its buffers with it
+                end
+            end
+        end
+    end
+end
@@ -114,6 +114,8 @@ if ~isempty(BpodSystem.HW.AppSerialPortName)
 end
 if ~isempty(BpodSystem.AnalogSerialPort)
     USBPorts = USBPorts(logical(1-strcmp(USBPorts, BpodSystem.AnalogSerialPort.PortName)));
+elseif BpodSystem.Status.NativeAnalog % BpodFlexIOAcquisition holds the analog port during the session
+    USBPorts = USBPorts(logical(1-strcmp(USBPorts, BpodSystem.Status.AnalogPortName)));
 end
 if ispc
     [Status RawString] = system('chgport'); % Extra step equired to find HARP Sound Card
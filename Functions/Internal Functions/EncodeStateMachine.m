@@ -0,0 +1,313 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% EncodeStateMachine() returns the bytes of a state machine description
+% message, as sent after the 'C' op and its header. It is the reference
+% encoder: SendStateMachine() uses the native encoder BpodStateMachineBytes
+% (/Functions/Internal Functions/Native) when it is built, and
+% BpodSystemTest.state_machine_encoder_test checks that the two agree.
+%
+% Arguments:
+% sma, a state machine description prepared by SendStateMachine(): states
+% in the order they were added, >exit and >back op codes replaced.
+%
+% Returns:
+% byteString, the description (uint8). On firmware v23+ it includes the
+% serial message library ops.
+% serialMessageVector, the ops loading implicit serial messages ([] if none)
+% nModulesLoaded, the number of modules whose serial messages are loaded
+
+function [byteString, serialMessageVector, nModulesLoaded] = EncodeStateMachine(sma)
+
+global BpodSystem % Import the global BpodSystem object
+
+nStates = length(sma.StateNames);
+
+% Determine number of global timers, global counters and conditions used
+nGlobalTimersUsed = find(sma.GlobalTimers.IsSet, 1, 'last');
+nGlobalCountersUsed = find(sma.GlobalCounterSet, 1, 'last');
+nConditionsUsed = find(sma.ConditionSet, 1, 'last');
+if isempty(nGlobalTimersUsed); nGlobalTimersUsed = 0; end
+if isempty(nGlobalCountersUsed); nGlobalCountersUsed = 0; end
+if isempty(nConditionsUsed); nConditionsUsed = 0; end
+
+% Next, format input, output, timer, counter and condition matrices into linear
+% byte vectors for transfer. This employs a compression scheme where only
+% differences from the default matrix are sent.
+
+% First, set up default matrices with 'same state' for every event
+defaultInputMatrix = repmat((1:nStates)', 1, sma.meta.InputMatrixSize);
+defaultExtensionMatrix_GT = defaultInputMatrix(1:nStates, 1:nGlobalTimersUsed);
+defaultExtensionMatrix_GC = defaultInputMatrix(1:nStates, 1:nGlobalCountersUsed);
+defaultExtensionMatrix_C = defaultInputMatrix(1:nStates, 1:nConditionsUsed);
+
+% Compute compressed input matrix
+differenceMatrix = (sma.InputMatrix ~= defaultInputMatrix)';
+nDifferences = sum(differenceMatrix);
+msgLength = sum(nDifferences>0)*2 + nStates;
+inputMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    inputMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = sma.InputMatrix(i,thisState)-1;
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        inputMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+inputMatrix = uint8(inputMatrix);
+
+% Compute compressed output matrix
+outputMatrixRaw = sma.OutputMatrix(:, 1:BpodSystem.HW.Pos.GlobalTimerTrig-1); % All physical channels. 
+                                                                              % Virtual outputs are handled separately
+differenceMatrix = (outputMatrixRaw ~= 0)';
+nDifferences = sum(differenceMatrix, 1);
+msgLength = sum(nDifferences>0)*2 + nStates;
+outputMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    outputMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = outputMatrixRaw(i,thisState);
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        outputMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+if BpodSystem.MachineType == 4
+    outputMatrix = typecast(uint16(outputMatrix), 'uint8');
+else
+    outputMatrix = uint8(outputMatrix);
+end
+
+% Compute compressed global timer start matrix
+differenceMatrix = (sma.GlobalTimerStartMatrix(:,1:nGlobalTimersUsed) ~= defaultExtensionMatrix_GT)';
+nDifferences = sum(differenceMatrix, 1);
+msgLength = sum(nDifferences>0)*2 + nStates;
+globalTimerStartMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    globalTimerStartMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = sma.GlobalTimerStartMatrix(i,thisState)-1;
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        globalTimerStartMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+globalTimerStartMatrix = uint8(globalTimerStartMatrix);
+
+% Compute compressed global timer end matrix
+differenceMatrix = (sma.GlobalTimerEndMatrix(:,1:nGlobalTimersUsed) ~= defaultExtensionMatrix_GT)';
+nDifferences = sum(differenceMatrix, 1);
+msgLength = sum(nDifferences>0)*2 + nStates;
+globalTimerEndMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    globalTimerEndMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = sma.GlobalTimerEndMatrix(i,thisState)-1;
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        globalTimerEndMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+globalTimerEndMatrix = uint8(globalTimerEndMatrix);
+
+% Compute compressed global counter matrix
+differenceMatrix = (sma.GlobalCounterMatrix(:,1:nGlobalCountersUsed) ~= defaultExtensionMatrix_GC)';
+nDifferences = sum(differenceMatrix, 1);
+msgLength = sum(nDifferences>0)*2 + nStates;
+globalCounterMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    globalCounterMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = sma.GlobalCounterMatrix(i,thisState)-1;
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        globalCounterMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+globalCounterMatrix = uint8(globalCounterMatrix);
+
+% Compute compressed condition matrix
+differenceMatrix = (sma.ConditionMatrix(:,1:nConditionsUsed) ~= defaultExtensionMatrix_C)';
+nDifferences = sum(differenceMatrix,1);
+msgLength = sum(nDifferences>0)*2 + nStates;
+conditionMatrix = zeros(1,msgLength); pos = 1;
+for i = 1:nStates
+    conditionMatrix(pos) = nDifferences(i); pos = pos + 1;
+    if nDifferences(i) > 0
+        thisState = differenceMatrix(:,i)';
+        positions = find(thisState)-1;
+        values = sma.ConditionMatrix(i,thisState)-1;
+        posVal = [positions; values];
+        posVal = posVal(1:end);
+        conditionMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
+        pos = pos + nDifferences(i)*2;
+    end
+end
+conditionMatrix = uint8(conditionMatrix);
+
+% Format state timer matrix
+stateTimerMatrix = uint8(sma.StateTimerMatrix-1);
+
+% Format global timer, counter and condition properties
+conditionChannels = uint8(sma.ConditionChannels(1:nConditionsUsed)-1);
+conditionValues = uint8(sma.ConditionValues(1:nConditionsUsed));
+globalTimerChannels = uint8(sma.GlobalTimers.OutputChannel(1:nGlobalTimersUsed)-1);
+uartChannels = globalTimerChannels < BpodSystem.HW.Pos.Input_USB-1;
+globalTimerOnMessages = sma.GlobalTimers.OnMessage(1:nGlobalTimersUsed);
+globalTimerOnMessages(globalTimerOnMessages==0 & uartChannels) = 255;
+globalTimerOffMessages = sma.GlobalTimers.OffMessage(1:nGlobalTimersUsed);
+globalTimerOffMessages(globalTimerOffMessages==0 & uartChannels) = 255;
+globalTimerLoopMode = uint8(sma.GlobalTimers.LoopMode(1:nGlobalTimersUsed));
+sendGlobalTimerEvents = uint8(sma.GlobalTimers.SendEvents(1:nGlobalTimersUsed));
+globalCounterAttachedEvents = uint8(sma.GlobalCounterEvents(1:nGlobalCountersUsed)-1);
+globalCounterThresholds = uint32(sma.GlobalCounterThresholds(1:nGlobalCountersUsed));
+if BpodSystem.MachineType == 4 % Global timer on/off messages are 16-bit on state machine 2+
+    globalTimerOnMessages = typecast(uint16(globalTimerOnMessages), 'uint8');
+    globalTimerOffMessages = typecast(uint16(globalTimerOffMessages), 'uint8');
+else
+    globalTimerOnMessages = uint8(globalTimerOnMessages);
+    globalTimerOffMessages = uint8(globalTimerOffMessages);
+end
+
+% Extract and format virtual outputs (global timer trig + cancel, global counter reset)
+maxGlobalTimers = BpodSystem.HW.n.GlobalTimers;
+if maxGlobalTimers > 16
+    globalTimerOnset_Trigger = uint32(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
+    globalTimerTrigs = uint32(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
+    globalTimerCancels = uint32(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
+elseif maxGlobalTimers > 8
+    globalTimerOnset_Trigger = uint16(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
+    globalTimerTrigs = uint16(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
+    globalTimerCancels = uint16(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
+else
+    globalTimerOnset_Trigger = uint8(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
+    globalTimerTrigs = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
+    globalTimerCancels = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
+end
+if BpodSystem.FirmwareVersion < 23
+    globalCounterResets = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalCounterReset))';
+else
+    gcResets = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalCounterReset))';
+    gcOverrides = find(gcResets ~= 0);
+    nOverrides = length(gcOverrides);
+    outMatrix = [];
+    if nOverrides > 0 
+        outMatrix = [gcOverrides-1; gcResets(gcOverrides)];
+    end
+    if nOverrides == 1
+        globalCounterResets = [nOverrides outMatrix'];
+    else 
+        globalCounterResets = [nOverrides outMatrix(1:end)];
+    end
+end
+
+% Extract and format Flex I/O analog input event matrix and threshold configuration
+analogThreshEnable = [];
+analogThreshDisable = [];
+if BpodSystem.MachineType == 4
+    atEnable = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.AnalogThreshEnable))'; 
+               % Bits indicate thresholds to enable (zeros are not disabled)
+    atOverrides = find(atEnable ~= 0);
+    nOverrides = length(atOverrides);
+    outMatrix = [];
+    if nOverrides > 0 
+        outMatrix = [atOverrides-1; atEnable(atOverrides)];
+    end
+    if length(outMatrix) == 2
+        outMatrix = outMatrix';
+    end
+    analogThreshEnable = [nOverrides outMatrix(1:end)]; 
+    
+    atDisable = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.AnalogThreshDisable))'; 
+                % Bits indicate thresholds to disable (zeros are not enabled)
+    atOverrides = find(atDisable ~= 0);
+    nOverrides = length(atOverrides);
+    outMatrix = [];
+    if nOverrides > 0 
+        outMatrix = [atOverrides-1; atDisable(atOverrides)];
+    end
+    if length(outMatrix) == 2
+        outMatrix = outMatrix';
+    end
+    analogThreshDisable = [nOverrides outMatrix(1:end)];
+end
+
+% Format timers (initially double type, unit=seconds) into 32 bit int, unit = multiple of the state machine cycle period
+stateTimers = uint32(sma.StateTimers*BpodSystem.HW.CycleFrequency);
+globalTimers = uint32(sma.GlobalTimers.Duration(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
+globalTimerDelays = uint32(sma.GlobalTimers.OnsetDelay(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
+globalTimerLoopIntervals = uint32(sma.GlobalTimers.LoopInterval(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
+
+% Assemble vectors of 8-bit, 16-bit and 32-bit data
+eightBitMatrix = [nStates nGlobalTimersUsed nGlobalCountersUsed nConditionsUsed...
+    stateTimerMatrix inputMatrix outputMatrix globalTimerStartMatrix globalTimerEndMatrix...
+    globalCounterMatrix conditionMatrix globalTimerChannels globalTimerOnMessages...
+    globalTimerOffMessages globalTimerLoopMode sendGlobalTimerEvents...
+    globalCounterAttachedEvents conditionChannels conditionValues globalCounterResets analogThreshEnable analogThreshDisable];
+globalTimerMatrix = [globalTimerTrigs globalTimerCancels globalTimerOnset_Trigger];
+thirtyTwoBitMatrix = [stateTimers globalTimers globalTimerDelays globalTimerLoopIntervals globalCounterThresholds];
+
+% Set additional ops packaged with state machine description (e.g. programming serial message library)
+containsAdditionalOps = [];
+finalAdditionalOps = [];
+if BpodSystem.FirmwareVersion > 22 
+    containsAdditionalOps = uint8(1);
+    finalAdditionalOps = uint8(0);
+end
+
+% This section can be optimized for speed (currently should take ~0.5ms per module for most tasks)
+% Create serial message vector (if using implicit serial messages)
+serialMessageVector = []; nModulesLoaded = 0;
+if sma.SerialMessageMode == 1
+    for i = 1:BpodSystem.HW.n.UartSerialChannels
+        if sma.nSerialMessages(i) > 0
+            serialMessageVector = [serialMessageVector containsAdditionalOps 'L' i-1 sma.nSerialMessages(i)];
+            for j = 1:sma.nSerialMessages(i)
+                thisMessage = sma.SerialMessages{i,j};
+                serialMessageVector = [serialMessageVector j length(thisMessage) thisMessage];
+            end
+            nModulesLoaded = nModulesLoaded + 1;
+        end
+    end
+    serialMessageVector = uint8(serialMessageVector);
+end
+
+if BpodSystem.FirmwareVersion > 22 % Package ops with byte string
+    byteString = [eightBitMatrix typecast(globalTimerMatrix, 'uint8') typecast(thirtyTwoBitMatrix, 'uint8')... 
+                  serialMessageVector finalAdditionalOps];
+else
+    byteString = [eightBitMatrix typecast(globalTimerMatrix, 'uint8') typecast(thirtyTwoBitMatrix, 'uint8')];
+end
@@ -0,0 +1,235 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "ArCOMHost.h"
+
+static speed_t baudConstant(int baudRate)
+{
+  // USB CDC ports (state machine, FlexIO analog) ignore the rate; it
+  // only matters for real UARTs.  B0 for a rate with no constant.
+  switch (baudRate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default: return B0;
+  }
+}
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__))
+// The kernel's struct termios2 (asm/termbits.h, which cannot be included
+// with termios.h), for rates without a B constant such as the module
+// link's 1312500 baud.
+struct kernelTermios2 {
+  tcflag_t c_iflag, c_oflag, c_cflag, c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed, c_ospeed;
+};
+#define KERNEL_TCGETS2 _IOR('T', 0x2A, struct kernelTermios2)
+#define KERNEL_TCSETS2 _IOW('T', 0x2B, struct kernelTermios2)
+#define KERNEL_BOTHER 0010000
+
+static int setCustomBaud(int fd, int baudRate)
+{
+  struct kernelTermios2 tio2;
+
+  if (ioctl(fd, KERNEL_TCGETS2, &tio2) < 0) return -1;
+  tio2.c_cflag &= ~CBAUD;
+  tio2.c_cflag |= KERNEL_BOTHER;
+  tio2.c_ispeed = tio2.c_ospeed = baudRate;
+  return ioctl(fd, KERNEL_TCSETS2, &tio2);
+}
+#else
+static int setCustomBaud(int, int)
+{
+  errno = EINVAL;
+  return -1;
+}
+#endif
+
+ArCOMHost::ArCOMHost() : portFd(-1), timeoutMs(1000), lastTimedOut(false), isTerminal(false) {
+}
+ArCOMHost::~ArCOMHost() {
+  close();
+}
+int ArCOMHost::open(const char *portName, int baudRate) {
+  struct termios tio;
+  int fd;
+
+  close();
+  fd = ::open(portName, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);  // 8N1, no echo, no flow control
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = baudConstant(baudRate);
+    cfsetispeed(&tio, speed == B0 ? B38400 : speed);
+    cfsetospeed(&tio, speed == B0 ? B38400 : speed);
+    if (tcsetattr(fd, TCSANOW, &tio) < 0 || (speed == B0 && (baudRate <= 0 || setCustomBaud(fd, baudRate) < 0))) {
+      int err = (baudRate <= 0) ? EINVAL : errno;
+      ::close(fd);
+      errno = err;
+      return -1;
+    }
+    isTerminal = true;
+  }
+  portFd = fd;
+  return 0;
+}
+int ArCOMHost::attach(int fd) {
+  close();
+  portFd = fd;
+  isTerminal = isatty(fd);
+  return 0;
+}
+void ArCOMHost::close() {
+  if (portFd >= 0) ::close(portFd);
+  portFd = -1;
+}
+unsigned int ArCOMHost::available() {
+  int n = 0;
+  if (portFd < 0 || ioctl(portFd, FIONREAD, &n) < 0) return 0;
+  return n;
+}
+void ArCOMHost::flush() {
+  uint8_t discard[4096];
+  if (portFd < 0) return;
+  if (isTerminal) {
+    tcflush(portFd, TCIFLUSH);
+  } else {
+    while (waitReadable(0) > 0 && readSome(discard, sizeof(discard)) > 0) {}
+  }
+}
+int ArCOMHost::waitReadable(int ms) {
+  struct pollfd p;
+  int ret;
+
+  p.fd = portFd;
+  p.events = POLLIN;
+  p.revents = 0;
+  do {
+    ret = poll(&p, 1, ms);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) return -1;
+  if (ret == 0) return 0;
+  if (p.revents & POLLIN) return 1;
+  return -1;  // POLLHUP / POLLERR with nothing left to read
+}
+int ArCOMHost::readSome(uint8_t *buffer, size_t size) {
+  ssize_t n;
+  do {
+    n = ::read(portFd, buffer, size);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && errno == EAGAIN) return 0;
+  if (n == 0 && size > 0) return isTerminal ? 0 : -1;  // a tty (VMIN = 0) has nothing to read; elsewhere the other side hung up
+  return n;
+}
+int ArCOMHost::readBytes(uint8_t *buffer, size_t size) {
+  size_t nRead = 0;
+  int n;
+
+  lastTimedOut = false;
+  while (nRead < size) {
+    if (waitReadable(timeoutMs) <= 0) {
+      lastTimedOut = true;
+      break;
+    }
+    n = readSome(buffer + nRead, size - nRead);
+    if (n < 0) {
+      lastTimedOut = true;
+      break;
+    }
+    nRead += n;
+  }
+  return nRead;
+}
+int ArCOMHost::writeBytes(const uint8_t *buffer, size_t size) {
+  ssize_t n;
+  while (size > 0) {
+    n = ::write(portFd, buffer, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    buffer += n;
+    size -= n;
+  }
+  return 0;
+}
+void ArCOMHost::writeUint16(uint16_t int2Write) {
+  uint8_t b[2] = {(uint8_t) int2Write, (uint8_t) (int2Write >> 8)};
+  writeBytes(b, 2);
+}
+void ArCOMHost::writeUint16Array(const uint16_t numArray[], unsigned int size) {
+  for (unsigned int i = 0; i < size; i++) writeUint16(numArray[i]);
+}
+void ArCOMHost::writeUint32(uint32_t int2Write) {
+  uint8_t b[4] = {(uint8_t) int2Write, (uint8_t) (int2Write >> 8), (uint8_t) (int2Write >> 16), (uint8_t) (int2Write >> 24)};
+  writeBytes(b, 4);
+}
+void ArCOMHost::writeUint32Array(const uint32_t numArray[], unsigned int size) {
+  for (unsigned int i = 0; i < size; i++) writeUint32(numArray[i]);
+}
+uint8_t ArCOMHost::readByte() {
+  uint8_t b = 0;
+  readBytes(&b, 1);
+  return b;
+}
+uint8_t ArCOMHost::readUint8() {
+  return readByte();
+}
+char ArCOMHost::readChar() {
+  return (char) readByte();
+}
+uint16_t ArCOMHost::readUint16() {
+  uint8_t b[2] = {0, 0};
+  readBytes(b, 2);
+  return b[0] | (b[1] << 8);
+}
+void ArCOMHost::readUint16Array(uint16_t numArray[], unsigned int size) {
+  for (unsigned int i = 0; i < size; i++) numArray[i] = readUint16();
+}
+uint32_t ArCOMHost::readUint32() {
+  uint8_t b[4] = {0, 0, 0, 0};
+  readBytes(b, 4);
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+void ArCOMHost::readUint32Array(uint32_t numArray[], unsigned int size) {
+  for (unsigned int i = 0; i < size; i++) numArray[i] = readUint32();
+}
+uint64_t ArCOMHost::readUint64() {
+  uint64_t low = readUint32();
+  return low | ((uint64_t) readUint32() << 32);
+}
@@ -0,0 +1,95 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  ArCOMHost: the ArCOM serial interface (see the module firmware's
+  ArCOM.h) for native code on the PC side, on a POSIX serial port, PTY,
+  pipe or socket.  Reads block for at most the timeout set with
+  setTimeout() (default 1000 ms); a read that times out returns what it
+  got and sets timedOut().  Multi-byte values are little-endian, as on
+  the state machine.
+*/
+
+#ifndef ArCOMHost_h
+#define ArCOMHost_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+class ArCOMHost
+{
+public:
+  ArCOMHost();
+  ~ArCOMHost();
+  // Port
+  // 0 on success, -1 with errno set.  Rates without a termios constant
+  // (e.g. 1312500) are set with termios2 on Linux, EINVAL elsewhere.
+  int open(const char *portName, int baudRate = 115200);
+  int attach(int fd);        // use a descriptor that is already open; closed by close()
+  void close();
+  bool isOpen() const { return portFd >= 0; }
+  int fd() const { return portFd; }
+  void setTimeout(int ms) { timeoutMs = ms; }
+  bool timedOut() const { return lastTimedOut; }
+  // Serial functions
+  unsigned int available();
+  void flush();              // discard unread input
+  int waitReadable(int ms);  // 1 if input is ready, 0 on timeout, -1 on error or hangup
+  int readSome(uint8_t *buffer, size_t size);  // whatever is ready (up to size, 0 on a tty with none), -1 on error or hangup
+  int readBytes(uint8_t *buffer, size_t size); // size bytes unless it times out; returns the count read
+  int writeBytes(const uint8_t *buffer, size_t size);  // 0 on success, -1 on error
+  // Unsigned integers
+  void writeByte(uint8_t byte2Write) { writeBytes(&byte2Write, 1); }
+  void writeUint8(uint8_t byte2Write) { writeBytes(&byte2Write, 1); }
+  void writeChar(char char2Write) { writeBytes((const uint8_t *) &char2Write, 1); }
+  void writeUint8Array(const uint8_t numArray[], unsigned int size) { writeBytes(numArray, size); }
+  void writeCharArray(const char charArray[], unsigned int size) { writeBytes((const uint8_t *) charArray, size); }
+  void writeUint16(uint16_t int2Write);
+  void writeUint16Array(const uint16_t numArray[], unsigned int size);
+  void writeUint32(uint32_t int2Write);
+  void writeUint32Array(const uint32_t numArray[], unsigned int size);
+  uint8_t readByte();
+  uint8_t readUint8();
+  char readChar();
+  void readUint8Array(uint8_t numArray[], unsigned int size) { readBytes(numArray, size); }
+  void readCharArray(char charArray[], unsigned int size) { readBytes((uint8_t *) charArray, size); }
+  uint16_t readUint16();
+  void readUint16Array(uint16_t numArray[], unsigned int size);
+  uint32_t readUint32();
+  void readUint32Array(uint32_t numArray[], unsigned int size);
+  uint64_t readUint64();
+  // Signed integers
+  void writeInt8(int8_t int2Write) { writeUint8((uint8_t) int2Write); }
+  void writeInt16(int16_t int2Write) { writeUint16((uint16_t) int2Write); }
+  void writeInt32(int32_t int2Write) { writeUint32((uint32_t) int2Write); }
+  int8_t readInt8() { return (int8_t) readUint8(); }
+  int16_t readInt16() { return (int16_t) readUint16(); }
+  int32_t readInt32() { return (int32_t) readUint32(); }
+
+private:
+  int portFd;
+  int timeoutMs;
+  bool lastTimedOut;
+  bool isTerminal;
+  ArCOMHost(const ArCOMHost &);             // not copyable: owns the descriptor
+  ArCOMHost &operator=(const ArCOMHost &);
+};
+#endif
@@ -0,0 +1,100 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  ArCOM for module sketches built on the PC (see Arduino.h).  The
+  sketch's own ArCOM.cpp defines the 32-bit methods with unsigned long,
+  which is uint32_t on the module but not on 64-bit hosts, so this file
+  implements the declarations in the sketch's ArCOM.h instead.  It has
+  the byte, char and 16-bit methods the example sketches use; a sketch
+  that calls the 32-bit ones fails to link.
+*/
+
+#include "Arduino.h"
+#include "ArCOM.h"
+
+ArCOM::ArCOM(Stream &s) {
+  ArCOMstream = &s;
+}
+unsigned int ArCOM::available() {
+  return ArCOMstream->available();
+}
+void ArCOM::flush() {
+  ArCOMstream->flush();
+}
+void ArCOM::writeByte(byte byte2Write) {
+  ArCOMstream->write(byte2Write);
+}
+void ArCOM::writeUint8(byte byte2Write) {
+  ArCOMstream->write(byte2Write);
+}
+void ArCOM::writeChar(char char2Write) {
+  ArCOMstream->write((byte) char2Write);
+}
+void ArCOM::writeByteArray(byte numArray[], unsigned int size) {
+  ArCOMstream->write(numArray, size);
+}
+void ArCOM::writeUint8Array(byte numArray[], unsigned int size) {
+  ArCOMstream->write(numArray, size);
+}
+void ArCOM::writeCharArray(char charArray[], unsigned int size) {
+  ArCOMstream->write(charArray, size);
+}
+void ArCOM::writeUint16(uint16_t int2Write) {
+  ArCOMstream->write((byte) int2Write);
+  ArCOMstream->write((byte) (int2Write >> 8));
+}
+byte ArCOM::readByte() {
+  while (ArCOMstream->available() == 0) {}
+  return ArCOMstream->read();
+}
+byte ArCOM::readUint8() {
+  return readByte();
+}
+char ArCOM::readChar() {
+  return (char) readByte();
+}
+void ArCOM::readByteArray(byte numArray[], unsigned int size) {
+  ArCOMstream->readBytes(numArray, size);
+}
+void ArCOM::readUint8Array(byte numArray[], unsigned int size) {
+  ArCOMstream->readBytes(numArray, size);
+}
+void ArCOM::readCharArray(char charArray[], unsigned int size) {
+  ArCOMstream->readBytes(charArray, size);
+}
+uint16_t ArCOM::readUint16() {
+  typeBuffer.byteArray[0] = readByte();
+  typeBuffer.byteArray[1] = readByte();
+  return typeBuffer.uint16;
+}
+void ArCOM::writeInt8(int8_t int2Write) {
+  ArCOMstream->write((byte) int2Write);
+}
+void ArCOM::writeInt16(int16_t int2Write) {
+  writeUint16((uint16_t) int2Write);
+}
+int8_t ArCOM::readInt8() {
+  return (int8_t) readByte();
+}
+int16_t ArCOM::readInt16() {
+  return (int16_t) readUint16();
+}
@@ -0,0 +1,157 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "Arduino.h"
+
+Stream Serial;
+Stream Serial1;
+Stream &SerialUSB = Serial;
+
+static std::atomic<int> pinLevel[N_HOST_PINS];  // driven by the test (inputs) or the sketch (outputs)
+static std::atomic<int> analogValue[N_HOST_PINS];
+static std::atomic<bool> running(false);
+static std::thread sketchThread;
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+int Stream::available() {
+  int n = 0;
+  if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0) return 0;
+  return n;
+}
+
+int Stream::read() {
+  byte b;
+  if (available() == 0 || ::read(fd, &b, 1) != 1) return -1;
+  return b;
+}
+
+size_t Stream::readBytes(byte *buffer, size_t length) {
+  size_t nRead = 0;
+  struct pollfd p;
+  ssize_t n;
+
+  if (fd < 0) return 0;
+  p.fd = fd;
+  p.events = POLLIN;
+  while (nRead < length) {
+    if (poll(&p, 1, timeoutMs) <= 0) break;
+    n = ::read(fd, buffer + nRead, length - nRead);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    nRead += n;
+  }
+  return nRead;
+}
+
+size_t Stream::write(const byte *buffer, size_t size) {
+  size_t nWritten = 0;
+  ssize_t n;
+
+  if (fd < 0) return size;
+  while (nWritten < size) {
+    n = ::write(fd, buffer + nWritten, size - nWritten);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    nWritten += n;
+  }
+  return nWritten;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= N_HOST_PINS) return;
+  if (mode == INPUT_PULLUP) pinLevel[pin] = HIGH;
+  if (mode == INPUT_PULLDOWN) pinLevel[pin] = LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  if (pin < N_HOST_PINS) pinLevel[pin] = (level != 0);
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < N_HOST_PINS) ? pinLevel[pin].load() : LOW;
+}
+
+int analogRead(uint8_t pin) {
+  return (pin < N_HOST_PINS) ? analogValue[pin].load() : 0;
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < N_HOST_PINS) analogValue[pin] = value;
+}
+
+uint32_t micros() {
+  // 32-bit, so it rolls over every 72 minutes as on the module
+  return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint32_t millis() {
+  return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+int arduinoHostStart(int serial1Fd, int serialFd) {
+  if (running) return -1;
+  for (int i = 0; i < N_HOST_PINS; i++) {
+    pinLevel[i] = LOW;
+    analogValue[i] = 1023;
+  }
+  Serial1.attach(serial1Fd);
+  Serial.attach(serialFd);
+  running = true;
+  sketchThread = std::thread([]() {
+    setup();
+    while (running) loop();  // spins, like the module's main loop
+  });
+  return 0;
+}
+
+void arduinoHostStop() {
+  if (!running) return;
+  running = false;
+  sketchThread.join();
+}
+
+void arduinoHostSetPin(uint8_t pin, uint8_t level) {
+  if (pin < N_HOST_PINS) pinLevel[pin] = (level != 0);
+}
+
+int arduinoHostGetPin(uint8_t pin) {
+  return digitalRead(pin);
+}
+
+void arduinoHostSetAnalog(uint8_t pin, int value) {
+  if (pin < N_HOST_PINS) analogValue[pin] = value;
+}
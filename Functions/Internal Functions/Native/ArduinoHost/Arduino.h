@@ -0,0 +1,118 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  Arduino.h for building module sketches (Examples/Firmware) on the PC,
+  for integration tests against VirtualStateMachine.  It covers what the
+  example sketches use: Serial (USB, also SerialUSB) and Serial1 (the
+  state machine link) on file descriptors, digital and analog pins the
+  test sets and reads, micros(), millis() and delay().
+
+  Arduino's build adds prototypes for the sketch's functions; the
+  Makefile generates them and passes them with -include, after this
+  file.  The sketch's ArCOM.h is used with ArduinoHost/ArCOM.cpp.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define N_HOST_PINS 64
+// Analog inputs as on Teensy 3.x
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+#define A8 22
+#define A9 23
+
+class Stream
+{
+public:
+  Stream() : fd(-1), timeoutMs(1000) {}
+  void begin(unsigned long baudRate) {}  // the link runs at pipe speed
+  void end() {}
+  void setTimeout(unsigned long ms) { timeoutMs = ms; }
+  int available();
+  int read();                            // -1 if nothing is there
+  size_t readBytes(byte *buffer, size_t length);  // waits up to the timeout (1 s), as on Arduino
+  size_t readBytes(char *buffer, size_t length) { return readBytes((byte *) buffer, length); }
+  size_t write(byte b) { return write(&b, 1); }
+  size_t write(const byte *buffer, size_t size);
+  size_t write(const char *buffer, size_t size) { return write((const byte *) buffer, size); }
+  size_t write(const char *s) { return write(s, strlen(s)); }
+  void flush() {}                        // writes are not buffered
+  operator bool() const { return fd >= 0; }
+  // Host side
+  void attach(int descriptor) { fd = descriptor; }  // not connected (reads nothing, writes are dropped) if -1
+
+private:
+  int fd;
+  unsigned long timeoutMs;
+};
+
+extern Stream Serial;
+extern Stream Serial1;
+extern Stream &SerialUSB;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+inline int digitalReadFast(uint8_t pin) { return digitalRead(pin); }
+inline void digitalWriteFast(uint8_t pin, uint8_t level) { digitalWrite(pin, level); }
+int analogRead(uint8_t pin);
+inline void analogReadResolution(int bits) {}
+inline void analogWriteResolution(int bits) {}
+void analogWrite(uint8_t pin, int value);
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// The sketch
+void setup();
+void loop();
+
+// Host side: run the sketch on a thread (setup(), then loop() until stopped) and drive its pins
+int arduinoHostStart(int serial1Fd, int serialFd);  // 0, or -1 if already running
+void arduinoHostStop();
+void arduinoHostSetPin(uint8_t pin, uint8_t level);  // level seen by digitalRead
+int arduinoHostGetPin(uint8_t pin);                  // level last set by digitalWrite
+void arduinoHostSetAnalog(uint8_t pin, int value);   // value returned by analogRead (default 1023)
+#endif
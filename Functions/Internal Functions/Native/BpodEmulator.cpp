@@ -0,0 +1,190 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to StateMachineEmulator:
+
+    BpodEmulator('load', ByteString, use255BackSignal, BpodSystem.HW, BpodSystem.MachineType,
+                 BpodSystem.FirmwareVersion, BpodSystem.LiveTimestamps)
+    [RawEvents, Stream] = BpodEmulator('run', Inputs, MaxTime)
+
+  'load' takes the description as BpodStateMachineBytes or
+  EncodeStateMachine return it.  'run' emulates one trial: Inputs is an
+  N x 2 matrix of [Time Event] rows (seconds after trial start, event
+  indexes as in RawEvents.Events, sorted by time), MaxTime the trial
+  length limit in seconds (0 = none).  RawEvents has the fields
+  RunStateMachine returns; Stream is the trial's byte stream as the state
+  machine would send it.  An error is thrown if the trial does not reach
+  the exit state.  Build with "make mex" in this folder.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "mex.h"
+#include "StateMachineEmulator.h"
+
+static StateMachineEmulator *emulator = NULL;
+static std::vector<uint8_t> stream;
+static std::vector<EmulatorInput> inputs;
+static double cycleFrequency;
+
+static void cleanup(void)
+{
+  delete emulator;
+  emulator = NULL;
+}
+
+static const mxArray *field(const mxArray *s, const char *name)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  if (f == NULL) mexErrMsgIdAndTxt("Bpod:BpodEmulator", "Missing field %s", name);
+  return f;
+}
+
+static int getInt(const mxArray *s, const char *name)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  return (f != NULL && !mxIsEmpty(f)) ? (int) mxGetScalar(f) : 0;
+}
+
+static void readHardware(EmulatorHardware &hw, const mxArray *HW, double machineType, double firmwareVersion,
+			 double liveTimestamps)
+{
+  const mxArray *n = field(HW, "n");
+  const mxArray *pos = field(HW, "Pos");
+  char channels[256];
+
+  hw.machineType = (int) machineType;
+  hw.firmwareVersion = (int) firmwareVersion;
+  hw.cycleFrequency = mxGetScalar(field(HW, "CycleFrequency"));
+  hw.inputMatrixSize = getInt(HW, "GlobalTimerStartposition") - 1;
+  hw.maxGlobalTimers = getInt(n, "GlobalTimers");
+  hw.maxGlobalCounters = getInt(n, "GlobalCounters");
+  hw.maxConditions = getInt(n, "Conditions");
+  hw.nInputs = getInt(n, "Inputs");
+  hw.ioEventStart = getInt(HW, "IOEventStartposition") - 1;
+  hw.outputUSB = getInt(pos, "Output_USB") - 1;
+  hw.liveTimestamps = liveTimestamps != 0;
+  // Input channels before the first port, BNC or wire input have no high/low I/O events
+  mxGetString(field(HW, "Inputs"), channels, sizeof(channels));
+  hw.ioFirstChannel = (int) strcspn(channels, "PBW");
+  if (hw.inputMatrixSize < 1 || hw.ioEventStart < 0 || hw.cycleFrequency <= 0) {
+    mexErrMsgIdAndTxt("Bpod:BpodEmulator", "BpodSystem.HW is not set up (run Bpod first)");
+  }
+}
+
+static mxArray *toRow(const std::vector<double> &values)
+{
+  mxArray *out = mxCreateDoubleMatrix(1, values.size(), mxREAL);
+  if (!values.empty()) memcpy(mxGetPr(out), values.data(), values.size()*sizeof(double));
+  return out;
+}
+
+static mxArray *rawEvents(const EmulatorTrial &trial, double trialStart)
+{
+  static const char *names[] = {"States", "Events", "StateTimestamps", "EventTimestamps", "TrialStartTimestamp",
+				"TrialEndTimestamp", "ErrorCodes"};
+  mxArray *out = mxCreateStructMatrix(1, 1, 7, names);
+  std::vector<double> values;
+  size_t nEvents = trial.events.size();
+
+  values.assign(trial.states.begin(), trial.states.end());
+  for (size_t i = 0; i < values.size(); i++) values[i] += 1;
+  mxSetField(out, 0, "States", toRow(values));
+  values.assign(trial.events.begin(), trial.events.end());
+  for (size_t i = 0; i < values.size(); i++) values[i] += 1;
+  mxSetField(out, 0, "Events", toRow(values));
+  // One per state, plus the trial end (time of the last event), as RunStateMachine reports them
+  values.assign(1, 0);
+  for (size_t i = 0; i + 1 < trial.states.size(); i++) values.push_back(trial.eventCycles[trial.stateChanges[i]]/cycleFrequency);
+  values.push_back(nEvents > 0 ? trial.eventCycles[nEvents-1]/cycleFrequency : 0);
+  mxSetField(out, 0, "StateTimestamps", toRow(values));
+  values.resize(nEvents);
+  for (size_t i = 0; i < nEvents; i++) values[i] = trial.eventCycles[i]/cycleFrequency;
+  mxSetField(out, 0, "EventTimestamps", toRow(values));
+  mxSetField(out, 0, "TrialStartTimestamp", mxCreateDoubleScalar(trialStart));
+  mxSetField(out, 0, "TrialEndTimestamp", mxCreateDoubleScalar(emulator->clockMicros/1e6));
+  mxSetField(out, 0, "ErrorCodes", mxCreateDoubleMatrix(0, 0, mxREAL));
+  return out;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  char command[16];
+
+  if (nrhs < 1 || !mxIsChar(prhs[0])) mexErrMsgIdAndTxt("Bpod:BpodEmulator", "The first argument must be a command");
+  mxGetString(prhs[0], command, sizeof(command));
+
+  if (strcmp(command, "load") == 0) {
+    EmulatorHardware hw;
+    std::vector<uint8_t> message;
+    if (nrhs != 7 || !mxIsStruct(prhs[3])) {
+      mexErrMsgIdAndTxt("Bpod:BpodEmulator", "Usage: BpodEmulator('load', ByteString, use255BackSignal, BpodSystem.HW, "
+			"BpodSystem.MachineType, BpodSystem.FirmwareVersion, BpodSystem.LiveTimestamps)");
+    }
+    readHardware(hw, prhs[3], mxGetScalar(prhs[4]), mxGetScalar(prhs[5]), mxGetScalar(prhs[6]));
+    size_t nBytes = mxGetNumberOfElements(prhs[1]);
+    if (nBytes > 65535) mexErrMsgIdAndTxt("Bpod:BpodEmulator", "ByteString is too long");
+    message.assign({'C', 0, (uint8_t) (mxGetScalar(prhs[2]) != 0), (uint8_t) nBytes, (uint8_t) (nBytes >> 8)});
+    for (size_t i = 0; i < nBytes; i++) {
+      message.push_back(mxIsUint8(prhs[1]) ? ((uint8_t *) mxGetData(prhs[1]))[i] : (uint8_t) mxGetPr(prhs[1])[i]);
+    }
+    mexAtExit(cleanup);
+    cleanup();
+    emulator = new StateMachineEmulator(hw);
+    cycleFrequency = hw.cycleFrequency;
+    if (emulator->load(message.data(), message.size()) < 0) {
+      cleanup();
+      mexErrMsgIdAndTxt("Bpod:BpodEmulator", "ByteString is not a valid state machine description for this hardware");
+    }
+  } else if (strcmp(command, "run") == 0) {
+    if (emulator == NULL) mexErrMsgIdAndTxt("Bpod:BpodEmulator", "No state machine loaded");
+    if (nrhs < 2 || !mxIsDouble(prhs[1]) || (!mxIsEmpty(prhs[1]) && mxGetN(prhs[1]) != 2)) {
+      mexErrMsgIdAndTxt("Bpod:BpodEmulator", "Usage: [RawEvents, Stream] = BpodEmulator('run', Inputs, MaxTime)");
+    }
+    size_t n = mxGetM(prhs[1]);
+    const double *in = mxGetPr(prhs[1]);
+    inputs.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      if (in[i] < 0 || (i > 0 && in[i] < in[i-1]) || in[i+n] < 1 || in[i+n] > 254) {
+	mexErrMsgIdAndTxt("Bpod:BpodEmulator", "Inputs row %d: times must be sorted and events in 1..254", (int) i + 1);
+      }
+      inputs[i].cycle = (uint64_t) floor(in[i]*cycleFrequency + 0.5);
+      inputs[i].event = (uint8_t) (in[i+n] - 1);
+    }
+    uint64_t maxCycles = (nrhs > 2) ? (uint64_t) (mxGetScalar(prhs[2])*cycleFrequency) : 0;
+    double trialStart = emulator->clockMicros/1e6;
+    stream.clear();
+    const EmulatorTrial &trial = emulator->runTrial(inputs.data(), n, maxCycles, stream);
+    if (!trial.finished) {
+      mexErrMsgIdAndTxt("Bpod:BpodEmulator", "The trial did not reach the exit state (%d events, %.3f s)",
+			(int) trial.events.size(), trial.endCycle/cycleFrequency);
+    }
+    plhs[0] = rawEvents(trial, trialStart);
+    if (nlhs > 1) {
+      plhs[1] = mxCreateNumericMatrix(1, stream.size(), mxUINT8_CLASS, mxREAL);
+      memcpy(mxGetData(plhs[1]), stream.data(), stream.size());
+    }
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodEmulator", "Unknown command '%s'", command);
+  }
+}
@@ -0,0 +1,149 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to FlexIOAcquisition (one acquisition per MATLAB session):
+
+    BpodFlexIOAcquisition('open', PortName, nChannels)
+    BpodFlexIOAcquisition('start', FileName)   % '' to acquire without a file
+    BpodFlexIOAcquisition('record', OnOff)     % pause or resume logging to the file
+    NewData = BpodFlexIOAcquisition('view', Decimation)
+    Status = BpodFlexIOAcquisition('status')
+    BpodFlexIOAcquisition('stop')              % writes what is buffered and closes the file
+    BpodFlexIOAcquisition('close')
+
+  'view' returns the samples kept for the viewer since the last call,
+  nChannels x n uint16 as ProcessAnalogSamples passes them to
+  analogViewer; from then on only every Decimation-th sample is kept.
+  Status has fields Running, Recording, nSamples, nSamplesRecorded,
+  SamplesDropped, ViewDropped, BytesWritten, Writes, RingPeak (bytes)
+  and WriteError ('' if none).  The acquisition owns the port, so
+  release BpodSystem.AnalogSerialPort first.  Build with "make mex" in
+  this folder.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include "mex.h"
+#include "FlexIOAcquisition.h"
+
+static FlexIOAcquisition *acquisition = NULL;
+
+static void closeAcquisition(void)
+{
+  delete acquisition;
+  acquisition = NULL;
+}
+
+static void requireOpen(void)
+{
+  if (acquisition == NULL) {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition",
+		      "The acquisition is not open. Call BpodFlexIOAcquisition('open', PortName, nChannels) first.");
+  }
+}
+
+static mxArray *viewSamples(void)
+{
+  uint32_t nChannels = acquisition->nChannels();
+  std::vector<uint16_t> samples(FLEXIO_VIEW_WORDS);
+  size_t n = acquisition->view(samples.data(), samples.size()/nChannels);
+  mxArray *out = mxCreateNumericMatrix(nChannels, n, mxUINT16_CLASS, mxREAL);
+
+  memcpy(mxGetData(out), samples.data(), 2*n*nChannels);
+  return out;
+}
+
+static mxArray *statusStruct(void)
+{
+  const char *fields[] = {"Running", "Recording", "nSamples", "nSamplesRecorded", "SamplesDropped", "ViewDropped",
+			  "BytesWritten", "Writes", "RingPeak", "WriteError"};
+  FlexIOAcquisitionStatus s = acquisition->status();
+  mxArray *out = mxCreateStructMatrix(1, 1, 10, fields);
+
+  mxSetField(out, 0, "Running", mxCreateDoubleScalar(s.running));
+  mxSetField(out, 0, "Recording", mxCreateDoubleScalar(s.recording));
+  mxSetField(out, 0, "nSamples", mxCreateDoubleScalar((double) s.samples));
+  mxSetField(out, 0, "nSamplesRecorded", mxCreateDoubleScalar((double) s.samplesRecorded));
+  mxSetField(out, 0, "SamplesDropped", mxCreateDoubleScalar((double) s.samplesDropped));
+  mxSetField(out, 0, "ViewDropped", mxCreateDoubleScalar((double) s.viewDropped));
+  mxSetField(out, 0, "BytesWritten", mxCreateDoubleScalar((double) s.bytesWritten));
+  mxSetField(out, 0, "Writes", mxCreateDoubleScalar((double) s.writes));
+  mxSetField(out, 0, "RingPeak", mxCreateDoubleScalar((double) s.ringPeak));
+  mxSetField(out, 0, "WriteError", mxCreateString(s.writeError ? strerror(s.writeError) : ""));
+  return out;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  char command[32];
+  char *arg;
+
+  if (nrhs < 1 || !mxIsChar(prhs[0])) {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Usage: BpodFlexIOAcquisition(Command, ...)");
+  }
+  mexAtExit(closeAcquisition);
+  arg = mxArrayToString(prhs[0]);
+  strncpy(command, arg, sizeof(command) - 1);
+  command[sizeof(command) - 1] = 0;
+  mxFree(arg);
+
+  if (strcmp(command, "open") == 0) {
+    if (nrhs < 3 || !mxIsChar(prhs[1]) || mxGetScalar(prhs[2]) < 1) {
+      mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Usage: BpodFlexIOAcquisition('open', PortName, nChannels)");
+    }
+    closeAcquisition();
+    acquisition = new FlexIOAcquisition();
+    arg = mxArrayToString(prhs[1]);
+    if (acquisition->open(arg, (uint32_t) mxGetScalar(prhs[2])) < 0) {
+      closeAcquisition();
+      mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Could not open %s: %s", arg, strerror(errno));
+    }
+    mxFree(arg);
+  } else if (strcmp(command, "close") == 0) {
+    closeAcquisition();
+  } else if (strcmp(command, "start") == 0) {
+    requireOpen();
+    if (nrhs < 2 || !mxIsChar(prhs[1])) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Usage: BpodFlexIOAcquisition('start', FileName)");
+    arg = mxArrayToString(prhs[1]);
+    if (acquisition->start(arg) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Could not start acquiring to %s: %s", arg, strerror(errno));
+    }
+    mxFree(arg);
+  } else if (strcmp(command, "record") == 0) {
+    requireOpen();
+    if (nrhs < 2) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Usage: BpodFlexIOAcquisition('record', OnOff)");
+    acquisition->setRecording(mxGetScalar(prhs[1]) != 0);
+  } else if (strcmp(command, "view") == 0) {
+    requireOpen();
+    if (nrhs > 1) acquisition->setDecimation((uint32_t) mxGetScalar(prhs[1]));
+    plhs[0] = viewSamples();
+  } else if (strcmp(command, "status") == 0) {
+    requireOpen();
+    plhs[0] = statusStruct();
+  } else if (strcmp(command, "stop") == 0) {
+    requireOpen();
+    acquisition->stop();
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAcquisition", "Unknown command '%s'", command);
+  }
+}
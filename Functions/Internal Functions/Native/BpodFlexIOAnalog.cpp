@@ -0,0 +1,136 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to FlexIOAnalogFile:
+
+    nSamples = BpodFlexIOAnalog('nSamples', FileName, nChannels)
+    [Samples, TrialNumber] = BpodFlexIOAnalog('read', FileName, nChannels, Format, Range)
+    Runs = BpodFlexIOAnalog('index', FileName, nChannels)
+
+  'read' returns Samples (nChannels x n, 'Volts' or 'Bits') and the trial
+  number of each sample (1 x n), both double as AddFlexIOAnalogData.m
+  returns them; Range ([First Last], 1-based, optional) reads part of the
+  file, e.g. one trial or one chunk at a time.  'index' returns one row
+  per run of samples acquired during the same trial: [Trial FirstSample
+  nSamples].  Only the samples read are converted; the file is mapped,
+  not loaded.  Build with "make mex" in this folder.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <string>
+#include "mex.h"
+#include "FlexIOAnalog.h"
+
+static FlexIOAnalogFile file;
+static std::string filePath;
+static size_t fileSize;
+
+static void cleanup(void)
+{
+  file.close();
+  filePath.clear();
+}
+
+static std::string getString(const mxArray *a, const char *name)
+{
+  if (!mxIsChar(a)) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "%s must be a string", name);
+  char *s = mxArrayToString(a);
+  std::string out(s);
+  mxFree(s);
+  return out;
+}
+
+static void openFile(const mxArray *fileName, const mxArray *nChannels)
+{
+  // Reopened when the file changed, e.g. samples were logged since the last call
+  std::string path = getString(fileName, "FileName");
+  struct stat st;
+
+  if (!mxIsNumeric(nChannels) || mxGetNumberOfElements(nChannels) != 1 || mxGetScalar(nChannels) < 1) {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "nChannels must be a positive number");
+  }
+  uint32_t n = (uint32_t) mxGetScalar(nChannels);
+  if (stat(path.c_str(), &st) < 0) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Cannot open %s", path.c_str());
+  if (path == filePath && (size_t) st.st_size == fileSize && n == file.nChannels()) return;
+  filePath.clear();
+  if (file.open(path.c_str(), n) < 0) {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Cannot open %s: %s", path.c_str(), strerror(errno));
+  }
+  filePath = path;
+  fileSize = st.st_size;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs < 1 || !mxIsChar(prhs[0])) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "The first argument must be a command");
+  std::string command = getString(prhs[0], "command");
+  mexAtExit(cleanup);
+
+  if (command == "nSamples") {
+    if (nrhs != 3) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Usage: nSamples = BpodFlexIOAnalog('nSamples', FileName, nChannels)");
+    openFile(prhs[1], prhs[2]);
+    plhs[0] = mxCreateDoubleScalar((double) file.nSamples());
+  } else if (command == "read") {
+    if (nrhs < 4 || nrhs > 5) {
+      mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Usage: [Samples, TrialNumber] = BpodFlexIOAnalog('read', FileName, nChannels, Format, Range)");
+    }
+    std::string format = getString(prhs[3], "Format");
+    bool volts = strcasecmp(format.c_str(), "volts") == 0;
+    if (!volts && strcasecmp(format.c_str(), "bits") != 0) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Format must be 'Volts' or 'Bits'");
+    openFile(prhs[1], prhs[2]);
+    uint64_t first = 0, n = file.nSamples();
+    if (nrhs == 5) {
+      if (!mxIsDouble(prhs[4]) || mxGetNumberOfElements(prhs[4]) != 2) {
+	mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Range must be [FirstSample LastSample]");
+      }
+      double a = mxGetPr(prhs[4])[0], b = mxGetPr(prhs[4])[1];
+      if (a < 1 || b < a - 1 || b > (double) file.nSamples()) {
+	mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Range must be within 1-%llu", (unsigned long long) file.nSamples());
+      }
+      first = (uint64_t) a - 1;
+      n = (uint64_t) b - first;
+    }
+    plhs[0] = mxCreateDoubleMatrix(file.nChannels(), n, mxREAL);
+    file.samples(first, n, mxGetPr(plhs[0]), volts);
+    if (nlhs > 1) {
+      plhs[1] = mxCreateDoubleMatrix(1, n, mxREAL);
+      file.trialNumbers(first, n, mxGetPr(plhs[1]));
+    }
+  } else if (command == "index") {
+    if (nrhs != 3) mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Usage: Runs = BpodFlexIOAnalog('index', FileName, nChannels)");
+    openFile(prhs[1], prhs[2]);
+    const std::vector<FlexIOTrialRun> &runs = file.trialIndex();
+    size_t nRuns = runs.size();
+    plhs[0] = mxCreateDoubleMatrix(nRuns, 3, mxREAL);
+    double *p = mxGetPr(plhs[0]);
+    for (size_t i = 0; i < nRuns; i++) {
+      p[i] = runs[i].trial;
+      p[nRuns + i] = (double) runs[i].first + 1;
+      p[2*nRuns + i] = (double) runs[i].n;
+    }
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodFlexIOAnalog", "Unknown command '%s'", command.c_str());
+  }
+}
@@ -0,0 +1,158 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to MirroredRingBuffer, for BpodMirroredBuffer.m:
+
+    Handle = BpodRingBuffer('create', BufferSizeInBytes)
+    BpodRingBuffer('write', Handle, Data)
+    Data = BpodRingBuffer('read', Handle, nBytes)
+    nBytes = BpodRingBuffer('bytesAvailable', Handle)
+    BpodRingBuffer('delete', Handle)
+
+  Data written is stored as uint8, rounded and saturated as MATLAB does
+  when it is assigned into a uint8 array; Data read is a uint8 row.  The
+  errors are BpodDoubleSidedBuffer's.  The MEX file stays locked while
+  any buffer exists, so "clear mex" cannot free buffers that MATLAB
+  objects still hold handles to.  Build with "make mex" in this folder.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "mex.h"
+#include "MirroredRingBuffer.h"
+
+static std::vector<MirroredRingBuffer *> buffers;
+static size_t nBuffers;  // not NULL in buffers; locked while > 0
+static std::vector<uint8_t> converted;
+
+static void deleteBuffers(void)
+{
+  for (size_t i = 0; i < buffers.size(); i++) delete buffers[i];
+  buffers.clear();
+  nBuffers = 0;
+}
+
+static MirroredRingBuffer *getBuffer(int nrhs, const mxArray *prhs[])
+{
+  double h = (nrhs > 1 && mxIsDouble(prhs[1]) && mxGetNumberOfElements(prhs[1]) == 1) ? mxGetScalar(prhs[1]) : 0;
+  if (h < 1 || h > buffers.size() || h != floor(h) || buffers[(size_t) h - 1] == NULL) {
+    mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Invalid buffer handle");
+  }
+  return buffers[(size_t) h - 1];
+}
+
+template <class T> static void toBytes(const mxArray *a, size_t n)
+{
+  const T *in = (const T *) mxGetData(a);
+  converted.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    double v = (double) in[i];
+    converted[i] = (v != v || v <= 0) ? 0 : (v >= 255) ? 255 : (uint8_t) (v + 0.5);
+  }
+}
+
+static const uint8_t *getBytes(const mxArray *a, size_t n)
+{
+  if (mxIsComplex(a) || mxIsSparse(a)) mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Data must be real and full");
+  switch (mxGetClassID(a)) {
+  case mxUINT8_CLASS:
+    return (const uint8_t *) mxGetData(a);
+  case mxLOGICAL_CLASS:
+    return (const uint8_t *) mxGetData(a);
+  case mxDOUBLE_CLASS: toBytes<double>(a, n); break;
+  case mxSINGLE_CLASS: toBytes<float>(a, n); break;
+  case mxCHAR_CLASS: toBytes<mxChar>(a, n); break;
+  case mxINT8_CLASS: toBytes<int8_t>(a, n); break;
+  case mxINT16_CLASS: toBytes<int16_t>(a, n); break;
+  case mxUINT16_CLASS: toBytes<uint16_t>(a, n); break;
+  case mxINT32_CLASS: toBytes<int32_t>(a, n); break;
+  case mxUINT32_CLASS: toBytes<uint32_t>(a, n); break;
+  case mxINT64_CLASS: toBytes<int64_t>(a, n); break;
+  case mxUINT64_CLASS: toBytes<uint64_t>(a, n); break;
+  default:
+    mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Data must be numeric, char or logical");
+  }
+  return converted.data();
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  char command[32];
+  char *arg;
+
+  if (nrhs < 1 || !mxIsChar(prhs[0])) {
+    mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Usage: BpodRingBuffer(Command, ...)");
+  }
+  mexAtExit(deleteBuffers);
+  arg = mxArrayToString(prhs[0]);
+  strncpy(command, arg, sizeof(command) - 1);
+  command[sizeof(command) - 1] = 0;
+  mxFree(arg);
+
+  // write, read and bytesAvailable come first: ArCOM calls them for every message
+  if (strcmp(command, "write") == 0) {
+    MirroredRingBuffer *buffer = getBuffer(nrhs, prhs);
+    if (nrhs < 3) mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Usage: BpodRingBuffer('write', Handle, Data)");
+    size_t n = mxGetNumberOfElements(prhs[2]);
+    if (n > 0 && !buffer->write(getBytes(prhs[2], n), n)) {
+      mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Error: Buffer overflow");
+    }
+  } else if (strcmp(command, "read") == 0) {
+    MirroredRingBuffer *buffer = getBuffer(nrhs, prhs);
+    if (nrhs < 3) mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Usage: BpodRingBuffer('read', Handle, nBytes)");
+    double n = mxGetScalar(prhs[2]);
+    size_t available = buffer->bytesAvailable();
+    if (n > available) {
+      mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Error: Tried to read %.15g bytes but %zu are available", n, available);
+    }
+    size_t nBytes = (n > 0) ? (size_t) n : 0;
+    plhs[0] = mxCreateNumericMatrix(1, nBytes, mxUINT8_CLASS, mxREAL);
+    buffer->read((uint8_t *) mxGetData(plhs[0]), nBytes);
+  } else if (strcmp(command, "bytesAvailable") == 0) {
+    plhs[0] = mxCreateDoubleScalar((double) getBuffer(nrhs, prhs)->bytesAvailable());
+  } else if (strcmp(command, "create") == 0) {
+    if (nrhs < 2 || mxGetScalar(prhs[1]) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Usage: BpodRingBuffer('create', BufferSizeInBytes)");
+    }
+    MirroredRingBuffer *buffer = new MirroredRingBuffer();
+    if (buffer->create((size_t) mxGetScalar(prhs[1])) < 0) {
+      int e = errno;
+      delete buffer;
+      mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Could not create the buffer: %s", strerror(e));
+    }
+    size_t h = 0;
+    while (h < buffers.size() && buffers[h] != NULL) h++;
+    if (h == buffers.size()) buffers.push_back(NULL);
+    buffers[h] = buffer;
+    if (nBuffers++ == 0) mexLock();
+    plhs[0] = mxCreateDoubleScalar((double) (h + 1));
+  } else if (strcmp(command, "delete") == 0) {
+    MirroredRingBuffer *buffer = getBuffer(nrhs, prhs);
+    buffers[(size_t) mxGetScalar(prhs[1]) - 1] = NULL;
+    delete buffer;
+    if (--nBuffers == 0) mexUnlock();
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodRingBuffer", "Unknown command '%s'", command);
+  }
+}
@@ -0,0 +1,257 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to SessionLog:
+
+    nTrials = BpodSessionLog('open', FileName, EventNames)
+    TrialNumber = BpodSessionLog('add', RawEvents, StateNames)
+    BpodSessionLog('close')
+    FileName = BpodSessionLog('file')
+    Info = BpodSessionLog('info', FileName)
+    [RawEvents, StateNames] = BpodSessionLog('read', FileName, TrialNumber)
+    [Times, TrialNumbers] = BpodSessionLog('eventTimes', FileName, Event)
+
+  'open' starts a log, or continues one after its last complete trial,
+  and returns the number of trials already in it.  'add' appends a trial
+  as RunStateMachine returns it, with the names of the trial's states
+  (BpodSystem.LastStateMatrix.StateNames).  'close' writes the index.
+  'file' returns the log open for writing, '' if none.
+  'info' returns nTrials, Complete (closed, with its index), EventNames,
+  TrialStartTimestamp and TrialEndTimestamp.  Event is an index or a name
+  in EventNames; Times are in seconds from the start of each trial.
+  Build with "make mex" in this folder.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include "mex.h"
+#include "SessionLog.h"
+
+static SessionLogWriter writer;
+static SessionLogReader reader;
+static std::string readerPath;
+static size_t readerSize;
+
+static void cleanup(void)
+{
+  writer.close();
+  reader.close();
+}
+
+static std::string getString(const mxArray *a, const char *name)
+{
+  if (!mxIsChar(a)) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "%s must be a string", name);
+  char *s = mxArrayToString(a);
+  std::string out(s);
+  mxFree(s);
+  return out;
+}
+
+static void getStrings(const mxArray *a, const char *name, std::vector<std::string> &out)
+{
+  if (!mxIsCell(a)) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "%s must be a cell array of strings", name);
+  out.resize(mxGetNumberOfElements(a));
+  for (size_t i = 0; i < out.size(); i++) {
+    const mxArray *c = mxGetCell(a, i);
+    out[i] = (c != NULL && mxIsChar(c)) ? getString(c, name) : std::string();
+  }
+}
+
+template <typename T> static void getField(const mxArray *s, const char *name, std::vector<T> &out)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  if (f == NULL || (!mxIsEmpty(f) && !mxIsNumeric(f))) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "RawEvents.%s is missing or not numeric", name);
+  size_t n = mxGetNumberOfElements(f);
+  const void *p = mxGetData(f);
+  double value;
+  out.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    switch (mxGetClassID(f)) {
+      case mxDOUBLE_CLASS: value = ((const double *) p)[i]; break;
+      case mxSINGLE_CLASS: value = ((const float *) p)[i]; break;
+      case mxUINT8_CLASS: value = ((const uint8_t *) p)[i]; break;
+      case mxUINT16_CLASS: value = ((const uint16_t *) p)[i]; break;
+      case mxUINT32_CLASS: value = ((const uint32_t *) p)[i]; break;
+      case mxINT32_CLASS: value = ((const int32_t *) p)[i]; break;
+      default: mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "RawEvents.%s has an unsupported class", name);
+    }
+    // States, events and error codes are stored as unsigned integers of the log's width
+    if (std::numeric_limits<T>::is_integer && !(value >= 0 && value <= std::numeric_limits<T>::max() && value == floor(value))) {
+      mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "RawEvents.%s(%u) = %g cannot be stored (must be an integer 0-%g)", name,
+			(unsigned) i + 1, value, (double) std::numeric_limits<T>::max());
+    }
+    out[i] = (T) value;
+  }
+}
+
+static double getScalar(const mxArray *s, const char *name)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  if (f == NULL || mxIsEmpty(f)) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "RawEvents.%s is missing", name);
+  return mxGetScalar(f);
+}
+
+static mxArray *toCell(const std::vector<std::string> &strings)
+{
+  mxArray *out = mxCreateCellMatrix(1, strings.size());
+  for (size_t i = 0; i < strings.size(); i++) mxSetCell(out, i, mxCreateString(strings[i].c_str()));
+  return out;
+}
+
+template <typename T> static mxArray *toRow(const T *values, size_t n)
+{
+  mxArray *out = mxCreateDoubleMatrix(1, n, mxREAL);
+  double *p = mxGetPr(out);
+  for (size_t i = 0; i < n; i++) p[i] = values[i];
+  return out;
+}
+
+static void openReader(const mxArray *fileName)
+{
+  // Reopened when the file changed, e.g. trials were added since the last call
+  std::string path = getString(fileName, "FileName");
+  struct stat st;
+
+  if (stat(path.c_str(), &st) < 0) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Cannot open %s", path.c_str());
+  if (reader.isOpen() && path == readerPath && (size_t) st.st_size == readerSize) return;
+  if (reader.open(path.c_str()) < 0) {
+    readerPath.clear();
+    mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "%s is not a Bpod session log", path.c_str());
+  }
+  readerPath = path;
+  readerSize = reader.fileSize();
+}
+
+static mxArray *rawEvents(const SessionTrialView &v)
+{
+  static const char *names[] = {"States", "Events", "StateTimestamps", "EventTimestamps", "TrialStartTimestamp",
+				"TrialEndTimestamp", "ErrorCodes"};
+  mxArray *out = mxCreateStructMatrix(1, 1, 7, names);
+
+  mxSetField(out, 0, "States", toRow(v.states, v.nStates));
+  mxSetField(out, 0, "Events", toRow(v.events, v.nEvents));
+  mxSetField(out, 0, "StateTimestamps", toRow(v.stateTimestamps, v.nStates + 1));
+  mxSetField(out, 0, "EventTimestamps", toRow(v.eventTimestamps, v.nEvents));
+  mxSetField(out, 0, "TrialStartTimestamp", mxCreateDoubleScalar(v.trialStartTimestamp));
+  mxSetField(out, 0, "TrialEndTimestamp", mxCreateDoubleScalar(v.trialEndTimestamp));
+  mxSetField(out, 0, "ErrorCodes", v.nErrorCodes ? toRow(v.errorCodes, v.nErrorCodes) : mxCreateDoubleMatrix(0, 0, mxREAL));
+  return out;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs < 1 || !mxIsChar(prhs[0])) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "The first argument must be a command");
+  std::string command = getString(prhs[0], "command");
+  mexAtExit(cleanup);
+
+  if (command == "open") {
+    std::vector<std::string> eventNames;
+    if (nrhs != 3) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Usage: nTrials = BpodSessionLog('open', FileName, EventNames)");
+    std::string path = getString(prhs[1], "FileName");
+    getStrings(prhs[2], "EventNames", eventNames);
+    writer.close();
+    if (writer.open(path.c_str(), eventNames) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Cannot open %s for writing: %s", path.c_str(),
+			errno == EINVAL ? "not a Bpod session log" : strerror(errno));
+    }
+    plhs[0] = mxCreateDoubleScalar(writer.nTrials());
+  } else if (command == "add") {
+    SessionTrial t;
+    std::vector<std::string> stateNames;
+    if (nrhs != 3 || !mxIsStruct(prhs[1])) {
+      mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Usage: BpodSessionLog('add', RawEvents, StateNames)");
+    }
+    if (!writer.isOpen()) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "No session log is open");
+    getField(prhs[1], "States", t.states);
+    getField(prhs[1], "Events", t.events);
+    getField(prhs[1], "StateTimestamps", t.stateTimestamps);
+    getField(prhs[1], "EventTimestamps", t.eventTimestamps);
+    getField(prhs[1], "ErrorCodes", t.errorCodes);
+    t.trialStartTimestamp = getScalar(prhs[1], "TrialStartTimestamp");
+    t.trialEndTimestamp = getScalar(prhs[1], "TrialEndTimestamp");
+    getStrings(prhs[2], "StateNames", stateNames);
+    if (writer.append(t, stateNames) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Could not add the trial to %s: %s", writer.path().c_str(),
+			errno == EINVAL ? "StateTimestamps must have one more element than States" : strerror(errno));
+    }
+    plhs[0] = mxCreateDoubleScalar(writer.nTrials());
+  } else if (command == "close") {
+    if (writer.close() < 0) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Could not write the index: %s", strerror(errno));
+  } else if (command == "file") {
+    plhs[0] = mxCreateString(writer.isOpen() ? writer.path().c_str() : "");
+  } else if (command == "info") {
+    static const char *names[] = {"nTrials", "Complete", "EventNames", "TrialStartTimestamp", "TrialEndTimestamp"};
+    SessionTrialView v;
+    if (nrhs != 2) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Usage: Info = BpodSessionLog('info', FileName)");
+    openReader(prhs[1]);
+    uint32_t n = reader.nTrials();
+    mxArray *start = mxCreateDoubleMatrix(1, n, mxREAL), *end = mxCreateDoubleMatrix(1, n, mxREAL);
+    for (uint32_t i = 0; i < n; i++) {
+      if (reader.trial(i, v) < 0) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Trial %u is damaged", i + 1);
+      mxGetPr(start)[i] = v.trialStartTimestamp;
+      mxGetPr(end)[i] = v.trialEndTimestamp;
+    }
+    plhs[0] = mxCreateStructMatrix(1, 1, 5, names);
+    mxSetField(plhs[0], 0, "nTrials", mxCreateDoubleScalar(n));
+    mxSetField(plhs[0], 0, "Complete", mxCreateLogicalScalar(reader.complete()));
+    mxSetField(plhs[0], 0, "EventNames", toCell(reader.eventNames()));
+    mxSetField(plhs[0], 0, "TrialStartTimestamp", start);
+    mxSetField(plhs[0], 0, "TrialEndTimestamp", end);
+  } else if (command == "read") {
+    SessionTrialView v;
+    if (nrhs != 3) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Usage: [RawEvents, StateNames] = BpodSessionLog('read', FileName, TrialNumber)");
+    openReader(prhs[1]);
+    double trial = mxGetScalar(prhs[2]);
+    if (trial < 1 || trial > reader.nTrials() || reader.trial((uint32_t) trial - 1, v) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "No trial %g in %s (%u trials)", trial, readerPath.c_str(), reader.nTrials());
+    }
+    plhs[0] = rawEvents(v);
+    if (nlhs > 1) plhs[1] = toCell(reader.stateNames(v.stateNames));
+  } else if (command == "eventTimes") {
+    std::vector<double> times;
+    std::vector<uint32_t> trials;
+    int event = 0;
+    if (nrhs != 3) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Usage: [Times, TrialNumbers] = BpodSessionLog('eventTimes', FileName, Event)");
+    openReader(prhs[1]);
+    if (mxIsChar(prhs[2])) {
+      std::string name = getString(prhs[2], "Event");
+      const std::vector<std::string> &names = reader.eventNames();
+      for (size_t i = 0; i < names.size() && event == 0; i++) {
+	if (names[i] == name) event = i + 1;
+      }
+      if (event == 0) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "No event named %s", name.c_str());
+    } else {
+      event = (int) mxGetScalar(prhs[2]);
+    }
+    if (event < 1 || event > 255) mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Event must be 1-255");
+    reader.eventTimes((uint8_t) event, times, &trials);
+    plhs[0] = toRow(times.data(), times.size());
+    if (nlhs > 1) plhs[1] = toRow(trials.data(), trials.size());
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodSessionLog", "Unknown command '%s'", command.c_str());
+  }
+}
@@ -0,0 +1,259 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to StateMachineEncoder:
+
+    [ByteString, SerialMessageVector, nModulesLoaded, Unchanged] = ...
+        BpodStateMachineBytes(sma, BpodSystem.HW, BpodSystem.MachineType, BpodSystem.FirmwareVersion)
+    BpodStateMachineBytes('reset')
+
+  sma is the description as SendStateMachine prepares it (states in the
+  order they were added, >exit and >back op codes replaced).  The first
+  three outputs are those of EncodeStateMachine.  Unchanged is true if
+  the description is identical to the one encoded by the previous call
+  and no reset came in between, so the state machine already holds it.
+  Build with "make mex" in this folder.
+*/
+
+#include <string.h>
+#include "mex.h"
+#include "StateMachineEncoder.h"
+
+static StateMachineEncoder encoder;
+static StateMachineDescription description;
+static std::vector<std::vector<double> > scratch;  // non-double fields, converted
+static size_t nScratch;
+
+static const mxArray *field(const mxArray *s, const char *name)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  if (f == NULL) mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "Missing field %s", name);
+  return f;
+}
+
+static SMArray toArray(const mxArray *a, const char *name)
+{
+  SMArray out;
+  size_t n;
+
+  if (!mxIsNumeric(a) && !mxIsLogical(a) && !mxIsChar(a)) {
+    mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "%s must be numeric", name);
+  }
+  out.rows = mxGetM(a);
+  out.cols = mxGetNumberOfElements(a)/((out.rows > 0) ? out.rows : 1);
+  n = mxGetNumberOfElements(a);
+  if (mxIsDouble(a) && !mxIsComplex(a)) {
+    out.data = mxGetPr(a);
+    return out;
+  }
+  if (nScratch == scratch.size()) scratch.resize(nScratch + 1);
+  std::vector<double> &buffer = scratch[nScratch++];
+  buffer.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    switch (mxGetClassID(a)) {
+      case mxLOGICAL_CLASS: buffer[i] = ((mxLogical *) mxGetData(a))[i]; break;
+      case mxCHAR_CLASS: buffer[i] = ((mxChar *) mxGetData(a))[i]; break;
+      case mxSINGLE_CLASS: buffer[i] = ((float *) mxGetData(a))[i]; break;
+      case mxINT8_CLASS: buffer[i] = ((int8_t *) mxGetData(a))[i]; break;
+      case mxUINT8_CLASS: buffer[i] = ((uint8_t *) mxGetData(a))[i]; break;
+      case mxINT16_CLASS: buffer[i] = ((int16_t *) mxGetData(a))[i]; break;
+      case mxUINT16_CLASS: buffer[i] = ((uint16_t *) mxGetData(a))[i]; break;
+      case mxINT32_CLASS: buffer[i] = ((int32_t *) mxGetData(a))[i]; break;
+      case mxUINT32_CLASS: buffer[i] = ((uint32_t *) mxGetData(a))[i]; break;
+      case mxINT64_CLASS: buffer[i] = (double) ((int64_t *) mxGetData(a))[i]; break;
+      case mxUINT64_CLASS: buffer[i] = (double) ((uint64_t *) mxGetData(a))[i]; break;
+      default: buffer[i] = 0; break;
+    }
+  }
+  out.data = buffer.data();
+  return out;
+}
+
+static SMArray getArray(const mxArray *s, const char *name)
+{
+  return toArray(field(s, name), name);
+}
+
+static SMArray getMatrix(const mxArray *s, const char *name, size_t minCols)
+{
+  // One row per state and at least minCols columns
+  SMArray m = getArray(s, name);
+  if (m.rows < description.nStates || m.cols < minCols) {
+    mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "%s is %dx%d, expected at least %dx%d", name, (int) m.rows,
+		      (int) m.cols, (int) description.nStates, (int) minCols);
+  }
+  return m;
+}
+
+static SMArray getVector(const mxArray *s, const char *name, size_t minLength)
+{
+  SMArray v = getArray(s, name);
+  if (v.numel() < minLength) {
+    mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "%s has %d elements, expected at least %d", name, (int) v.numel(),
+		      (int) minLength);
+  }
+  return v;
+}
+
+static int getInt(const mxArray *s, const char *name)
+{
+  const mxArray *f = mxGetField(s, 0, name);
+  return (f != NULL && !mxIsEmpty(f)) ? (int) mxGetScalar(f) : 0;
+}
+
+static size_t lastSet(const SMArray &isSet)
+{
+  for (size_t i = isSet.numel(); i > 0; i--) {
+    if (isSet[i-1] != 0) return i;
+  }
+  return 0;
+}
+
+static void readDescription(const mxArray *sma, const StateMachineHardware &hw)
+{
+  StateMachineDescription &d = description;
+  const mxArray *timers = field(sma, "GlobalTimers");
+  const mxArray *meta = field(sma, "meta");
+  const mxArray *messages;
+  size_t nTimers, nCounters, nConditions, nOutputs;
+
+  nScratch = 0;
+  d.nStates = mxGetNumberOfElements(field(sma, "StateNames"));
+  d.inputMatrixSize = getInt(meta, "InputMatrixSize");
+  d.use255BackSignal = getInt(meta, "use255BackSignal") != 0;
+  d.timerIsSet = getArray(timers, "IsSet");
+  d.counterSet = getArray(sma, "GlobalCounterSet");
+  d.conditionSet = getArray(sma, "ConditionSet");
+  nTimers = lastSet(d.timerIsSet);
+  nCounters = lastSet(d.counterSet);
+  nConditions = lastSet(d.conditionSet);
+  nOutputs = hw.posGlobalTimerTrig;
+  if (hw.posGlobalTimerCancel > (int) nOutputs) nOutputs = hw.posGlobalTimerCancel;
+  if (hw.posGlobalCounterReset > (int) nOutputs) nOutputs = hw.posGlobalCounterReset;
+  if (hw.machineType == 4 && hw.posAnalogThreshDisable > (int) nOutputs) nOutputs = hw.posAnalogThreshDisable;
+  if (hw.machineType == 4 && hw.posAnalogThreshEnable > (int) nOutputs) nOutputs = hw.posAnalogThreshEnable;
+
+  d.inputMatrix = getMatrix(sma, "InputMatrix", d.inputMatrixSize);
+  d.outputMatrix = getMatrix(sma, "OutputMatrix", nOutputs);
+  d.stateTimerMatrix = getVector(sma, "StateTimerMatrix", d.nStates);
+  d.stateTimers = getVector(sma, "StateTimers", d.nStates);
+  d.globalTimerStartMatrix = getMatrix(sma, "GlobalTimerStartMatrix", nTimers);
+  d.globalTimerEndMatrix = getMatrix(sma, "GlobalTimerEndMatrix", nTimers);
+  d.globalCounterMatrix = getMatrix(sma, "GlobalCounterMatrix", nCounters);
+  d.conditionMatrix = getMatrix(sma, "ConditionMatrix", nConditions);
+  d.timerOutputChannel = getVector(timers, "OutputChannel", nTimers);
+  d.timerOnMessage = getVector(timers, "OnMessage", nTimers);
+  d.timerOffMessage = getVector(timers, "OffMessage", nTimers);
+  d.timerLoopMode = getVector(timers, "LoopMode", nTimers);
+  d.timerSendEvents = getVector(timers, "SendEvents", nTimers);
+  d.timerOnTrigger = getVector(timers, "TimerOn_Trigger", nTimers);
+  d.timerDuration = getVector(timers, "Duration", nTimers);
+  d.timerOnsetDelay = getVector(timers, "OnsetDelay", nTimers);
+  d.timerLoopInterval = getVector(timers, "LoopInterval", nTimers);
+  d.counterEvents = getVector(sma, "GlobalCounterEvents", nCounters);
+  d.counterThresholds = getVector(sma, "GlobalCounterThresholds", nCounters);
+  d.conditionChannels = getVector(sma, "ConditionChannels", nConditions);
+  d.conditionValues = getVector(sma, "ConditionValues", nConditions);
+
+  d.serialMessageMode = getInt(sma, "SerialMessageMode");
+  if (d.serialMessageMode != 1) return;
+  d.nSerialMessages = getVector(sma, "nSerialMessages", hw.nUartSerialChannels);
+  messages = field(sma, "SerialMessages");
+  if (!mxIsCell(messages)) mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "SerialMessages must be a cell array");
+  d.serialMessages.resize(hw.nUartSerialChannels);
+  for (int i = 0; i < hw.nUartSerialChannels; i++) {
+    size_t n = (size_t) d.nSerialMessages[i];
+    if (n > 0 && (mxGetM(messages) <= (size_t) i || mxGetN(messages) < n)) {
+      mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "SerialMessages has no message %d for channel %d", (int) n, i + 1);
+    }
+    d.serialMessages[i].resize(n);
+    for (size_t j = 0; j < n; j++) {
+      const mxArray *m = mxGetCell(messages, i + j*mxGetM(messages));
+      std::vector<uint8_t> &bytes = d.serialMessages[i][j];
+      bytes.clear();
+      if (m == NULL) continue;
+      SMArray values = toArray(m, "SerialMessages");
+      for (size_t k = 0; k < values.numel(); k++) {
+	double v = values[k];
+	bytes.push_back((!(v > 0)) ? 0 : (v >= 255) ? 255 : (uint8_t) (v + 0.5));
+      }
+    }
+  }
+}
+
+static void readHardware(StateMachineHardware &hw, const mxArray *HW, double machineType, double firmwareVersion)
+{
+  const mxArray *pos = field(HW, "Pos");
+  const mxArray *n = field(HW, "n");
+
+  hw.machineType = (int) machineType;
+  hw.firmwareVersion = (int) firmwareVersion;
+  hw.cycleFrequency = mxGetScalar(field(HW, "CycleFrequency"));
+  hw.maxGlobalTimers = getInt(n, "GlobalTimers");
+  hw.nUartSerialChannels = getInt(n, "UartSerialChannels");
+  hw.posGlobalTimerTrig = getInt(pos, "GlobalTimerTrig");
+  hw.posGlobalTimerCancel = getInt(pos, "GlobalTimerCancel");
+  hw.posGlobalCounterReset = getInt(pos, "GlobalCounterReset");
+  hw.posAnalogThreshEnable = getInt(pos, "AnalogThreshEnable");
+  hw.posAnalogThreshDisable = getInt(pos, "AnalogThreshDisable");
+  hw.posInputUSB = getInt(pos, "Input_USB");
+  if (hw.posGlobalTimerTrig < 1 || hw.posGlobalTimerCancel < 1 || hw.posGlobalCounterReset < 1 ||
+      (hw.machineType == 4 && (hw.posAnalogThreshEnable < 1 || hw.posAnalogThreshDisable < 1))) {
+    mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "HW.Pos is missing the virtual output channel positions");
+  }
+}
+
+static mxArray *toUint8Row(const std::vector<uint8_t> &bytes)
+{
+  mxArray *out = mxCreateNumericMatrix(bytes.empty() ? 0 : 1, bytes.size(), mxUINT8_CLASS, mxREAL);  // uint8([]) is 0x0
+  if (!bytes.empty()) memcpy(mxGetData(out), bytes.data(), bytes.size());
+  return out;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  StateMachineHardware hw;
+  bool unchanged;
+
+  if (nrhs == 1 && mxIsChar(prhs[0])) {
+    char command[16];
+    mxGetString(prhs[0], command, sizeof(command));
+    if (strcmp(command, "reset") != 0) mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes", "Unknown command '%s'", command);
+    encoder.reset();
+    return;
+  }
+  if (nrhs != 4 || !mxIsStruct(prhs[0]) || !mxIsStruct(prhs[1])) {
+    mexErrMsgIdAndTxt("Bpod:BpodStateMachineBytes",
+		      "Usage: BpodStateMachineBytes(sma, BpodSystem.HW, BpodSystem.MachineType, BpodSystem.FirmwareVersion)");
+  }
+  readHardware(hw, prhs[1], mxGetScalar(prhs[2]), mxGetScalar(prhs[3]));
+  readDescription(prhs[0], hw);
+  unchanged = encoder.encode(description, hw);
+
+  plhs[0] = toUint8Row(encoder.byteString());
+  if (nlhs > 1) {
+    // EncodeStateMachine returns [] when no messages are loaded with the description
+    plhs[1] = (description.serialMessageMode == 1) ? toUint8Row(encoder.serialMessageVector()) : mxCreateDoubleMatrix(0, 0, mxREAL);
+  }
+  if (nlhs > 2) plhs[2] = mxCreateDoubleScalar(encoder.nModulesLoaded());
+  if (nlhs > 3) plhs[3] = mxCreateLogicalScalar(unchanged);
+}
@@ -0,0 +1,170 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MEX interface to TrialEventDecoder (one decoder per MATLAB session):
+
+    BpodTrialEvents('open', PortName)
+    BpodTrialEvents('startTrial', NewStateMachineSent, LiveTimestamps)  % sends 'R'
+    Records = BpodTrialEvents('drain')         % N x 5 [Type Code Time Message Trial]
+    BpodTrialEvents('write', Bytes)            % uint8 row, e.g. soft codes or manual overrides
+    Bytes = BpodTrialEvents('read', N, Timeout)  % reply bytes received between trials, Timeout in s
+    Status = BpodTrialEvents('status')
+    BpodTrialEvents('close')
+
+  Type is a BpodRecordType (TrialEventDecoder.h): 1 = event, 2 = soft
+  code, 3 = trial start, 4 = trial end, 5 = legacy timestamp, 6 = error.
+  Event codes are 0-based as sent by the state machine.  The decoder
+  owns the port, so close BpodSystem.SerialPort first.  Build with
+  "make mex" in this folder.
+*/
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "mex.h"
+#include "TrialEventDecoder.h"
+
+static TrialEventDecoder *decoder = NULL;
+
+static void closeDecoder(void)
+{
+  delete decoder;
+  decoder = NULL;
+}
+
+static void requireOpen(void)
+{
+  if (decoder == NULL) {
+    mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "The decoder is not open. Call BpodTrialEvents('open', PortName) first.");
+  }
+}
+
+static mxArray *drainRecords(void)
+{
+  std::vector<BpodEventRecord> records(4096);
+  std::vector<BpodEventRecord> all;
+  size_t n;
+  mxArray *out;
+  double *pr;
+
+  while ((n = decoder->drain(records.data(), records.size())) > 0) {
+    all.insert(all.end(), records.begin(), records.begin() + n);
+  }
+  out = mxCreateDoubleMatrix(all.size(), 5, mxREAL);
+  pr = mxGetPr(out);
+  n = all.size();
+  for (size_t i = 0; i < n; i++) {
+    pr[i] = all[i].type;
+    pr[i + n] = all[i].code;
+    pr[i + 2*n] = (double) all[i].time;
+    pr[i + 3*n] = all[i].message;
+    pr[i + 4*n] = all[i].trial;
+  }
+  return out;
+}
+
+static mxArray *readReply(size_t nBytes, double timeoutMs)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((long long) (timeoutMs*1000));
+  mxArray *out = mxCreateNumericMatrix(1, nBytes, mxUINT8_CLASS, mxREAL);
+  uint8_t *data = (uint8_t *) mxGetData(out);
+  size_t nRead = 0;
+
+  while (nRead < nBytes) {
+    nRead += decoder->readReply(data + nRead, nBytes - nRead);
+    if (nRead == nBytes || std::chrono::steady_clock::now() > deadline) break;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  if (nRead < nBytes) {
+    mxDestroyArray(out);
+    out = mxCreateNumericMatrix(1, 0, mxUINT8_CLASS, mxREAL);  // same as a timed out serial read
+  }
+  return out;
+}
+
+static mxArray *statusStruct(void)
+{
+  const char *fields[] = {"Running", "InTrial", "BytesRead", "Records", "Dropped", "ReplyDropped", "TrialsCompleted"};
+  TrialDecoderStatus s = decoder->status();
+  mxArray *out = mxCreateStructMatrix(1, 1, 7, fields);
+
+  mxSetField(out, 0, "Running", mxCreateDoubleScalar(s.running));
+  mxSetField(out, 0, "InTrial", mxCreateDoubleScalar(s.inTrial));
+  mxSetField(out, 0, "BytesRead", mxCreateDoubleScalar((double) s.bytesRead));
+  mxSetField(out, 0, "Records", mxCreateDoubleScalar((double) s.records));
+  mxSetField(out, 0, "Dropped", mxCreateDoubleScalar((double) s.dropped));
+  mxSetField(out, 0, "ReplyDropped", mxCreateDoubleScalar((double) s.replyDropped));
+  mxSetField(out, 0, "TrialsCompleted", mxCreateDoubleScalar(s.trialsCompleted));
+  return out;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  char command[32];
+  char *portName;
+
+  if (nrhs < 1 || !mxIsChar(prhs[0])) {
+    mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Usage: BpodTrialEvents(Command, ...)");
+  }
+  mexAtExit(closeDecoder);
+  portName = mxArrayToString(prhs[0]);
+  strncpy(command, portName, sizeof(command) - 1);
+  command[sizeof(command) - 1] = 0;
+  mxFree(portName);
+
+  if (strcmp(command, "open") == 0) {
+    if (nrhs < 2 || !mxIsChar(prhs[1])) mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Usage: BpodTrialEvents('open', PortName)");
+    closeDecoder();
+    decoder = new TrialEventDecoder();
+    portName = mxArrayToString(prhs[1]);
+    if (decoder->open(portName) < 0) {
+      closeDecoder();
+      mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Could not open %s: %s", portName, strerror(errno));
+    }
+    mxFree(portName);
+  } else if (strcmp(command, "close") == 0) {
+    closeDecoder();
+  } else if (strcmp(command, "startTrial") == 0) {
+    requireOpen();
+    if (decoder->startTrial(nrhs > 1 && mxGetScalar(prhs[1]) != 0, nrhs < 3 || mxGetScalar(prhs[2]) != 0) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Could not start the trial: the decoder thread is not running.");
+    }
+  } else if (strcmp(command, "drain") == 0) {
+    requireOpen();
+    plhs[0] = drainRecords();
+  } else if (strcmp(command, "write") == 0) {
+    requireOpen();
+    if (nrhs < 2 || !mxIsUint8(prhs[1])) mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Usage: BpodTrialEvents('write', uint8(Bytes))");
+    if (decoder->write((const uint8_t *) mxGetData(prhs[1]), mxGetNumberOfElements(prhs[1])) < 0) {
+      mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Write failed: %s", strerror(errno));
+    }
+  } else if (strcmp(command, "read") == 0) {
+    requireOpen();
+    if (nrhs < 2) mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Usage: BpodTrialEvents('read', N, Timeout)");
+    plhs[0] = readReply((size_t) mxGetScalar(prhs[1]), (nrhs > 2) ? mxGetScalar(prhs[2])*1000 : 1000);
+  } else if (strcmp(command, "status") == 0) {
+    requireOpen();
+    plhs[0] = statusStruct();
+  } else {
+    mexErrMsgIdAndTxt("Bpod:BpodTrialEvents", "Unknown command '%s'", command);
+  }
+}
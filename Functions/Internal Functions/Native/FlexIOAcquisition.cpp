@@ -0,0 +1,259 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "FlexIOAcquisition.h"
+
+FlexIOAcquisition::FlexIOAcquisition() : nChan(0), ring(FLEXIO_RING_BYTES), viewQueue(FLEXIO_VIEW_WORDS),
+  stopFlag(false), readerDone(true), running(false), recordFlag(false), recording(false), decimation(1), bytesRead(0),
+  samples(0), samplesRecorded(0), samplesDropped(0), viewDropped(0), bytesWritten(0), writes(0), ringPeak(0),
+  writeError(0), fileFd(-1), block(NULL), blockUsed(0), fileOffset(0) {
+}
+
+FlexIOAcquisition::~FlexIOAcquisition() {
+  close();
+  free(block);
+}
+
+int FlexIOAcquisition::open(const char *portName, uint32_t nChannels) {
+  close();
+  if (nChannels == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (port.open(portName) < 0) return -1;
+  nChan = nChannels;
+  return 0;
+}
+
+int FlexIOAcquisition::attach(int fd, uint32_t nChannels) {
+  close();
+  if (nChannels == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  port.attach(fd);
+  nChan = nChannels;
+  return 0;
+}
+
+int FlexIOAcquisition::start(const char *fileName, bool record) {
+  uint16_t stale[1024];
+  void *p;
+
+  stop();
+  if (!port.isOpen()) {
+    errno = EBADF;
+    return -1;
+  }
+  if (block == NULL) {
+    if (posix_memalign(&p, FLEXIO_ALIGN, FLEXIO_WRITE_BLOCK) != 0) {
+      errno = ENOMEM;
+      return -1;
+    }
+    block = (uint8_t *) p;
+  }
+  if (fileName && fileName[0]) {
+    fileFd = ::open(fileName, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fileFd < 0) return -1;
+    off_t end = lseek(fileFd, 0, SEEK_END);
+    if (end < 0) {
+      ::close(fileFd);
+      fileFd = -1;
+      return -1;
+    }
+    fileOffset = end;
+  }
+  blockUsed = 0;
+  while (viewQueue.pop(stale, sizeof(stale)/2) > 0) {}  // left from the last run
+  bytesRead = samples = samplesRecorded = samplesDropped = viewDropped = bytesWritten = writes = ringPeak = 0;
+  writeError = 0;
+  recordFlag = record;
+  recording = false;
+  port.flush();  // acquisition starts at a sample boundary, as in ProcessAnalogSamples.m
+  stopFlag = false;
+  readerDone = false;
+  running = true;
+  reader = std::thread(&FlexIOAcquisition::readLoop, this);
+  writer = std::thread(&FlexIOAcquisition::writeLoop, this);
+  return 0;
+}
+
+void FlexIOAcquisition::stop() {
+  if (reader.joinable()) {
+    stopFlag = true;
+    reader.join();
+  }
+  if (writer.joinable()) writer.join();  // ends once the ring is empty
+  if (fileFd >= 0) ::close(fileFd);
+  fileFd = -1;
+  running = false;
+  recording = false;
+}
+
+void FlexIOAcquisition::close() {
+  stop();
+  port.close();
+  nChan = 0;
+}
+
+size_t FlexIOAcquisition::view(uint16_t *out, size_t maxSamples) {
+  if (nChan == 0) return 0;
+  return viewQueue.pop(out, maxSamples*nChan)/nChan;
+}
+
+FlexIOAcquisitionStatus FlexIOAcquisition::status() const {
+  FlexIOAcquisitionStatus s;
+  s.running = running;
+  s.recording = recording;
+  s.bytesRead = bytesRead;
+  s.samples = samples;
+  s.samplesRecorded = samplesRecorded;
+  s.samplesDropped = samplesDropped;
+  s.viewDropped = viewDropped;
+  s.bytesWritten = bytesWritten;
+  s.writes = writes;
+  s.ringPeak = ringPeak;
+  s.writeError = writeError;
+  return s;
+}
+
+void FlexIOAcquisition::readLoop() {
+  /*
+    Only whole samples go into the ring, so when it is full whole samples
+    are dropped and the writer never has to find the sample boundary again.
+    The part of a sample that ends a read waits at the front of buffer.
+  */
+  const size_t frame = 2*((size_t) nChan + 1);
+  std::vector<uint8_t> buffer(FLEXIO_READ_SIZE + frame);
+  size_t carry = 0;
+  int n;
+
+  while (!stopFlag) {
+    n = port.waitReadable(100);
+    if (n < 0) break;
+    if (n == 0) continue;
+    n = port.readSome(buffer.data() + carry, FLEXIO_READ_SIZE);
+    if (n < 0) break;  // port closed or device gone
+    bytesRead += n;
+    size_t total = carry + n, whole = total - total % frame;
+    size_t room = ring.capacity() - ring.size();
+    size_t pushed = ring.push(buffer.data(), (whole < room) ? whole : room - room % frame);
+    if (pushed < whole) samplesDropped += (whole - pushed)/frame;
+    carry = total - whole;
+    memmove(buffer.data(), buffer.data() + whole, carry);
+    size_t waiting = ring.size();
+    if (waiting > ringPeak) ringPeak = waiting;
+  }
+  readerDone = true;
+  running = false;
+}
+
+int FlexIOAcquisition::writeBlock(size_t n) {
+  size_t done = 0;
+  ssize_t w;
+
+  while (done < n) {
+    w = ::write(fileFd, block + done, n - done);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      int none = 0;
+      writeError.compare_exchange_strong(none, w < 0 ? errno : EIO);
+      break;
+    }
+    done += w;
+  }
+  writes++;
+  bytesWritten += done;
+  fileOffset += done;
+  blockUsed -= n;
+  memmove(block, block + n, blockUsed);
+  return done == n ? 0 : -1;
+}
+
+int FlexIOAcquisition::flushBlock(bool all) {
+  // Unless all, only up to the last FLEXIO_ALIGN boundary in the file, so the next write starts on one
+  size_t n = blockUsed;
+  if (!all) {
+    uint64_t end = (fileOffset + blockUsed)/FLEXIO_ALIGN*FLEXIO_ALIGN;
+    n = (end > fileOffset) ? end - fileOffset : 0;
+  }
+  return n ? writeBlock(n) : 0;
+}
+
+void FlexIOAcquisition::writeLoop() {
+  const size_t frame = 2*((size_t) nChan + 1);
+  std::vector<uint8_t> chunk(FLEXIO_WRITE_BLOCK/frame*frame);
+  std::vector<uint16_t> sample(nChan + 1);
+  auto lastFlush = std::chrono::steady_clock::now();
+  uint32_t phase = 0;
+
+  for (;;) {
+    bool done = readerDone;
+    size_t n = ring.pop(chunk.data(), chunk.size());  // whole samples, as pushed
+    if (n == 0) {
+      if (done) break;
+      if (fileFd >= 0 && std::chrono::steady_clock::now() - lastFlush > std::chrono::milliseconds(FLEXIO_FLUSH_MS)) {
+	flushBlock(false);
+	lastFlush = std::chrono::steady_clock::now();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      continue;
+    }
+    uint64_t k = n/frame;
+    samples += k;
+
+    bool rec = recordFlag && fileFd >= 0;
+    recording = rec;
+    for (size_t pos = 0; rec && pos < n;) {
+      size_t c = FLEXIO_WRITE_BLOCK - blockUsed;
+      if (c > n - pos) c = n - pos;
+      memcpy(block + blockUsed, chunk.data() + pos, c);
+      blockUsed += c;
+      pos += c;
+      if (blockUsed == FLEXIO_WRITE_BLOCK) {
+	flushBlock(false);
+	lastFlush = std::chrono::steady_clock::now();
+      }
+    }
+    if (rec) samplesRecorded += k;
+
+    // Every decimation-th sample for the viewer, without the trial number
+    uint32_t d = decimation;
+    for (uint64_t i = 0; i < k; i++, phase++) {
+      if (phase >= d) phase = 0;
+      if (phase) continue;
+      if (viewQueue.capacity() - viewQueue.size() < nChan) {
+	viewDropped++;
+	continue;
+      }
+      memcpy(sample.data(), chunk.data() + i*frame, frame);
+      viewQueue.push(sample.data() + 1, nChan);
+    }
+  }
+  if (fileFd >= 0) flushBlock(true);
+}
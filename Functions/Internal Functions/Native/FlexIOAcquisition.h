@@ -0,0 +1,110 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  FlexIOAcquisition: drains the state machine's Flex I/O analog port on
+  its own thread, so samples are not lost while MATLAB is busy (the
+  analog timer in ProcessAnalogSamples.m is only as regular as MATLAB
+  is).  Samples arrive as nChannels + 1 uint16 words (the trial number,
+  then one word per channel; see FlexIOAnalog.h).
+
+  The reader thread moves port input into a lock-free ring.  A second
+  thread takes it from there in whole samples: it logs them to the
+  analog data file through an aligned buffer, written in FLEXIO_WRITE_BLOCK
+  blocks at block-aligned file offsets (a partial block only when the
+  file is flushed or closed), and keeps every decimation-th sample for a
+  viewer (view()).  The client only polls status() and view().  If the
+  ring fills (the disk stalled for minutes), whole samples are dropped
+  and counted, so the file stays sample-aligned.
+*/
+
+#ifndef FlexIOAcquisition_h
+#define FlexIOAcquisition_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "ArCOMHost.h"
+#include "SPSCQueue.h"
+
+#define FLEXIO_RING_BYTES   (1 << 24)  // port input buffered ahead of the file (16 MB)
+#define FLEXIO_VIEW_WORDS   (1 << 18)  // decimated samples kept for the viewer, in words
+#define FLEXIO_WRITE_BLOCK  (1 << 20)  // bytes per file write
+#define FLEXIO_ALIGN        4096       // buffer and file offset alignment
+#define FLEXIO_FLUSH_MS     1000       // data reaches the file at least this often
+#define FLEXIO_READ_SIZE    65536      // bytes per port read
+
+struct FlexIOAcquisitionStatus {
+  bool running;            // reader thread alive (false after a port error)
+  bool recording;
+  uint64_t bytesRead;
+  uint64_t samples;        // complete samples received
+  uint64_t samplesRecorded;
+  uint64_t samplesDropped; // lost because the ring was full
+  uint64_t viewDropped;    // decimated samples lost because nobody viewed them
+  uint64_t bytesWritten;
+  uint64_t writes;         // write() calls on the file
+  uint64_t ringPeak;       // most bytes waiting in the ring
+  int writeError;          // errno of the first failed write, 0 if none
+};
+
+class FlexIOAcquisition
+{
+public:
+  FlexIOAcquisition();
+  ~FlexIOAcquisition();
+  int open(const char *portName, uint32_t nChannels);  // 0, or -1 with errno set
+  int attach(int fd, uint32_t nChannels);               // same, on an open descriptor
+  // Discards pending port input and starts acquiring; samples are appended to
+  // fileName (created if needed) while recording.  No file: fileName NULL or "".
+  int start(const char *fileName, bool record = true);
+  void stop();                   // drains what was read, writes it and closes the file
+  void close();                  // stops, then closes the port
+  void setRecording(bool on) { recordFlag = on; }  // takes effect at a sample boundary
+  void setDecimation(uint32_t n) { decimation = n ? n : 1; }
+  uint32_t nChannels() const { return nChan; }
+  size_t view(uint16_t *out, size_t maxSamples);   // decimated samples, nChannels words each
+  FlexIOAcquisitionStatus status() const;
+
+private:
+  ArCOMHost port;
+  uint32_t nChan;
+  SPSCQueue<uint8_t> ring;
+  SPSCQueue<uint16_t> viewQueue;
+  std::thread reader, writer;
+  std::atomic<bool> stopFlag, readerDone, running, recordFlag, recording;
+  std::atomic<uint32_t> decimation;
+  std::atomic<uint64_t> bytesRead, samples, samplesRecorded, samplesDropped, viewDropped, bytesWritten, writes, ringPeak;
+  std::atomic<int> writeError;
+  int fileFd;
+  uint8_t *block;                // FLEXIO_WRITE_BLOCK bytes, FLEXIO_ALIGN aligned
+  size_t blockUsed;
+  uint64_t fileOffset;
+  int writeBlock(size_t n);
+  int flushBlock(bool all);
+  void readLoop();
+  void writeLoop();
+  FlexIOAcquisition(const FlexIOAcquisition &);
+  FlexIOAcquisition &operator=(const FlexIOAcquisition &);
+};
+#endif
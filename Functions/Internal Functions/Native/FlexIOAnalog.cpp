@@ -0,0 +1,190 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "FlexIOAnalog.h"
+
+#define BLOCK_BYTES 16384  // source words per transpose block: about half of L1
+
+/*
+  The copy loops are templates on the channel count, so that for the 1-4
+  channels a state machine has the inner loop is unrolled with a constant
+  stride and vectorized; NCHAN = 0 is the general case.
+*/
+
+template <int NCHAN> static void copySamples(const uint16_t *src, uint32_t nChan, uint64_t n, uint16_t *out)
+{
+  const uint32_t nc = NCHAN ? NCHAN : nChan, stride = nc + 1;
+
+  for (uint64_t i = 0; i < n; i++, src += stride, out += nc) {
+    for (uint32_t c = 0; c < nc; c++) out[c] = src[c + 1];
+  }
+}
+
+template <int NCHAN> static void convertSamples(const uint16_t *src, uint32_t nChan, uint64_t n, double *out, bool volts)
+{
+  const uint32_t nc = NCHAN ? NCHAN : nChan, stride = nc + 1;
+
+  if (volts) {
+    // Same expression as AddFlexIOAnalogData.m, for identical results
+    for (uint64_t i = 0; i < n; i++, src += stride, out += nc) {
+      for (uint32_t c = 0; c < nc; c++) out[c] = ((double) src[c + 1]/FLEXIO_BIT_MAX)*FLEXIO_VOLTAGE_MAX;
+    }
+  } else {
+    for (uint64_t i = 0; i < n; i++, src += stride, out += nc) {
+      for (uint32_t c = 0; c < nc; c++) out[c] = src[c + 1];
+    }
+  }
+}
+
+template <int NCHAN> static void transposeSamples(const uint16_t *src, uint32_t nChan, uint64_t n, uint16_t *const *out)
+{
+  // One block of samples at a time, so each channel's pass over it reads from cache
+  const uint32_t nc = NCHAN ? NCHAN : nChan, stride = nc + 1;
+  const uint64_t block = BLOCK_BYTES/(2*stride);
+
+  for (uint64_t b = 0; b < n; b += block) {
+    const uint64_t m = (n - b < block) ? n - b : block;
+    const uint16_t *s = src + b*stride;
+    for (uint32_t c = 0; c < nc; c++) {
+      uint16_t *o = out[c] + b;
+      for (uint64_t i = 0; i < m; i++) o[i] = s[i*stride + c + 1];
+    }
+  }
+}
+
+FlexIOAnalogFile::FlexIOAnalogFile() : map(NULL), size(0), nChan(0), nSamp(0), indexed(false) {
+}
+
+FlexIOAnalogFile::~FlexIOAnalogFile() {
+  close();
+}
+
+void FlexIOAnalogFile::close() {
+  if (map) munmap((void *) map, size);
+  map = NULL;
+  size = 0;
+  nChan = 0;
+  nSamp = 0;
+  runs.clear();
+  indexed = false;
+}
+
+int FlexIOAnalogFile::open(const char *path, uint32_t nChannels) {
+  struct stat st;
+  void *m;
+  int fd;
+
+  close();
+  if (nChannels == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  if ((uint64_t) st.st_size < 2*((uint64_t) nChannels + 1)) {
+    // Nothing to map: no complete sample
+    ::close(fd);
+    map = NULL;
+    nChan = nChannels;
+    return 0;
+  }
+  m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) return -1;
+  madvise(m, st.st_size, MADV_SEQUENTIAL);
+  map = (const uint16_t *) m;
+  size = st.st_size;
+  nChan = nChannels;
+  nSamp = size/(2*((uint64_t) nChan + 1));
+  return 0;
+}
+
+void FlexIOAnalogFile::samples(uint64_t first, uint64_t n, uint16_t *out) const {
+  const uint16_t *src = map + first*(nChan + 1);
+
+  switch (nChan) {
+    case 1: copySamples<1>(src, nChan, n, out); break;
+    case 2: copySamples<2>(src, nChan, n, out); break;
+    case 3: copySamples<3>(src, nChan, n, out); break;
+    case 4: copySamples<4>(src, nChan, n, out); break;
+    default: copySamples<0>(src, nChan, n, out);
+  }
+}
+
+void FlexIOAnalogFile::samples(uint64_t first, uint64_t n, double *out, bool volts) const {
+  const uint16_t *src = map + first*(nChan + 1);
+
+  switch (nChan) {
+    case 1: convertSamples<1>(src, nChan, n, out, volts); break;
+    case 2: convertSamples<2>(src, nChan, n, out, volts); break;
+    case 3: convertSamples<3>(src, nChan, n, out, volts); break;
+    case 4: convertSamples<4>(src, nChan, n, out, volts); break;
+    default: convertSamples<0>(src, nChan, n, out, volts);
+  }
+}
+
+void FlexIOAnalogFile::trialNumbers(uint64_t first, uint64_t n, double *out) const {
+  const uint16_t *src = map + first*(nChan + 1);
+
+  for (uint64_t i = 0; i < n; i++) out[i] = src[i*(nChan + 1)];
+}
+
+void FlexIOAnalogFile::channels(uint64_t first, uint64_t n, uint16_t *const *out) const {
+  const uint16_t *src = map + first*(nChan + 1);
+
+  switch (nChan) {
+    case 1: transposeSamples<1>(src, nChan, n, out); break;
+    case 2: transposeSamples<2>(src, nChan, n, out); break;
+    case 3: transposeSamples<3>(src, nChan, n, out); break;
+    case 4: transposeSamples<4>(src, nChan, n, out); break;
+    default: transposeSamples<0>(src, nChan, n, out);
+  }
+}
+
+const std::vector<FlexIOTrialRun> &FlexIOAnalogFile::trialIndex() {
+  // One pass over the sync words; the samples themselves are not read
+  if (indexed) return runs;
+  const uint32_t stride = nChan + 1;
+  FlexIOTrialRun run;
+  for (uint64_t i = 0; i < nSamp; i++) {
+    uint16_t trial = map[i*stride];
+    if (i == 0 || trial != run.trial) {
+      if (i) runs.push_back(run);
+      run.trial = trial;
+      run.first = i;
+      run.n = 0;
+    }
+    run.n++;
+  }
+  if (nSamp) runs.push_back(run);
+  indexed = true;
+  return runs;
+}
@@ -0,0 +1,80 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  FlexIOAnalogFile: reads the Flex I/O analog data file that
+  ProcessAnalogSamples() logs during a session, through a memory map,
+  without loading it: samples in a range as MATLAB's nChannels x n matrix
+  (in bits or volts), one array per channel, and an index of the samples
+  acquired during each trial.
+
+  File layout: one uint16 word per channel plus the sync word (the trial
+  number), per sample:
+    [trial, channel 1, ..., channel nChannels] x nSamples
+  An incomplete last sample (acquisition cut short) is ignored.
+*/
+
+#ifndef FlexIOAnalog_h
+#define FlexIOAnalog_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define FLEXIO_BIT_MAX 4095       // ADC bit depth
+#define FLEXIO_VOLTAGE_MAX 5.0    // ADC input range is 0 - 5V
+
+struct FlexIOTrialRun {           // consecutive samples with the same trial number
+  uint32_t trial;
+  uint64_t first, n;              // 0-based sample index, number of samples
+};
+
+class FlexIOAnalogFile
+{
+public:
+  FlexIOAnalogFile();
+  ~FlexIOAnalogFile();
+  int open(const char *path, uint32_t nChannels);  // 0, or -1 with errno set
+  void close();
+  bool isOpen() const { return map != NULL; }
+  size_t fileSize() const { return size; }
+  uint32_t nChannels() const { return nChan; }
+  uint64_t nSamples() const { return nSamp; }
+  uint16_t trialNumber(uint64_t sample) const { return map[sample*(nChan + 1)]; }
+  // Samples [first, first + n), channel-interleaved (nChannels x n, column-major, sync word dropped)
+  void samples(uint64_t first, uint64_t n, uint16_t *out) const;
+  void samples(uint64_t first, uint64_t n, double *out, bool volts) const;
+  void trialNumbers(uint64_t first, uint64_t n, double *out) const;
+  // Samples [first, first + n), one array per channel: out[channel][0..n-1]
+  void channels(uint64_t first, uint64_t n, uint16_t *const *out) const;
+  const std::vector<FlexIOTrialRun> &trialIndex();  // built on first use
+
+private:
+  const uint16_t *map;
+  size_t size;
+  uint32_t nChan;
+  uint64_t nSamp;
+  std::vector<FlexIOTrialRun> runs;
+  bool indexed;
+  FlexIOAnalogFile(const FlexIOAnalogFile &);
+  FlexIOAnalogFile &operator=(const FlexIOAnalogFile &);
+};
+#endif
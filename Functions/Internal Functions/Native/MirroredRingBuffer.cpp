@@ -0,0 +1,118 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "MirroredRingBuffer.h"
+
+static int anonymousFile(size_t size)
+{
+  // A file with no name, backing both mappings
+  int fd;
+#ifdef MFD_CLOEXEC
+  fd = memfd_create("bpod-ring-buffer", MFD_CLOEXEC);
+#else
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/bpod-ring-buffer-XXXXXX", dir ? dir : "/tmp");
+  fd = mkstemp(path);
+  if (fd >= 0) unlink(path);
+#endif
+  if (fd < 0) return -1;
+  if (ftruncate(fd, size) < 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  return fd;
+}
+
+MirroredRingBuffer::MirroredRingBuffer() : base(NULL), size(0), head(0), tail(0) {
+}
+
+MirroredRingBuffer::~MirroredRingBuffer() {
+  destroy();
+}
+
+void MirroredRingBuffer::destroy() {
+  if (base) munmap(base, 2*size);
+  base = NULL;
+  size = 0;
+  head = 0;
+  tail = 0;
+}
+
+int MirroredRingBuffer::create(size_t minCapacity) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  void *reserved, *first, *second;
+  int fd, e;
+
+  destroy();
+  if (minCapacity == 0) minCapacity = 1;
+  size_t n = (minCapacity + page - 1)/page*page;
+  fd = anonymousFile(n);
+  if (fd < 0) return -1;
+  // Reserve twice the size, then map the file over each half
+  reserved = mmap(NULL, 2*n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved == MAP_FAILED) {
+    e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  first = mmap(reserved, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+  second = (first == MAP_FAILED) ? MAP_FAILED :
+    mmap((uint8_t *) reserved + n, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+  e = errno;
+  close(fd);  // the mappings keep the pages
+  if (first == MAP_FAILED || second == MAP_FAILED) {
+    munmap(reserved, 2*n);
+    errno = e;
+    return -1;
+  }
+  base = (uint8_t *) reserved;
+  size = n;
+  return 0;
+}
+
+bool MirroredRingBuffer::write(const uint8_t *data, size_t n) {
+  size_t room;
+  uint8_t *p = writeSpace(room);
+  if (n > room) return false;
+  memcpy(p, data, n);
+  commit(n);
+  return true;
+}
+
+bool MirroredRingBuffer::read(uint8_t *data, size_t n) {
+  size_t available;
+  const uint8_t *p = readData(available);
+  if (n > available) return false;
+  memcpy(data, p, n);
+  consume(n);
+  return true;
+}
@@ -0,0 +1,80 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  MirroredRingBuffer: a byte ring for one producer thread and one consumer
+  thread whose pages are mapped twice, back to back, so the free space and
+  the data waiting are always contiguous in memory: write() and read() are
+  one memcpy each, and a client can fill or parse the buffer in place
+  (writeSpace()/commit(), readData()/consume()) with no wrap handling.
+
+  The capacity is a multiple of the page size.  Positions are 64-bit byte
+  counts that never wrap; the data waiting is [tail, head).
+*/
+
+#ifndef MirroredRingBuffer_h
+#define MirroredRingBuffer_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class MirroredRingBuffer
+{
+public:
+  MirroredRingBuffer();
+  ~MirroredRingBuffer();
+  int create(size_t minCapacity);  // 0, or -1 with errno set
+  void destroy();
+  bool isOpen() const { return base != NULL; }
+  size_t capacity() const { return size; }
+  size_t bytesAvailable() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  // Producer side
+  uint8_t *writeSpace(size_t &room) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    room = size - (h - tail.load(std::memory_order_acquire));
+    return base + (h % size);
+  }
+  void commit(size_t n) { head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+  bool write(const uint8_t *data, size_t n);  // all of it, or nothing if it does not fit
+  // Consumer side
+  const uint8_t *readData(size_t &available) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    available = head.load(std::memory_order_acquire) - t;
+    return base + (t % size);
+  }
+  void consume(size_t n) { tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+  bool read(uint8_t *data, size_t n);         // all of it, or nothing if fewer bytes are waiting
+
+private:
+  uint8_t *base;
+  size_t size;
+  char pad0[64];
+  std::atomic<uint64_t> head;  // bytes written, owned by the producer
+  char pad1[64 - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> tail;  // bytes read, owned by the consumer
+  char pad2[64 - sizeof(std::atomic<uint64_t>)];
+  MirroredRingBuffer(const MirroredRingBuffer &);
+  MirroredRingBuffer &operator=(const MirroredRingBuffer &);
+};
+#endif
@@ -0,0 +1,88 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  SPSCQueue: fixed-capacity lock-free queue for one producer thread and
+  one consumer thread, e.g. a port reader handing records to MATLAB.
+  push() never blocks; when the queue is full it returns false (or, for
+  an array, pushes what fits) and the producer counts the loss.  pop()
+  drains up to maxItems in one call.
+*/
+
+#ifndef SPSCQueue_h
+#define SPSCQueue_h
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+template <typename T>
+class SPSCQueue
+{
+public:
+  explicit SPSCQueue(size_t capacity) : head(0), tail(0) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;  // power of two, so indexes wrap with a mask
+    buffer.resize(n);
+    mask = n - 1;
+  }
+  size_t capacity() const { return mask + 1; }
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  // Producer side
+  bool push(const T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) > mask) return false;
+    buffer[h & mask] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  size_t push(const T *items, size_t n) {  // as many as fit; returns the count pushed
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t room = mask + 1 - (h - tail.load(std::memory_order_acquire));
+    if (n > room) n = room;
+    for (size_t i = 0; i < n; i++) buffer[(h + i) & mask] = items[i];
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+  // Consumer side
+  size_t pop(T *items, size_t maxItems) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t n = head.load(std::memory_order_acquire) - t;
+    if (n > maxItems) n = maxItems;
+    for (size_t i = 0; i < n; i++) items[i] = buffer[(t + i) & mask];
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+
+private:
+  std::vector<T> buffer;
+  size_t mask;
+  // Padding keeps head and tail on separate cache lines without alignas,
+  // which C++11 operator new does not honor for heap-allocated owners.
+  char pad0[64];
+  std::atomic<size_t> head;  // next slot to write, owned by the producer
+  char pad1[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail;  // next slot to read, owned by the consumer
+  char pad2[64 - sizeof(std::atomic<size_t>)];
+};
+#endif
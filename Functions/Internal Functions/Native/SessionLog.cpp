@@ -0,0 +1,384 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SessionLog.h"
+
+#define LOG_HEADER_SIZE  16
+#define LOG_TRAILER_SIZE 16
+#define TRIAL_FIXED_SIZE 48  // block header, 6 uint32, 2 doubles
+
+static const char logMagic[8] = {'B', 'P', 'O', 'D', 'L', 'O', 'G', 0};
+static const char endMagic[8] = {'B', 'P', 'O', 'D', 'E', 'N', 'D', 0};
+static const std::vector<std::string> noNames;
+
+template <typename T> static T get(const uint8_t *p)
+{
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+template <typename T> static void put(std::vector<uint8_t> &buffer, T value)
+{
+  const uint8_t *p = (const uint8_t *) &value;
+  buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+static void pad8(std::vector<uint8_t> &buffer)
+{
+  while (buffer.size() % 8) buffer.push_back(0);
+}
+
+static size_t trialSize(uint32_t nStates, uint32_t nEvents, uint32_t nErrorCodes)
+{
+  // Without padding
+  return TRIAL_FIXED_SIZE + 8*((size_t) nStates + 1 + nEvents) + 4*(size_t) nErrorCodes + 2*(size_t) nStates + nEvents;
+}
+
+// ------------------------------------------------------------------ reader
+
+SessionLogReader::SessionLogReader() : map(NULL), size(0), end(0), indexed(false), eventNamesTable(UINT32_MAX) {
+}
+
+SessionLogReader::~SessionLogReader() {
+  close();
+}
+
+void SessionLogReader::close() {
+  if (map) munmap((void *) map, size);
+  map = NULL;
+  size = end = 0;
+  indexed = false;
+  trialOffsets.clear();
+  nameOffsets.clear();
+  names.clear();
+  stateTables.clear();
+  eventNamesTable = UINT32_MAX;
+}
+
+int SessionLogReader::open(const char *path) {
+  struct stat st;
+  void *m;
+  int fd;
+
+  close();
+  fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  if (st.st_size < LOG_HEADER_SIZE) {
+    ::close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) return -1;
+  map = (const uint8_t *) m;
+  size = st.st_size;
+  if (memcmp(map, logMagic, 8) != 0 || get<uint32_t>(map + 8) != LOG_VERSION ||
+      (readIndex() < 0 && scanBlocks() < 0)) {
+    close();
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+int SessionLogReader::readIndex() {
+  // Closed logs end with the index and the trailer
+  if (size < LOG_HEADER_SIZE + 16 + LOG_TRAILER_SIZE || memcmp(map + size - 8, endMagic, 8) != 0) return -1;
+  uint64_t indexOffset = get<uint64_t>(map + size - LOG_TRAILER_SIZE);
+  if (indexOffset < LOG_HEADER_SIZE || indexOffset % 8 || indexOffset + 16 > size - LOG_TRAILER_SIZE) return -1;
+  const uint8_t *p = map + indexOffset;
+  uint32_t nTrials = get<uint32_t>(p + 8), nTables = get<uint32_t>(p + 12);
+  if (get<uint32_t>(p) != LOG_INDEX || get<uint32_t>(p + 4) != 16 + 8*((uint64_t) nTrials + nTables) ||
+      indexOffset + get<uint32_t>(p + 4) != size - LOG_TRAILER_SIZE) return -1;
+  trialOffsets.resize(nTrials);
+  nameOffsets.resize(nTables);
+  if (nTrials) memcpy(trialOffsets.data(), p + 16, 8*(size_t) nTrials);
+  if (nTables) memcpy(nameOffsets.data(), p + 16 + 8*(size_t) nTrials, 8*(size_t) nTables);
+  for (uint32_t i = 0; i < nTables; i++) {
+    if (readNames(nameOffsets[i]) < 0) return -1;
+  }
+  for (uint32_t i = 0; i < nTrials; i++) {
+    if (trialOffsets[i] < LOG_HEADER_SIZE || trialOffsets[i] + TRIAL_FIXED_SIZE > indexOffset) return -1;
+  }
+  end = indexOffset;
+  indexed = true;
+  return 0;
+}
+
+int SessionLogReader::scanBlocks() {
+  // A log that was not closed: every block up to the first incomplete one
+  size_t pos = LOG_HEADER_SIZE;
+
+  trialOffsets.clear();
+  nameOffsets.clear();
+  names.clear();
+  stateTables.clear();
+  while (pos + 8 <= size) {
+    uint32_t type = get<uint32_t>(map + pos), blockSize = get<uint32_t>(map + pos + 4);
+    if (blockSize < 16 || blockSize % 8 || pos + blockSize > size) break;
+    if (type == LOG_TRIAL) {
+      if (blockSize < TRIAL_FIXED_SIZE || trialSize(get<uint32_t>(map + pos + 12), get<uint32_t>(map + pos + 16),
+						     get<uint32_t>(map + pos + 20)) > blockSize) break;
+      trialOffsets.push_back(pos);
+    } else if (type == LOG_NAMES) {
+      if (readNames(pos) < 0) break;
+      nameOffsets.push_back(pos);
+    } else {
+      break;  // LOG_INDEX without its trailer: the log was being closed
+    }
+    pos += blockSize;
+  }
+  end = pos;
+  return 0;
+}
+
+int SessionLogReader::readNames(uint64_t offset) {
+  if (offset + 16 > size || get<uint32_t>(map + offset) != LOG_NAMES) return -1;
+  uint32_t blockSize = get<uint32_t>(map + offset + 4);
+  uint32_t kind = get<uint32_t>(map + offset + 8), n = get<uint32_t>(map + offset + 12);
+  size_t pos = offset + 16, blockEnd = offset + blockSize;
+  std::vector<std::string> table;
+
+  if (blockEnd > size) return -1;
+  for (uint32_t i = 0; i < n; i++) {
+    if (pos + 2 > blockEnd) return -1;
+    uint16_t length = get<uint16_t>(map + pos);
+    if (pos + 2 + length > blockEnd) return -1;
+    table.push_back(std::string((const char *) map + pos + 2, length));
+    pos += 2 + length;
+  }
+  if (kind == 0) {
+    eventNamesTable = names.size();
+  } else {
+    stateTables.push_back(names.size());
+  }
+  names.push_back(table);
+  return 0;
+}
+
+const std::vector<std::string> &SessionLogReader::eventNames() const {
+  // A writer that failed or died between the header and the first names block leaves none
+  return (eventNamesTable < names.size()) ? names[eventNamesTable] : noNames;
+}
+
+const std::vector<std::string> &SessionLogReader::stateNames(uint32_t table) const {
+  return (table < stateTables.size()) ? names[stateTables[table]] : noNames;
+}
+
+int SessionLogReader::trial(uint32_t i, SessionTrialView &v) const {
+  if (i >= trialOffsets.size()) return -1;
+  const uint8_t *p = map + trialOffsets[i];
+  uint32_t blockSize = get<uint32_t>(p + 4);
+  if (get<uint32_t>(p) != LOG_TRIAL || trialOffsets[i] + blockSize > end) return -1;
+  v.trial = get<uint32_t>(p + 8);
+  v.nStates = get<uint32_t>(p + 12);
+  v.nEvents = get<uint32_t>(p + 16);
+  v.nErrorCodes = get<uint32_t>(p + 20);
+  v.stateNames = get<uint32_t>(p + 24);
+  if (trialSize(v.nStates, v.nEvents, v.nErrorCodes) > blockSize) return -1;
+  v.trialStartTimestamp = get<double>(p + 32);
+  v.trialEndTimestamp = get<double>(p + 40);
+  // Blocks are 8-byte aligned in a page-aligned map
+  v.stateTimestamps = (const double *) (p + TRIAL_FIXED_SIZE);
+  v.eventTimestamps = v.stateTimestamps + v.nStates + 1;
+  v.errorCodes = (const uint32_t *) (v.eventTimestamps + v.nEvents);
+  v.states = (const uint16_t *) (v.errorCodes + v.nErrorCodes);
+  v.events = (const uint8_t *) (v.states + v.nStates);
+  return 0;
+}
+
+size_t SessionLogReader::eventTimes(uint8_t event, std::vector<double> &times, std::vector<uint32_t> *trials) const {
+  SessionTrialView v;
+  size_t n = 0;
+
+  for (uint32_t i = 0; i < trialOffsets.size(); i++) {
+    if (trial(i, v) < 0) continue;
+    for (uint32_t e = 0; e < v.nEvents; e++) {
+      if (v.events[e] != event) continue;
+      times.push_back(v.eventTimestamps[e]);
+      if (trials) trials->push_back(v.trial);
+      n++;
+    }
+  }
+  return n;
+}
+
+// ------------------------------------------------------------------ writer
+
+SessionLogWriter::SessionLogWriter() : fd(-1), offset(0), nStateTables(0) {
+}
+
+SessionLogWriter::~SessionLogWriter() {
+  close();
+}
+
+int SessionLogWriter::open(const char *path, const std::vector<std::string> &eventNames) {
+  SessionLogReader existing;
+  struct stat st;
+
+  close();
+  trialOffsets.clear();
+  nameOffsets.clear();
+  lastStateNames.clear();
+  nStateTables = 0;
+  if (stat(path, &st) == 0 && st.st_size > 0) {
+    // Continue the log after its last complete trial; the index is written again on close
+    if (existing.open(path) < 0) return -1;
+    trialOffsets = existing.trialOffsets;
+    nameOffsets = existing.nameOffsets;
+    nStateTables = existing.nStateNameTables();
+    if (nStateTables > 0) lastStateNames = existing.stateNames(nStateTables - 1);
+    offset = existing.dataEnd();
+    bool sameEvents = existing.eventNames() == eventNames;
+    existing.close();
+    fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, offset) < 0 || lseek(fd, offset, SEEK_SET) < 0) {
+      if (fd >= 0) ::close(fd);
+      fd = -1;
+      return -1;
+    }
+    if (!sameEvents && writeNames(0, eventNames) < 0) return -1;
+  } else {
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    offset = 0;
+    block.assign(logMagic, logMagic + 8);
+    put<uint32_t>(block, LOG_VERSION);
+    put<uint32_t>(block, 0);
+    if (writeBlock() < 0 || writeNames(0, eventNames) < 0) return -1;
+  }
+  fileName = path;
+  return 0;
+}
+
+int SessionLogWriter::writeBlock() {
+  size_t nWritten = 0;
+  ssize_t n;
+
+  while (nWritten < block.size()) {
+    n = ::write(fd, block.data() + nWritten, block.size() - nWritten);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      // Cut off what was written, so offset still matches the file and the next block lands there
+      int err = errno;
+      if (nWritten > 0 && ftruncate(fd, offset) == 0) lseek(fd, offset, SEEK_SET);
+      errno = err;
+      return -1;
+    }
+    nWritten += n;
+  }
+  offset += block.size();
+  return 0;
+}
+
+int SessionLogWriter::writeNames(uint32_t kind, const std::vector<std::string> &names) {
+  block.clear();
+  put<uint32_t>(block, LOG_NAMES);
+  put<uint32_t>(block, 0);
+  put<uint32_t>(block, kind);
+  put<uint32_t>(block, names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    uint16_t length = (names[i].size() > 65535) ? 65535 : names[i].size();
+    put<uint16_t>(block, length);
+    block.insert(block.end(), names[i].begin(), names[i].begin() + length);
+  }
+  pad8(block);
+  uint32_t blockSize = block.size();
+  memcpy(&block[4], &blockSize, 4);
+  uint64_t blockOffset = offset;
+  if (writeBlock() < 0) return -1;
+  nameOffsets.push_back(blockOffset);
+  return 0;
+}
+
+int SessionLogWriter::append(const SessionTrial &t, const std::vector<std::string> &stateNames) {
+  uint32_t nStates = t.states.size(), nEvents = t.events.size(), nErrorCodes = t.errorCodes.size();
+
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  if (t.stateTimestamps.size() != (size_t) nStates + 1 || t.eventTimestamps.size() != nEvents ||
+      trialSize(nStates, nEvents, nErrorCodes) > UINT32_MAX - 8) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nStateTables == 0 || stateNames != lastStateNames) {
+    if (writeNames(1, stateNames) < 0) return -1;
+    lastStateNames = stateNames;
+    nStateTables++;
+  }
+  block.clear();
+  put<uint32_t>(block, LOG_TRIAL);
+  put<uint32_t>(block, 0);
+  put<uint32_t>(block, trialOffsets.size() + 1);
+  put<uint32_t>(block, nStates);
+  put<uint32_t>(block, nEvents);
+  put<uint32_t>(block, nErrorCodes);
+  put<uint32_t>(block, nStateTables - 1);
+  put<uint32_t>(block, 0);
+  put<double>(block, t.trialStartTimestamp);
+  put<double>(block, t.trialEndTimestamp);
+  block.insert(block.end(), (const uint8_t *) t.stateTimestamps.data(), (const uint8_t *) (t.stateTimestamps.data() + nStates + 1));
+  block.insert(block.end(), (const uint8_t *) t.eventTimestamps.data(), (const uint8_t *) (t.eventTimestamps.data() + nEvents));
+  block.insert(block.end(), (const uint8_t *) t.errorCodes.data(), (const uint8_t *) (t.errorCodes.data() + nErrorCodes));
+  block.insert(block.end(), (const uint8_t *) t.states.data(), (const uint8_t *) (t.states.data() + nStates));
+  block.insert(block.end(), t.events.begin(), t.events.end());
+  pad8(block);
+  uint32_t blockSize = block.size();
+  memcpy(&block[4], &blockSize, 4);
+  uint64_t blockOffset = offset;
+  if (writeBlock() < 0) return -1;  // a partial block is dropped when the log is reopened or read
+  trialOffsets.push_back(blockOffset);
+  return 0;
+}
+
+int SessionLogWriter::close() {
+  int ret = 0;
+
+  if (fd < 0) return 0;
+  uint64_t indexOffset = offset;
+  block.clear();
+  put<uint32_t>(block, LOG_INDEX);
+  put<uint32_t>(block, 16 + 8*(trialOffsets.size() + nameOffsets.size()));
+  put<uint32_t>(block, trialOffsets.size());
+  put<uint32_t>(block, nameOffsets.size());
+  block.insert(block.end(), (const uint8_t *) trialOffsets.data(), (const uint8_t *) (trialOffsets.data() + trialOffsets.size()));
+  block.insert(block.end(), (const uint8_t *) nameOffsets.data(), (const uint8_t *) (nameOffsets.data() + nameOffsets.size()));
+  put<uint64_t>(block, indexOffset);
+  block.insert(block.end(), endMagic, endMagic + 8);
+  if (writeBlock() < 0) ret = -1;
+  if (::close(fd) < 0) ret = -1;
+  fd = -1;
+  return ret;
+}
@@ -0,0 +1,147 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  SessionLog: an append-only binary log of a session's trials, written
+  one trial at a time (SessionLogWriter) instead of re-saving the whole
+  SessionData struct, and read back through a memory map
+  (SessionLogReader), one trial in O(1) or one event across the session.
+
+  File layout (little-endian, blocks 8-byte aligned):
+    "BPODLOG\0", uint32 version, uint32 0
+    blocks of [uint32 type, uint32 size (bytes, with this header)]:
+      LOG_NAMES  uint32 kind (0 = event names, 1 = state names), uint32 n,
+                 n x [uint16 length, characters]
+      LOG_TRIAL  uint32 trial, nStates, nEvents, nErrorCodes,
+                 uint32 state names table (0-based, in file order), uint32 0,
+                 double trial start, trial end (state machine clock, s),
+                 double stateTimestamps[nStates+1], eventTimestamps[nEvents],
+                 uint32 errorCodes[nErrorCodes],
+                 uint16 states[nStates], uint8 events[nEvents] (1-based, as RawEvents)
+      LOG_INDEX  uint32 nTrials, nNameTables, uint64 trial block offsets[nTrials],
+                 names block offsets[nNameTables]
+    after LOG_INDEX: uint64 index offset, "BPODEND\0"
+
+  The index is written by SessionLogWriter::close().  A log that was not
+  closed (a crash) is read by walking the blocks up to the last complete
+  one, and reopening it for writing continues after that block.
+
+  Version 2 widened states to uint16 (a state machine can have 256
+  states); version 1 logs are not read.  Event codes are bytes on the
+  serial link, so events stay uint8.
+*/
+
+#ifndef SessionLog_h
+#define SessionLog_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define LOG_VERSION 2
+
+enum SessionLogBlock {
+  LOG_NAMES = 1,
+  LOG_TRIAL = 2,
+  LOG_INDEX = 3
+};
+
+struct SessionTrial {         // a trial as RunStateMachine returns it
+  std::vector<uint16_t> states;
+  std::vector<uint8_t> events;
+  std::vector<double> stateTimestamps;  // nStates + 1
+  std::vector<double> eventTimestamps;
+  std::vector<uint32_t> errorCodes;
+  double trialStartTimestamp, trialEndTimestamp;
+};
+
+struct SessionTrialView {     // a trial in the mapped file
+  uint32_t trial, nStates, nEvents, nErrorCodes, stateNames;
+  double trialStartTimestamp, trialEndTimestamp;
+  const double *stateTimestamps, *eventTimestamps;
+  const uint32_t *errorCodes;
+  const uint16_t *states;
+  const uint8_t *events;
+};
+
+class SessionLogReader
+{
+public:
+  SessionLogReader();
+  ~SessionLogReader();
+  int open(const char *path);  // 0, or -1 with errno set (EINVAL: not a session log)
+  void close();
+  bool isOpen() const { return map != NULL; }
+  bool complete() const { return indexed; }  // closed by the writer (has an index)
+  size_t fileSize() const { return size; }
+  size_t dataEnd() const { return end; }      // end of the last complete trial or names block
+  uint32_t nTrials() const { return trialOffsets.size(); }
+  int trial(uint32_t i, SessionTrialView &view) const;  // 0-based; 0, or -1 if out of range
+  const std::vector<std::string> &eventNames() const;  // empty if the log has no event names block
+  const std::vector<std::string> &stateNames(uint32_t table) const;
+  uint32_t nStateNameTables() const { return stateTables.size(); }
+  // Every occurrence of event (1-based) in the session: time in the trial, and trial number (1-based)
+  size_t eventTimes(uint8_t event, std::vector<double> &times, std::vector<uint32_t> *trials = NULL) const;
+
+private:
+  const uint8_t *map;
+  size_t size, end;
+  bool indexed;
+  std::vector<uint64_t> trialOffsets, nameOffsets;
+  std::vector<std::vector<std::string> > names;  // per names block
+  std::vector<uint32_t> stateTables;              // names block of each state names table
+  uint32_t eventNamesTable;
+  int readIndex();
+  int scanBlocks();
+  int readNames(uint64_t offset);
+  friend class SessionLogWriter;
+  SessionLogReader(const SessionLogReader &);
+  SessionLogReader &operator=(const SessionLogReader &);
+};
+
+class SessionLogWriter
+{
+public:
+  SessionLogWriter();
+  ~SessionLogWriter();
+  // Creates the log, or reopens it to append after its last complete trial.  0, or -1 with errno set.
+  int open(const char *path, const std::vector<std::string> &eventNames);
+  int append(const SessionTrial &trial, const std::vector<std::string> &stateNames);  // 0, or -1
+  int close();                   // writes the index; 0, or -1
+  bool isOpen() const { return fd >= 0; }
+  uint32_t nTrials() const { return trialOffsets.size(); }
+  const std::string &path() const { return fileName; }
+
+private:
+  int fd;
+  uint64_t offset;
+  std::string fileName;
+  std::vector<uint64_t> trialOffsets, nameOffsets;
+  std::vector<std::string> lastStateNames;
+  uint32_t nStateTables;
+  std::vector<uint8_t> block;
+  int writeNames(uint32_t kind, const std::vector<std::string> &names);
+  int writeBlock();
+  SessionLogWriter(const SessionLogWriter &);
+  SessionLogWriter &operator=(const SessionLogWriter &);
+};
+#endif
@@ -0,0 +1,396 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "StateMachineEmulator.h"
+
+namespace {
+
+class Reader
+{
+  // Bounds-checked little-endian reader over the description
+public:
+  Reader(const uint8_t *data, size_t size) : p(data), end(data + size), failed(false) {}
+  uint32_t read(int width) {
+    uint32_t value = 0;
+    if ((size_t) (end - p) < (size_t) width) {
+      failed = true;
+      return 0;
+    }
+    for (int i = 0; i < width; i++) value |= (uint32_t) *p++ << (8*i);
+    return value;
+  }
+  uint8_t byte() { return (uint8_t) read(1); }
+  bool atEnd() const { return p == end; }
+  const uint8_t *p;
+  const uint8_t *end;
+  bool failed;
+};
+
+}
+
+template <typename T>
+static void putLE(std::vector<uint8_t> &out, T value)
+{
+  for (size_t i = 0; i < sizeof(T); i++) out.push_back((uint8_t) (value >> (8*i)));
+}
+
+StateMachineEmulator::StateMachineEmulator(const EmulatorHardware &hardware) : clockMicros(0), hw(hardware), nStates(0),
+  nTimers(0), nCounters(0), nConditions(0), confirmPending(false), seq(0), currentState(0), previousState(0),
+  stateGeneration(0), channelChanged(false) {
+}
+
+int StateMachineEmulator::load(const uint8_t *message, size_t size) {
+  int width = (hw.machineType == 4) ? 2 : 1;
+  int trigWidth = (hw.maxGlobalTimers > 16) ? 4 : (hw.maxGlobalTimers > 8) ? 2 : 1;
+  int columns = nEvents();
+  uint32_t n, column, value;
+
+  if (size < 5 || message[0] != 'C' || (size_t) (message[3] | message[4] << 8) != size - 5) return -1;
+  Reader r(message + 5, size - 5);
+  nStates = 0;
+  int states = r.byte();
+  nTimers = r.byte();
+  nCounters = r.byte();
+  nConditions = r.byte();
+  if (states == 0 || nTimers > hw.maxGlobalTimers || nCounters > hw.maxGlobalCounters || nConditions > hw.maxConditions) {
+    return -1;
+  }
+
+  stateTimerMatrix.resize(states);
+  for (int i = 0; i < states; i++) stateTimerMatrix[i] = r.byte();
+  inputMatrix.resize((size_t) states*columns);
+  for (int i = 0; i < states; i++) {
+    std::fill(&inputMatrix[(size_t) i*columns], &inputMatrix[(size_t) i*columns] + columns, (uint8_t) i);
+  }
+  // Sparse transition matrices: inputs, global timer starts and ends, global counters, conditions
+  const int offset[5] = {0, hw.inputMatrixSize, hw.inputMatrixSize + hw.maxGlobalTimers,
+			 hw.inputMatrixSize + 2*hw.maxGlobalTimers, hw.inputMatrixSize + 2*hw.maxGlobalTimers + hw.maxGlobalCounters};
+  const int limit[5] = {hw.inputMatrixSize, nTimers, nTimers, nCounters, nConditions};
+  softCodes.assign(states, 0);
+  for (int m = 0; m < 6; m++) {
+    int k = (m == 0) ? 0 : m - 1;  // m == 1 is the output matrix
+    for (int i = 0; i < states; i++) {
+      n = r.read(m == 1 ? width : 1);
+      for (uint32_t j = 0; j < n; j++) {
+	column = r.read(m == 1 ? width : 1);
+	value = r.read(m == 1 ? width : 1);
+	if (m == 1) {
+	  if ((int) column == hw.outputUSB) softCodes[i] = value;
+	  continue;
+	}
+	if ((int) column >= limit[k]) return -1;
+	inputMatrix[(size_t) i*columns + offset[k] + column] = value;
+      }
+    }
+  }
+  timerChannel.resize(nTimers);
+  for (int i = 0; i < nTimers; i++) timerChannel[i] = r.byte();
+  for (int i = 0; i < 2*nTimers; i++) r.read(width);  // on / off messages drive outputs only
+  timerLoopMode.resize(nTimers);
+  timerSendEvents.resize(nTimers);
+  for (int i = 0; i < nTimers; i++) timerLoopMode[i] = r.byte();
+  for (int i = 0; i < nTimers; i++) timerSendEvents[i] = r.byte();
+  counterEvent.resize(nCounters);
+  for (int i = 0; i < nCounters; i++) counterEvent[i] = r.byte();
+  conditionChannel.resize(nConditions);
+  conditionValue.resize(nConditions);
+  for (int i = 0; i < nConditions; i++) conditionChannel[i] = r.byte();
+  for (int i = 0; i < nConditions; i++) conditionValue[i] = r.byte();
+  counterResets.assign(states, 0);
+  if (hw.firmwareVersion < 23) {
+    for (int i = 0; i < states; i++) counterResets[i] = r.byte();
+  } else {
+    n = r.byte();
+    for (uint32_t j = 0; j < n; j++) {
+      column = r.byte();
+      value = r.byte();
+      if ((int) column < states) counterResets[column] = value;
+    }
+  }
+  if (hw.machineType == 4) {
+    for (int k = 0; k < 2; k++) {  // analog threshold enable / disable
+      n = r.byte();
+      for (uint32_t j = 0; j < 2*n; j++) r.byte();
+    }
+  }
+  timerTrigs.resize(states);
+  timerCancels.resize(states);
+  timerOnTrigger.resize(nTimers);
+  for (int i = 0; i < states; i++) timerTrigs[i] = r.read(trigWidth);
+  for (int i = 0; i < states; i++) timerCancels[i] = r.read(trigWidth);
+  for (int i = 0; i < nTimers; i++) timerOnTrigger[i] = r.read(trigWidth);
+  stateTimers.resize(states);
+  timerDuration.resize(nTimers);
+  timerDelay.resize(nTimers);
+  timerLoopInterval.resize(nTimers);
+  counterThreshold.resize(nCounters);
+  for (int i = 0; i < states; i++) stateTimers[i] = r.read(4);
+  for (int i = 0; i < nTimers; i++) timerDuration[i] = r.read(4);
+  for (int i = 0; i < nTimers; i++) timerDelay[i] = r.read(4);
+  for (int i = 0; i < nTimers; i++) timerLoopInterval[i] = r.read(4);
+  for (int i = 0; i < nCounters; i++) counterThreshold[i] = r.read(4);
+  if (hw.firmwareVersion > 22) {
+    // Packaged ops: [1 'L' module nMessages (index length bytes)...]... 0
+    while (!r.failed && r.byte() == 1) {
+      if (r.byte() != 'L') return -1;
+      r.byte();
+      n = r.byte();
+      for (uint32_t j = 0; j < n && !r.failed; j++) {
+	r.byte();
+	uint32_t length = r.byte();
+	for (uint32_t k = 0; k < length; k++) r.byte();
+      }
+    }
+  }
+  if (r.failed || !r.atEnd()) return -1;
+  nStates = states;
+  confirmPending = true;
+  return 0;
+}
+
+void StateMachineEmulator::schedule(uint64_t cycle, uint8_t type, uint8_t index, uint32_t generation) {
+  Pending p;
+  p.cycle = cycle;
+  p.seq = seq++;
+  p.type = type;
+  p.index = index;
+  p.generation = generation;
+  pending.push(p);
+}
+
+void StateMachineEmulator::triggerTimers(uint32_t bits, uint64_t now) {
+  for (int i = 0; i < nTimers && bits; i++, bits >>= 1) {
+    if (!(bits & 1)) continue;
+    timerGeneration[i]++;  // a triggered timer starts over
+    timerActive[i] = 0;
+    timerLoops[i] = 0;
+    schedule(now + std::max<uint64_t>(timerDelay[i], 1), TIMER_START, i, timerGeneration[i]);
+  }
+}
+
+void StateMachineEmulator::startTimer(int timer, uint64_t now) {
+  timerActive[timer] = 1;
+  channelChanged = true;
+  if (timerSendEvents[timer]) cycleEvents.push_back(hw.inputMatrixSize + timer);
+  schedule(now + std::max<uint32_t>(timerDuration[timer], 1), TIMER_END, timer, timerGeneration[timer]);
+  if (timerOnTrigger[timer]) {
+    uint32_t bits = timerOnTrigger[timer] & ~(1u << timer);
+    triggerTimers(bits, now);
+  }
+}
+
+void StateMachineEmulator::endTimer(int timer, uint64_t now) {
+  timerActive[timer] = 0;
+  channelChanged = true;
+  if (timerSendEvents[timer]) cycleEvents.push_back(hw.inputMatrixSize + hw.maxGlobalTimers + timer);
+  // Loop mode 1 loops until canceled, n > 1 runs n times
+  timerLoops[timer]++;
+  if (timerLoopMode[timer] == 1 || (timerLoopMode[timer] > 1 && timerLoops[timer] < timerLoopMode[timer])) {
+    if (timerLoopInterval[timer] == 0) {
+      startTimer(timer, now);
+    } else {
+      schedule(now + timerLoopInterval[timer], TIMER_START, timer, timerGeneration[timer]);
+    }
+  }
+}
+
+void StateMachineEmulator::enterState(int state, uint64_t now, std::vector<uint8_t> &stream) {
+  uint32_t bits;
+
+  previousState = currentState;
+  currentState = state;
+  stateGeneration++;
+  if (softCodes[state]) {
+    stream.push_back(2);
+    stream.push_back((uint8_t) softCodes[state]);
+    trial.nSoftCodes++;
+  }
+  bits = timerCancels[state];
+  for (int i = 0; i < nTimers && bits; i++, bits >>= 1) {
+    if (!(bits & 1)) continue;
+    timerGeneration[i]++;
+    if (timerActive[i]) channelChanged = true;
+    timerActive[i] = 0;
+  }
+  triggerTimers(timerTrigs[state], now);
+  if (counterResets[state] > 0 && (int) counterResets[state] <= nCounters) {
+    counterCount[counterResets[state] - 1] = 0;
+    counterHandled[counterResets[state] - 1] = 0;
+  }
+  if (stateTimerMatrix[state] != state) {
+    schedule(now + std::max<uint32_t>(stateTimers[state], 1), STATE_TIMER, 0, stateGeneration);
+  }
+  if (nConditions > 0) schedule(now + 1, CONDITION_CHECK, 0, stateGeneration);
+}
+
+void StateMachineEmulator::checkConditions() {
+  int conditionStart = hw.inputMatrixSize + 2*hw.maxGlobalTimers + hw.maxGlobalCounters;
+  int columns = nEvents();
+
+  for (int i = 0; i < nConditions; i++) {
+    if (inputMatrix[(size_t) currentState*columns + conditionStart + i] == currentState) continue;
+    int channel = conditionChannel[i];
+    int level;
+    if (channel < hw.nInputs) {
+      level = inputLevel[channel];
+    } else if (channel - hw.nInputs < nTimers) {
+      level = timerActive[channel - hw.nInputs];
+    } else {
+      continue;
+    }
+    if (level == conditionValue[i]) cycleEvents.push_back(conditionStart + i);
+  }
+}
+
+const EmulatorTrial &StateMachineEmulator::runTrial(const EmulatorInput *inputs, size_t nInputs, uint64_t maxCycles,
+						    std::vector<uint8_t> &stream) {
+  int columns = nEvents();
+  int tup = columns;
+  uint64_t now = 0;
+  size_t nextInput = 0;
+
+  trial.finished = false;
+  trial.endCycle = 0;
+  trial.events.clear();
+  trial.eventCycles.clear();
+  trial.states.clear();
+  trial.stateChanges.clear();
+  trial.nSoftCodes = 0;
+  if (nStates == 0) return trial;
+
+  while (!pending.empty()) pending.pop();
+  seq = 0;
+  currentState = previousState = 0;
+  timerGeneration.assign(nTimers, 0);
+  timerLoops.assign(nTimers, 0);
+  timerActive.assign(nTimers, 0);
+  counterCount.assign(nCounters, 0);
+  counterHandled.assign(nCounters, 0);
+  inputLevel.assign(hw.nInputs, 0);
+
+  if (confirmPending) stream.push_back(1);
+  confirmPending = false;
+  putLE<uint64_t>(stream, clockMicros);
+  trial.states.push_back(0);
+  enterState(0, 0, stream);
+
+  for (;;) {
+    // Next cycle with something to do: an input or a pending entry
+    uint64_t next = UINT64_MAX;
+    if (nextInput < nInputs) next = inputs[nextInput].cycle;
+    if (!pending.empty() && pending.top().cycle < next) next = pending.top().cycle;
+    if (next == UINT64_MAX || (maxCycles > 0 && next > maxCycles)) break;
+    now = next;
+    cycleEvents.clear();
+    channelChanged = false;
+    bool conditionCheck = false;
+
+    while (nextInput < nInputs && inputs[nextInput].cycle == now) {
+      int event = inputs[nextInput++].event;
+      int offset = event - hw.ioEventStart;
+      if (offset >= 0 && hw.ioFirstChannel + offset/2 < hw.nInputs) {
+	inputLevel[hw.ioFirstChannel + offset/2] = (offset % 2 == 0);
+	channelChanged = true;
+      }
+      cycleEvents.push_back(event);
+    }
+    while (!pending.empty() && pending.top().cycle == now) {
+      Pending p = pending.top();
+      pending.pop();
+      switch (p.type) {
+	case TIMER_START:
+	  if (p.generation == timerGeneration[p.index]) startTimer(p.index, now);
+	  break;
+	case TIMER_END:
+	  if (p.generation == timerGeneration[p.index] && timerActive[p.index]) endTimer(p.index, now);
+	  break;
+	case STATE_TIMER:
+	  if (p.generation == stateGeneration) cycleEvents.push_back(tup);
+	  break;
+	case CONDITION_CHECK:
+	  if (p.generation == stateGeneration) conditionCheck = true;
+	  break;
+      }
+    }
+    std::stable_sort(cycleEvents.begin(), cycleEvents.end());
+    // Global counters count their events, and fire once on reaching the threshold
+    size_t nCounted = cycleEvents.size();
+    for (size_t e = 0; e < nCounted; e++) {
+      for (int i = 0; i < nCounters; i++) {
+	if (counterEvent[i] != cycleEvents[e] || counterHandled[i]) continue;
+	if (++counterCount[i] >= counterThreshold[i]) {
+	  counterHandled[i] = 1;
+	  cycleEvents.push_back(hw.inputMatrixSize + 2*hw.maxGlobalTimers + i);
+	}
+      }
+    }
+    if (conditionCheck || channelChanged) checkConditions();
+    if (cycleEvents.empty()) continue;
+    std::stable_sort(cycleEvents.begin(), cycleEvents.end());
+
+    // The first event with a transition out of the current state wins
+    int newState = currentState;
+    size_t firstEvent = trial.events.size();
+    for (size_t e = 0; e < cycleEvents.size(); e++) {
+      int event = cycleEvents[e];
+      int target = (event == tup) ? stateTimerMatrix[currentState] : (event < columns) ?
+	inputMatrix[(size_t) currentState*columns + event] : currentState;
+      if (target != currentState) {
+	newState = (target == EMULATOR_BACK_STATE) ? previousState : target;
+	trial.stateChanges.push_back(firstEvent + e);
+	break;
+      }
+    }
+    for (size_t e = 0; e < cycleEvents.size(); e++) {
+      trial.events.push_back(cycleEvents[e]);
+      trial.eventCycles.push_back((uint32_t) now);
+    }
+    bool exiting = (newState >= nStates);
+    if (exiting) cycleEvents.push_back(EMULATOR_EXIT_EVENT);
+    stream.push_back(1);
+    stream.push_back((uint8_t) cycleEvents.size());
+    stream.insert(stream.end(), cycleEvents.begin(), cycleEvents.end());
+    if (hw.liveTimestamps) putLE<uint32_t>(stream, (uint32_t) now);
+    if (exiting) {
+      trial.finished = true;
+      break;
+    }
+    if (newState != currentState) {
+      trial.states.push_back(newState);
+      enterState(newState, now, stream);
+    }
+  }
+
+  trial.endCycle = now;
+  if (trial.finished) {
+    uint64_t endMicros = clockMicros + (uint64_t) (now*1e6/hw.cycleFrequency + 0.5);
+    putLE<uint32_t>(stream, (uint32_t) now);  // nHWTimerCycles
+    putLE<uint64_t>(stream, endMicros);
+    if (!hw.liveTimestamps) {
+      putLE<uint16_t>(stream, (uint16_t) trial.events.size());
+      for (size_t e = 0; e < trial.events.size(); e++) putLE<uint32_t>(stream, trial.eventCycles[e]);
+    }
+    clockMicros = endMicros;
+  }
+  return trial;
+}
@@ -0,0 +1,140 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  StateMachineEmulator: runs a state machine description, as sent in the
+  'C' message (see StateMachineEncoder.h), against a list of timestamped
+  input events, and produces the byte stream the state machine would send
+  for the trial (see TrialEventDecoder.h): confirmation, start time,
+  opcode 1 event messages with live timestamps, opcode 2 soft codes, the
+  exit event and the trial end fields.
+
+  Time advances in state machine cycles from one pending event to the
+  next (inputs, state timers, global timer onsets, ends and loops,
+  condition checks) taken from a priority queue, so a trial takes as long
+  to emulate as it has events, not as long as it lasts.  Within a cycle,
+  events are reported in event code order, and the first one whose
+  transition leaves the current state moves the machine.  Actions taken
+  on entering a state (timer triggers, condition checks, state timer)
+  produce events from the next cycle on.  Analog threshold ops and the
+  serial message library are accepted and ignored.
+
+  Event codes are 0-based, laid out as on the state machine: input
+  matrix columns (serial, Flex I/O and digital input events), global
+  timer starts, global timer ends, global counters, conditions, Tup.
+*/
+
+#ifndef StateMachineEmulator_h
+#define StateMachineEmulator_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <queue>
+#include <vector>
+
+#define EMULATOR_EXIT_EVENT 254
+#define EMULATOR_BACK_STATE 255
+
+struct EmulatorHardware {
+  int machineType;         // BpodSystem.MachineType
+  int firmwareVersion;
+  double cycleFrequency;   // Hz
+  int inputMatrixSize;     // events with an input matrix column
+  int maxGlobalTimers;     // HW.n.GlobalTimers, ...
+  int maxGlobalCounters;
+  int maxConditions;
+  int nInputs;             // input channels; condition channels past them are global timers
+  int ioEventStart;        // code of the "high" event of input channel ioFirstChannel
+  int ioFirstChannel;      // first input channel with high/low events (after serial and Flex I/O)
+  int outputUSB;           // 0-based output matrix column of soft codes, -1 if none
+  bool liveTimestamps;
+};
+
+struct EmulatorInput {
+  uint64_t cycle;          // state machine cycles after trial start
+  uint8_t event;           // 0-based event code
+};
+
+struct EmulatorTrial {
+  bool finished;           // reached the exit state (false: ran out of events or time)
+  uint64_t endCycle;
+  std::vector<uint8_t> events;         // 0-based codes, without the exit event
+  std::vector<uint32_t> eventCycles;
+  std::vector<uint8_t> states;         // 0-based states visited
+  std::vector<uint32_t> stateChanges;  // index in events of the event that entered states[i+1]
+  uint32_t nSoftCodes;
+};
+
+class StateMachineEmulator
+{
+public:
+  StateMachineEmulator(const EmulatorHardware &hw);
+  // Loads a 'C' message (op, runASAP, use255BackSignal, uint16 size, description).  0 or -1.
+  int load(const uint8_t *message, size_t size);
+  bool loaded() const { return nStates > 0; }
+  // Runs one trial; appends the state machine's output to stream.  inputs must be sorted by cycle.
+  // Gives up at maxCycles (0 = no limit) or when nothing is left to happen.
+  const EmulatorTrial &runTrial(const EmulatorInput *inputs, size_t nInputs, uint64_t maxCycles, std::vector<uint8_t> &stream);
+  uint64_t clockMicros;    // state machine clock at the start of the next trial
+
+private:
+  enum PendingType { INPUT, TIMER_START, TIMER_END, STATE_TIMER, CONDITION_CHECK };
+  struct Pending {
+    uint64_t cycle;
+    uint64_t seq;          // keeps same-cycle entries in the order they were scheduled
+    uint8_t type;
+    uint8_t index;         // input event code or timer
+    uint32_t generation;   // stale if it no longer matches the timer's or state's
+    bool operator>(const Pending &p) const { return cycle != p.cycle ? cycle > p.cycle : seq > p.seq; }
+  };
+
+  EmulatorHardware hw;
+  // Description
+  int nStates, nTimers, nCounters, nConditions;
+  std::vector<uint8_t> inputMatrix;    // nStates x nEvents (all event codes but Tup), target states
+  std::vector<uint8_t> stateTimerMatrix;
+  std::vector<uint16_t> softCodes;
+  std::vector<uint32_t> timerTrigs, timerCancels, counterResets;
+  std::vector<uint32_t> stateTimers;
+  std::vector<uint8_t> timerChannel, timerLoopMode, timerSendEvents, counterEvent, conditionChannel, conditionValue;
+  std::vector<uint32_t> timerOnTrigger, timerDuration, timerDelay, timerLoopInterval, counterThreshold;
+  bool confirmPending;
+  // Trial state
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending> > pending;
+  uint64_t seq;
+  int currentState, previousState;
+  uint32_t stateGeneration;
+  std::vector<uint32_t> timerGeneration, timerLoops;
+  std::vector<uint8_t> timerActive, inputLevel, counterHandled;
+  std::vector<uint32_t> counterCount;
+  std::vector<uint8_t> cycleEvents;
+  bool channelChanged;
+  EmulatorTrial trial;
+
+  int nEvents() const { return hw.inputMatrixSize + 2*hw.maxGlobalTimers + hw.maxGlobalCounters + hw.maxConditions; }
+  void schedule(uint64_t cycle, uint8_t type, uint8_t index, uint32_t generation);
+  void triggerTimers(uint32_t bits, uint64_t now);
+  void startTimer(int timer, uint64_t now);
+  void endTimer(int timer, uint64_t now);
+  void enterState(int state, uint64_t now, std::vector<uint8_t> &stream);
+  void checkConditions();
+};
+#endif
@@ -0,0 +1,202 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <limits>
+#include "StateMachineEncoder.h"
+
+template <typename T>
+static T toUint(double x)
+{
+  // MATLAB's uint8(), uint16() and uint32()
+  if (!(x > 0)) return 0;
+  if (x >= (double) std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+  return (T) (x + 0.5);
+}
+
+template <typename T>
+static void put(std::vector<uint8_t> &out, T value)
+{
+  for (size_t i = 0; i < sizeof(T); i++) out.push_back((uint8_t) (value >> (8*i)));
+}
+
+static void putWidth(std::vector<uint8_t> &out, double value, int width)
+{
+  switch (width) {
+    case 4: put<uint32_t>(out, toUint<uint32_t>(value)); break;
+    case 2: put<uint16_t>(out, toUint<uint16_t>(value)); break;
+    default: out.push_back(toUint<uint8_t>(value)); break;
+  }
+}
+
+static size_t lastSet(const SMArray &isSet)
+{
+  // find(isSet, 1, 'last'), 0 if none
+  for (size_t i = isSet.numel(); i > 0; i--) {
+    if (isSet[i-1] != 0) return i;
+  }
+  return 0;
+}
+
+StateMachineEncoder::StateMachineEncoder() : nModules(0), valid(false), back(false) {
+}
+
+void StateMachineEncoder::reset() {
+  valid = false;
+}
+
+void StateMachineEncoder::encodeSparse(std::vector<uint8_t> &out, const StateMachineDescription &sm, const SMArray &matrix,
+				       size_t nCols, bool stateValues, bool wide) {
+  /*
+    Per state: the number of entries that differ from the default, then
+    (column, value) pairs.  For state transition matrices the default is
+    the state itself and values are 0-based states; for the output
+    matrix the default is 0 and values are sent as they are.
+  */
+  int width = wide ? 2 : 1;
+
+  for (size_t i = 0; i < sm.nStates; i++) {
+    double self = stateValues ? (double) (i + 1) : 0;
+    size_t nDifferences = 0;
+    for (size_t c = 0; c < nCols; c++) {
+      if (matrix(i, c) != self) nDifferences++;
+    }
+    putWidth(out, (double) nDifferences, width);
+    for (size_t c = 0; c < nCols && nDifferences > 0; c++) {
+      double value = matrix(i, c);
+      if (value == self) continue;
+      putWidth(out, (double) c, width);
+      putWidth(out, stateValues ? value - 1 : value, width);
+    }
+  }
+}
+
+void StateMachineEncoder::encodeOverrides(std::vector<uint8_t> &out, const StateMachineDescription &sm, int column) {
+  // The number of states with a nonzero entry in an output matrix column, then (state, value) pairs
+  size_t nOverrides = 0;
+
+  for (size_t i = 0; i < sm.nStates; i++) {
+    if (toUint<uint8_t>(sm.outputMatrix(i, column - 1)) != 0) nOverrides++;
+  }
+  out.push_back(toUint<uint8_t>((double) nOverrides));
+  for (size_t i = 0; i < sm.nStates; i++) {
+    uint8_t value = toUint<uint8_t>(sm.outputMatrix(i, column - 1));
+    if (value == 0) continue;
+    out.push_back(toUint<uint8_t>((double) i));
+    out.push_back(value);
+  }
+}
+
+void StateMachineEncoder::encodeSerialMessages(std::vector<uint8_t> &out, const StateMachineDescription &sm,
+					       const StateMachineHardware &hw) {
+  // 'L' ops that load implicit serial messages, prefixed with the "more ops" flag on firmware v23+
+  nModules = 0;
+  if (sm.serialMessageMode != 1) return;
+  for (int i = 0; i < hw.nUartSerialChannels && i < (int) sm.nSerialMessages.numel(); i++) {
+    size_t n = (size_t) sm.nSerialMessages[i];
+    if (n == 0) continue;
+    if (hw.firmwareVersion > 22) out.push_back(1);
+    out.push_back('L');
+    out.push_back(toUint<uint8_t>(i));
+    out.push_back(toUint<uint8_t>(sm.nSerialMessages[i]));
+    for (size_t j = 0; j < n; j++) {
+      const std::vector<uint8_t> &message = sm.serialMessages[i][j];
+      out.push_back(toUint<uint8_t>((double) (j + 1)));
+      out.push_back(toUint<uint8_t>((double) message.size()));
+      out.insert(out.end(), message.begin(), message.end());
+    }
+    nModules++;
+  }
+}
+
+bool StateMachineEncoder::encode(const StateMachineDescription &sm, const StateMachineHardware &hw) {
+  std::vector<uint8_t> &out = nextBytes;
+  size_t nStates = sm.nStates;
+  size_t nTimers = lastSet(sm.timerIsSet);
+  size_t nCounters = lastSet(sm.counterSet);
+  size_t nConditions = lastSet(sm.conditionSet);
+  bool sm2 = (hw.machineType == 4);  // 16-bit output matrix and global timer messages
+  int trigWidth = (hw.maxGlobalTimers > 16) ? 4 : (hw.maxGlobalTimers > 8) ? 2 : 1;
+  bool unchanged;
+
+  out.clear();
+  nextSerial.clear();
+
+  // 8-bit section
+  out.push_back(toUint<uint8_t>((double) nStates));
+  out.push_back(toUint<uint8_t>((double) nTimers));
+  out.push_back(toUint<uint8_t>((double) nCounters));
+  out.push_back(toUint<uint8_t>((double) nConditions));
+  for (size_t i = 0; i < nStates; i++) out.push_back(toUint<uint8_t>(sm.stateTimerMatrix[i] - 1));
+  encodeSparse(out, sm, sm.inputMatrix, sm.inputMatrixSize, true, false);
+  encodeSparse(out, sm, sm.outputMatrix, hw.posGlobalTimerTrig - 1, false, sm2);  // physical channels only
+  encodeSparse(out, sm, sm.globalTimerStartMatrix, nTimers, true, false);
+  encodeSparse(out, sm, sm.globalTimerEndMatrix, nTimers, true, false);
+  encodeSparse(out, sm, sm.globalCounterMatrix, nCounters, true, false);
+  encodeSparse(out, sm, sm.conditionMatrix, nConditions, true, false);
+  for (size_t i = 0; i < nTimers; i++) out.push_back(toUint<uint8_t>(sm.timerOutputChannel[i] - 1));
+  for (int on = 1; on >= 0; on--) {
+    const SMArray &messages = on ? sm.timerOnMessage : sm.timerOffMessage;
+    for (size_t i = 0; i < nTimers; i++) {
+      double message = messages[i];
+      bool uart = toUint<uint8_t>(sm.timerOutputChannel[i] - 1) < hw.posInputUSB - 1;
+      if (message == 0 && uart) message = 255;
+      putWidth(out, message, sm2 ? 2 : 1);
+    }
+  }
+  for (size_t i = 0; i < nTimers; i++) out.push_back(toUint<uint8_t>(sm.timerLoopMode[i]));
+  for (size_t i = 0; i < nTimers; i++) out.push_back(toUint<uint8_t>(sm.timerSendEvents[i]));
+  for (size_t i = 0; i < nCounters; i++) out.push_back(toUint<uint8_t>(sm.counterEvents[i] - 1));
+  for (size_t i = 0; i < nConditions; i++) out.push_back(toUint<uint8_t>(sm.conditionChannels[i] - 1));
+  for (size_t i = 0; i < nConditions; i++) out.push_back(toUint<uint8_t>(sm.conditionValues[i]));
+  if (hw.firmwareVersion < 23) {
+    for (size_t i = 0; i < nStates; i++) out.push_back(toUint<uint8_t>(sm.outputMatrix(i, hw.posGlobalCounterReset - 1)));
+  } else {
+    encodeOverrides(out, sm, hw.posGlobalCounterReset);
+  }
+  if (sm2) {
+    encodeOverrides(out, sm, hw.posAnalogThreshEnable);
+    encodeOverrides(out, sm, hw.posAnalogThreshDisable);
+  }
+
+  // Global timer trigger / cancel bitfields, then 32-bit section (timers in state machine cycles)
+  for (size_t i = 0; i < nStates; i++) putWidth(out, sm.outputMatrix(i, hw.posGlobalTimerTrig - 1), trigWidth);
+  for (size_t i = 0; i < nStates; i++) putWidth(out, sm.outputMatrix(i, hw.posGlobalTimerCancel - 1), trigWidth);
+  for (size_t i = 0; i < nTimers; i++) putWidth(out, sm.timerOnTrigger[i], trigWidth);
+  for (size_t i = 0; i < nStates; i++) put<uint32_t>(out, toUint<uint32_t>(sm.stateTimers[i]*hw.cycleFrequency));
+  for (size_t i = 0; i < nTimers; i++) put<uint32_t>(out, toUint<uint32_t>(sm.timerDuration[i]*hw.cycleFrequency));
+  for (size_t i = 0; i < nTimers; i++) put<uint32_t>(out, toUint<uint32_t>(sm.timerOnsetDelay[i]*hw.cycleFrequency));
+  for (size_t i = 0; i < nTimers; i++) put<uint32_t>(out, toUint<uint32_t>(sm.timerLoopInterval[i]*hw.cycleFrequency));
+  for (size_t i = 0; i < nCounters; i++) put<uint32_t>(out, toUint<uint32_t>(sm.counterThresholds[i]));
+
+  // Ops packaged with the description on firmware v23+
+  encodeSerialMessages(nextSerial, sm, hw);
+  if (hw.firmwareVersion > 22) {
+    out.insert(out.end(), nextSerial.begin(), nextSerial.end());
+    out.push_back(0);
+  }
+
+  unchanged = valid && back == sm.use255BackSignal && nextBytes == bytes && nextSerial == serial;
+  bytes.swap(nextBytes);  // both buffers keep their capacity from trial to trial
+  serial.swap(nextSerial);
+  back = sm.use255BackSignal;
+  valid = true;
+  return unchanged;
+}
@@ -0,0 +1,110 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  StateMachineEncoder: builds the byte string of the state machine
+  description message ('C'), the same bytes SendStateMachine.m assembles
+  from uint8 casts and typecasts (EncodeStateMachine.m is the reference).
+
+  The description is read in place from MATLAB's column-major arrays
+  (see SMArray) after SendStateMachine has put the states in the order
+  they were added and replaced the >exit and >back op codes.  Numeric
+  conversions follow MATLAB's: round half away from zero, saturate,
+  NaN to 0.
+
+  The encoder keeps the previous output.  encode() writes into a second
+  buffer it reuses across trials and reports whether the result is
+  identical to the previous description, in which case the caller may
+  skip sending it: the state machine still holds it.  reset() forgets
+  the previous description (new connection, serial message library
+  reloaded).
+*/
+
+#ifndef StateMachineEncoder_h
+#define StateMachineEncoder_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct SMArray {
+  const double *data;      // column-major, as in MATLAB
+  size_t rows;
+  size_t cols;
+  SMArray() : data(NULL), rows(0), cols(0) {}
+  double operator()(size_t row, size_t col) const { return data[row + col*rows]; }
+  double operator[](size_t i) const { return data[i]; }  // vectors
+  size_t numel() const { return rows*cols; }
+};
+
+struct StateMachineHardware {
+  int machineType;         // BpodSystem.MachineType
+  int firmwareVersion;
+  double cycleFrequency;   // Hz
+  int maxGlobalTimers;     // HW.n.GlobalTimers, sets the width of timer trigger bitfields
+  int nUartSerialChannels;
+  int posGlobalTimerTrig;  // 1-based OutputMatrix columns (HW.Pos)
+  int posGlobalTimerCancel;
+  int posGlobalCounterReset;
+  int posAnalogThreshEnable;   // machine type 4 only
+  int posAnalogThreshDisable;
+  int posInputUSB;         // 0 if the state machine has no USB input channel
+};
+
+struct StateMachineDescription {
+  size_t nStates;
+  size_t inputMatrixSize;  // sma.meta.InputMatrixSize
+  bool use255BackSignal;
+  SMArray inputMatrix, outputMatrix, stateTimerMatrix, stateTimers;
+  SMArray globalTimerStartMatrix, globalTimerEndMatrix, globalCounterMatrix, conditionMatrix;
+  SMArray timerIsSet, timerOutputChannel, timerOnMessage, timerOffMessage, timerLoopMode, timerSendEvents,
+    timerOnTrigger, timerDuration, timerOnsetDelay, timerLoopInterval;
+  SMArray counterSet, counterEvents, counterThresholds;
+  SMArray conditionSet, conditionChannels, conditionValues;
+  int serialMessageMode;   // 1: messages below are loaded with the description
+  SMArray nSerialMessages; // per UART channel
+  std::vector<std::vector<std::vector<uint8_t> > > serialMessages;  // [channel][message]
+};
+
+class StateMachineEncoder
+{
+public:
+  StateMachineEncoder();
+  // Returns true if the description is identical to the one encoded last.
+  bool encode(const StateMachineDescription &sm, const StateMachineHardware &hw);
+  void reset();
+  const std::vector<uint8_t> &byteString() const { return bytes; }
+  // Serial message library ops ('L'), already part of byteString() on firmware v23+
+  const std::vector<uint8_t> &serialMessageVector() const { return serial; }
+  int nModulesLoaded() const { return nModules; }
+
+private:
+  std::vector<uint8_t> bytes, serial;       // last description
+  std::vector<uint8_t> nextBytes, nextSerial;
+  int nModules;
+  bool valid;              // bytes holds a description the caller sent
+  bool back;
+  void encodeSparse(std::vector<uint8_t> &out, const StateMachineDescription &sm, const SMArray &matrix,
+		    size_t nCols, bool stateValues, bool wide);
+  void encodeOverrides(std::vector<uint8_t> &out, const StateMachineDescription &sm, int column);
+  void encodeSerialMessages(std::vector<uint8_t> &out, const StateMachineDescription &sm, const StateMachineHardware &hw);
+};
+#endif
@@ -0,0 +1,330 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include "TrialEventDecoder.h"
+
+TrialStreamParser::TrialStreamParser() : phase(IDLE), confirm(false), live(true), trial(0), message(0), eventCount(0),
+  opcode(0), nEvents(0), fieldSize(0), fieldPos(0), nTimestamps(0), exitSeen(false) {
+}
+
+void TrialStreamParser::startTrial(bool expectConfirmation, bool liveTimestamps) {
+  confirm = expectConfirmation;
+  live = liveTimestamps;
+  trial++;
+  message = 0;
+  eventCount = 0;
+  exitSeen = false;
+  if (confirm) {
+    expect(CONFIRM, 1);
+  } else {
+    expect(START_TIME, 8);
+  }
+}
+
+void TrialStreamParser::expect(Phase next, unsigned int size) {
+  phase = next;
+  fieldSize = size;
+  fieldPos = 0;
+}
+
+void TrialStreamParser::emit(std::vector<BpodEventRecord> &records, uint8_t type, uint8_t code, uint64_t time, uint32_t msg) {
+  BpodEventRecord r;
+  r.time = time;
+  r.message = msg;
+  r.type = type;
+  r.code = code;
+  r.trial = trial;
+  records.push_back(r);
+}
+
+static uint32_t fieldUint32(const uint8_t *b) {
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static uint64_t fieldUint64(const uint8_t *b) {
+  return fieldUint32(b) | ((uint64_t) fieldUint32(b + 4) << 32);
+}
+
+void TrialStreamParser::fieldComplete(std::vector<BpodEventRecord> &records) {
+  unsigned int i;
+
+  switch (phase) {
+    case START_TIME:
+      emit(records, RECORD_TRIAL_START, 0, fieldUint64(field), 0);
+      expect(OPCODE, 1);
+      break;
+    case EVENTS:
+    case EVENT_TIME:
+      if (phase == EVENTS && live) {
+        expect(EVENT_TIME, 4);
+        break;
+      }
+      for (i = 0; i < nEvents; i++) {
+        emit(records, RECORD_EVENT, events[i], live ? fieldUint32(field) : 0, message);
+        eventCount++;
+        if (events[i] == EXIT_EVENT) exitSeen = true;
+      }
+      message++;
+      if (exitSeen) {
+        expect(END_TIME, 12);
+      } else {
+        expect(OPCODE, 1);
+      }
+      break;
+    case END_TIME:
+      emit(records, RECORD_TRIAL_END, 0, fieldUint64(field + 4), fieldUint32(field));
+      if (live) {
+        phase = IDLE;
+      } else {
+        expect(N_TIMESTAMPS, 2);
+      }
+      break;
+    case N_TIMESTAMPS:
+      nTimestamps = field[0] | (field[1] << 8);
+      eventCount = 0;
+      if (nTimestamps == 0) {
+        phase = IDLE;
+      } else {
+        expect(TIMESTAMPS, 4);
+      }
+      break;
+    case TIMESTAMPS:
+      emit(records, RECORD_TIMESTAMP, 0, fieldUint32(field), eventCount++);
+      if (eventCount == nTimestamps) {
+        phase = IDLE;
+      } else {
+        expect(TIMESTAMPS, 4);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+size_t TrialStreamParser::parse(const uint8_t *data, size_t size, std::vector<BpodEventRecord> &records, std::vector<uint8_t> &reply) {
+  size_t first = records.size();
+  size_t k = 0;
+  size_t n;
+
+  while (k < size) {
+    switch (phase) {
+      case IDLE:
+        reply.push_back(data[k++]);
+        break;
+      case CONFIRM:
+        if (data[k] != 1) {
+          emit(records, RECORD_ERROR, data[k], 0, 0);  // state machine rejected the last description
+          phase = IDLE;
+        } else {
+          expect(START_TIME, 8);
+        }
+        k++;
+        break;
+      case OPCODE:
+        opcode = data[k++];
+        if (opcode == 1 || opcode == 2) {
+          expect(OPERAND, 1);
+        } else {
+          emit(records, RECORD_ERROR, opcode, 0, message);  // same as 'Invalid op code received'
+        }
+        break;
+      case OPERAND:
+        if (opcode == 2) {
+          emit(records, RECORD_SOFT_CODE, data[k++], 0, message++);
+          expect(OPCODE, 1);
+          break;
+        }
+        nEvents = data[k++];
+        expect(EVENTS, nEvents);
+        if (nEvents == 0) fieldComplete(records);
+        break;
+      case EVENTS:
+        // copy as much of the event list as this chunk holds
+        n = (size - k < fieldSize - fieldPos) ? size - k : fieldSize - fieldPos;
+        memcpy(events + fieldPos, data + k, n);
+        fieldPos += n;
+        k += n;
+        if (fieldPos == fieldSize) fieldComplete(records);
+        break;
+      default:
+        field[fieldPos++] = data[k++];
+        if (fieldPos == fieldSize) fieldComplete(records);
+        break;
+    }
+  }
+  return records.size() - first;
+}
+
+TrialEventDecoder::TrialEventDecoder(size_t queueRecords) : queue(queueRecords), replies(DECODER_REPLY_BYTES),
+  stopFlag(false), running(false), pendingStart(-1), inTrial(false), bytesRead(0), records(0), dropped(0),
+  replyDropped(0), trialsCompleted(0) {
+  wakePipe[0] = wakePipe[1] = -1;
+}
+
+TrialEventDecoder::~TrialEventDecoder() {
+  close();
+}
+
+int TrialEventDecoder::open(const char *portName) {
+  close();
+  if (port.open(portName) < 0) return -1;
+  start();
+  return 0;
+}
+
+int TrialEventDecoder::attach(int fd) {
+  close();
+  port.attach(fd);
+  start();
+  return 0;
+}
+
+void TrialEventDecoder::start() {
+  if (pipe(wakePipe) < 0) {
+    wakePipe[0] = wakePipe[1] = -1;
+  } else {
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+  }
+  stopFlag = false;
+  pendingStart = -1;
+  running = true;
+  reader = std::thread(&TrialEventDecoder::run, this);
+}
+
+void TrialEventDecoder::close() {
+  uint8_t wake = 0;
+
+  if (reader.joinable()) {
+    stopFlag = true;
+    if (wakePipe[1] >= 0 && ::write(wakePipe[1], &wake, 1) < 0) {}
+    reader.join();
+  }
+  for (int i = 0; i < 2; i++) {
+    if (wakePipe[i] >= 0) ::close(wakePipe[i]);
+    wakePipe[i] = -1;
+  }
+  port.close();
+  running = false;
+  inTrial = false;
+}
+
+int TrialEventDecoder::startTrial(bool newStateMachineSent, bool liveTimestamps) {
+  /*
+    The reader arms the parser and discards stale input before 'R' goes
+    out, so every byte it reads afterwards belongs to the new trial.
+  */
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  uint8_t wake = 0;
+  uint8_t run = 'R';
+
+  if (!running) return -1;
+  pendingStart = (newStateMachineSent ? 1 : 0) | (liveTimestamps ? 2 : 0);
+  if (wakePipe[1] >= 0 && ::write(wakePipe[1], &wake, 1) < 0) return -1;
+  while (pendingStart.load() >= 0) {
+    if (!running || std::chrono::steady_clock::now() > deadline) return -1;
+    std::this_thread::yield();
+  }
+  return port.writeBytes(&run, 1);
+}
+
+int TrialEventDecoder::write(const uint8_t *data, size_t size) {
+  return port.writeBytes(data, size);
+}
+
+size_t TrialEventDecoder::drain(BpodEventRecord *out, size_t maxRecords) {
+  return queue.pop(out, maxRecords);
+}
+
+size_t TrialEventDecoder::readReply(uint8_t *data, size_t maxBytes) {
+  return replies.pop(data, maxBytes);
+}
+
+TrialDecoderStatus TrialEventDecoder::status() const {
+  TrialDecoderStatus s;
+  s.running = running;
+  s.inTrial = inTrial;
+  s.bytesRead = bytesRead;
+  s.records = records;
+  s.dropped = dropped;
+  s.replyDropped = replyDropped;
+  s.trialsCompleted = trialsCompleted;
+  return s;
+}
+
+void TrialEventDecoder::run() {
+  TrialStreamParser parser;
+  std::vector<BpodEventRecord> out;
+  std::vector<uint8_t> reply;
+  uint8_t buffer[DECODER_READ_SIZE];
+  uint8_t discard[64];
+  struct pollfd p[2];
+  int flags, n;
+
+  out.reserve(DECODER_READ_SIZE);
+  reply.reserve(DECODER_READ_SIZE);
+  while (!stopFlag) {
+    p[0].fd = port.fd();
+    p[0].events = POLLIN;
+    p[1].fd = wakePipe[0];
+    p[1].events = POLLIN;
+    p[0].revents = p[1].revents = 0;
+    n = poll(p, (wakePipe[0] >= 0) ? 2 : 1, 100);
+    if (n < 0 && errno != EINTR) break;
+    if (p[1].revents & POLLIN) {
+      while (::read(wakePipe[0], discard, sizeof(discard)) > 0) {}
+    }
+    flags = pendingStart.load();
+    if (flags >= 0) {
+      port.flush();
+      parser.startTrial(flags & 1, flags & 2);
+      inTrial = true;
+      pendingStart = -1;
+      continue;  // the flush may have emptied the port since poll(): poll again before reading
+    }
+    if (n <= 0 || !(p[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+    n = port.readSome(buffer, sizeof(buffer));
+    if (n < 0) break;  // port closed or device gone
+    bytesRead += n;
+    out.clear();
+    reply.clear();
+    parser.parse(buffer, n, out, reply);
+    for (size_t i = 0; i < out.size(); i++) {
+      if (queue.push(out[i])) {
+        records++;
+      } else {
+        dropped++;
+      }
+      if (out[i].type == RECORD_TRIAL_END) trialsCompleted++;
+    }
+    for (size_t i = 0; i < reply.size(); i++) {
+      if (!replies.push(reply[i])) replyDropped++;
+    }
+    inTrial = parser.inTrial();
+  }
+  running = false;
+}
@@ -0,0 +1,148 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  TrialEventDecoder: reads the state machine's USB stream on its own
+  thread and turns it into timestamped records, so a client (the
+  BpodTrialEvents MEX, bpod-trial-events) can drain a whole burst of
+  events at once instead of polling bytesAvailable per message.
+
+  Stream during a trial (see RunStateMachine.m, send_trial_start_command):
+    after 'R':      [1] confirmation, only if a new state machine was sent
+                    uint64 trial start time (us)
+    opcode 1:       [1 nEvents] nEvents event bytes (0-based)
+                    [uint32 timestamp (cycles), with live timestamps]
+    opcode 2:       [2 softCode]
+    exit event 254: the opcode 1 message is followed by uint32 nHWTimerCycles,
+                    uint64 trial end time (us) and, without live timestamps,
+                    uint16 nTimestamps + nTimestamps uint32 (cycles).
+  Bytes that arrive between trials are replies to other commands; they
+  are kept for readReply().
+
+  The port is only read on the decoder thread; startTrial(), write(),
+  drain() and readReply() may be called from one other thread.
+*/
+
+#ifndef TrialEventDecoder_h
+#define TrialEventDecoder_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ArCOMHost.h"
+#include "SPSCQueue.h"
+
+#define DECODER_QUEUE_RECORDS  (1 << 20)  // records buffered between drains
+#define DECODER_REPLY_BYTES    (1 << 16)  // bytes buffered outside a trial
+#define DECODER_READ_SIZE      4096       // bytes per port read
+#define EXIT_EVENT             254        // 0-based code of the trial exit event
+
+enum BpodRecordType {
+  RECORD_EVENT = 1,        // code = event (0-based), time = cycles, message = refresh index in the trial
+  RECORD_SOFT_CODE = 2,    // code = soft code, message = refresh index
+  RECORD_TRIAL_START = 3,  // time = trial start (us)
+  RECORD_TRIAL_END = 4,    // time = trial end (us), message = nHWTimerCycles
+  RECORD_TIMESTAMP = 5,    // legacy (no live timestamps): time = cycles of event number message
+  RECORD_ERROR = 6         // code = unexpected byte (bad confirmation or opcode)
+};
+
+struct BpodEventRecord {
+  uint64_t time;
+  uint32_t message;
+  uint8_t type;            // BpodRecordType
+  uint8_t code;
+  uint16_t trial;          // trials started since open, modulo 65536
+};
+
+class TrialStreamParser
+{
+public:
+  TrialStreamParser();
+  void startTrial(bool expectConfirmation, bool liveTimestamps);
+  bool inTrial() const { return phase != IDLE; }
+  // Parses size bytes; records go to records, bytes outside a trial to reply.
+  // Returns the number of records produced.
+  size_t parse(const uint8_t *data, size_t size, std::vector<BpodEventRecord> &records, std::vector<uint8_t> &reply);
+
+private:
+  enum Phase { IDLE, CONFIRM, START_TIME, OPCODE, OPERAND, EVENTS, EVENT_TIME, END_TIME, N_TIMESTAMPS, TIMESTAMPS };
+  Phase phase;
+  bool confirm;
+  bool live;
+  uint16_t trial;
+  uint32_t message;        // opcode messages so far in this trial
+  uint32_t eventCount;     // events so far in this trial (legacy timestamp index)
+  uint8_t opcode;
+  uint8_t nEvents;
+  uint8_t events[256];
+  uint8_t field[12];       // multi-byte field being assembled
+  unsigned int fieldSize, fieldPos;
+  uint32_t nTimestamps;
+  bool exitSeen;
+  void expect(Phase next, unsigned int size);
+  void emit(std::vector<BpodEventRecord> &records, uint8_t type, uint8_t code, uint64_t time, uint32_t message);
+  void fieldComplete(std::vector<BpodEventRecord> &records);
+};
+
+struct TrialDecoderStatus {
+  bool running;            // reader thread alive
+  bool inTrial;
+  uint64_t bytesRead;
+  uint64_t records;        // records queued since open
+  uint64_t dropped;        // records lost because the queue was full
+  uint64_t replyDropped;   // reply bytes lost because nobody read them
+  uint32_t trialsCompleted;
+};
+
+class TrialEventDecoder
+{
+public:
+  explicit TrialEventDecoder(size_t queueRecords = DECODER_QUEUE_RECORDS);
+  ~TrialEventDecoder();
+  int open(const char *portName);  // opens the port and starts the reader; 0 or -1
+  int attach(int fd);              // same, on an open descriptor (PTY, pipe, socket)
+  void close();
+  // Arms the parser and sends 'R'.  newStateMachineSent: a confirmation
+  // byte precedes the start time.  liveTimestamps: FSM 0.7 and newer.
+  int startTrial(bool newStateMachineSent, bool liveTimestamps);
+  int write(const uint8_t *data, size_t size);
+  size_t drain(BpodEventRecord *records, size_t maxRecords);
+  size_t readReply(uint8_t *data, size_t maxBytes);
+  TrialDecoderStatus status() const;
+
+private:
+  ArCOMHost port;
+  SPSCQueue<BpodEventRecord> queue;
+  SPSCQueue<uint8_t> replies;
+  std::thread reader;
+  std::atomic<bool> stopFlag;
+  std::atomic<bool> running;
+  std::atomic<int> pendingStart;   // -1 none, else bit 0 = confirmation, bit 1 = live timestamps
+  std::atomic<bool> inTrial;
+  std::atomic<uint64_t> bytesRead, records, dropped, replyDropped;
+  std::atomic<uint32_t> trialsCompleted;
+  int wakePipe[2];                 // wakes the reader's poll() for startTrial and close
+  void start();
+  void run();
+};
+#endif
@@ -0,0 +1,174 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include "VirtualStateMachine.h"
+
+#define MODULE_INFO_TIMEOUT 1000  // ms
+#define ECHO_TIMEOUT 1000
+
+static uint64_t nowMicros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+VirtualStateMachine::VirtualStateMachine(ArCOMHost &link, int first, int n) : nIgnored(0), port(link), firstEvent(first),
+  nSerialEvents(n), startTime(nowMicros()), buffer(4096) {
+  info.firmwareVersion = 0;
+  info.nEventsRequested = -1;
+  info.hwVersionMajor = info.hwVersionMinor = -1;
+}
+
+uint64_t VirtualStateMachine::micros() const {
+  return nowMicros() - startTime;
+}
+
+int VirtualStateMachine::requestModuleInfo(ModuleInfo &out) {
+  uint8_t moreInfo;
+  char text[256];
+
+  port.flush();
+  port.setTimeout(MODULE_INFO_TIMEOUT);
+  port.writeByte(255);
+  if (port.readByte() != 65 || port.timedOut()) return -1;
+  info = ModuleInfo();
+  info.nEventsRequested = -1;
+  info.hwVersionMajor = info.hwVersionMinor = -1;
+  info.firmwareVersion = port.readUint32();
+  uint8_t nameLength = port.readByte();
+  port.readCharArray(text, nameLength);
+  info.name.assign(text, nameLength);
+  moreInfo = port.readByte();
+  while (moreInfo == 1 && !port.timedOut()) {
+    switch (port.readByte()) {
+      case '#':
+	info.nEventsRequested = port.readByte();
+	break;
+      case 'E': {
+	uint8_t nStrings = port.readByte();
+	info.eventNames.clear();
+	for (int i = 0; i < nStrings && !port.timedOut(); i++) {
+	  uint8_t length = port.readByte();
+	  port.readCharArray(text, length);
+	  info.eventNames.push_back(std::string(text, length));
+	}
+	break;
+      }
+      case 'V': info.hwVersionMajor = port.readByte(); break;
+      case 'v': info.hwVersionMinor = port.readByte(); break;
+      default: return -1;  // unknown parameters have no length; the rest can't be parsed
+    }
+    moreInfo = port.readByte();
+  }
+  if (port.timedOut() || moreInfo > 1) return -1;
+  if (info.nEventsRequested > nSerialEvents) nSerialEvents = info.nEventsRequested;
+  out = info;
+  return 0;
+}
+
+std::string VirtualStateMachine::eventName(uint8_t code) const {
+  int index = code - firstEvent;
+  std::string prefix = (info.name.empty() ? std::string("Serial") : info.name) + "1_";
+
+  if (index < 0 || index >= nSerialEvents) return "";
+  if (index < (int) info.eventNames.size()) return prefix + info.eventNames[index];
+  return prefix + std::to_string(index + 1);
+}
+
+int VirtualStateMachine::sendMessage(const uint8_t *bytes, size_t n) {
+  return port.writeBytes(bytes, n);
+}
+
+int VirtualStateMachine::pollEvents(std::vector<ModuleEvent> &events, int timeoutMs) {
+  ModuleEvent e;
+  int n, ready, nEvents = 0;
+
+  ready = port.waitReadable(timeoutMs);
+  while (ready > 0) {
+    n = port.readSome(buffer.data(), buffer.size());
+    if (n < 0) return -1;
+    e.time = micros();
+    for (int i = 0; i < n; i++) {
+      e.byte = buffer[i];
+      if (e.byte == 0 || e.byte > nSerialEvents) {
+	nIgnored++;
+	continue;
+      }
+      e.code = (uint8_t) (firstEvent + e.byte - 1);
+      events.push_back(e);
+      nEvents++;
+    }
+    ready = port.waitReadable(0);
+  }
+  return (ready < 0 && nEvents == 0) ? -1 : nEvents;
+}
+
+int VirtualStateMachine::measureEcho(uint32_t nBytes, int window, LatencyStats &stats, std::vector<uint32_t> *samples) {
+  // Echoes come back in order, so the oldest unanswered byte is the one expected next.  A lost
+  // echo is found from the next one: its value (1-254) names one byte of the window.
+  std::vector<uint64_t> sendTime(nBytes);
+  std::vector<uint32_t> latency;
+  uint32_t nSent = 0, nReceived = 0, k;
+  uint8_t out[256];
+  int n;
+
+  if (window < 1) window = 1;
+  if (window > 254) window = 254;  // a sketch reads at most 255 bytes at a time; 254 values tell the window apart
+  latency.reserve(nBytes);
+  stats = LatencyStats();
+  while (nReceived < nBytes) {
+    int nOut = 0;
+    while (nSent < nBytes && (int) (nSent - nReceived) < window) {
+      out[nOut++] = (uint8_t) (1 + nSent % 254);
+      sendTime[nSent++] = nowMicros();
+    }
+    if (nOut > 0 && port.writeBytes(out, nOut) < 0) return -1;
+    if (port.waitReadable(ECHO_TIMEOUT) <= 0) break;
+    n = port.readSome(buffer.data(), std::min<size_t>(buffer.size(), nSent - nReceived));
+    if (n < 0) return -1;
+    uint64_t now = nowMicros();
+    for (int i = 0; i < n; i++) {
+      if (buffer[i] < 1 || buffer[i] > 254) continue;  // not an echo
+      k = nReceived + (buffer[i] - 1 + 254 - nReceived % 254) % 254;
+      if (k >= nSent) continue;  // not an echo of a byte in flight
+      stats.lost += k - nReceived;  // skipped echoes, counted once
+      nReceived = k;
+      latency.push_back((uint32_t) (now - sendTime[nReceived++]));
+    }
+  }
+  stats.lost += nBytes - nReceived;
+  stats.n = latency.size();
+  if (samples) *samples = latency;
+  if (latency.empty()) return -1;
+  double sum = 0;
+  for (size_t i = 0; i < latency.size(); i++) sum += latency[i];
+  std::sort(latency.begin(), latency.end());
+  size_t last = latency.size() - 1;
+  stats.mean = sum/latency.size();
+  stats.min = latency[0];
+  stats.median = latency[last/2];
+  stats.p90 = latency[(size_t) (last*0.9)];
+  stats.p99 = latency[(size_t) (last*0.99)];
+  stats.p999 = latency[(size_t) (last*0.999)];
+  stats.max = latency[last];
+  return 0;
+}
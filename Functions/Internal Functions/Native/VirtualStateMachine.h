@@ -0,0 +1,90 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  VirtualStateMachine: the state machine's side of a module link (Serial1
+  on the module, 1312500 baud), for testing module firmware without a
+  Bpod.  The module runs on a PTY or socket (a sketch built on the PC,
+  see ArduinoHost/Arduino.h) or on hardware through a USB-serial adapter.
+
+  requestModuleInfo() sends op code 255 and parses the reply as
+  LoadModules does: 65, uint32 firmware version, name, then while the
+  "more info" byte is 1, '#' (number of events), 'E' (event names), 'V'
+  or 'v' (hardware version).  pollEvents() turns bytes from the module
+  into events, as the state machine does: byte b (1 to nSerialEvents) is
+  event firstEvent + b - 1, named ModuleName1_EventName.  measureEcho()
+  times round trips through a module that echoes (EchoModule).
+*/
+
+#ifndef VirtualStateMachine_h
+#define VirtualStateMachine_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "ArCOMHost.h"
+
+struct ModuleInfo {
+  uint32_t firmwareVersion;
+  std::string name;
+  int nEventsRequested;                 // '#', -1 if not sent
+  std::vector<std::string> eventNames;  // 'E'
+  int hwVersionMajor, hwVersionMinor;   // 'V', 'v', -1 if not sent
+};
+
+struct ModuleEvent {
+  uint64_t time;  // microseconds since the link was made
+  uint8_t code;   // 0-based state machine event code
+  uint8_t byte;   // as sent by the module
+};
+
+struct LatencyStats {
+  uint32_t n, lost;
+  double mean, min, median, p90, p99, p999, max;  // microseconds
+};
+
+class VirtualStateMachine
+{
+public:
+  // port is the module link; firstEvent and nSerialEvents place the module's events among the state machine's
+  // (defaults: module 1 of a Bpod 2 state machine, before any '#' request)
+  VirtualStateMachine(ArCOMHost &port, int firstEvent = 0, int nSerialEvents = 15);
+  int requestModuleInfo(ModuleInfo &info);  // 0, or -1 if there was no valid reply
+  const ModuleInfo &moduleInfo() const { return info; }
+  std::string eventName(uint8_t code) const;
+  int sendMessage(const uint8_t *bytes, size_t n);  // serial message to the module; 0 or -1
+  // Reads what the module sent within timeoutMs and appends the events; returns their number, -1 if the link closed
+  int pollEvents(std::vector<ModuleEvent> &events, int timeoutMs);
+  // Sends nBytes bytes (1-254) keeping up to window (at most 254) unanswered, and times each echo;
+  // stats.lost counts the bytes whose echo never came
+  int measureEcho(uint32_t nBytes, int window, LatencyStats &stats, std::vector<uint32_t> *samples = NULL);
+  uint64_t micros() const;
+  uint32_t nIgnored;  // module bytes that are not events (0 or past nSerialEvents)
+
+private:
+  ArCOMHost &port;
+  int firstEvent, nSerialEvents;
+  ModuleInfo info;
+  uint64_t startTime;
+  std::vector<uint8_t> buffer;
+};
+#endif
@@ -0,0 +1,234 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-emulator: benchmark and self test of the native state machine
+  emulator.  A task state machine (poke for reward or punishment, looping
+  global timer, global counter, condition, soft code) is encoded with
+  StateMachineEncoder, loaded into StateMachineEmulator, and run for
+  nTrials trials of random pokes.  The output stream is decoded with
+  TrialStreamParser and checked against the emulator's trial record.
+
+    bpod-emulator [-l] [-v] nTrials
+      -l  legacy stream (timestamps after the trial instead of live)
+      -v  print the decoded records of the first trial
+
+  Protocols are emulated from MATLAB with the BpodEmulator MEX.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "StateMachineEncoder.h"
+#include "StateMachineEmulator.h"
+#include "TrialEventDecoder.h"
+
+#define N_STATES       4
+#define N_SERIAL       60   // serial / USB events
+#define N_INPUTS       10   // 3 serial channels, then BNC1-2 and Port1-5
+#define N_EVENTS       (N_SERIAL + 2*7)
+#define N_OUTPUTS      15   // 12 physical, global timer trig / cancel, global counter reset
+#define PORT_IN(p)     (N_SERIAL + 2*(1 + (p)))  // 0-based event codes, p = 1..5
+#define PORT_OUT(p)    (PORT_IN(p) + 1)
+
+static unsigned int seed = 1;
+
+static double uniform(void)
+{
+  return rand_r(&seed)/(RAND_MAX + 1.0);
+}
+
+static void buildMessage(bool machine2, std::vector<uint8_t> &message)
+{
+  /* 0 WaitForPoke (5 s, starts looping timer 1): Port1In -> Reward, Port3In -> Punish, Tup -> exit
+     1 Reward (0.1 s, soft code 1, cancels timer 1): Tup -> Drink
+     2 Punish (1 s, resets counter 1): Port2 high (condition 1) -> Drink, Tup -> exit
+     3 Drink (0.5 s): 3 Port1In (counter 1) -> exit, Tup -> exit */
+  static double input[N_STATES*N_EVENTS], output[N_STATES*N_OUTPUTS];
+  static double stateTimerMatrix[N_STATES] = {5, 4, 5, 5}, stateTimers[N_STATES] = {5, 0.1, 1, 0.5};
+  static double self[N_STATES] = {1, 2, 3, 4}, counterMatrix[N_STATES] = {1, 2, 3, 5}, conditionMatrix[N_STATES] = {1, 2, 4, 4};
+  static double one[1] = {1}, zero[1] = {0}, channel[1] = {255}, duration[1] = {0.1};
+  static double counterEvent[1] = {PORT_IN(1) + 1}, threshold[1] = {3}, conditionChannel[1] = {7};
+  StateMachineDescription d;
+  StateMachineHardware hw;
+  StateMachineEncoder encoder;
+
+  for (int s = 0; s < N_STATES; s++) {
+    for (int e = 0; e < N_EVENTS; e++) input[s + e*N_STATES] = s + 1;
+  }
+  input[0 + PORT_IN(1)*N_STATES] = 2;
+  input[0 + PORT_IN(3)*N_STATES] = 3;
+  memset(output, 0, sizeof(output));
+  output[0 + 12*N_STATES] = 1;  // trigger timer 1
+  output[1 + 2*N_STATES] = 1;   // soft code 1
+  output[1 + 13*N_STATES] = 1;  // cancel timer 1
+  output[2 + 14*N_STATES] = 1;  // reset counter 1
+
+  auto array = [](double *data, size_t rows, size_t cols) { SMArray a; a.data = data; a.rows = rows; a.cols = cols; return a; };
+  d.nStates = N_STATES;
+  d.inputMatrixSize = N_EVENTS;
+  d.use255BackSignal = false;
+  d.inputMatrix = array(input, N_STATES, N_EVENTS);
+  d.outputMatrix = array(output, N_STATES, N_OUTPUTS);
+  d.stateTimerMatrix = array(stateTimerMatrix, 1, N_STATES);
+  d.stateTimers = array(stateTimers, 1, N_STATES);
+  d.globalTimerStartMatrix = d.globalTimerEndMatrix = array(self, N_STATES, 1);
+  d.globalCounterMatrix = array(counterMatrix, N_STATES, 1);
+  d.conditionMatrix = array(conditionMatrix, N_STATES, 1);
+  d.timerIsSet = d.counterSet = d.conditionSet = d.timerLoopMode = d.timerSendEvents = array(one, 1, 1);
+  d.timerOutputChannel = array(channel, 1, 1);
+  d.timerOnMessage = d.timerOffMessage = d.timerOnTrigger = d.timerOnsetDelay = array(zero, 1, 1);
+  d.timerDuration = d.timerLoopInterval = array(duration, 1, 1);
+  d.counterEvents = array(counterEvent, 1, 1);
+  d.counterThresholds = array(threshold, 1, 1);
+  d.conditionChannels = array(conditionChannel, 1, 1);
+  d.conditionValues = array(one, 1, 1);
+  d.serialMessageMode = 0;
+  hw.machineType = machine2 ? 4 : 3;
+  hw.firmwareVersion = 23;
+  hw.cycleFrequency = 10000;
+  hw.maxGlobalTimers = 16;
+  hw.nUartSerialChannels = 2;
+  hw.posGlobalTimerTrig = 13;
+  hw.posGlobalTimerCancel = 14;
+  hw.posGlobalCounterReset = 15;
+  hw.posAnalogThreshEnable = 13;  // no analog thresholds: any column with zeros
+  hw.posAnalogThreshDisable = 13;
+  hw.posInputUSB = 3;
+  encoder.encode(d, hw);
+
+  const std::vector<uint8_t> &body = encoder.byteString();
+  message.assign({'C', 0, 0, (uint8_t) body.size(), (uint8_t) (body.size() >> 8)});
+  message.insert(message.end(), body.begin(), body.end());
+}
+
+static void randomPokes(std::vector<EmulatorInput> &inputs)
+{
+  // Port 1, 2 or 3 pokes of 50-150 ms, 0.2-3 s apart
+  double t = 0;
+  EmulatorInput in;
+
+  inputs.clear();
+  for (;;) {
+    t += 0.2 + 2.8*uniform();
+    if (t > 8) break;
+    int port = 1 + (int) (3*uniform());
+    in.cycle = (uint64_t) (t*10000);
+    in.event = PORT_IN(port);
+    inputs.push_back(in);
+    t += 0.05 + 0.1*uniform();
+    in.cycle = (uint64_t) (t*10000);
+    in.event = PORT_OUT(port);
+    inputs.push_back(in);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  EmulatorHardware hw;
+  std::vector<uint8_t> message, stream, reply;
+  std::vector<EmulatorInput> inputs;
+  std::vector<BpodEventRecord> records;
+  TrialStreamParser parser;
+  bool live = true, verbose = false, ok = true;
+  uint64_t nEvents = 0, nBytes = 0;
+  long nTrials, nFinished = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "lvh")) != -1) {
+    switch (ch) {
+      case 'l': live = false; break;
+      case 'v': verbose = true; break;
+      default:
+	fprintf(stderr, "usage: %s [-l] [-v] nTrials\n", argv[0]);
+	return 1;
+    }
+  }
+  if (optind >= argc || (nTrials = atol(argv[optind])) <= 0) {
+    fprintf(stderr, "usage: %s [-l] [-v] nTrials\n", argv[0]);
+    return 1;
+  }
+
+  hw.machineType = 3;
+  hw.firmwareVersion = 23;
+  hw.cycleFrequency = 10000;
+  hw.inputMatrixSize = N_EVENTS;
+  hw.maxGlobalTimers = 16;
+  hw.maxGlobalCounters = 8;
+  hw.maxConditions = 16;
+  hw.nInputs = N_INPUTS;
+  hw.ioEventStart = N_SERIAL;
+  hw.ioFirstChannel = 3;
+  hw.outputUSB = 2;
+  hw.liveTimestamps = live;
+  StateMachineEmulator emulator(hw);
+  buildMessage(false, message);
+  if (emulator.load(message.data(), message.size()) < 0) {
+    fprintf(stderr, "The emulator rejected the encoded state machine\n");
+    return 1;
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (long trial = 0; trial < nTrials && ok; trial++) {
+    randomPokes(inputs);
+    stream.clear();
+    const EmulatorTrial &result = emulator.runTrial(inputs.data(), inputs.size(), 0, stream);
+    nFinished += result.finished;
+    nEvents += result.events.size();
+    nBytes += stream.size();
+
+    // Decode the stream as the host would, and compare with the emulator's record
+    records.clear();
+    parser.startTrial(trial == 0, live);
+    parser.parse(stream.data(), stream.size(), records, reply);
+    size_t nEvent = 0, nSoft = 0, nEnd = 0, nTimestamps = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+      const BpodEventRecord &r = records[i];
+      if (verbose && trial == 0) {
+	printf("%d %d %llu %u\n", r.type, r.code, (unsigned long long) r.time, r.message);
+      }
+      switch (r.type) {
+	case RECORD_EVENT:
+	  if (r.code == EXIT_EVENT) break;
+	  if (nEvent >= result.events.size() || r.code != result.events[nEvent] ||
+	      (live && r.time != result.eventCycles[nEvent])) ok = false;
+	  nEvent++;
+	  break;
+	case RECORD_SOFT_CODE: nSoft++; break;
+	case RECORD_TRIAL_END: nEnd++; break;
+	case RECORD_TIMESTAMP: nTimestamps++; break;
+	case RECORD_ERROR: ok = false; break;
+      }
+    }
+    if (!result.finished || nEvent != result.events.size() || nSoft != result.nSoftCodes || nEnd != 1 ||
+	parser.inTrial() || (!live && nTimestamps != nEvent)) {
+      fprintf(stderr, "Trial %ld: the decoded stream does not match the emulated trial\n", trial + 1);
+      ok = false;
+    }
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("%ld trials (%ld finished), %llu events, %llu bytes in %.3f s: %.0f trials/s, %s\n", nTrials, nFinished,
+	 (unsigned long long) nEvents, (unsigned long long) nBytes, elapsed, nTrials/elapsed, ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-flexio-acquisition: acquires Flex I/O analog samples from the state
+  machine's analog port (see FlexIOAcquisition.h).
+
+    bpod-flexio-acquisition [-d decimation] port nChannels file seconds
+      records to file (appended) and prints the status once per second
+
+    bpod-flexio-acquisition [-r MB/s] -s seconds
+      self test: a simulated device streams 4 channel samples over a socket
+      at MB/s (default 20), in writes that split samples; recording is
+      paused for a while, and the view is polled every 100 ms as the analog
+      timer would.  The file and the view are checked sample by sample.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "FlexIOAcquisition.h"
+
+#define TEST_CHANNELS   4
+#define TEST_DECIMATION 10
+
+static double seconds(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void makeSample(uint64_t i, uint16_t *words)
+{
+  // Trial number, then channels from which the sample index can be recovered
+  words[0] = 1 + i/1000;
+  words[1] = i & 0xffff;
+  words[2] = (i >> 16) & 0xffff;
+  words[3] = ~words[1];
+  words[4] = words[1] ^ 0x5555;
+}
+
+static bool checkChannels(const uint16_t *channels, uint64_t &i)
+{
+  uint16_t expected[TEST_CHANNELS + 1];
+  i = channels[0] | ((uint64_t) channels[1] << 16);
+  makeSample(i, expected);
+  return memcmp(channels, expected + 1, 2*TEST_CHANNELS) == 0;
+}
+
+static void printStatus(const FlexIOAcquisitionStatus &s)
+{
+  printf("%s: %llu samples, %llu recorded, %llu dropped, %llu bytes in %llu writes, ring peak %llu bytes%s%s\n",
+	 s.running ? (s.recording ? "recording" : "running") : "stopped", (unsigned long long) s.samples,
+	 (unsigned long long) s.samplesRecorded, (unsigned long long) s.samplesDropped, (unsigned long long) s.bytesWritten,
+	 (unsigned long long) s.writes, (unsigned long long) s.ringPeak, s.writeError ? ", write error: " : "",
+	 s.writeError ? strerror(s.writeError) : "");
+}
+
+static int selfTest(double duration, double rate)
+{
+  char path[] = "/tmp/bpod-flexio-acquisition-XXXXXX";
+  const size_t frame = 2*(TEST_CHANNELS + 1);
+  FlexIOAcquisition acquisition;
+  std::atomic<uint64_t> produced(0);
+  std::atomic<bool> deviceDone(false);
+  bool ok = true;
+  int fds[2], fd;
+
+  if (duration <= 0 || rate <= 0) {
+    fprintf(stderr, "seconds and MB/s must be positive\n");
+    return 1;
+  }
+  fd = mkstemp(path);
+  if (fd < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    perror("setup");
+    return 1;
+  }
+  close(fd);
+  acquisition.attach(fds[0], TEST_CHANNELS);
+  acquisition.setDecimation(TEST_DECIMATION);
+  if (acquisition.start(path) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  // The device: writes of up to 7777 bytes every millisecond, ending on a sample boundary
+  std::thread device([&]() {
+    std::vector<uint8_t> pending;
+    uint16_t words[TEST_CHANNELS + 1];
+    uint64_t next = 0, sent = 0;
+    size_t pos = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (bool last = false; !last;) {
+      last = seconds(t0) >= duration;
+      uint64_t target = last ? (sent + frame - 1)/frame*frame : (uint64_t) (seconds(t0)*rate*1e6);
+      while (sent < target) {
+	if (pos == pending.size()) {
+	  pending.clear();
+	  pos = 0;
+	  for (int k = 0; k < 1000; k++) {
+	    makeSample(next++, words);
+	    pending.insert(pending.end(), (uint8_t *) words, (uint8_t *) words + frame);
+	  }
+	}
+	size_t n = pending.size() - pos;
+	if (n > 7777) n = 7777;
+	if (n > target - sent) n = target - sent;
+	ssize_t w = write(fds[1], pending.data() + pos, n);
+	if (w <= 0) break;
+	pos += w;
+	sent += w;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    produced = sent/frame;
+    deviceDone = true;
+  });
+
+  // The analog timer: polls the view, pauses recording from 40% to 60% of the run
+  std::vector<uint16_t> view(TEST_CHANNELS*(FLEXIO_VIEW_WORDS/TEST_CHANNELS));
+  uint64_t nView = 0, lastView = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (;;) {
+    bool done = deviceDone;
+    double t = seconds(t0);
+    acquisition.setRecording(t < 0.4*duration || t > 0.6*duration);
+    size_t n;
+    while ((n = acquisition.view(view.data(), view.size()/TEST_CHANNELS)) > 0) {
+      for (size_t k = 0; k < n; k++) {
+	uint64_t i;
+	if (!checkChannels(&view[k*TEST_CHANNELS], i) || i % TEST_DECIMATION || (nView > 0 && i <= lastView)) {
+	  if (ok) fprintf(stderr, "view sample %llu is wrong\n", (unsigned long long) nView);
+	  ok = false;
+	}
+	lastView = i;
+	nView++;
+      }
+    }
+    FlexIOAcquisitionStatus s = acquisition.status();
+    if (done && s.samples + s.samplesDropped == produced) break;
+    if (done && seconds(t0) > duration + 10) {
+      fprintf(stderr, "samples missing\n");
+      ok = false;
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  device.join();
+  double elapsed = seconds(t0);
+  acquisition.stop();
+  FlexIOAcquisitionStatus s = acquisition.status();
+  close(fds[1]);
+
+  // The file: whole samples, in order, the pause being the only gap unless samples were dropped
+  FILE *f = fopen(path, "rb");
+  std::vector<uint16_t> words(TEST_CHANNELS + 1);
+  uint64_t nRecorded = 0, gaps = 0, last = 0;
+  while (f && fread(words.data(), 2, words.size(), f) == words.size()) {
+    uint64_t i;
+    if (!checkChannels(&words[1], i) || words[0] != 1 + i/1000 || (nRecorded > 0 && i <= last)) {
+      if (ok) fprintf(stderr, "recorded sample %llu is wrong\n", (unsigned long long) nRecorded);
+      ok = false;
+    }
+    if (nRecorded > 0 && i != last + 1) gaps++;
+    last = i;
+    nRecorded++;
+  }
+  if (f == NULL || ftell(f) % frame != 0) ok = false;
+  if (f) fclose(f);
+  ok = ok && nRecorded == s.samplesRecorded && s.samples + s.samplesDropped == produced && s.writeError == 0 &&
+    (gaps <= 1 || s.samplesDropped > 0) && nView > 0;
+
+  printf("%llu samples in %.1f s (%.1f MB/s): %llu recorded in %llu writes (%.0f KiB each), %llu viewed (%llu not), "
+	 "%llu dropped, ring peak %llu kB: %s\n", (unsigned long long) produced.load(), elapsed,
+	 produced*frame/elapsed/1e6, (unsigned long long) nRecorded, (unsigned long long) s.writes,
+	 s.writes ? s.bytesWritten/1024.0/s.writes : 0.0, (unsigned long long) nView,
+	 (unsigned long long) s.viewDropped, (unsigned long long) s.samplesDropped,
+	 (unsigned long long) s.ringPeak/1000, ok ? "OK" : "FAILED");
+  unlink(path);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  FlexIOAcquisition acquisition;
+  double testSeconds = 0, rate = 20;
+  int ch, decimation = 1;
+
+  while ((ch = getopt(argc, argv, "d:r:s:h")) != -1) {
+    switch (ch) {
+      case 'd': decimation = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 's': testSeconds = atof(optarg); break;
+      default:
+	fprintf(stderr, "usage: %s [-d decimation] port nChannels file seconds\n       %s [-r MB/s] -s seconds\n", argv[0], argv[0]);
+	return 1;
+    }
+  }
+  if (testSeconds) return selfTest(testSeconds, rate);
+  if (optind != argc - 4 || atoi(argv[optind + 1]) < 1) {
+    fprintf(stderr, "usage: %s [-d decimation] port nChannels file seconds\n       %s [-r MB/s] -s seconds\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (acquisition.open(argv[optind], atoi(argv[optind + 1])) < 0) {
+    fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+  acquisition.setDecimation(decimation);
+  if (acquisition.start(argv[optind + 2]) < 0) {
+    fprintf(stderr, "%s: %s\n", argv[optind + 2], strerror(errno));
+    return 1;
+  }
+  std::vector<uint16_t> view(FLEXIO_VIEW_WORDS);
+  double duration = atof(argv[optind + 3]);
+  auto t0 = std::chrono::steady_clock::now();
+  while (seconds(t0) < duration && acquisition.status().running) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    while (acquisition.view(view.data(), view.size()/acquisition.nChannels()) > 0) {}
+    printStatus(acquisition.status());
+  }
+  acquisition.stop();
+  printStatus(acquisition.status());
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-flexio-analog: reads a Flex I/O analog data file (see FlexIOAnalog.h).
+
+    bpod-flexio-analog nChannels file            samples per trial: trial, first sample, nSamples
+    bpod-flexio-analog -o prefix nChannels file  one uint16 file per channel, prefix<channel>.u16
+
+    bpod-flexio-analog -s nSamples
+      self test: writes nSamples synthetic samples for 4 and 6 channels,
+      checks the samples in volts, the channel arrays and the trial index
+      against straightforward code, and reports the rates of both.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "FlexIOAnalog.h"
+
+#define CHUNK 1048576  // samples per chunk when writing channel files
+
+static double seconds(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static int writeChannels(FlexIOAnalogFile &file, const char *prefix)
+{
+  std::vector<std::vector<uint16_t> > buffers(file.nChannels(), std::vector<uint16_t>(CHUNK));
+  std::vector<uint16_t *> out(file.nChannels());
+  std::vector<FILE *> files(file.nChannels());
+  int result = 0;
+
+  for (uint32_t c = 0; c < file.nChannels(); c++) {
+    std::string name = std::string(prefix) + std::to_string(c + 1) + ".u16";
+    out[c] = buffers[c].data();
+    files[c] = fopen(name.c_str(), "wb");
+    if (files[c] == NULL) {
+      fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+      result = 1;
+    }
+  }
+  for (uint64_t first = 0; result == 0 && first < file.nSamples(); first += CHUNK) {
+    uint64_t n = (file.nSamples() - first < CHUNK) ? file.nSamples() - first : CHUNK;
+    file.channels(first, n, out.data());
+    for (uint32_t c = 0; c < file.nChannels(); c++) {
+      if (fwrite(out[c], 2, n, files[c]) != n) {
+	perror("fwrite");
+	result = 1;
+      }
+    }
+  }
+  for (uint32_t c = 0; c < file.nChannels(); c++) {
+    if (files[c] && fclose(files[c]) != 0) result = 1;
+  }
+  return result;
+}
+
+static bool testChannels(uint32_t nChannels, uint64_t nSamples)
+{
+  char path[] = "/tmp/bpod-flexio-analog-XXXXXX";
+  const uint32_t stride = nChannels + 1;
+  std::vector<uint16_t> data(nSamples*stride);
+  std::vector<FlexIOTrialRun> expected;
+  FlexIOAnalogFile file;
+  bool ok = true;
+  int fd;
+
+  // Trials of 500-1500 samples, then a partial sample at the end
+  uint32_t trial = 1;
+  uint64_t trialEnd = 0;
+  for (uint64_t i = 0; i < nSamples; i++) {
+    if (i == trialEnd) {
+      if (i) trial++;
+      trialEnd = i + 500 + (trial*7919) % 1001;
+      expected.push_back(FlexIOTrialRun{trial, i, 0});
+    }
+    expected.back().n++;
+    data[i*stride] = trial;
+    for (uint32_t c = 0; c < nChannels; c++) data[i*stride + c + 1] = (i*(c + 3) + c*1000) % (FLEXIO_BIT_MAX + 1);
+  }
+  fd = mkstemp(path);
+  if (fd < 0 || write(fd, data.data(), 2*data.size()) != (ssize_t) (2*data.size()) || write(fd, data.data(), 2) != 2) {
+    perror(path);
+    return false;
+  }
+  close(fd);
+  if (file.open(path, nChannels) < 0 || file.nSamples() != nSamples) {
+    fprintf(stderr, "%u channels: %s\n", nChannels, strerror(errno));
+    unlink(path);
+    return false;
+  }
+
+  // As AddFlexIOAnalogData.m does it: every word to volts, then each channel's strided copy
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<double> all(data.size()), reference(nSamples*nChannels);
+  for (size_t i = 0; i < data.size(); i++) all[i] = ((double) data[i]/FLEXIO_BIT_MAX)*FLEXIO_VOLTAGE_MAX;
+  for (uint32_t c = 0; c < nChannels; c++) {
+    for (uint64_t i = 0; i < nSamples; i++) reference[i*nChannels + c] = all[i*stride + c + 1];
+  }
+  double referenceTime = seconds(t0);
+  std::vector<double>().swap(all);
+
+  t0 = std::chrono::steady_clock::now();
+  std::vector<double> volts(nSamples*nChannels);
+  file.samples(0, nSamples, volts.data(), true);
+  double voltsTime = seconds(t0);
+  ok = memcmp(volts.data(), reference.data(), 8*volts.size()) == 0 && ok;
+  std::vector<double>().swap(reference);
+  std::vector<double>().swap(volts);
+
+  t0 = std::chrono::steady_clock::now();
+  std::vector<std::vector<uint16_t> > channels(nChannels, std::vector<uint16_t>(nSamples));
+  std::vector<uint16_t *> out(nChannels);
+  for (uint32_t c = 0; c < nChannels; c++) out[c] = channels[c].data();
+  file.channels(0, nSamples, out.data());
+  double channelsTime = seconds(t0);
+  for (uint32_t c = 0; c < nChannels; c++) {
+    for (uint64_t i = 0; i < nSamples; i++) ok = ok && channels[c][i] == data[i*stride + c + 1];
+  }
+  // A range in the middle
+  uint64_t middle = nSamples/2, nMiddle = (nSamples - middle < 1000) ? nSamples - middle : 1000;
+  std::vector<uint16_t> some(nMiddle*nChannels);
+  file.samples(middle, nMiddle, some.data());
+  for (uint64_t i = 0; i < nMiddle; i++) {
+    for (uint32_t c = 0; c < nChannels; c++) ok = ok && some[i*nChannels + c] == data[(middle + i)*stride + c + 1];
+  }
+
+  t0 = std::chrono::steady_clock::now();
+  const std::vector<FlexIOTrialRun> &runs = file.trialIndex();
+  double indexTime = seconds(t0);
+  ok = ok && runs.size() == expected.size();
+  for (size_t i = 0; ok && i < runs.size(); i++) {
+    ok = runs[i].trial == expected[i].trial && runs[i].first == expected[i].first && runs[i].n == expected[i].n;
+  }
+
+  printf("%u channels, %llu samples (%zu trials): volts %.0f Msamples/s (all words then per channel %.0f), "
+	 "channel arrays %.0f Msamples/s, trial index %.1f ms: %s\n", nChannels, (unsigned long long) nSamples,
+	 runs.size(), nSamples/voltsTime/1e6, nSamples/referenceTime/1e6, nSamples/channelsTime/1e6, indexTime*1e3,
+	 ok ? "OK" : "FAILED");
+  file.close();
+  unlink(path);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  FlexIOAnalogFile file;
+  const char *prefix = NULL;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "o:s:h")) != -1) {
+    switch (ch) {
+      case 'o': prefix = optarg; break;
+      case 's': {
+	uint64_t nSamples = strtoull(optarg, NULL, 10);
+	if (nSamples == 0) {
+	  fprintf(stderr, "nSamples must be at least 1\n");
+	  return 1;
+	}
+	bool ok = testChannels(4, nSamples);
+	ok = testChannels(6, nSamples) && ok;
+	return ok ? 0 : 1;
+      }
+      default:
+	fprintf(stderr, "usage: %s [-o prefix] nChannels file\n       %s -s nSamples\n", argv[0], argv[0]);
+	return 1;
+    }
+  }
+  if (optind != argc - 2 || atoi(argv[optind]) < 1) {
+    fprintf(stderr, "usage: %s [-o prefix] nChannels file\n       %s -s nSamples\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (file.open(argv[optind + 1], atoi(argv[optind])) < 0) {
+    fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(errno));
+    return 1;
+  }
+  if (prefix) return writeChannels(file, prefix);
+  const std::vector<FlexIOTrialRun> &runs = file.trialIndex();
+  for (size_t i = 0; i < runs.size(); i++) {
+    printf("%u %llu %llu\n", runs[i].trial, (unsigned long long) runs[i].first + 1, (unsigned long long) runs[i].n);
+  }
+  return 0;
+}
@@ -0,0 +1,234 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-module-link: a virtual state machine for module firmware tests
+  (see VirtualStateMachine.h).  It reads the module's info, then
+  optionally times echoes and prints the module's events.
+
+    bpod-module-link [-c channel] [-e nBytes] [-w window] [-l seconds] port
+      -c  the module's serial channel, for its event codes (default 1)
+      -e  send nBytes bytes and time their echoes (EchoModule)
+      -w  bytes in flight during -e (default 1; more for latency under load)
+      -l  print the module's events for this many seconds
+
+  Built with a sketch (make module-EchoModule etc.), the sketch runs on
+  a thread connected to the virtual state machine by a socket pair, and
+  two more options are available:
+      -t pin:count  toggle a digital input count times, 2 ms apart, and
+                    check that each toggle produced one event
+      -p            instead of testing, serve the sketch's Serial1 and
+                    USB on pseudo-terminals until interrupted; connect
+                    with bpod-module-link from another shell
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "VirtualStateMachine.h"
+#ifdef HOST_SKETCH
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include "ArduinoHost/Arduino.h"
+#endif
+
+#define N_SERIAL_EVENTS 15  // per module channel, before '#' requests (Bpod 2: 60 serial events, 4 channels)
+
+static void usage(const char *name)
+{
+#ifdef HOST_SKETCH
+  fprintf(stderr, "usage: %s [-c channel] [-e nBytes] [-w window] [-l seconds] [-t pin:count] [-p]\n", name);
+#else
+  fprintf(stderr, "usage: %s [-c channel] [-e nBytes] [-w window] [-l seconds] port\n", name);
+#endif
+  exit(1);
+}
+
+static void printInfo(const ModuleInfo &info)
+{
+  printf("%s, firmware v%u", info.name.c_str(), info.firmwareVersion);
+  if (info.hwVersionMajor >= 0) printf(", hardware v%d.%d", info.hwVersionMajor, info.hwVersionMinor >= 0 ? info.hwVersionMinor : 0);
+  if (info.nEventsRequested >= 0) printf(", %d events", info.nEventsRequested);
+  printf("\n");
+  for (size_t i = 0; i < info.eventNames.size(); i++) printf("  event %d: %s\n", (int) i + 1, info.eventNames[i].c_str());
+}
+
+static bool echoTest(VirtualStateMachine &vsm, uint32_t nBytes, int window)
+{
+  LatencyStats s;
+  if (vsm.measureEcho(nBytes, window, s) < 0) {
+    printf("echo: no reply (%u of %u bytes lost)\n", s.lost, nBytes);
+    return false;
+  }
+  printf("echo: %u bytes, window %d, %u lost; round trip (us): mean %.1f, min %.0f, median %.0f, 90%% %.0f, "
+	 "99%% %.0f, 99.9%% %.0f, max %.0f\n", s.n, window, s.lost, s.mean, s.min, s.median, s.p90, s.p99, s.p999, s.max);
+  return s.lost == 0;
+}
+
+static void listen(VirtualStateMachine &vsm, double seconds)
+{
+  std::vector<ModuleEvent> events;
+  uint64_t end = vsm.micros() + (uint64_t) (seconds*1e6);
+
+  while (vsm.micros() < end) {
+    events.clear();
+    if (vsm.pollEvents(events, 10) < 0) break;
+    for (size_t i = 0; i < events.size(); i++) {
+      printf("%.6f %d %s\n", events[i].time*1e-6, events[i].code + 1, vsm.eventName(events[i].code).c_str());
+    }
+  }
+  fflush(stdout);
+}
+
+#ifdef HOST_SKETCH
+static int openPTY(int &slave)
+{
+  // The slave stays open here, in raw mode, so the sketch's writes are neither echoed nor lost while nobody is connected
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) return -1;
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &tio) < 0) return -1;
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return master;
+}
+
+static int serve(void)
+{
+  sigset_t signals;
+  int uartSlave, usbSlave, signal;
+  int uart = openPTY(uartSlave), usb = openPTY(usbSlave);
+
+  if (uart < 0 || usb < 0) {
+    perror("pseudo-terminal");
+    return 1;
+  }
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+  printf("Serial1 (state machine link): %s\n", ptsname(uart));
+  printf("USB: %s\n", ptsname(usb));
+  fflush(stdout);
+  arduinoHostStart(uart, usb);
+  sigwait(&signals, &signal);
+  arduinoHostStop();
+  return 0;
+}
+
+static bool toggleTest(VirtualStateMachine &vsm, int pin, int count)
+{
+  std::vector<ModuleEvent> events;
+  std::vector<uint64_t> toggleTime;
+  std::vector<uint32_t> latency;
+  int level = digitalRead(pin);
+
+  for (int i = 0; i < count; i++) {
+    level = !level;
+    toggleTime.push_back(vsm.micros());
+    arduinoHostSetPin(pin, level);
+    while (vsm.micros() < toggleTime.back() + 2000) {
+      if (vsm.pollEvents(events, 1) < 0) break;
+    }
+  }
+  vsm.pollEvents(events, 100);
+  for (size_t i = 0; i < events.size() && i < toggleTime.size(); i++) latency.push_back(events[i].time - toggleTime[i]);
+  std::sort(latency.begin(), latency.end());
+  printf("pin %d: %d toggles, %d events", pin, count, (int) events.size());
+  if (!latency.empty()) printf("; toggle to event (us): median %u, max %u", latency[latency.size()/2], latency.back());
+  printf("\n");
+  return (int) events.size() == count;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  ArCOMHost port;
+  ModuleInfo info;
+  int ch, channel = 1, window = 1;
+  uint32_t nEcho = 0;
+  double listenTime = 0;
+  bool ok = true;
+
+#ifdef HOST_SKETCH
+  int togglePin = -1, toggleCount = 0;
+  const char *options = "c:e:w:l:t:ph";
+#else
+  const char *options = "c:e:w:l:h";
+#endif
+  while ((ch = getopt(argc, argv, options)) != -1) {
+    switch (ch) {
+      case 'c': channel = atoi(optarg); break;
+      case 'e': nEcho = strtoul(optarg, NULL, 10); break;
+      case 'w': window = atoi(optarg); break;
+      case 'l': listenTime = atof(optarg); break;
+#ifdef HOST_SKETCH
+      case 't':
+	if (sscanf(optarg, "%d:%d", &togglePin, &toggleCount) != 2 || togglePin < 0 || togglePin >= N_HOST_PINS) usage(argv[0]);
+	break;
+      case 'p': return serve();
+#endif
+      default: usage(argv[0]);
+    }
+  }
+  if (channel < 1) usage(argv[0]);
+
+#ifdef HOST_SKETCH
+  int sv[2];
+  if (optind != argc) usage(argv[0]);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    perror("socketpair");
+    return 1;
+  }
+  port.attach(sv[0]);
+  arduinoHostStart(sv[1], -1);
+#else
+  if (optind != argc - 1) usage(argv[0]);
+  if (port.open(argv[optind], 1312500) < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+#endif
+
+  VirtualStateMachine vsm(port, (channel - 1)*N_SERIAL_EVENTS, N_SERIAL_EVENTS);
+  if (vsm.requestModuleInfo(info) < 0) {
+    fprintf(stderr, "No valid reply to the module info request (255)\n");
+    ok = false;
+  } else {
+    printInfo(info);
+    if (nEcho > 0) ok = echoTest(vsm, nEcho, window) && ok;
+#ifdef HOST_SKETCH
+    if (togglePin >= 0) ok = toggleTest(vsm, togglePin, toggleCount) && ok;
+#endif
+    if (listenTime > 0) listen(vsm, listenTime);
+  }
+#ifdef HOST_SKETCH
+  arduinoHostStop();
+#endif
+  return ok ? 0 : 1;
+}
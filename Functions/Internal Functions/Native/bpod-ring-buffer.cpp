@@ -0,0 +1,309 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-ring-buffer: tests MirroredRingBuffer (see MirroredRingBuffer.h).
+
+    bpod-ring-buffer -s megabytes
+      self test: a producer thread streams megabytes of numbered bytes to
+      a consumer thread through a 64 kB ring, in writes and reads of
+      random sizes, half of them in place; the consumer checks every byte.
+      Then the single-threaded pattern ArCOM uses (write what arrived,
+      read a message) is timed through the ring, through a copy of
+      BpodDoubleSidedBuffer's algorithm and through a ring that splits
+      copies at the wrap.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "MirroredRingBuffer.h"
+
+#define TEST_CAPACITY 65536
+
+static double seconds(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static inline uint8_t byteAt(uint64_t i)
+{
+  return (uint8_t) (i ^ (i >> 8) ^ (i >> 16));
+}
+
+static inline uint32_t nextRandom(uint32_t &state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// BpodDoubleSidedBuffer.m, as C++: writes go to one buffer while reads drain the other
+class DoubleSidedBuffer
+{
+public:
+  DoubleSidedBuffer(size_t n) : size(n), buffers{std::vector<uint8_t>(n), std::vector<uint8_t>(n)},
+				writePos{0, 0}, readPos{0, 0}, output(1), available(0) {}
+  bool write(const uint8_t *data, size_t n) {
+    int in = 1 - output;
+    if (writePos[in] + n > size) return false;
+    memcpy(&buffers[in][writePos[in]], data, n);
+    writePos[in] += n;
+    available += n;
+    return true;
+  }
+  bool read(uint8_t *data, size_t n) {
+    if (n > available) return false;
+    size_t first = writePos[output] - readPos[output];
+    if (first > n) first = n;
+    memcpy(data, &buffers[output][readPos[output]], first);
+    readPos[output] += first;
+    if (first < n) {  // this buffer is empty: swap
+      int in = 1 - output;
+      memcpy(data + first, &buffers[in][0], n - first);
+      readPos[in] = n - first;
+      readPos[output] = writePos[output] = 0;
+      output = in;
+    }
+    available -= n;
+    return true;
+  }
+private:
+  size_t size;
+  std::vector<uint8_t> buffers[2];
+  size_t writePos[2], readPos[2];
+  int output;
+  size_t available;
+};
+
+// A ring without the mirror: copies that cross the end are split in two
+class SplitRingBuffer
+{
+public:
+  SplitRingBuffer(size_t n) : buffer(n), head(0), tail(0) {}
+  bool write(const uint8_t *data, size_t n) {
+    if (n > buffer.size() - (head - tail)) return false;
+    size_t at = head % buffer.size(), first = buffer.size() - at;
+    if (first > n) first = n;
+    memcpy(&buffer[at], data, first);
+    memcpy(&buffer[0], data + first, n - first);
+    head += n;
+    return true;
+  }
+  bool read(uint8_t *data, size_t n) {
+    if (n > head - tail) return false;
+    size_t at = tail % buffer.size(), first = buffer.size() - at;
+    if (first > n) first = n;
+    memcpy(data, &buffer[at], first);
+    memcpy(data + first, &buffer[0], n - first);
+    tail += n;
+    return true;
+  }
+private:
+  std::vector<uint8_t> buffer;
+  uint64_t head, tail;
+};
+
+static bool threaded(MirroredRingBuffer &ring, uint64_t nBytes)
+{
+  bool ok = true;
+  uint64_t producerSpins = 0;
+
+  std::thread producer([&]() {
+    std::vector<uint8_t> chunk(4096);
+    uint32_t state = 12345;
+    uint64_t i = 0;
+    while (i < nBytes) {
+      size_t n = 1 + nextRandom(state) % 4096;
+      if (n > nBytes - i) n = nBytes - i;
+      if (state & 0x10000) {
+	// In place: fill what fits of the free space directly
+	size_t room;
+	uint8_t *p = ring.writeSpace(room);
+	if (n > room) n = room;
+	if (n == 0) {
+	  producerSpins++;
+	  std::this_thread::yield();
+	  continue;
+	}
+	for (size_t k = 0; k < n; k++) p[k] = byteAt(i + k);
+	ring.commit(n);
+      } else {
+	for (size_t k = 0; k < n; k++) chunk[k] = byteAt(i + k);
+	while (!ring.write(chunk.data(), n)) {
+	  producerSpins++;
+	  std::this_thread::yield();
+	}
+      }
+      i += n;
+    }
+  });
+
+  std::vector<uint8_t> chunk(4096);
+  uint32_t state = 67890;
+  uint64_t i = 0;
+  while (i < nBytes && ok) {
+    size_t n = 1 + nextRandom(state) % 4096;
+    if (n > nBytes - i) n = nBytes - i;
+    const uint8_t *p;
+    if (state & 0x10000) {
+      // In place: check what is waiting, up to n
+      size_t available;
+      p = ring.readData(available);
+      if (available == 0) {
+	std::this_thread::yield();
+	continue;
+      }
+      if (n > available) n = available;
+    } else {
+      while (!ring.read(chunk.data(), n)) std::this_thread::yield();
+      p = chunk.data();
+    }
+    for (size_t k = 0; k < n && ok; k++) {
+      if (p[k] != byteAt(i + k)) {
+	fprintf(stderr, "byte %llu is %u, not %u\n", (unsigned long long) (i + k), p[k], byteAt(i + k));
+	ok = false;
+      }
+    }
+    if (p != chunk.data()) ring.consume(n);
+    i += n;
+  }
+  while (i < nBytes) {
+    // after a failure, drain the ring so the producer can finish
+    size_t available;
+    ring.readData(available);
+    ring.consume(available);
+    i += available;
+    if (available == 0) std::this_thread::yield();
+  }
+  producer.join();
+  printf("%llu bytes through a %zu byte ring, producer waited %llu times\n",
+	 (unsigned long long) nBytes, ring.capacity(), (unsigned long long) producerSpins);
+  return ok && ring.bytesAvailable() == 0;
+}
+
+template <class Buffer> static double timeMessages(Buffer &buffer, uint64_t nBytes, uint64_t &check)
+{
+  // What arrives from the port (1-256 bytes) is written, then the messages in it (1-16 bytes) are read
+  uint8_t in[256], out[16];
+  uint32_t state = 2468;
+  uint64_t read = 0, sum = 0;
+  size_t waiting = 0;
+
+  check = 0;
+
+  for (size_t k = 0; k < sizeof(in); k++) in[k] = byteAt(k);
+  auto t0 = std::chrono::steady_clock::now();
+  while (read < nBytes) {
+    size_t n = 1 + nextRandom(state) % sizeof(in);
+    if (!buffer.write(in, n)) return -1;
+    waiting += n;
+    while (waiting > 0) {
+      size_t m = 1 + nextRandom(state) % sizeof(out);
+      if (m > waiting) m = waiting;
+      if (!buffer.read(out, m)) return -1;
+      sum += out[0] + out[m - 1];
+      waiting -= m;
+      read += m;
+    }
+  }
+  double t = seconds(t0);
+  check = sum;
+  return t;
+}
+
+static int selfTest(double megabytes)
+{
+  MirroredRingBuffer ring;
+  uint64_t nBytes = (uint64_t) (megabytes*1e6);
+  bool ok = true;
+
+  if (ring.create(TEST_CAPACITY) < 0) {
+    fprintf(stderr, "Could not create the ring buffer: %s\n", strerror(errno));
+    return 1;
+  }
+  // The mirror: a write across the end reads back from the start, and the other way around
+  size_t room, available;
+  uint8_t *p = ring.writeSpace(room);
+  uint8_t out[64];
+  ok &= room == ring.capacity() && ring.capacity() % 4096 == 0;
+  p[0] = 0xA5;
+  ok &= p[ring.capacity()] == 0xA5;
+  for (int i = 0; i < 2 && ok; i++) {
+    std::vector<uint8_t> fill(ring.capacity() - 10, 0);
+    ok &= ring.write(fill.data(), fill.size()) && ring.read(fill.data(), fill.size());
+  }
+  for (int i = 0; i < 64; i++) out[i] = byteAt(i);
+  ok &= ring.write(out, 64) && !ring.read(out, 65) && ring.bytesAvailable() == 64;
+  ok &= !ring.write(out, ring.capacity() - 63);
+  memset(out, 0, sizeof(out));
+  ok &= ring.read(out, 64) && ring.bytesAvailable() == 0;
+  for (int i = 0; i < 64; i++) ok &= out[i] == byteAt(i);
+  ring.readData(available);
+  ok &= available == 0;
+  if (!ok) {
+    fprintf(stderr, "wrap or overflow check failed\n");
+    return 1;
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  ok = threaded(ring, nBytes);
+  double t = seconds(t0);
+  printf("two threads: %.0f MB/s\n", nBytes/t/1e6);
+  if (!ok) {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+
+  // Each buffer holds 1 MB, as ArCOM's default input buffer does
+  MirroredRingBuffer mirrored;
+  if (mirrored.create(1000000) < 0) {
+    fprintf(stderr, "Could not create the ring buffer: %s\n", strerror(errno));
+    return 1;
+  }
+  DoubleSidedBuffer doubleSided(1000000);
+  SplitRingBuffer split(mirrored.capacity());
+  uint64_t sums[3];
+  double times[3];
+  times[0] = timeMessages(mirrored, nBytes, sums[0]);
+  times[1] = timeMessages(doubleSided, nBytes, sums[1]);
+  times[2] = timeMessages(split, nBytes, sums[2]);
+  if (times[0] < 0 || times[1] < 0 || times[2] < 0 || sums[1] != sums[0] || sums[2] != sums[0]) {
+    fprintf(stderr, "the buffers disagree\nFAILED\n");
+    return 1;
+  }
+  printf("messages, one thread (MB/s): mirrored %.0f, double sided %.0f, split copies %.0f\n",
+	 nBytes/times[0]/1e6, nBytes/times[1]/1e6, nBytes/times[2]/1e6);
+  printf("OK\n");
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 3 && strcmp(argv[1], "-s") == 0) return selfTest(atof(argv[2]));
+  fprintf(stderr, "Usage: %s -s megabytes\n", argv[0]);
+  return 1;
+}
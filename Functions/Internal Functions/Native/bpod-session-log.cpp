@@ -0,0 +1,290 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-session-log: prints a session log (see SessionLog.h).
+
+    bpod-session-log file            one line per trial: trial, start, end, nStates, nEvents
+    bpod-session-log -t trial file   the trial's states and events, with names
+    bpod-session-log -e event file   every occurrence of an event (1-based code): trial, time
+
+    bpod-session-log -s nTrials
+      self test: writes nTrials synthetic trials to a temporary log, reads
+      it back after a simulated crash, after reopening and appending, and
+      once closed, and reports append and read rates.  Then checks that a
+      trial cut short by a failed write, and a log cut off before its event
+      names, can be appended to.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "SessionLog.h"
+
+static double seconds(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void makeTrial(uint32_t n, SessionTrial &t)
+{
+  // 3-20 states, 2 events per state, deterministic in the trial number; every 50th trial ends in state 256
+  uint32_t nStates = 3 + n % 18;
+
+  t.states.clear();
+  t.events.clear();
+  t.stateTimestamps.clear();
+  t.eventTimestamps.clear();
+  t.errorCodes.clear();
+  for (uint32_t s = 0; s < nStates; s++) {
+    t.states.push_back(1 + (s + n) % 7);
+    t.stateTimestamps.push_back(s*0.25);
+    for (int e = 0; e < 2; e++) {
+      t.events.push_back(1 + (s*2 + e + n) % 90);
+      t.eventTimestamps.push_back(s*0.25 + e*0.1);
+    }
+  }
+  t.stateTimestamps.push_back(nStates*0.25);
+  if (n % 50 == 0) t.states.back() = 256;  // MaxStates is 256
+  if (n % 100 == 0) t.errorCodes.push_back(1);
+  t.trialStartTimestamp = n*10.0;
+  t.trialEndTimestamp = n*10.0 + nStates*0.25;
+}
+
+static bool sameTrial(const SessionTrialView &v, const SessionTrial &t)
+{
+  return v.nStates == t.states.size() && v.nEvents == t.events.size() && v.nErrorCodes == t.errorCodes.size() &&
+    memcmp(v.states, t.states.data(), 2*v.nStates) == 0 && memcmp(v.events, t.events.data(), v.nEvents) == 0 &&
+    memcmp(v.stateTimestamps, t.stateTimestamps.data(), 8*(v.nStates + 1)) == 0 &&
+    memcmp(v.eventTimestamps, t.eventTimestamps.data(), 8*v.nEvents) == 0 &&
+    (v.nErrorCodes == 0 || memcmp(v.errorCodes, t.errorCodes.data(), 4*v.nErrorCodes) == 0) &&
+    v.trialStartTimestamp == t.trialStartTimestamp && v.trialEndTimestamp == t.trialEndTimestamp;
+}
+
+static bool checkLog(const char *path, uint32_t nTrials, bool complete, const char *when)
+{
+  SessionLogReader reader;
+  SessionTrialView v;
+  SessionTrial t;
+
+  if (reader.open(path) < 0) {
+    fprintf(stderr, "%s: %s\n", when, strerror(errno));
+    return false;
+  }
+  if (reader.nTrials() != nTrials || reader.complete() != complete || reader.eventNames().size() != 90) {
+    fprintf(stderr, "%s: %u trials (expected %u), %s\n", when, reader.nTrials(), nTrials, reader.complete() ? "indexed" : "not indexed");
+    return false;
+  }
+  for (uint32_t i = 0; i < nTrials; i++) {
+    makeTrial(i + 1, t);
+    if (reader.trial(i, v) < 0 || v.trial != i + 1 || !sameTrial(v, t) ||
+	reader.stateNames(v.stateNames).size() != 7 + (i + 1)/1000) {
+      fprintf(stderr, "%s: trial %u differs\n", when, i + 1);
+      return false;
+    }
+  }
+  return true;
+}
+
+static int selfTest(uint32_t nTrials)
+{
+  char path[] = "/tmp/bpod-session-log-XXXXXX";
+  std::vector<std::string> eventNames, stateNames;
+  SessionLogWriter writer;
+  SessionLogReader reader;
+  SessionTrialView v;
+  SessionTrial t;
+  bool ok = true;
+  int fd;
+
+  if (nTrials == 0) {
+    fprintf(stderr, "nTrials must be at least 1\n");
+    return 1;
+  }
+  fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  for (int i = 0; i < 90; i++) eventNames.push_back("Event" + std::to_string(i + 1));
+
+  // A child process writes the first half and dies without closing (no index), leaving a torn trial
+  // at the end; the log is then reopened and the rest appended
+  auto t0 = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (writer.open(path, eventNames) < 0) _exit(1);
+    for (uint32_t i = 0; i < nTrials/2; i++) {
+      makeTrial(i + 1, t);
+      stateNames.assign(7 + (i + 1)/1000, "State");  // a new state names table every 1000 trials
+      if (writer.append(t, stateNames) < 0) _exit(1);
+    }
+    if (write(open(path, O_WRONLY | O_APPEND), "\x02\0\0\0\x40\0\0\0partial", 15) != 15) _exit(1);
+    _exit(0);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "writing the first half of the log failed\n");
+    return 1;
+  }
+  ok = checkLog(path, nTrials/2, false, "after a crash") && ok;
+  if (writer.open(path, eventNames) < 0 || writer.nTrials() != nTrials/2) {
+    fprintf(stderr, "reopening after a crash failed\n");
+    return 1;
+  }
+  for (uint32_t i = nTrials/2; i < nTrials; i++) {
+    makeTrial(i + 1, t);
+    stateNames.assign(7 + (i + 1)/1000, "State");
+    if (writer.append(t, stateNames) < 0) {
+      perror("append");
+      return 1;
+    }
+  }
+  double writeTime = seconds(t0);
+  ok = checkLog(path, nTrials, false, "before closing") && ok;
+  writer.close();
+  ok = checkLog(path, nTrials, true, "after closing") && ok;
+
+  // Random access and one event across the session
+  reader.open(path);
+  t0 = std::chrono::steady_clock::now();
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < nTrials; i++) {
+    reader.trial((uint32_t) ((i*2654435761u) % nTrials), v);
+    sum += v.nEvents;
+  }
+  double readTime = seconds(t0);
+  ok = ok && sum > 0;
+  std::vector<double> times;
+  t0 = std::chrono::steady_clock::now();
+  reader.eventTimes(5, times);
+  double eventTime = seconds(t0);
+  printf("%u trials, %zu bytes: append %.0f trials/s, random read %.0f trials/s, one event over the session in %.2f ms "
+	 "(%zu times): %s\n", nTrials, reader.fileSize(), nTrials/writeTime, nTrials/readTime, eventTime*1e3, times.size(),
+	 ok ? "OK" : "FAILED");
+  reader.close();
+
+  // A write that fails part way (here the file size limit) is cut back, so the next trial lands where it is indexed
+  pid = fork();
+  if (pid == 0) {
+    struct rlimit limit, small;
+    struct stat st;
+    signal(SIGXFSZ, SIG_IGN);
+    if (getrlimit(RLIMIT_FSIZE, &limit) < 0 || writer.open(path, eventNames) < 0 || stat(path, &st) < 0) _exit(1);
+    small = limit;
+    small.rlim_cur = st.st_size + 64;  // less than a trial
+    makeTrial(nTrials + 1, t);
+    stateNames.assign(7 + (nTrials + 1)/1000, "State");
+    if (setrlimit(RLIMIT_FSIZE, &small) < 0 || writer.append(t, stateNames) == 0) _exit(1);
+    if (setrlimit(RLIMIT_FSIZE, &limit) < 0 || writer.append(t, stateNames) < 0 || writer.close() < 0) _exit(1);
+    _exit(0);
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "appending after a failed write failed\n");
+    ok = false;
+  } else {
+    ok = checkLog(path, nTrials + 1, true, "after a failed write") && ok;
+  }
+
+  // A log with only its header (the writer died before the event names) has no names, and can be continued
+  if (truncate(path, 16) < 0 || reader.open(path) < 0 || reader.nTrials() != 0 || !reader.eventNames().empty()) {
+    fprintf(stderr, "a log without event names did not read back empty\n");
+    ok = false;
+  }
+  reader.close();
+  makeTrial(1, t);
+  stateNames.assign(7, "State");
+  if (writer.open(path, eventNames) < 0 || writer.append(t, stateNames) < 0 || writer.close() < 0) {
+    fprintf(stderr, "reopening a log without event names failed\n");
+    ok = false;
+  } else {
+    ok = checkLog(path, 1, true, "after reopening a log without event names") && ok;
+  }
+  printf("failed write, log without event names: %s\n", ok ? "OK" : "FAILED");
+  unlink(path);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  SessionLogReader reader;
+  SessionTrialView v;
+  int ch, trial = 0, event = 0;
+
+  while ((ch = getopt(argc, argv, "t:e:s:h")) != -1) {
+    switch (ch) {
+      case 't': trial = atoi(optarg); break;
+      case 'e': event = atoi(optarg); break;
+      case 's': return selfTest(strtoul(optarg, NULL, 10));
+      default:
+	fprintf(stderr, "usage: %s [-t trial | -e event] file\n       %s -s nTrials\n", argv[0], argv[0]);
+	return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-t trial | -e event] file\n       %s -s nTrials\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (reader.open(argv[optind]) < 0) {
+    fprintf(stderr, "%s: %s\n", argv[optind], errno == EINVAL ? "not a Bpod session log" : strerror(errno));
+    return 1;
+  }
+  const std::vector<std::string> &eventNames = reader.eventNames();
+
+  if (trial > 0) {
+    if (reader.trial(trial - 1, v) < 0) {
+      fprintf(stderr, "No trial %d (%u trials)\n", trial, reader.nTrials());
+      return 1;
+    }
+    const std::vector<std::string> &stateNames = reader.stateNames(v.stateNames);
+    printf("Trial %u: start %.6f, end %.6f\n", v.trial, v.trialStartTimestamp, v.trialEndTimestamp);
+    for (uint32_t i = 0; i < v.nStates; i++) {
+      printf("  state %.6f-%.6f %s\n", v.stateTimestamps[i], v.stateTimestamps[i+1],
+	     v.states[i] <= stateNames.size() ? stateNames[v.states[i]-1].c_str() : "?");
+    }
+    for (uint32_t i = 0; i < v.nEvents; i++) {
+      printf("  event %.6f %s\n", v.eventTimestamps[i], v.events[i] <= eventNames.size() ? eventNames[v.events[i]-1].c_str() : "?");
+    }
+  } else if (event > 0) {
+    std::vector<double> times;
+    std::vector<uint32_t> trials;
+    reader.eventTimes(event, times, &trials);
+    for (size_t i = 0; i < times.size(); i++) printf("%u %.6f\n", trials[i], times[i]);
+  } else {
+    for (uint32_t i = 0; i < reader.nTrials(); i++) {
+      if (reader.trial(i, v) < 0) continue;
+      printf("%u %.6f %.6f %u %u\n", v.trial, v.trialStartTimestamp, v.trialEndTimestamp, v.nStates, v.nEvents);
+    }
+    if (!reader.complete()) fprintf(stderr, "(not closed: read without the index)\n");
+  }
+  return 0;
+}
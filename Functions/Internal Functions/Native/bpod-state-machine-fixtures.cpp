@@ -0,0 +1,274 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-state-machine-fixtures: checks the native state machine encoder
+  and emulator against bytes worked out by hand: the description from
+  EncodeStateMachine.m, and the trial's stream from the protocol
+  RunStateMachine.m reads (see StateMachineEmulator.h for the timing).
+
+    bpod-state-machine-fixtures
+      encodes the fixture description (4 states, 2 global timers, a
+      global counter, a condition, soft codes, serial messages and an
+      implicit serial message library) for a state machine r2 on firmware
+      v23 and compares the result with the hand-encoded bytes, then runs
+      it in the emulator against a fixed list of inputs and compares the
+      stream it sends with the hand-written one.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "StateMachineEncoder.h"
+#include "StateMachineEmulator.h"
+
+/* Hardware: 2 global timers (1-byte trigger bitfields), 1 global counter, 1 condition.
+   Input matrix columns: 0-3 serial events, 4 BNC1High, 5 BNC1Low, 6 Port1In, 7 Port1Out.
+   Output matrix columns: 0 Serial1, 1 Serial2, 2 USB (soft codes), 3 BNC1, 4 PWM1,
+   5 global timer trig, 6 global timer cancel, 7 global counter reset.
+   Input channels: 0 Serial1, 1 Serial2, 2 USB, 3 BNC1, 4 Port1. */
+#define F_STATES  4
+#define F_INPUTS  8
+#define F_OUTPUTS 8
+#define F_EXIT    5     // 1-based, as SendStateMachine leaves it
+
+/* The description, 1-based as in the sma:
+   1 WaitForPoke (5 s, BNC1 high, triggers timers 1 and 2): Serial event 2 -> Punish, Port1In -> Reward, Tup -> exit
+   2 Reward (0.1 s, Serial1 message 2, soft code 5, cancels timer 2): GlobalTimer1_End -> Punish, Tup -> Drink
+   3 Punish (1 s, resets counter 1): Condition1 -> Drink, Tup -> exit
+   4 Drink (0.5 s): GlobalCounter1_End -> exit, Tup -> exit
+   Timer 1: BNC1, 0.25 s, on message 1, sends events.
+   Timer 2: Serial1, 0.5 s after 0.1 s, on message 3, twice 0.2 s apart, sends events.
+   Counter 1: 2 Port1In.  Condition 1: Port1 high.
+   Serial message library: one message, 'ABC', for Serial1. */
+static double fxInput[F_STATES*F_INPUTS], fxOutput[F_STATES*F_OUTPUTS];
+static double fxStateTimerMatrix[F_STATES] = {F_EXIT, 4, F_EXIT, F_EXIT}, fxStateTimers[F_STATES] = {5, 0.1, 1, 0.5};
+static double fxTimerStart[F_STATES*2] = {1, 2, 3, 4, 1, 2, 3, 4}, fxTimerEnd[F_STATES*2] = {1, 3, 3, 4, 1, 2, 3, 4};
+static double fxCounter[F_STATES] = {1, 2, 3, F_EXIT}, fxCondition[F_STATES] = {1, 2, 4, 4};
+static double fxOnes[2] = {1, 1}, fxZeros[2] = {0, 0};
+static double fxTimerChannel[2] = {4, 1}, fxTimerOn[2] = {1, 3}, fxLoopMode[2] = {0, 2};
+static double fxDuration[2] = {0.25, 0.5}, fxDelay[2] = {0, 0.1}, fxLoopInterval[2] = {0, 0.2};
+static double fxCounterEvent[1] = {7}, fxThreshold[1] = {2}, fxConditionChannel[1] = {5};
+static double fxNSerialMessages[2] = {1, 0};
+
+static const uint8_t fxBytes[] = {
+  4, 2, 1, 1,                          // nStates, nGlobalTimersUsed, nGlobalCountersUsed, nConditionsUsed
+  4, 3, 4, 4,                          // stateTimerMatrix - 1
+  2, 1, 2, 6, 1,  0,  0,  0,           // input matrix: state 0 has 2 differences (column, state)
+  1, 3, 1,  2, 0, 2, 2, 5,  0,  0,     // output matrix (physical channels)
+  0, 0, 0, 0,                          // global timer start matrix
+  0,  1, 0, 2,  0,  0,                 // global timer end matrix
+  0, 0, 0,  1, 0, 4,                   // global counter matrix
+  0, 0,  1, 0, 3,  0,                  // condition matrix
+  3, 0,                                // global timer channels - 1
+  1, 3,                                // on messages
+  0, 255,                              // off messages: 0 on a UART channel is sent as 255
+  0, 2,                                // loop mode
+  1, 1,                                // send events
+  6,                                   // global counter events - 1
+  4,                                   // condition channels - 1
+  1,                                   // condition values
+  1, 2, 1,                             // global counter resets (firmware v23+: nOverrides, state, counter)
+  3, 0, 0, 0,                          // global timer trigs
+  0, 2, 0, 0,                          // global timer cancels
+  0, 0,                                // global timer onset triggers
+  0x50, 0xC3, 0, 0,  0xE8, 3, 0, 0,  0x10, 0x27, 0, 0,  0x88, 0x13, 0, 0,  // state timers (cycles)
+  0xC4, 9, 0, 0,  0x88, 0x13, 0, 0,    // global timer durations
+  0, 0, 0, 0,  0xE8, 3, 0, 0,          // onset delays
+  0, 0, 0, 0,  0xD0, 7, 0, 0,          // loop intervals
+  2, 0, 0, 0,                          // global counter thresholds
+  1, 'L', 0, 1,  1, 3, 'A', 'B', 'C',  // serial message library for Serial1
+  0                                    // end of packaged ops
+};
+
+/* The trial, in cycles (10 kHz), with 0-based event codes: 8-9 global timer 1-2 starts,
+   10-11 ends, 12 global counter 1, 13 condition 1, 14 Tup, 254 exit. */
+static const EmulatorInput fxInputs[] = {
+  {2000, 6}, {3000, 7}, {3200, 1}, {3500, 6}, {3800, 7}, {4500, 6}
+};
+
+static const uint8_t fxStream[] = {
+  1,                                   // description received
+  0, 0, 0, 0, 0, 0, 0, 0,              // trial start, microseconds
+  1, 1, 8,  1, 0, 0, 0,                // 1: timer 1 starts, the cycle after WaitForPoke triggers it
+  1, 1, 9,  0xE8, 3, 0, 0,             // 1000: timer 2 starts after its onset delay
+  1, 1, 6,  0xD0, 7, 0, 0,             // 2000: Port1In (counter 1: 1) -> Reward
+  2, 5,                                // soft code 5; timer 2 is canceled before it ends
+  1, 1, 10,  0xC5, 9, 0, 0,            // 2501: timer 1 ends, 2500 cycles after it started -> Punish, resets counter 1
+  1, 1, 13,  0xC6, 9, 0, 0,            // 2502: condition 1, Port1 still high, checked the cycle after entry -> Drink
+  1, 1, 7,  0xB8, 0xB, 0, 0,           // 3000: Port1Out (Reward's state timer is stale)
+  1, 1, 1,  0x80, 0xC, 0, 0,           // 3200: serial event 2, no transition out of Drink
+  1, 1, 6,  0xAC, 0xD, 0, 0,           // 3500: Port1In (counter 1: 1)
+  1, 1, 7,  0xD8, 0xE, 0, 0,           // 3800: Port1Out
+  1, 3, 6, 12, 254,  0x94, 0x11, 0, 0, // 4500: Port1In reaches counter 1's threshold in the same cycle -> exit
+  0x94, 0x11, 0, 0,                    // trial end: hardware timer cycles
+  0xD0, 0xDD, 6, 0, 0, 0, 0, 0         // trial end, microseconds (450 ms)
+};
+
+static SMArray array(double *data, size_t rows, size_t cols)
+{
+  SMArray a;
+  a.data = data;
+  a.rows = rows;
+  a.cols = cols;
+  return a;
+}
+
+static void fixtureDescription(StateMachineDescription &d, StateMachineHardware &hw)
+{
+  for (int s = 0; s < F_STATES; s++) {
+    for (int e = 0; e < F_INPUTS; e++) fxInput[s + e*F_STATES] = s + 1;
+  }
+  fxInput[0 + 1*F_STATES] = 3;  // serial event 2 -> Punish
+  fxInput[0 + 6*F_STATES] = 2;  // Port1In -> Reward
+  memset(fxOutput, 0, sizeof(fxOutput));
+  fxOutput[0 + 3*F_STATES] = 1;  // BNC1
+  fxOutput[0 + 5*F_STATES] = 3;  // trigger timers 1 and 2
+  fxOutput[1 + 0*F_STATES] = 2;  // Serial1 message 2
+  fxOutput[1 + 2*F_STATES] = 5;  // soft code 5
+  fxOutput[1 + 6*F_STATES] = 2;  // cancel timer 2
+  fxOutput[2 + 7*F_STATES] = 1;  // reset counter 1
+
+  d.nStates = F_STATES;
+  d.inputMatrixSize = F_INPUTS;
+  d.use255BackSignal = false;
+  d.inputMatrix = array(fxInput, F_STATES, F_INPUTS);
+  d.outputMatrix = array(fxOutput, F_STATES, F_OUTPUTS);
+  d.stateTimerMatrix = array(fxStateTimerMatrix, 1, F_STATES);
+  d.stateTimers = array(fxStateTimers, 1, F_STATES);
+  d.globalTimerStartMatrix = array(fxTimerStart, F_STATES, 2);
+  d.globalTimerEndMatrix = array(fxTimerEnd, F_STATES, 2);
+  d.globalCounterMatrix = array(fxCounter, F_STATES, 1);
+  d.conditionMatrix = array(fxCondition, F_STATES, 1);
+  d.timerIsSet = d.timerSendEvents = array(fxOnes, 1, 2);
+  d.timerOutputChannel = array(fxTimerChannel, 1, 2);
+  d.timerOnMessage = array(fxTimerOn, 1, 2);
+  d.timerOffMessage = d.timerOnTrigger = array(fxZeros, 1, 2);
+  d.timerLoopMode = array(fxLoopMode, 1, 2);
+  d.timerDuration = array(fxDuration, 1, 2);
+  d.timerOnsetDelay = array(fxDelay, 1, 2);
+  d.timerLoopInterval = array(fxLoopInterval, 1, 2);
+  d.counterSet = d.conditionSet = d.conditionValues = array(fxOnes, 1, 1);
+  d.counterEvents = array(fxCounterEvent, 1, 1);
+  d.counterThresholds = array(fxThreshold, 1, 1);
+  d.conditionChannels = array(fxConditionChannel, 1, 1);
+  d.serialMessageMode = 1;
+  d.nSerialMessages = array(fxNSerialMessages, 1, 2);
+  d.serialMessages.assign(2, std::vector<std::vector<uint8_t> >());
+  d.serialMessages[0].push_back(std::vector<uint8_t>({'A', 'B', 'C'}));
+  hw.machineType = 3;
+  hw.firmwareVersion = 23;
+  hw.cycleFrequency = 10000;
+  hw.maxGlobalTimers = 2;
+  hw.nUartSerialChannels = 2;
+  hw.posGlobalTimerTrig = 6;
+  hw.posGlobalTimerCancel = 7;
+  hw.posGlobalCounterReset = 8;
+  hw.posAnalogThreshEnable = 0;  // machine type 4 only
+  hw.posAnalogThreshDisable = 0;
+  hw.posInputUSB = 3;
+}
+
+static bool sameBytes(const char *what, const std::vector<uint8_t> &got, const uint8_t *expected, size_t n)
+{
+  size_t i = 0;
+  while (i < got.size() && i < n && got[i] == expected[i]) i++;
+  if (i == n && got.size() == n) return true;
+  if (i < got.size() && i < n) {
+    fprintf(stderr, "%s: byte %zu is %u, expected %u\n", what, i, got[i], expected[i]);
+  } else {
+    fprintf(stderr, "%s: %zu bytes, expected %zu\n", what, got.size(), n);
+  }
+  return false;
+}
+
+static bool encoderFixture(void)
+{
+  StateMachineDescription d;
+  StateMachineHardware hw;
+  StateMachineEncoder encoder;
+  bool ok = true;
+
+  fixtureDescription(d, hw);
+  ok &= !encoder.encode(d, hw);
+  ok &= sameBytes("encoder", encoder.byteString(), fxBytes, sizeof(fxBytes));
+  ok &= sameBytes("serial message library", encoder.serialMessageVector(), fxBytes + sizeof(fxBytes) - 10, 9);
+  ok &= encoder.nModulesLoaded() == 1;
+  // Sent again unchanged, then with a different state timer, then after a reset
+  ok &= encoder.encode(d, hw);
+  fxStateTimers[3] = 0.6;
+  ok &= !encoder.encode(d, hw);
+  fxStateTimers[3] = 0.5;
+  ok &= !encoder.encode(d, hw) && encoder.encode(d, hw);
+  encoder.reset();
+  ok &= !encoder.encode(d, hw);
+  printf("encoder: %zu byte description %s\n", sizeof(fxBytes), ok ? "matches" : "differs");
+  return ok;
+}
+
+static bool emulatorFixture(void)
+{
+  StateMachineDescription d;
+  StateMachineHardware hw;
+  EmulatorHardware ehw;
+  std::vector<uint8_t> message, stream;
+
+  fixtureDescription(d, hw);
+  message.assign({'C', 0, 0, (uint8_t) sizeof(fxBytes), 0});
+  message.insert(message.end(), fxBytes, fxBytes + sizeof(fxBytes));
+  ehw.machineType = hw.machineType;
+  ehw.firmwareVersion = hw.firmwareVersion;
+  ehw.cycleFrequency = hw.cycleFrequency;
+  ehw.inputMatrixSize = F_INPUTS;
+  ehw.maxGlobalTimers = 2;
+  ehw.maxGlobalCounters = 1;
+  ehw.maxConditions = 1;
+  ehw.nInputs = 5;
+  ehw.ioEventStart = 4;
+  ehw.ioFirstChannel = 3;
+  ehw.outputUSB = 2;
+  ehw.liveTimestamps = true;
+  StateMachineEmulator emulator(ehw);
+  if (emulator.load(message.data(), message.size()) < 0) {
+    fprintf(stderr, "emulator: the fixture description was rejected\n");
+    return false;
+  }
+  const EmulatorTrial &trial = emulator.runTrial(fxInputs, sizeof(fxInputs)/sizeof(fxInputs[0]), 0, stream);
+  bool ok = trial.finished && sameBytes("emulator", stream, fxStream, sizeof(fxStream));
+  printf("emulator: %zu byte trial stream %s\n", sizeof(fxStream), ok ? "matches" : "differs");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 1) {
+    fprintf(stderr, "usage: %s\n", argv[0]);
+    return 1;
+  }
+  bool ok = encoderFixture();
+  ok &= emulatorFixture();
+  if (!ok) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,262 @@
+/*
+  ----------------------------------------------------------------------------
+
+  This file is part of the Sanworks Bpod_Gen2 repository
+  Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+  ----------------------------------------------------------------------------
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3.
+
+  This program is distributed  WITHOUT ANY WARRANTY and without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+  bpod-trial-events: runs trials of the state machine already loaded on
+  the port and prints the decoded records, one per line:
+    type code time message trial
+  (see BpodRecordType in TrialEventDecoder.h).
+
+    bpod-trial-events [-n] [-l] [-t nTrials] port
+      -n  a new state machine was just sent (expect the confirmation byte)
+      -l  legacy firmware without live timestamps
+      -t  number of trials to run (default 1)
+
+    bpod-trial-events -s nEvents
+      self test: decodes a synthetic trial of nEvents events from a
+      simulated state machine on a socket pair and reports throughput,
+      then runs short trials on a pseudo terminal, which is read like a
+      serial port, with stray bytes waiting when each trial starts.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "TrialEventDecoder.h"
+
+static void putBytes(std::vector<uint8_t> &stream, uint64_t value, int size)
+{
+  for (int i = 0; i < size; i++) stream.push_back((uint8_t) (value >> (8*i)));
+}
+
+static void simulateStateMachine(int fd, uint32_t nEvents, int nTrials)
+{
+  /* For each trial, waits for 'R', then sends a live-timestamp trial of nEvents
+     events in messages of up to 4, with a soft code after every 100th message. */
+  std::vector<uint8_t> stream;
+  uint8_t command = 0;
+  uint32_t i, n, message = 0;
+
+  for (int trial = 0; trial < nTrials; trial++) {
+    if (read(fd, &command, 1) != 1 || command != 'R') return;
+    stream.clear();
+    message = 0;
+    putBytes(stream, 1000000, 8);
+    for (i = 0; i < nEvents; i += n, message++) {
+      n = (nEvents - i < 4) ? nEvents - i : 4;
+      stream.push_back(1);
+      stream.push_back(n);
+      for (uint32_t k = 0; k < n; k++) stream.push_back((i + k) % 64);
+      putBytes(stream, i*10, 4);
+      if (message % 100 == 99) {
+        stream.push_back(2);
+        stream.push_back(message % 256);
+      }
+    }
+    stream.push_back(1);
+    stream.push_back(1);
+    stream.push_back(EXIT_EVENT);
+    putBytes(stream, nEvents*10, 4);  // exit event timestamp
+    putBytes(stream, nEvents*10, 4);  // nHWTimerCycles
+    putBytes(stream, 1000000 + nEvents*10*100, 8);
+    for (i = 0; i < stream.size(); i += 1024) {
+      n = (stream.size() - i < 1024) ? stream.size() - i : 1024;
+      if (write(fd, &stream[i], n) != (ssize_t) n) return;
+    }
+  }
+}
+
+static bool readTrial(TrialEventDecoder &decoder, std::vector<BpodEventRecord> &records, uint64_t &nEvent, uint64_t &nSoft)
+{
+  /* Drains one trial of simulateStateMachine(); false if it was not decoded exactly. */
+  uint32_t expected = 0;
+  uint64_t nEnd = 0, n;
+  bool ok = true;
+
+  while (ok && nEnd == 0) {
+    n = decoder.drain(records.data(), records.size());
+    if (n == 0) {
+      if (!decoder.status().running) return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+    for (size_t i = 0; i < n; i++) {
+      switch (records[i].type) {
+        case RECORD_EVENT:
+          if (records[i].code == EXIT_EVENT) break;
+          if (records[i].code != expected % 64 || records[i].time != (expected/4)*40) ok = false;
+          expected++;
+          nEvent++;
+          break;
+        case RECORD_SOFT_CODE: nSoft++; break;
+        case RECORD_TRIAL_END: nEnd++; break;
+        case RECORD_ERROR: ok = false; break;
+      }
+    }
+  }
+  return ok;
+}
+
+static int selfTest(uint32_t nEvents)
+{
+  TrialEventDecoder decoder;
+  std::vector<BpodEventRecord> records(65536);
+  uint64_t nEvent = 0, nSoft = 0;
+  int sv[2];
+  bool ok = true;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    perror("socketpair");
+    return -1;
+  }
+  std::thread device(simulateStateMachine, sv[1], nEvents, 1);
+  decoder.attach(sv[0]);
+  auto t0 = std::chrono::steady_clock::now();
+  if (decoder.startTrial(false, true) < 0) {
+    fprintf(stderr, "startTrial failed\n");
+    ok = false;
+  }
+  ok = ok && readTrial(decoder, records, nEvent, nSoft);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  device.join();
+  decoder.close();
+  close(sv[1]);
+  if (nEvent != nEvents) ok = false;
+  printf("%llu events, %llu soft codes in %.3f s (%.2f M events/s), %llu dropped: %s\n",
+	 (unsigned long long) nEvent, (unsigned long long) nSoft, elapsed, nEvent/elapsed*1e-6,
+	 (unsigned long long) decoder.status().dropped, ok ? "OK" : "FAILED");
+  return ok ? 0 : -1;
+}
+
+static int ptyTest(int nTrials, uint32_t nEvents)
+{
+  /*
+    A pseudo terminal is opened like a serial port (raw, VMIN = VTIME = 0),
+    so startTrial() discards stale input with tcflush.  Stray bytes wait on
+    the port as each trial starts; the decoder must keep running and decode
+    every trial.
+  */
+  TrialEventDecoder decoder;
+  std::vector<BpodEventRecord> records(4096);
+  const uint8_t stray[8] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA};
+  uint8_t reply[64];
+  uint64_t nEvent = 0, nSoft = 0, bytesRead;
+  int master, slave = -1, pending, trial, nDecoded = 0;
+  bool ok = true;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || decoder.open(ptsname(master)) < 0 ||
+      (slave = ::open(ptsname(master), O_RDWR | O_NOCTTY)) < 0) {
+    perror("pseudo terminal");
+    if (master >= 0) close(master);
+    return -1;
+  }
+  {
+    ArCOMHost idle;  // nothing to read on a tty is not a hangup
+    uint8_t b;
+    idle.attach(dup(slave));
+    if (idle.readSome(&b, 1) != 0) ok = false;
+  }
+  std::thread device(simulateStateMachine, master, nEvents, nTrials);
+  for (trial = 0; ok && trial < nTrials; trial++) {
+    // Wait until the stray bytes reach the port (or the reader), so none arrive after the flush
+    bytesRead = decoder.status().bytesRead;
+    if (write(master, stray, sizeof(stray)) != sizeof(stray)) ok = false;
+    do {
+      pending = 0;
+      ioctl(slave, FIONREAD, &pending);
+    } while (ok && pending == 0 && decoder.status().bytesRead < bytesRead + sizeof(stray));
+    if (!ok || decoder.startTrial(false, true) < 0 || !readTrial(decoder, records, nEvent, nSoft)) {
+      ok = false;
+    } else {
+      nDecoded++;
+    }
+    while (decoder.readReply(reply, sizeof(reply)) > 0) {}
+  }
+  decoder.close();
+  close(slave);  // a simulated state machine still waiting for 'R' reads EIO and returns
+  device.join();
+  close(master);
+  if (nEvent != (uint64_t) nTrials*nEvents) ok = false;
+  printf("pseudo terminal: %d of %d trials with stray input decoded: %s\n", nDecoded, nTrials, ok ? "OK" : "FAILED");
+  return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  TrialEventDecoder decoder;
+  std::vector<BpodEventRecord> records(4096);
+  bool newStateMachine = false, live = true;
+  int nTrials = 1, trial, ch;
+  size_t n;
+
+  while ((ch = getopt(argc, argv, "nlt:s:h")) != -1) {
+    switch (ch) {
+      case 'n': newStateMachine = true; break;
+      case 'l': live = false; break;
+      case 't': nTrials = atoi(optarg); break;
+      case 's': return (selfTest(strtoul(optarg, NULL, 0)) == 0 && ptyTest(500, 100) == 0) ? 0 : 1;
+      default:
+        fprintf(stderr, "usage: %s [-n] [-l] [-t nTrials] port\n       %s -s nEvents\n", argv[0], argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: %s [-n] [-l] [-t nTrials] port\n", argv[0]);
+    return 1;
+  }
+  if (decoder.open(argv[optind]) < 0) {
+    fprintf(stderr, "Could not open %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+
+  for (trial = 0; trial < nTrials; trial++) {
+    if (decoder.startTrial(newStateMachine && trial == 0, live) < 0) {
+      fprintf(stderr, "Could not start trial %d\n", trial + 1);
+      return 1;
+    }
+    for (;;) {
+      n = decoder.drain(records.data(), records.size());
+      for (size_t i = 0; i < n; i++) {
+	printf("%d %d %llu %u %u\n", records[i].type, records[i].code, (unsigned long long) records[i].time,
+	       records[i].message, records[i].trial);
+      }
+      if (n == 0) {
+	if (!decoder.status().inTrial || !decoder.status().running) break;
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    fflush(stdout);
+    if (!decoder.status().running) {
+      fprintf(stderr, "The port was closed during trial %d\n", trial + 1);
+      return 1;
+    }
+  }
+  return 0;
+}
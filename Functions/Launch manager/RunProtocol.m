@@ -239,9 +239,12 @@ switch Opstring
         BpodSystem.Status.CurrentProtocolName = '';
         BpodSystem.Path.Settings = '';
         BpodSystem.Status.Live = 0;
+        if exist('BpodSessionLog', 'file') == 3
+            BpodSessionLog('close'); % Writes the trial index of the session log, if SaveBpodSessionLog() opened one
+        end
         if BpodSystem.EmulatorMode == 0
             if BpodSystem.MachineType > 3
-                stop(BpodSystem.Timers.AnalogTimer);
+                BpodSystem.analogAcquisition('stop');
                 try
                 fclose(BpodSystem.AnalogDataFile);
                 catch
@@ -0,0 +1,76 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the 
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% LoadBpodSessionLog() reads a session log written by SaveBpodSessionLog()
+% into a session data struct, with the fields AddTrialEvents() adds for
+% each trial: nTrials, RawEvents, RawData, TrialStartTimestamp and
+% TrialEndTimestamp.
+%
+% Single trials and single events can be read without loading the session:
+% [RawEvents, StateNames] = BpodSessionLog('read', FileName, TrialNumber);
+% [Times, TrialNumbers] = BpodSessionLog('eventTimes', FileName, 'Port1In');
+%
+% Arguments: FileName, the session log (.bpodlog)
+% Returns: SessionData
+% Example usage: SessionData = LoadBpodSessionLog('MyMouse_MyProtocol_20240101_120000.bpodlog');
+
+function SessionData = LoadBpodSessionLog(FileName)
+
+info = BpodSessionLog('info', FileName);
+eventNames = info.EventNames;
+nTrials = info.nTrials;
+
+SessionData = struct;
+SessionData.nTrials = nTrials;
+SessionData.RawEvents.Trial = cell(1,nTrials);
+SessionData.RawData.OriginalStateNamesByNumber = cell(1,nTrials);
+SessionData.RawData.OriginalStateData = cell(1,nTrials);
+SessionData.RawData.OriginalEventData = cell(1,nTrials);
+SessionData.RawData.OriginalStateTimestamps = cell(1,nTrials);
+SessionData.RawData.OriginalEventTimestamps = cell(1,nTrials);
+SessionData.RawData.StateMachineErrorCodes = cell(1,nTrials);
+SessionData.TrialStartTimestamp = info.TrialStartTimestamp;
+SessionData.TrialEndTimestamp = info.TrialEndTimestamp;
+for trialNum = 1:nTrials
+    [rawTrialEvents, stateNames] = BpodSessionLog('read', FileName, trialNum);
+    states = rawTrialEvents.States;
+    events = rawTrialEvents.Events;
+    % Entry and exit timestamps of each visit to each state, [NaN NaN] for states not visited
+    trial = struct;
+    for x = 1:length(stateNames)
+        visits = find(states == x);
+        if isempty(visits)
+            trial.States.(stateNames{x}) = [NaN NaN];
+        else
+            trial.States.(stateNames{x}) = [rawTrialEvents.StateTimestamps(visits)' rawTrialEvents.StateTimestamps(visits+1)'];
+        end
+    end
+    % Timestamps of each occurrence of each event
+    for x = unique(events)
+        trial.Events.(eventNames{x}) = rawTrialEvents.EventTimestamps(events == x);
+    end
+    SessionData.RawEvents.Trial{trialNum} = trial;
+    SessionData.RawData.OriginalStateNamesByNumber{trialNum} = stateNames;
+    SessionData.RawData.OriginalStateData{trialNum} = states;
+    SessionData.RawData.OriginalEventData{trialNum} = events;
+    SessionData.RawData.OriginalStateTimestamps{trialNum} = rawTrialEvents.StateTimestamps;
+    SessionData.RawData.OriginalEventTimestamps{trialNum} = rawTrialEvents.EventTimestamps;
+    SessionData.RawData.StateMachineErrorCodes{trialNum} = rawTrialEvents.ErrorCodes;
+end
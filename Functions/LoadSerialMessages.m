@@ -93,6 +93,9 @@ end
 serialMessage = ['L' module-1 nMessages serialMessage(1:Pos-1)];
 if BpodSystem.EmulatorMode == 0
     BpodSystem.SerialPort.write(serialMessage, 'uint8');
+    if exist('BpodStateMachineBytes', 'file') == 3
+        BpodStateMachineBytes('reset'); % An identical state machine description must reload its serial messages
+    end
     ack = BpodSystem.SerialPort.read(1, 'uint8');
     if isempty(ack)
         ack = 0;
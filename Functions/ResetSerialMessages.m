@@ -31,6 +31,9 @@ global BpodSystem % Import the global BpodSystem object
 
 if BpodSystem.EmulatorMode == 0
     BpodSystem.SerialPort.write('>', 'uint8');
+    if exist('BpodStateMachineBytes', 'file') == 3
+        BpodStateMachineBytes('reset'); % An identical state machine description must reload its serial messages
+    end
     ack = BpodSystem.SerialPort.read(1, 'uint8');
     if isempty(ack)
         ack = 0;
@@ -107,8 +107,7 @@ BpodSystem.Status.BeingUsed = 1; BpodSystem.Status.InStateMatrix = 1;
 if BpodSystem.Status.SessionStartFlag == 1 % On first run of session
     BpodSystem.Status.SessionStartFlag = 0;
     if BpodSystem.MachineType == 4
-        BpodSystem.AnalogSerialPort.flush;
-        start(BpodSystem.Timers.AnalogTimer);
+        BpodSystem.analogAcquisition('start');
     end
 end
 if BpodSystem.EmulatorMode == 0
@@ -0,0 +1,49 @@
+%{
+----------------------------------------------------------------------------
+
+This file is part of the Sanworks Bpod repository
+Copyright (C) Sanworks LLC, Rochester, New York, USA
+
+----------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3.
+
+This program is distributed  WITHOUT ANY WARRANTY and without even the 
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%}
+
+% SaveBpodSessionLog() appends a trial to the session log, a binary file next
+% to the current data file (same name, extension .bpodlog). Only the new trial
+% is written, so unlike SaveBpodSessionData the time it takes does not grow
+% with the session; it can be called after every trial. The log holds the
+% trial events as RunStateMachine() returns them, with the state and event
+% names. It is closed (its trial index written) when the session ends, and
+% can be read with LoadBpodSessionLog(), also while it is being written.
+% Session metadata and user-added data fields are not logged: call
+% SaveBpodSessionData at the end of the session to save them.
+%
+% Requires BpodSessionLog, built with "make mex" in /Functions/Internal Functions/Native
+%
+% Arguments: rawTrialEvents, as returned by RunStateMachine() or BpodTrialManager
+% Returns: None
+% Example usage: SaveBpodSessionLog(RawEvents);
+
+function SaveBpodSessionLog(rawTrialEvents)
+
+global BpodSystem % Import the global BpodSystem object
+
+if exist('BpodSessionLog', 'file') ~= 3
+    error(['Error: SaveBpodSessionLog requires BpodSessionLog. Run make mex in '...
+           fullfile(BpodSystem.Path.BpodRoot, 'Functions', 'Internal Functions', 'Native')])
+end
+logFile = [BpodSystem.Path.CurrentDataFile(1:end-4) '.bpodlog'];
+if ~strcmp(BpodSessionLog('file'), logFile)
+    BpodSessionLog('open', logFile, BpodSystem.StateMachineInfo.EventNames);
+end
+BpodSessionLog('add', rawTrialEvents, BpodSystem.LastStateMatrix.StateNames);
@@ -163,284 +163,27 @@ sma.GlobalTimerEndMatrix(sma.GlobalTimerEndMatrix == 65538) = backState;
 sma.GlobalCounterMatrix(sma.GlobalCounterMatrix == 65538) = backState;
 sma.ConditionMatrix(sma.ConditionMatrix == 65538) = backState;
 
-% Determine number of global timers, global counters and conditions used
-nGlobalTimersUsed = find(sma.GlobalTimers.IsSet, 1, 'last');
-nGlobalCountersUsed = find(sma.GlobalCounterSet, 1, 'last');
-nConditionsUsed = find(sma.ConditionSet, 1, 'last');
-if isempty(nGlobalTimersUsed); nGlobalTimersUsed = 0; end
-if isempty(nGlobalCountersUsed); nGlobalCountersUsed = 0; end
-if isempty(nConditionsUsed); nConditionsUsed = 0; end
-
-% Next, format input, output, timer, counter and condition matrices into linear
-% byte vectors for transfer. This employs a compression scheme where only
-% differences from the default matrix are sent.
-
-% First, set up default matrices with 'same state' for every event
-defaultInputMatrix = repmat((1:nStates)', 1, sma.meta.InputMatrixSize);
-defaultExtensionMatrix_GT = defaultInputMatrix(1:nStates, 1:nGlobalTimersUsed);
-defaultExtensionMatrix_GC = defaultInputMatrix(1:nStates, 1:nGlobalCountersUsed);
-defaultExtensionMatrix_C = defaultInputMatrix(1:nStates, 1:nConditionsUsed);
-
-% Compute compressed input matrix
-differenceMatrix = (sma.InputMatrix ~= defaultInputMatrix)';
-nDifferences = sum(differenceMatrix);
-msgLength = sum(nDifferences>0)*2 + nStates;
-inputMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    inputMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = sma.InputMatrix(i,thisState)-1;
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        inputMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-inputMatrix = uint8(inputMatrix);
-
-% Compute compressed output matrix
-outputMatrixRaw = sma.OutputMatrix(:, 1:BpodSystem.HW.Pos.GlobalTimerTrig-1); % All physical channels. 
-                                                                              % Virtual outputs are handled separately
-differenceMatrix = (outputMatrixRaw ~= 0)';
-nDifferences = sum(differenceMatrix, 1);
-msgLength = sum(nDifferences>0)*2 + nStates;
-outputMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    outputMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = outputMatrixRaw(i,thisState);
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        outputMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-if BpodSystem.MachineType == 4
-    outputMatrix = typecast(uint16(outputMatrix), 'uint8');
-else
-    outputMatrix = uint8(outputMatrix);
-end
-
-% Compute compressed global timer start matrix
-differenceMatrix = (sma.GlobalTimerStartMatrix(:,1:nGlobalTimersUsed) ~= defaultExtensionMatrix_GT)';
-nDifferences = sum(differenceMatrix, 1);
-msgLength = sum(nDifferences>0)*2 + nStates;
-globalTimerStartMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    globalTimerStartMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = sma.GlobalTimerStartMatrix(i,thisState)-1;
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        globalTimerStartMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-globalTimerStartMatrix = uint8(globalTimerStartMatrix);
-
-% Compute compressed global timer end matrix
-differenceMatrix = (sma.GlobalTimerEndMatrix(:,1:nGlobalTimersUsed) ~= defaultExtensionMatrix_GT)';
-nDifferences = sum(differenceMatrix, 1);
-msgLength = sum(nDifferences>0)*2 + nStates;
-globalTimerEndMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    globalTimerEndMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = sma.GlobalTimerEndMatrix(i,thisState)-1;
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        globalTimerEndMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-globalTimerEndMatrix = uint8(globalTimerEndMatrix);
-
-% Compute compressed global counter matrix
-differenceMatrix = (sma.GlobalCounterMatrix(:,1:nGlobalCountersUsed) ~= defaultExtensionMatrix_GC)';
-nDifferences = sum(differenceMatrix, 1);
-msgLength = sum(nDifferences>0)*2 + nStates;
-globalCounterMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    globalCounterMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = sma.GlobalCounterMatrix(i,thisState)-1;
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        globalCounterMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-globalCounterMatrix = uint8(globalCounterMatrix);
-
-% Compute compressed condition matrix
-differenceMatrix = (sma.ConditionMatrix(:,1:nConditionsUsed) ~= defaultExtensionMatrix_C)';
-nDifferences = sum(differenceMatrix,1);
-msgLength = sum(nDifferences>0)*2 + nStates;
-conditionMatrix = zeros(1,msgLength); pos = 1;
-for i = 1:nStates
-    conditionMatrix(pos) = nDifferences(i); pos = pos + 1;
-    if nDifferences(i) > 0
-        thisState = differenceMatrix(:,i)';
-        positions = find(thisState)-1;
-        values = sma.ConditionMatrix(i,thisState)-1;
-        posVal = [positions; values];
-        posVal = posVal(1:end);
-        conditionMatrix(pos:pos+(nDifferences(i)*2)-1) = posVal;
-        pos = pos + nDifferences(i)*2;
-    end
-end
-conditionMatrix = uint8(conditionMatrix);
-
-% Format state timer matrix
-stateTimerMatrix = uint8(sma.StateTimerMatrix-1);
-
-% Format global timer, counter and condition properties
-conditionChannels = uint8(sma.ConditionChannels(1:nConditionsUsed)-1);
-conditionValues = uint8(sma.ConditionValues(1:nConditionsUsed));
-globalTimerChannels = uint8(sma.GlobalTimers.OutputChannel(1:nGlobalTimersUsed)-1);
-uartChannels = globalTimerChannels < BpodSystem.HW.Pos.Input_USB-1;
-globalTimerOnMessages = sma.GlobalTimers.OnMessage(1:nGlobalTimersUsed);
-globalTimerOnMessages(globalTimerOnMessages==0 & uartChannels) = 255;
-globalTimerOffMessages = sma.GlobalTimers.OffMessage(1:nGlobalTimersUsed);
-globalTimerOffMessages(globalTimerOffMessages==0 & uartChannels) = 255;
-globalTimerLoopMode = uint8(sma.GlobalTimers.LoopMode(1:nGlobalTimersUsed));
-sendGlobalTimerEvents = uint8(sma.GlobalTimers.SendEvents(1:nGlobalTimersUsed));
-globalCounterAttachedEvents = uint8(sma.GlobalCounterEvents(1:nGlobalCountersUsed)-1);
-globalCounterThresholds = uint32(sma.GlobalCounterThresholds(1:nGlobalCountersUsed));
-if BpodSystem.MachineType == 4 % Global timer on/off messages are 16-bit on state machine 2+
-    globalTimerOnMessages = typecast(uint16(globalTimerOnMessages), 'uint8');
-    globalTimerOffMessages = typecast(uint16(globalTimerOffMessages), 'uint8');
-else
-    globalTimerOnMessages = uint8(globalTimerOnMessages);
-    globalTimerOffMessages = uint8(globalTimerOffMessages);
-end
-
-% Extract and format virtual outputs (global timer trig + cancel, global counter reset)
-maxGlobalTimers = BpodSystem.HW.n.GlobalTimers;
-if maxGlobalTimers > 16
-    globalTimerOnset_Trigger = uint32(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
-    globalTimerTrigs = uint32(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
-    globalTimerCancels = uint32(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
-elseif maxGlobalTimers > 8
-    globalTimerOnset_Trigger = uint16(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
-    globalTimerTrigs = uint16(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
-    globalTimerCancels = uint16(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
-else
-    globalTimerOnset_Trigger = uint8(sma.GlobalTimers.TimerOn_Trigger(1:nGlobalTimersUsed));
-    globalTimerTrigs = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerTrig))';
-    globalTimerCancels = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalTimerCancel))';
-end
-if BpodSystem.FirmwareVersion < 23
-    globalCounterResets = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalCounterReset))';
+% Encode the description. The native encoder also reports whether it is identical to the one
+% sent last, which the state machine still holds; EncodeStateMachine() is the MATLAB reference.
+useNativeEncoder = BpodSystem.EmulatorMode == 0 && exist('BpodStateMachineBytes', 'file') == 3;
+if useNativeEncoder
+    [byteString, serialMessageVector, nModulesLoaded, unchanged] = BpodStateMachineBytes(sma, BpodSystem.HW,...
+        BpodSystem.MachineType, BpodSystem.FirmwareVersion);
 else
-    gcResets = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.GlobalCounterReset))';
-    gcOverrides = find(gcResets ~= 0);
-    nOverrides = length(gcOverrides);
-    outMatrix = [];
-    if nOverrides > 0 
-        outMatrix = [gcOverrides-1; gcResets(gcOverrides)];
-    end
-    if nOverrides == 1
-        globalCounterResets = [nOverrides outMatrix'];
-    else 
-        globalCounterResets = [nOverrides outMatrix(1:end)];
-    end
-end
-
-% Extract and format Flex I/O analog input event matrix and threshold configuration
-analogThreshEnable = [];
-analogThreshDisable = [];
-if BpodSystem.MachineType == 4
-    atEnable = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.AnalogThreshEnable))'; 
-               % Bits indicate thresholds to enable (zeros are not disabled)
-    atOverrides = find(atEnable ~= 0);
-    nOverrides = length(atOverrides);
-    outMatrix = [];
-    if nOverrides > 0 
-        outMatrix = [atOverrides-1; atEnable(atOverrides)];
-    end
-    if length(outMatrix) == 2
-        outMatrix = outMatrix';
-    end
-    analogThreshEnable = [nOverrides outMatrix(1:end)]; 
-    
-    atDisable = uint8(sma.OutputMatrix(:,BpodSystem.HW.Pos.AnalogThreshDisable))'; 
-                % Bits indicate thresholds to disable (zeros are not enabled)
-    atOverrides = find(atDisable ~= 0);
-    nOverrides = length(atOverrides);
-    outMatrix = [];
-    if nOverrides > 0 
-        outMatrix = [atOverrides-1; atDisable(atOverrides)];
-    end
-    if length(outMatrix) == 2
-        outMatrix = outMatrix';
-    end
-    analogThreshDisable = [nOverrides outMatrix(1:end)];
-end
-
-% Format timers (initially double type, unit=seconds) into 32 bit int, unit = multiple of the state machine cycle period
-stateTimers = uint32(sma.StateTimers*BpodSystem.HW.CycleFrequency);
-globalTimers = uint32(sma.GlobalTimers.Duration(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
-globalTimerDelays = uint32(sma.GlobalTimers.OnsetDelay(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
-globalTimerLoopIntervals = uint32(sma.GlobalTimers.LoopInterval(1:nGlobalTimersUsed)*BpodSystem.HW.CycleFrequency);
-
-% Assemble vectors of 8-bit, 16-bit and 32-bit data
-eightBitMatrix = [nStates nGlobalTimersUsed nGlobalCountersUsed nConditionsUsed...
-    stateTimerMatrix inputMatrix outputMatrix globalTimerStartMatrix globalTimerEndMatrix...
-    globalCounterMatrix conditionMatrix globalTimerChannels globalTimerOnMessages...
-    globalTimerOffMessages globalTimerLoopMode sendGlobalTimerEvents...
-    globalCounterAttachedEvents conditionChannels conditionValues globalCounterResets analogThreshEnable analogThreshDisable];
-globalTimerMatrix = [globalTimerTrigs globalTimerCancels globalTimerOnset_Trigger];
-thirtyTwoBitMatrix = [stateTimers globalTimers globalTimerDelays globalTimerLoopIntervals globalCounterThresholds];
-
-% Set additional ops packaged with state machine description (e.g. programming serial message library)
-containsAdditionalOps = [];
-finalAdditionalOps = [];
-if BpodSystem.FirmwareVersion > 22 
-    containsAdditionalOps = uint8(1);
-    finalAdditionalOps = uint8(0);
-end
-
-% This section can be optimized for speed (currently should take ~0.5ms per module for most tasks)
-% Create serial message vector (if using implicit serial messages)
-serialMessageVector = []; nModulesLoaded = 0;
-if sma.SerialMessageMode == 1
-    for i = 1:BpodSystem.HW.n.UartSerialChannels
-        if sma.nSerialMessages(i) > 0
-            serialMessageVector = [serialMessageVector containsAdditionalOps 'L' i-1 sma.nSerialMessages(i)];
-            for j = 1:sma.nSerialMessages(i)
-                thisMessage = sma.SerialMessages{i,j};
-                serialMessageVector = [serialMessageVector j length(thisMessage) thisMessage];
-            end
-            nModulesLoaded = nModulesLoaded + 1;
-        end
-    end
-    serialMessageVector = uint8(serialMessageVector);
+    [byteString, serialMessageVector, nModulesLoaded] = EncodeStateMachine(sma);
+    unchanged = false;
 end
 
 % Send state machine description to Bpod State Machine device
 if BpodSystem.EmulatorMode == 0
-    if BpodSystem.FirmwareVersion > 22 % Package ops with byte string
-        byteString = [eightBitMatrix typecast(globalTimerMatrix, 'uint8') typecast(thirtyTwoBitMatrix, 'uint8')... 
-                      serialMessageVector finalAdditionalOps];
-    else
-        byteString = [eightBitMatrix typecast(globalTimerMatrix, 'uint8') typecast(thirtyTwoBitMatrix, 'uint8')];
-    end
     nBytes = uint16(length(byteString));
     if BpodSystem.Status.InStateMatrix == 1 % If loading during a trial
         if sma.SerialMessageMode == 0 || BpodSystem.FirmwareVersion > 22
             switch BpodSystem.MachineType
                 case 1
+                    if useNativeEncoder
+                        BpodStateMachineBytes('reset'); % Not sent
+                    end
                     error(['Error: Bpod 0.5 cannot send a state machine while a trial is in progress. '...
                            'If you need this functionality, consider switching to Bpod 0.7+'])
                 case 2
@@ -454,10 +197,16 @@ if BpodSystem.EmulatorMode == 0
                     BpodSystem.SerialPort.write(['C' runASAP use255BackSignal typecast(nBytes, 'uint8') byteString], 'uint8');
             end
         else
+            if useNativeEncoder
+                BpodStateMachineBytes('reset'); % Not sent
+            end
             error(['Error: On state machine firmware v22 and older, TrialManager does not support state machine descriptions that' ...
                    char(10) 'use implicit serial messages (e.g. {''MyModule1'', [''A'' 1 2]}.' char(10)...
                    'Use LoadSerialMessages() to program them explicitly, or upgrade to firmware v23+.'])
         end
+    elseif unchanged && ~runASAP
+        % The state machine still holds this description (and its serial messages); the next 'R' runs it
+        % again. NewStateMachineSent is left as it is: 1 if the description sent last has not run yet.
     else
         BpodSystem.SerialPort.write(['C' runASAP use255BackSignal typecast(nBytes, 'uint8') byteString], 'uint8');
         if BpodSystem.FirmwareVersion < 23
@@ -472,7 +221,9 @@ if BpodSystem.EmulatorMode == 0
     end
     
     
-    BpodSystem.Status.NewStateMachineSent = 1; % On next run, a byte is returned confirming that the state machine was received.
+    if ~unchanged || runASAP || BpodSystem.Status.InStateMatrix == 1
+        BpodSystem.Status.NewStateMachineSent = 1; % On next run, a byte is returned confirming that the state machine was received.
+    end
     BpodSystem.Status.SM2runASAP = runASAP;
     % Note: depricated confirmation. To reduce dead time when SerialMessageMode = 0, 
     %       transmission is confirmed on next call to RunStateMachine()